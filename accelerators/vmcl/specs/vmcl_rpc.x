@@ -112,6 +112,17 @@ struct VMCLQueueFlushOp {
    VMCLQueueId               queue;
 };
 
+/*
+ * Accelerator surface allocation with initial contents, the contents are
+ * written to the new surface on the queue without reading back the
+ * surface. The allocation and the update cost a single request.
+ */
+struct VMCLSurfaceAllocateInitOp {
+   VMCLQueueId               queue;
+   VMCLSurfaceAllocateDesc   alloc;
+   opaque                    data<>;
+};
+
 /*
  * Accelerator operations. If qid is zero, then operation is dispatched
  * immediately, otherwise operation is inserted into the supplied queue
@@ -233,6 +244,13 @@ struct VMCLKernelAllocateDesc {
    VMCLKernelId              client;
    unsigned int              subDevice;
    VMCLKernelLanguage        language;
+
+   /*
+    * Hash of the source, see VMAccel_Hash64. If the source is omitted,
+    * the kernel is allocated from the Accelerator's program cache and
+    * VMACCEL_RESOURCE_UNAVAILABLE is returned on a cache miss.
+    */
+   unsigned hyper            sourceHash;
    opaque                    source<>;
 
    /*
@@ -267,12 +285,14 @@ enum VMCLKernelSemanticType {
 enum VMCLKernelArgType {
    VMCL_ARG_IMMEDIATE,
    VMCL_ARG_SURFACE,
-   VMCL_ARG_SAMPLER
+   VMCL_ARG_SAMPLER,
+   VMCL_ARG_LOCAL
 };
 
 /*
- * Accelerator kernel argument descriptor, immediate mode arguments are not
- * perimitted due to low-level data consistency contracts.
+ * Accelerator kernel argument descriptor. Immediate arguments are passed
+ * by value in data, and are consumed when the dispatch is enqueued. Local
+ * arguments reserve localSize bytes of work-group local memory.
  */
 struct VMCLKernelArgDesc {
    VMCLQueueId               queue;
@@ -281,6 +301,17 @@ struct VMCLKernelArgDesc {
    VMAccelSurfaceUsage       usage;
    VMAccelSurfaceId          surf;
    VMCLSamplerId             sampler;
+   opaque                    data<>;
+   unsigned int              localSize;
+};
+
+/*
+ * Pair of kernel argument indices whose surfaces are exchanged between the
+ * iterations of a repeated dispatch.
+ */
+struct VMCLKernelArgSwap {
+   unsigned int              first;
+   unsigned int              second;
 };
 
 /*
@@ -304,6 +335,93 @@ struct VMCLDispatchOp {
     */
    VMCLKernelArgDesc         args<>;
    VMAccelSurfaceId          refs<>;
+
+   /*
+    * Number of back to back executions of the dispatch by the accelerator,
+    * zero is treated as one. The surfaces bound to each pair of swapped
+    * arguments are exchanged between iterations, e.g. ping-pong buffers of
+    * an iterative solver.
+    */
+   unsigned int              repeatCount;
+   VMCLKernelArgSwap         swaps<>;
+};
+
+/*
+ * Dispatch list operation, the dispatches are enqueued back to back on the
+ * queue of the list in a single request. The queue of each dispatch is
+ * ignored. A list is either enqueued in full or, if a surface is not yet
+ * at the requested generation, not at all.
+ */
+struct VMCLDispatchListOp {
+   VMCLQueueId               queue;
+   VMCLDispatchOp            dispatches<>;
+};
+
+/*
+ * Command list identifier. A command list is a dispatch list held by the
+ * accelerator, recorded once and replayed on request.
+ */
+struct VMCLCmdListId {
+   VMCLContextId             cid;
+   VMAccelId                 id;
+};
+
+/*
+ * Command list record operation, replaces the contents of the list.
+ */
+struct VMCLCmdListRecordOp {
+   VMCLCmdListId             list;
+   VMCLDispatchListOp        dispatches;
+};
+
+/*
+ * Replaces the argument with the same index in a recorded dispatch, e.g.
+ * a surface at a new generation or a new immediate value.
+ */
+struct VMCLKernelArgUpdate {
+   unsigned int              dispatch;
+   VMCLKernelArgDesc         arg;
+};
+
+/*
+ * Command list replay operation. The updates are applied to the recorded
+ * list, which is then enqueued as a dispatch list.
+ */
+struct VMCLCmdListReplayOp {
+   VMCLCmdListId             list;
+   VMCLKernelArgUpdate       updates<>;
+};
+
+/*
+ * Profiled command classes, see VMCL_PROFILEQUERY.
+ */
+enum VMCLProfileOpType {
+   VMCL_PROFILE_DISPATCH,
+   VMCL_PROFILE_UPLOAD,
+   VMCL_PROFILE_DOWNLOAD,
+   VMCL_PROFILE_COPY,
+   VMCL_PROFILE_MAX
+};
+
+/*
+ * Profile query for the most recent command of a class executed by a queue
+ * allocated with VMACCEL_QUEUE_ENABLE_PROFILING_FLAG. The query waits for
+ * the command to complete.
+ */
+struct VMCLProfileQueryOp {
+   VMCLQueueId               queue;
+   VMCLProfileOpType         type;
+};
+
+/*
+ * Timestamps of the profiled command, in nanoseconds of the device clock.
+ */
+struct VMCLProfileStatus {
+   VMAccelStatusCode         status;
+   unsigned hyper            queued;
+   unsigned hyper            submit;
+   unsigned hyper            start;
+   unsigned hyper            end;
 };
 
 /*
@@ -336,6 +454,16 @@ union VMCLKernelAllocateReturnStatus switch (int errno) {
       void;
 };
 
+/*
+ * The result of a Profile query operation.
+ */
+union VMCLProfileReturnStatus switch (int errno) {
+   case 0:
+      VMCLProfileStatus *ret;
+   default:
+      void;
+};
+
 /*
  * VM Accelerator program definition.
  */
@@ -406,5 +534,33 @@ program VMCL {
        */
       VMAccelReturnStatus
          VMCL_DISPATCH(VMCLDispatchOp) = 18;
+
+      /*
+       * Profiling of completed operations.
+       */
+      VMCLProfileReturnStatus
+         VMCL_PROFILEQUERY(VMCLProfileQueryOp) = 19;
+
+      /*
+       * Batched Compute Kernel dispatch operation.
+       */
+      VMAccelReturnStatus
+         VMCL_DISPATCHLIST(VMCLDispatchListOp) = 20;
+
+      /*
+       * Command list record/replay operations.
+       */
+      VMAccelReturnStatus
+         VMCL_CMDLISTRECORD(VMCLCmdListRecordOp) = 21;
+      VMAccelReturnStatus
+         VMCL_CMDLISTREPLAY(VMCLCmdListReplayOp) = 22;
+      VMAccelReturnStatus
+         VMCL_CMDLISTDESTROY(VMCLCmdListId) = 23;
+
+      /*
+       * Fused surface allocation and update.
+       */
+      VMAccelSurfaceAllocateReturnStatus
+         VMCL_SURFACEALLOCINIT(VMCLSurfaceAllocateInitOp) = 24;
   } = 2;
 } = 0x20000081;
@@ -644,3 +644,207 @@ VMAccelReturnStatus *vmcl_dispatch_2(VMCLDispatchOp *argp, CLIENT *clnt) {
    return (NULL);
 #endif
 }
+
+VMCLProfileReturnStatus *vmcl_profilequery_2(VMCLProfileQueryOp *argp,
+                                             CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMCLProfileReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_state_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_profilequery_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_state_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMCLProfileReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_state_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_PROFILEQUERY, (xdrproc_t)xdr_VMCLProfileQueryOp,
+                 (caddr_t)argp, (xdrproc_t)xdr_VMCLProfileReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_state_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_state_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
+
+VMAccelReturnStatus *vmcl_dispatchlist_2(VMCLDispatchListOp *argp,
+                                         CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMAccelReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_dispatchlist_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMAccelReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_DISPATCHLIST, (xdrproc_t)xdr_VMCLDispatchListOp,
+                 (caddr_t)argp, (xdrproc_t)xdr_VMAccelReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_compute_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
+
+VMAccelReturnStatus *vmcl_cmdlistrecord_2(VMCLCmdListRecordOp *argp,
+                                          CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMAccelReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_cmdlistrecord_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMAccelReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_CMDLISTRECORD, (xdrproc_t)xdr_VMCLCmdListRecordOp,
+                 (caddr_t)argp, (xdrproc_t)xdr_VMAccelReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_compute_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
+
+VMAccelReturnStatus *vmcl_cmdlistreplay_2(VMCLCmdListReplayOp *argp,
+                                          CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMAccelReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_cmdlistreplay_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMAccelReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_CMDLISTREPLAY, (xdrproc_t)xdr_VMCLCmdListReplayOp,
+                 (caddr_t)argp, (xdrproc_t)xdr_VMAccelReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_compute_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
+
+VMAccelReturnStatus *vmcl_cmdlistdestroy_2(VMCLCmdListId *argp, CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMAccelReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_cmdlistdestroy_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMAccelReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_compute_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_CMDLISTDESTROY, (xdrproc_t)xdr_VMCLCmdListId,
+                 (caddr_t)argp, (xdrproc_t)xdr_VMAccelReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_compute_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_compute_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
+
+VMAccelSurfaceAllocateReturnStatus *
+vmcl_surfaceallocinit_2(VMCLSurfaceAllocateInitOp *argp, CLIENT *clnt) {
+#if ENABLE_VMACCEL_LOCAL
+   if (clnt == NULL) {
+      VMAccelSurfaceAllocateReturnStatus *ret;
+      if (pthread_mutex_lock(&svc_state_mutex) != 0) {
+         VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+         return (NULL);
+      }
+      ret = vmcl_surfaceallocinit_2_svc(argp, NULL);
+      pthread_mutex_unlock(&svc_state_mutex);
+      return ret;
+   }
+#endif
+#if ENABLE_VMACCEL_RPC
+   static VMAccelSurfaceAllocateReturnStatus clnt_res;
+   if (pthread_mutex_lock(&svc_state_mutex) != 0) {
+      VMACCEL_WARNING("%s: Unable to acquire svc lock\n", __FUNCTION__);
+      return (NULL);
+   }
+   memset((char *)&clnt_res, 0, sizeof(clnt_res));
+   if (clnt_call(clnt, VMCL_SURFACEALLOCINIT,
+                 (xdrproc_t)xdr_VMCLSurfaceAllocateInitOp, (caddr_t)argp,
+                 (xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus,
+                 (caddr_t)&clnt_res, TIMEOUT) != RPC_SUCCESS) {
+      pthread_mutex_unlock(&svc_state_mutex);
+      return (NULL);
+   }
+   pthread_mutex_unlock(&svc_state_mutex);
+   return (&clnt_res);
+#else
+   return (NULL);
+#endif
+}
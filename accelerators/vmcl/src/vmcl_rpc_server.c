@@ -26,10 +26,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 ******************************************************************************/
 
+#include "vmaccel_utils.h"
 #include "vmcl_ops.h"
 #include "vmcl_rpc.h"
+#include "vmcpu.h"
 #include "vmwopencl.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "log_level.h"
@@ -37,28 +42,208 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static VMCLOps *cl = &vmwopenclOps;
 static volatile unsigned long clRefCount = 0;
 
+/*
+ * Every device of the backend is powered on and registered with the manager
+ * as its own Accelerator. Requests are served by a single svc_run thread
+ * into static result buffers, operations execute inline on that thread
+ * whichever device the context was placed on.
+ */
+typedef struct VMCLDevice {
+   /*
+    * Power on status of the device, the identifier is the backend's.
+    */
+   VMAccelAllocateStatus status;
+} VMCLDevice;
+
+static VMCLDevice devices[VMCL_MAX_DEVICES];
+static unsigned int numDevices = 0;
+
+/*
+ * Command lists recorded by each context, a private copy of the recorded
+ * dispatch list is held until the list is destroyed or re-recorded.
+ */
+typedef struct VMCLCmdList {
+   bool active;
+   VMAccelId id;
+   VMCLDispatchListOp list;
+} VMCLCmdList;
+
+static VMCLCmdList cmdLists[VMCL_MAX_CONTEXTS][VMCL_MAX_CMDLISTS];
+static pthread_mutex_t cmdListMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Backends selectable at server start with the VMCL_BACKEND environment
+ * variable, the first entry is the default.
+ */
+static const struct {
+   const char *name;
+   VMCLOps *ops;
+} backends[] = {
+   {"opencl", &vmwopenclOps},
+   {"cpu", &vmcpuOps},
+   {"null", &vmnullOps},
+};
+
+static VMCLOps *vmcl_select_backend() {
+   const char *name = getenv("VMCL_BACKEND");
+   int i;
+
+   if (name == NULL) {
+      return backends[0].ops;
+   }
+
+   for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+      if (strcmp(name, backends[i].name) == 0) {
+         return backends[i].ops;
+      }
+   }
+
+   VMACCEL_WARNING("%s: Unknown backend %s, using %s\n", __FUNCTION__, name,
+                   backends[0].name);
+
+   return backends[0].ops;
+}
+
+static void vmcl_device_start(const VMAccelAllocateStatus *status) {
+   VMCLDevice *dev = &devices[numDevices];
+
+   dev->status = *status;
+   dev->status.desc.parentAddr.subDevice = numDevices;
+
+   VMACCEL_LOG("%s: Device %u powered on, architecture=%u\n", __FUNCTION__,
+               numDevices, status->desc.architecture);
+
+   numDevices++;
+}
+
+/*
+ * vmcl_restore
+ *
+ * Restores the backend's last checkpoint, restored contexts are recreated
+ * by the backend on the device they were checkpointed on.
+ */
+static void vmcl_restore() {
+   if (cl->restore != NULL) {
+      cl->restore();
+   }
+}
+
+/*
+ * vmcl_xdr_copy
+ *
+ * Deep copies an RPC structure into zeroed storage by encoding and decoding
+ * it, the copy is released with xdr_free.
+ */
+static bool vmcl_xdr_copy(xdrproc_t proc, void *src, void *dst) {
+   unsigned long size = xdr_sizeof(proc, src);
+   char *buf = malloc(size);
+   XDR xdrs;
+   bool ret;
+
+   if (buf == NULL) {
+      return false;
+   }
+
+   xdrmem_create(&xdrs, buf, size, XDR_ENCODE);
+   ret = proc(&xdrs, src);
+   xdr_destroy(&xdrs);
+
+   if (ret) {
+      xdrmem_create(&xdrs, buf, size, XDR_DECODE);
+      ret = proc(&xdrs, dst);
+      xdr_destroy(&xdrs);
+   }
+
+   free(buf);
+
+   return ret;
+}
+
+/*
+ * vmcl_cmdlist_lookup
+ *
+ * Returns the command list of a context with an identifier, or if alloc is
+ * set a free entry for it. Requires cmdListMutex.
+ */
+static VMCLCmdList *vmcl_cmdlist_lookup(const VMCLCmdListId *id, bool alloc) {
+   VMCLCmdList *unused = NULL;
+   unsigned int i;
+
+   if (id->cid >= VMCL_MAX_CONTEXTS) {
+      return NULL;
+   }
+
+   for (i = 0; i < VMCL_MAX_CMDLISTS; i++) {
+      VMCLCmdList *cmdList = &cmdLists[id->cid][i];
+
+      if (cmdList->active && (cmdList->id == id->id)) {
+         return cmdList;
+      } else if (!cmdList->active && (unused == NULL)) {
+         unused = cmdList;
+      }
+   }
+
+   return alloc ? unused : NULL;
+}
+
+static void vmcl_cmdlist_release(VMCLCmdList *cmdList) {
+   if (cmdList->active) {
+      xdr_free((xdrproc_t)xdr_VMCLDispatchListOp, (char *)&cmdList->list);
+   }
+
+   memset(cmdList, 0, sizeof(*cmdList));
+}
+
 VMAccelAllocateStatus *vmcl_poweron_svc(VMCLOps *ops,
                                         unsigned int useDataStreaming) {
    VMAccelAllocateStatus *ret = NULL;
+   unsigned int i, j;
+
+   if (clRefCount > 0) {
+      clRefCount++;
+      return &devices[0].status;
+   }
+
+   cl = (ops != NULL) ? ops : vmcl_select_backend();
+
    /*
-    * Loop through all the Accelerator architectures until one powers on.
+    * Power on every device of each Accelerator architecture, only the first
+    * device serves data streaming.
     */
    assert(VMACCEL_SELECT_MAX > 0);
-   for (int i = 0; i < VMACCEL_SELECT_MAX; i++) {
-      ret = cl->poweron(NULL, i, 0, useDataStreaming);
-      if (ret->status == VMACCEL_SUCCESS) {
-         clRefCount++;
-         return ret;
+   for (i = 0; i < VMACCEL_SELECT_MAX; i++) {
+      for (j = 0; numDevices < VMCL_MAX_DEVICES; j++) {
+         ret = cl->poweron(NULL, i, j, useDataStreaming && (numDevices == 0));
+         if (ret->status != VMACCEL_SUCCESS) {
+            break;
+         }
+         vmcl_device_start(ret);
       }
    }
-   VMACCEL_WARNING("%s: Unable to power on any VMCL capable backends.\n",
-                   __FUNCTION__);
-   return ret;
+
+   if (numDevices == 0) {
+      VMACCEL_WARNING("%s: Unable to power on any VMCL capable backends.\n",
+                      __FUNCTION__);
+      return ret;
+   }
+
+   vmcl_restore();
+
+   clRefCount++;
+
+   return &devices[0].status;
 }
 
 VMAccelStatus *vmcl_poweroff_svc() {
    if (clRefCount == 1) {
       clRefCount = 0;
+
+      if (cl->checkpoint != NULL) {
+         cl->checkpoint();
+      }
+
+      numDevices = 0;
+
       return cl->poweroff();
    } else if (clRefCount > 1) {
       clRefCount--;
@@ -66,6 +251,14 @@ VMAccelStatus *vmcl_poweroff_svc() {
    return NULL;
 }
 
+unsigned int vmcl_num_devices_svc() {
+   return numDevices;
+}
+
+VMAccelAllocateStatus *vmcl_device_svc(unsigned int device) {
+   return (device < numDevices) ? &devices[device].status : NULL;
+}
+
 VMCLContextAllocateReturnStatus *
 vmcl_contextalloc_2_svc(VMCLContextAllocateDesc *argp, struct svc_req *rqstp) {
    static VMCLContextAllocateReturnStatus result;
@@ -73,7 +266,17 @@ vmcl_contextalloc_2_svc(VMCLContextAllocateDesc *argp, struct svc_req *rqstp) {
    /*
     * insert server code here
     */
-   result.VMCLContextAllocateReturnStatus_u.ret = cl->contextalloc_1(argp);
+   unsigned int device = (argp->accelId < numDevices) ? argp->accelId : 0;
+   VMCLContextAllocateStatus *ret;
+
+   /*
+    * Translate the server's device index to the backend's identifier.
+    */
+   argp->accelId = devices[device].status.id;
+
+   ret = cl->contextalloc_1(argp);
+
+   result.VMCLContextAllocateReturnStatus_u.ret = ret;
 
    return (&result);
 }
@@ -82,10 +285,19 @@ VMAccelReturnStatus *vmcl_contextdestroy_2_svc(VMCLContextId *argp,
                                                struct svc_req *rqstp) {
 
    static VMAccelReturnStatus result;
+   unsigned int i;
 
    /*
     * insert server code here
     */
+   if (*argp < VMCL_MAX_CONTEXTS) {
+      pthread_mutex_lock(&cmdListMutex);
+      for (i = 0; i < VMCL_MAX_CMDLISTS; i++) {
+         vmcl_cmdlist_release(&cmdLists[*argp][i]);
+      }
+      pthread_mutex_unlock(&cmdListMutex);
+   }
+
    result.VMAccelReturnStatus_u.ret = cl->contextdestroy_1(argp);
 
    return (&result);
@@ -104,6 +316,73 @@ vmcl_surfacealloc_2_svc(VMCLSurfaceAllocateDesc *argp, struct svc_req *rqstp) {
    return (&result);
 }
 
+VMAccelSurfaceAllocateReturnStatus *
+vmcl_surfaceallocinit_2_svc(VMCLSurfaceAllocateInitOp *argp,
+                            struct svc_req *rqstp) {
+
+   static VMAccelSurfaceAllocateReturnStatus result;
+   static VMAccelSurfaceAllocateStatus allocResult;
+   VMAccelSurfaceAllocateStatus *allocStatus;
+   VMAccelStatus *uploadStatus;
+   VMCLImageUploadOp upload;
+
+   /*
+    * The memory of a local client outlives the request, surfaces on user
+    * memory are created on it if the backend is able to.
+    */
+   if ((rqstp == NULL) &&
+       (argp->alloc.desc.pool == VMACCEL_SURFACE_POOL_USER_MEMORY) &&
+       (cl->surfaceallocuser_1 != NULL)) {
+      allocStatus = cl->surfaceallocuser_1(argp);
+
+      if ((allocStatus == NULL) ||
+          (allocStatus->status != VMACCEL_SEMANTIC_ERROR)) {
+         result.VMAccelSurfaceAllocateReturnStatus_u.ret = allocStatus;
+         return (&result);
+      }
+   }
+
+   allocStatus = cl->surfacealloc_1(&argp->alloc);
+
+   if ((allocStatus == NULL) || (allocStatus->status != VMACCEL_SUCCESS) ||
+       (argp->data.data_len == 0)) {
+      result.VMAccelSurfaceAllocateReturnStatus_u.ret = allocStatus;
+      return (&result);
+   }
+
+   allocResult = *allocStatus;
+
+   /*
+    * The contents of the new surface are replaced as a whole, at the
+    * generation of the allocation.
+    */
+   memset(&upload, 0, sizeof(upload));
+   upload.queue = argp->queue;
+   upload.img = argp->alloc.client;
+   upload.op.imgRegion.size.x = argp->alloc.desc.width;
+   upload.op.imgRegion.size.y = argp->alloc.desc.height;
+   upload.op.imgRegion.size.z = argp->alloc.desc.depth;
+   upload.op.ptr.ptr_len = argp->data.data_len;
+   upload.op.ptr.ptr_val = argp->data.data_val;
+   upload.mode = VMACCEL_SURFACE_WRITE_ASYNCHRONOUS;
+
+   uploadStatus = cl->imageupload_1(&upload);
+
+   /*
+    * The request fails as a whole, a surface without its contents is not
+    * left behind for the client to track.
+    */
+   if ((uploadStatus == NULL) || (uploadStatus->status != VMACCEL_SUCCESS)) {
+      allocResult.status =
+         (uploadStatus == NULL) ? VMACCEL_FAIL : uploadStatus->status;
+      cl->surfacedestroy_1(&argp->alloc.client);
+   }
+
+   result.VMAccelSurfaceAllocateReturnStatus_u.ret = &allocResult;
+
+   return (&result);
+}
+
 VMAccelReturnStatus *vmcl_surfacedestroy_2_svc(VMCLSurfaceId *argp,
                                                struct svc_req *rqstp) {
 
@@ -314,3 +593,180 @@ VMAccelReturnStatus *vmcl_dispatch_2_svc(VMCLDispatchOp *argp,
 
    return (&result);
 }
+
+VMCLProfileReturnStatus *vmcl_profilequery_2_svc(VMCLProfileQueryOp *argp,
+                                                 struct svc_req *rqstp) {
+
+   static VMCLProfileReturnStatus result;
+   static VMCLProfileStatus unsupported;
+
+   /*
+    * Backends without profiling support report a failed query.
+    */
+   if (cl->profilequery_1 == NULL) {
+      memset(&unsupported, 0, sizeof(unsupported));
+      unsupported.status = VMACCEL_FAIL;
+      result.VMCLProfileReturnStatus_u.ret = &unsupported;
+      return (&result);
+   }
+
+   result.VMCLProfileReturnStatus_u.ret = cl->profilequery_1(argp);
+
+   return (&result);
+}
+
+/*
+ * vmcl_dispatch_list
+ *
+ * Enqueues the dispatches of a list on the queue of the list.
+ */
+static VMAccelStatus *vmcl_dispatch_list(VMCLDispatchListOp *argp) {
+   static VMAccelStatus status;
+   unsigned int i;
+
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      argp->dispatches.dispatches_val[i].queue = argp->queue;
+   }
+
+   if (cl->dispatchlist_1 != NULL) {
+      return cl->dispatchlist_1(argp);
+   }
+
+   /*
+    * Backends without dispatch lists execute the dispatches in order. Lists
+    * are not atomic: a failure of the first dispatch is returned as is and
+    * nothing is enqueued. A later failure leaves the dispatches before it
+    * enqueued and returns VMACCEL_FAIL, which the client doesn't retry.
+    */
+   memset(&status, 0, sizeof(status));
+
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      VMAccelStatus *ret = cl->dispatch_1(&argp->dispatches.dispatches_val[i]);
+
+      if ((ret == NULL) || (ret->status != VMACCEL_SUCCESS)) {
+         status.status = ((ret != NULL) && (i == 0)) ? ret->status
+                                                     : VMACCEL_FAIL;
+         break;
+      }
+   }
+
+   return &status;
+}
+
+VMAccelReturnStatus *vmcl_dispatchlist_2_svc(VMCLDispatchListOp *argp,
+                                             struct svc_req *rqstp) {
+
+   static VMAccelReturnStatus result;
+
+   result.VMAccelReturnStatus_u.ret = vmcl_dispatch_list(argp);
+
+   return (&result);
+}
+
+VMAccelReturnStatus *vmcl_cmdlistrecord_2_svc(VMCLCmdListRecordOp *argp,
+                                              struct svc_req *rqstp) {
+
+   static VMAccelReturnStatus result;
+   static VMAccelStatus status;
+   VMCLCmdList *cmdList;
+
+   memset(&status, 0, sizeof(status));
+
+   pthread_mutex_lock(&cmdListMutex);
+
+   cmdList = vmcl_cmdlist_lookup(&argp->list, true);
+
+   if (cmdList == NULL) {
+      VMACCEL_WARNING("%s: Unable to record command list %d\n", __FUNCTION__,
+                      argp->list.id);
+      status.status = VMACCEL_FAIL;
+   } else {
+      vmcl_cmdlist_release(cmdList);
+
+      if (vmcl_xdr_copy((xdrproc_t)xdr_VMCLDispatchListOp, &argp->dispatches,
+                        &cmdList->list)) {
+         cmdList->active = true;
+         cmdList->id = argp->list.id;
+      } else {
+         xdr_free((xdrproc_t)xdr_VMCLDispatchListOp, (char *)&cmdList->list);
+         memset(cmdList, 0, sizeof(*cmdList));
+         status.status = VMACCEL_FAIL;
+      }
+   }
+
+   pthread_mutex_unlock(&cmdListMutex);
+
+   result.VMAccelReturnStatus_u.ret = &status;
+
+   return (&result);
+}
+
+VMAccelReturnStatus *vmcl_cmdlistreplay_2_svc(VMCLCmdListReplayOp *argp,
+                                              struct svc_req *rqstp) {
+
+   static VMAccelReturnStatus result;
+   static VMAccelStatus status;
+   VMCLDispatchListOp list;
+   VMCLCmdList *cmdList;
+   unsigned int badUpdate = 0;
+
+   memset(&status, 0, sizeof(status));
+   result.VMAccelReturnStatus_u.ret = &status;
+
+   pthread_mutex_lock(&cmdListMutex);
+
+   cmdList = vmcl_cmdlist_lookup(&argp->list, false);
+
+   if (cmdList == NULL) {
+      pthread_mutex_unlock(&cmdListMutex);
+      status.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   /*
+    * The updates apply to this replay only, they are applied to a copy of
+    * the recorded list.
+    */
+   status.status = VMAccel_CmdListApplyUpdates(
+      &cmdList->list, argp->updates.updates_val, argp->updates.updates_len,
+      &list, &badUpdate);
+
+   if (status.status == VMACCEL_SEMANTIC_ERROR) {
+      VMACCEL_WARNING("%s: Invalid update %d of command list %d\n",
+                      __FUNCTION__, badUpdate, argp->list.id);
+   }
+
+   if (status.status == VMACCEL_SUCCESS) {
+      result.VMAccelReturnStatus_u.ret = vmcl_dispatch_list(&list);
+   }
+
+   pthread_mutex_unlock(&cmdListMutex);
+
+   free(list.dispatches.dispatches_val);
+
+   return (&result);
+}
+
+VMAccelReturnStatus *vmcl_cmdlistdestroy_2_svc(VMCLCmdListId *argp,
+                                               struct svc_req *rqstp) {
+
+   static VMAccelReturnStatus result;
+   static VMAccelStatus status;
+   VMCLCmdList *cmdList;
+
+   memset(&status, 0, sizeof(status));
+
+   pthread_mutex_lock(&cmdListMutex);
+
+   cmdList = vmcl_cmdlist_lookup(argp, false);
+
+   if (cmdList != NULL) {
+      vmcl_cmdlist_release(cmdList);
+   }
+
+   pthread_mutex_unlock(&cmdListMutex);
+
+   result.VMAccelReturnStatus_u.ret = &status;
+
+   return (&result);
+}
@@ -35,6 +35,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <netdb.h>
 #include <netinet/in.h>
 #include <rpc/pmap_clnt.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -71,6 +72,12 @@ static void vmcl_1(struct svc_req *rqstp, register SVCXPRT *transp) {
       VMCLKernelAllocateDesc vmcl_kernelalloc_1_arg;
       VMCLKernelId vmcl_kerneldestroy_1_arg;
       VMCLDispatchOp vmcl_dispatch_1_arg;
+      VMCLProfileQueryOp vmcl_profilequery_1_arg;
+      VMCLDispatchListOp vmcl_dispatchlist_1_arg;
+      VMCLCmdListRecordOp vmcl_cmdlistrecord_1_arg;
+      VMCLCmdListReplayOp vmcl_cmdlistreplay_1_arg;
+      VMCLCmdListId vmcl_cmdlistdestroy_1_arg;
+      VMCLSurfaceAllocateInitOp vmcl_surfaceallocinit_1_arg;
    } argument;
    char *result;
    xdrproc_t _xdr_argument, _xdr_result;
@@ -189,6 +196,44 @@ static void vmcl_1(struct svc_req *rqstp, register SVCXPRT *transp) {
          local = (char *(*)(char *, struct svc_req *))vmcl_dispatch_2_svc;
          break;
 
+      case VMCL_PROFILEQUERY:
+         _xdr_argument = (xdrproc_t)xdr_VMCLProfileQueryOp;
+         _xdr_result = (xdrproc_t)xdr_VMCLProfileReturnStatus;
+         local = (char *(*)(char *, struct svc_req *))vmcl_profilequery_2_svc;
+         break;
+
+      case VMCL_DISPATCHLIST:
+         _xdr_argument = (xdrproc_t)xdr_VMCLDispatchListOp;
+         _xdr_result = (xdrproc_t)xdr_VMAccelReturnStatus;
+         local = (char *(*)(char *, struct svc_req *))vmcl_dispatchlist_2_svc;
+         break;
+
+      case VMCL_CMDLISTRECORD:
+         _xdr_argument = (xdrproc_t)xdr_VMCLCmdListRecordOp;
+         _xdr_result = (xdrproc_t)xdr_VMAccelReturnStatus;
+         local = (char *(*)(char *, struct svc_req *))vmcl_cmdlistrecord_2_svc;
+         break;
+
+      case VMCL_CMDLISTREPLAY:
+         _xdr_argument = (xdrproc_t)xdr_VMCLCmdListReplayOp;
+         _xdr_result = (xdrproc_t)xdr_VMAccelReturnStatus;
+         local = (char *(*)(char *, struct svc_req *))vmcl_cmdlistreplay_2_svc;
+         break;
+
+      case VMCL_CMDLISTDESTROY:
+         _xdr_argument = (xdrproc_t)xdr_VMCLCmdListId;
+         _xdr_result = (xdrproc_t)xdr_VMAccelReturnStatus;
+         local =
+            (char *(*)(char *, struct svc_req *))vmcl_cmdlistdestroy_2_svc;
+         break;
+
+      case VMCL_SURFACEALLOCINIT:
+         _xdr_argument = (xdrproc_t)xdr_VMCLSurfaceAllocateInitOp;
+         _xdr_result = (xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus;
+         local =
+            (char *(*)(char *, struct svc_req *))vmcl_surfaceallocinit_2_svc;
+         break;
+
       default:
          svcerr_noproc(transp);
          return;
@@ -210,10 +255,20 @@ static void vmcl_1(struct svc_req *rqstp, register SVCXPRT *transp) {
    return;
 }
 
+/*
+ * Leave svc_run on termination, so the server powers off and checkpoints
+ * the backend.
+ */
+static void vmcl_terminate(int sig) {
+   svc_exit();
+}
+
 int main(int argc, char **argv) {
    register SVCXPRT *transp;
    VMAccelAllocateStatus *allocStatus;
-   VMAccelMgrClient mgrClient = {NULL, NULL, -1};
+   VMAccelMgrClient mgrClients[VMCL_MAX_DEVICES];
+   unsigned int numMgrClients = 0;
+   unsigned int i;
 
    pmap_unset(VMCL, VMCL_VERSION);
    openlog("vmcl_rpc", LOG_PID, LOG_DAEMON);
@@ -248,32 +303,43 @@ int main(int argc, char **argv) {
    }
 
    /*
-    * Managment host specified.
+    * Managment host specified, each device is a separate accelerator.
     */
    if (argc >= 3) {
       char *iface = argv[1];
       char *host = argv[2];
 
-      mgrClient = vmaccelmgr_register(host, iface, &allocStatus->desc);
+      for (i = 0; i < vmcl_num_devices_svc(); i++) {
+         mgrClients[i] =
+            vmaccelmgr_register(host, iface, &vmcl_device_svc(i)->desc);
 
-      if (mgrClient.clnt == NULL) {
-         VMACCEL_WARNING("Unable to register with management server...\n");
-         vmcl_poweroff_svc();
-         exit(1);
+         if (mgrClients[i].clnt == NULL) {
+            VMACCEL_WARNING("Unable to register with management server...\n");
+            while (numMgrClients > 0) {
+               vmaccelmgr_unregister(&mgrClients[--numMgrClients]);
+            }
+            vmcl_poweroff_svc();
+            exit(1);
+         }
+
+         numMgrClients++;
       }
    }
 
+   signal(SIGTERM, vmcl_terminate);
+   signal(SIGINT, vmcl_terminate);
+
    svc_run();
    syslog(LOG_ERR, "%s", "svc_run returned");
 
-   if (mgrClient.clnt != NULL) {
-      vmaccelmgr_unregister(&mgrClient);
+   for (i = 0; i < numMgrClients; i++) {
+      vmaccelmgr_unregister(&mgrClients[i]);
    }
 
    vmaccel_stream_poweroff();
 
    vmcl_poweroff_svc();
 
-   exit(1);
+   exit(0);
    /* NOTREACHED */
 }
@@ -114,6 +114,18 @@ bool_t xdr_VMCLQueueFlushOp(XDR *xdrs, VMCLQueueFlushOp *objp) {
    return TRUE;
 }
 
+bool_t xdr_VMCLSurfaceAllocateInitOp(XDR *xdrs,
+                                     VMCLSurfaceAllocateInitOp *objp) {
+   if (!xdr_VMCLQueueId(xdrs, &objp->queue))
+      return FALSE;
+   if (!xdr_VMCLSurfaceAllocateDesc(xdrs, &objp->alloc))
+      return FALSE;
+   if (!xdr_bytes(xdrs, (char **)&objp->data.data_val,
+                  (u_int *)&objp->data.data_len, ~0))
+      return FALSE;
+   return TRUE;
+}
+
 bool_t xdr_VMCLSurfaceCopyOp(XDR *xdrs, VMCLSurfaceCopyOp *objp) {
    if (!xdr_VMCLQueueId(xdrs, &objp->queue))
       return FALSE;
@@ -237,6 +249,8 @@ bool_t xdr_VMCLKernelAllocateDesc(XDR *xdrs, VMCLKernelAllocateDesc *objp) {
       return FALSE;
    if (!xdr_VMCLKernelLanguage(xdrs, &objp->language))
       return FALSE;
+   if (!xdr_u_quad_t(xdrs, &objp->sourceHash))
+      return FALSE;
    if (!xdr_bytes(xdrs, (char **)&objp->source.source_val,
                   (u_int *)&objp->source.source_len, ~0))
       return FALSE;
@@ -277,6 +291,19 @@ bool_t xdr_VMCLKernelArgDesc(XDR *xdrs, VMCLKernelArgDesc *objp) {
       return FALSE;
    if (!xdr_VMCLSamplerId(xdrs, &objp->sampler))
       return FALSE;
+   if (!xdr_bytes(xdrs, (char **)&objp->data.data_val,
+                  (u_int *)&objp->data.data_len, ~0))
+      return FALSE;
+   if (!xdr_u_int(xdrs, &objp->localSize))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLKernelArgSwap(XDR *xdrs, VMCLKernelArgSwap *objp) {
+   if (!xdr_u_int(xdrs, &objp->first))
+      return FALSE;
+   if (!xdr_u_int(xdrs, &objp->second))
+      return FALSE;
    return TRUE;
 }
 
@@ -307,6 +334,85 @@ bool_t xdr_VMCLDispatchOp(XDR *xdrs, VMCLDispatchOp *objp) {
                   (u_int *)&objp->refs.refs_len, ~0, sizeof(VMAccelSurfaceId),
                   (xdrproc_t)xdr_VMAccelSurfaceId))
       return FALSE;
+   if (!xdr_u_int(xdrs, &objp->repeatCount))
+      return FALSE;
+   if (!xdr_array(xdrs, (char **)&objp->swaps.swaps_val,
+                  (u_int *)&objp->swaps.swaps_len, ~0,
+                  sizeof(VMCLKernelArgSwap), (xdrproc_t)xdr_VMCLKernelArgSwap))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLDispatchListOp(XDR *xdrs, VMCLDispatchListOp *objp) {
+   if (!xdr_VMCLQueueId(xdrs, &objp->queue))
+      return FALSE;
+   if (!xdr_array(xdrs, (char **)&objp->dispatches.dispatches_val,
+                  (u_int *)&objp->dispatches.dispatches_len, ~0,
+                  sizeof(VMCLDispatchOp), (xdrproc_t)xdr_VMCLDispatchOp))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLCmdListId(XDR *xdrs, VMCLCmdListId *objp) {
+   if (!xdr_VMCLContextId(xdrs, &objp->cid))
+      return FALSE;
+   if (!xdr_VMAccelId(xdrs, &objp->id))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLCmdListRecordOp(XDR *xdrs, VMCLCmdListRecordOp *objp) {
+   if (!xdr_VMCLCmdListId(xdrs, &objp->list))
+      return FALSE;
+   if (!xdr_VMCLDispatchListOp(xdrs, &objp->dispatches))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLKernelArgUpdate(XDR *xdrs, VMCLKernelArgUpdate *objp) {
+   if (!xdr_u_int(xdrs, &objp->dispatch))
+      return FALSE;
+   if (!xdr_VMCLKernelArgDesc(xdrs, &objp->arg))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLCmdListReplayOp(XDR *xdrs, VMCLCmdListReplayOp *objp) {
+   if (!xdr_VMCLCmdListId(xdrs, &objp->list))
+      return FALSE;
+   if (!xdr_array(xdrs, (char **)&objp->updates.updates_val,
+                  (u_int *)&objp->updates.updates_len, ~0,
+                  sizeof(VMCLKernelArgUpdate),
+                  (xdrproc_t)xdr_VMCLKernelArgUpdate))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLProfileOpType(XDR *xdrs, VMCLProfileOpType *objp) {
+   if (!xdr_enum(xdrs, (enum_t *)objp))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLProfileQueryOp(XDR *xdrs, VMCLProfileQueryOp *objp) {
+   if (!xdr_VMCLQueueId(xdrs, &objp->queue))
+      return FALSE;
+   if (!xdr_VMCLProfileOpType(xdrs, &objp->type))
+      return FALSE;
+   return TRUE;
+}
+
+bool_t xdr_VMCLProfileStatus(XDR *xdrs, VMCLProfileStatus *objp) {
+   if (!xdr_VMAccelStatusCode(xdrs, &objp->status))
+      return FALSE;
+   if (!xdr_u_quad_t(xdrs, &objp->queued))
+      return FALSE;
+   if (!xdr_u_quad_t(xdrs, &objp->submit))
+      return FALSE;
+   if (!xdr_u_quad_t(xdrs, &objp->start))
+      return FALSE;
+   if (!xdr_u_quad_t(xdrs, &objp->end))
+      return FALSE;
    return TRUE;
 }
 
@@ -366,3 +472,19 @@ xdr_VMCLKernelAllocateReturnStatus(XDR *xdrs,
    }
    return TRUE;
 }
+
+bool_t xdr_VMCLProfileReturnStatus(XDR *xdrs, VMCLProfileReturnStatus *objp) {
+   if (!xdr_int(xdrs, &objp->errno))
+      return FALSE;
+   switch (objp->errno) {
+      case 0:
+         if (!xdr_pointer(xdrs, (char **)&objp->VMCLProfileReturnStatus_u.ret,
+                          sizeof(VMCLProfileStatus),
+                          (xdrproc_t)xdr_VMCLProfileStatus))
+            return FALSE;
+         break;
+      default:
+         break;
+   }
+   return TRUE;
+}
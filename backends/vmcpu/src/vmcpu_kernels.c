@@ -0,0 +1,142 @@
+/******************************************************************************
+
+Copyright (c) 2022 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+
+/*
+ * vmcpu_kernels.c
+ *
+ * Native kernels built into the CPU backend, registered when the backend
+ * is powered on. Other kernels are added with VMCPU_RegisterKernel by the
+ * server embedding the backend.
+ */
+
+#include <stddef.h>
+
+#include "vmcpu.h"
+#include "vmcpu_kernels.h"
+
+#include "log_level.h"
+
+/*
+ * VMCPUKernel_Range
+ *
+ * Returns the global ids of dimension 0 covered by the work-group, clamped
+ * to the number of elements of the arguments.
+ */
+static void VMCPUKernel_Range(const VMCPUWorkGroup *group, size_t count,
+                              size_t *begin, size_t *end) {
+   size_t globalEnd = group->globalOffset[0] + group->globalSize[0];
+
+   *begin = group->globalOffset[0] + group->groupId[0] * group->localSize[0];
+   *end = *begin + group->localSize[0];
+
+   if (*end > globalEnd) {
+      *end = globalEnd;
+   }
+
+   if (*end > count) {
+      *end = count;
+   }
+}
+
+/*
+ * vmcpu_double_int(int *a)
+ *
+ * a[gid] = a[gid] + a[gid]
+ */
+static void VMCPUKernel_DoubleInt(const VMCPUWorkGroup *group,
+                                  const VMCPUKernelArg *args,
+                                  unsigned int numArgs) {
+   int *a;
+   size_t begin, end, gid;
+
+   if ((group->dimension < 1) || (numArgs < 1) || (args[0].ptr == NULL)) {
+      return;
+   }
+
+   a = (int *)args[0].ptr;
+
+   VMCPUKernel_Range(group, args[0].size / sizeof(int), &begin, &end);
+
+   for (gid = begin; gid < end; gid++) {
+      a[gid] = a[gid] + a[gid];
+   }
+}
+
+/*
+ * vmcpu_add_int(const int *a, int *b)
+ *
+ * b[gid] = b[gid] + a[gid]
+ */
+static void VMCPUKernel_AddInt(const VMCPUWorkGroup *group,
+                               const VMCPUKernelArg *args,
+                               unsigned int numArgs) {
+   const int *a;
+   int *b;
+   size_t count;
+   size_t begin, end, gid;
+
+   if ((group->dimension < 1) || (numArgs < 2) || (args[0].ptr == NULL) ||
+       (args[1].ptr == NULL)) {
+      return;
+   }
+
+   a = (const int *)args[0].ptr;
+   b = (int *)args[1].ptr;
+   count = args[0].size / sizeof(int);
+
+   if (count > args[1].size / sizeof(int)) {
+      count = args[1].size / sizeof(int);
+   }
+
+   VMCPUKernel_Range(group, count, &begin, &end);
+
+   for (gid = begin; gid < end; gid++) {
+      b[gid] = b[gid] + a[gid];
+   }
+}
+
+static const struct {
+   const char *name;
+   VMCPUKernelFunc func;
+} builtinKernels[] = {
+   {"vmcpu_double_int", VMCPUKernel_DoubleInt},
+   {"vmcpu_add_int", VMCPUKernel_AddInt},
+};
+
+void VMCPU_RegisterBuiltinKernels(void) {
+   unsigned int i;
+
+   for (i = 0; i < sizeof(builtinKernels) / sizeof(builtinKernels[0]); i++) {
+      if (!VMCPU_RegisterKernel(builtinKernels[i].name,
+                                builtinKernels[i].func)) {
+         VMACCEL_WARNING("%s: Unable to register kernel %s\n", __FUNCTION__,
+                         builtinKernels[i].name);
+      }
+   }
+}
@@ -0,0 +1,1225 @@
+/******************************************************************************
+
+Copyright (c) 2022 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+/*
+ * vmcpu_ops.c
+ *
+ * Pure-CPU VMCL backend. Surfaces are kept in host memory and dispatches
+ * execute native kernels across a work-stealing pool of worker threads,
+ * one task per work-group. Operations complete before returning, so each
+ * surface holds a single instance.
+ *
+ * The same backend provides the loopback backend, vmnullOps, which accepts
+ * kernels of any language and replaces their execution with a no-op or a
+ * memcpy. This isolates the cost of the protocol and client library.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmaccel_stream.h"
+#include "vmaccel_utils.h"
+#include "vmcpu.h"
+#include "vmcpu_kernels.h"
+#include "vmcpu_pool.h"
+
+#include "log_level.h"
+
+typedef struct VMCPUMapping {
+   void *ptr;
+   unsigned int refCount;
+} VMCPUMapping;
+
+typedef struct VMCPUSurface {
+   unsigned int cid;
+   VMAccelSurfaceDesc desc;
+   void *ptr;
+   unsigned int generation;
+   VMCPUMapping mapping;
+   pthread_mutex_t mutex;
+} VMCPUSurface;
+
+typedef struct VMCPUNativeKernel {
+   char name[VMCPU_MAX_KERNEL_NAME];
+   VMCPUKernelFunc func;
+} VMCPUNativeKernel;
+
+typedef struct VMCPUKernel {
+   VMCPUKernelFunc func;
+} VMCPUKernel;
+
+/*
+ * State of a dispatch shared by the work-group tasks.
+ */
+typedef struct VMCPUDispatch {
+   VMCPUKernelFunc func;
+   VMCPUWorkGroup group;
+   VMCPUKernelArg *args;
+   unsigned int numArgs;
+   size_t localSize;
+} VMCPUDispatch;
+
+/*
+ * Local arguments are carved out of a per-task scratch allocation, with
+ * each argument aligned for any scalar or vector type.
+ */
+#define VMCPU_LOCAL_ALIGN(_SIZE) (((_SIZE) + 63) & ~((size_t)63))
+
+typedef enum VMCPUNullDispatch {
+   VMCPU_NULL_DISPATCH_NONE = 0,
+   VMCPU_NULL_DISPATCH_NOOP = 1,
+   VMCPU_NULL_DISPATCH_MEMCPY = 2,
+} VMCPUNullDispatch;
+
+static VMCPUPool *pool = NULL;
+
+/*
+ * Loopback mode, see vmnullOps.
+ */
+static VMCPUNullDispatch nullDispatch = VMCPU_NULL_DISPATCH_NONE;
+
+static IdentifierDB *contextIds = NULL;
+
+static VMCPUSurface *surfaces = NULL;
+static IdentifierDB *surfaceIds = NULL;
+
+static IdentifierDB *queueIds = NULL;
+
+static VMCPUKernel *kernels = NULL;
+static IdentifierDB *kernelIds = NULL;
+
+static VMCPUNativeKernel nativeKernels[VMCPU_MAX_NATIVE_KERNELS];
+static pthread_mutex_t nativeKernelMutex = PTHREAD_MUTEX_INITIALIZER;
+
+VMAccelStatus *vmcpu_poweroff();
+VMAccelSurfaceMapStatus *vmcpu_surfacemap_1(VMCLSurfaceMapOp *argp);
+VMAccelStatus *vmcpu_surfaceunmap_1(VMCLSurfaceUnmapOp *argp);
+
+bool VMCPU_RegisterKernel(const char *name, VMCPUKernelFunc func) {
+   int freeIndex = -1;
+   int i;
+
+   if ((name == NULL) || (strlen(name) >= VMCPU_MAX_KERNEL_NAME)) {
+      return false;
+   }
+
+   pthread_mutex_lock(&nativeKernelMutex);
+
+   for (i = 0; i < VMCPU_MAX_NATIVE_KERNELS; i++) {
+      if (nativeKernels[i].func == NULL) {
+         if (freeIndex == -1) {
+            freeIndex = i;
+         }
+      } else if (strcmp(nativeKernels[i].name, name) == 0) {
+         freeIndex = i;
+         break;
+      }
+   }
+
+   if (freeIndex != -1) {
+      strcpy(nativeKernels[freeIndex].name, name);
+      nativeKernels[freeIndex].func = func;
+   }
+
+   pthread_mutex_unlock(&nativeKernelMutex);
+
+   return (freeIndex != -1);
+}
+
+void VMCPU_UnregisterKernel(const char *name) {
+   int i;
+
+   pthread_mutex_lock(&nativeKernelMutex);
+
+   for (i = 0; i < VMCPU_MAX_NATIVE_KERNELS; i++) {
+      if ((nativeKernels[i].func != NULL) &&
+          (strcmp(nativeKernels[i].name, name) == 0)) {
+         memset(&nativeKernels[i], 0, sizeof(nativeKernels[0]));
+      }
+   }
+
+   pthread_mutex_unlock(&nativeKernelMutex);
+}
+
+static VMCPUKernelFunc VMCPU_LookupKernel(const char *name) {
+   VMCPUKernelFunc func = NULL;
+   int i;
+
+   pthread_mutex_lock(&nativeKernelMutex);
+
+   for (i = 0; i < VMCPU_MAX_NATIVE_KERNELS; i++) {
+      if ((nativeKernels[i].func != NULL) &&
+          (strcmp(nativeKernels[i].name, name) == 0)) {
+         func = nativeKernels[i].func;
+         break;
+      }
+   }
+
+   pthread_mutex_unlock(&nativeKernelMutex);
+
+   return func;
+}
+
+static VMAccelAllocateStatus *VMCPU_PowerOn(unsigned int accelArch,
+                                            unsigned int useDataStreaming) {
+   static VMAccelAllocateStatus result;
+   long numProcessors;
+
+   memset(&result, 0, sizeof(result));
+
+   numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (numProcessors <= 0) {
+      numProcessors = 1;
+   }
+
+   if (nullDispatch == VMCPU_NULL_DISPATCH_NONE) {
+      pool = VMCPUPool_Create((unsigned int)numProcessors);
+   }
+
+   result.desc.typeMask = VMACCEL_COMPUTE_ACCELERATOR_MASK;
+   result.desc.architecture = accelArch;
+   result.desc.caps = VMACCEL_SURFACEMAP;
+
+   result.desc.formatCaps.formatCaps_len = 0;
+   result.desc.formatCaps.formatCaps_val = NULL;
+
+   /*
+    * Processor clock and cache information is not queried, export the
+    * number of worker threads at a nominal 1GHz.
+    */
+   result.desc.capacity.megaFlops = numProcessors * 1000;
+   result.desc.capacity.megaOps = result.desc.capacity.megaFlops;
+
+   contextIds = IdentifierDB_Alloc(VMCL_MAX_CONTEXTS);
+
+   surfaces = calloc(VMCL_MAX_SURFACES, sizeof(VMCPUSurface));
+   surfaceIds = IdentifierDB_Alloc(VMCL_MAX_SURFACES);
+
+   queueIds = IdentifierDB_Alloc(VMCL_MAX_QUEUES);
+
+   kernels = calloc(VMCL_MAX_KERNELS, sizeof(VMCPUKernel));
+   kernelIds = IdentifierDB_Alloc(VMCL_MAX_KERNELS);
+
+   /*
+    * Final check for allocation failure.
+    */
+   if (((pool == NULL) && (nullDispatch == VMCPU_NULL_DISPATCH_NONE)) ||
+       (contextIds == NULL) || (surfaces == NULL) ||
+       (surfaceIds == NULL) || (queueIds == NULL) || (kernels == NULL) ||
+       (kernelIds == NULL)) {
+      VMACCEL_WARNING("Unable to allocate object database...\n");
+      result.status = VMACCEL_FAIL;
+      vmcpu_poweroff();
+      return (&result);
+   }
+
+   result.status = VMACCEL_SUCCESS;
+
+   result.desc.maxContexts = VMCL_MAX_CONTEXTS;
+   result.desc.maxQueues = VMCL_MAX_QUEUES;
+   result.desc.maxSurfaces = VMCL_MAX_SURFACES;
+   result.desc.maxMappings = VMCL_MAX_SURFACES;
+
+#if ENABLE_DATA_STREAMING
+   if (useDataStreaming) {
+      VMAccelStreamCallbacks cb;
+      cb.clSurfacemap_1 = vmcpu_surfacemap_1;
+      cb.clSurfaceunmap_1 = vmcpu_surfaceunmap_1;
+      vmaccel_stream_server(VMACCEL_STREAM_TYPE_VMCL_UPLOAD,
+                            VMACCEL_VMCL_BASE_PORT, &cb);
+   }
+#endif
+
+   return (&result);
+}
+
+VMAccelAllocateStatus *vmcpu_poweron(VMCLOps *ops, unsigned int accelArch,
+                                     unsigned int accelIndex,
+                                     unsigned int useDataStreaming) {
+   static VMAccelAllocateStatus result;
+
+   /*
+    * The host processors are exposed as a single device.
+    */
+   if ((accelArch != VMACCEL_CPU) || (accelIndex > 0)) {
+      memset(&result, 0, sizeof(result));
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   VMACCEL_LOG("Powering on vmcpu backend...\n");
+
+   nullDispatch = VMCPU_NULL_DISPATCH_NONE;
+
+   VMCPU_RegisterBuiltinKernels();
+
+   return VMCPU_PowerOn(accelArch, useDataStreaming);
+}
+
+/*
+ * vmnull_poweron
+ *
+ * Powers on the loopback backend as a single device of the first
+ * architecture requested. The dispatch
+ * behavior is selected with the VMCL_NULL_DISPATCH environment variable,
+ * either "noop" (default) or "memcpy", which copies the first surface
+ * argument to the remaining surface arguments.
+ */
+VMAccelAllocateStatus *vmnull_poweron(VMCLOps *ops, unsigned int accelArch,
+                                      unsigned int accelIndex,
+                                      unsigned int useDataStreaming) {
+   static VMAccelAllocateStatus result;
+   const char *mode = getenv("VMCL_NULL_DISPATCH");
+
+   if (surfaces != NULL) {
+      memset(&result, 0, sizeof(result));
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   VMACCEL_LOG("Powering on vmnull backend...\n");
+
+   if ((mode != NULL) && (strcmp(mode, "memcpy") == 0)) {
+      nullDispatch = VMCPU_NULL_DISPATCH_MEMCPY;
+   } else {
+      nullDispatch = VMCPU_NULL_DISPATCH_NOOP;
+   }
+
+   return VMCPU_PowerOn(accelArch, useDataStreaming);
+}
+
+VMAccelStatus *vmcpu_poweroff() {
+   static VMAccelStatus result;
+
+   memset(&result, 0, sizeof(result));
+
+   VMCPUPool_Destroy(pool);
+   pool = NULL;
+
+   IdentifierDB_Free(contextIds);
+   contextIds = NULL;
+
+   IdentifierDB_Free(surfaceIds);
+   free(surfaces);
+   surfaceIds = NULL;
+   surfaces = NULL;
+
+   IdentifierDB_Free(queueIds);
+   queueIds = NULL;
+
+   IdentifierDB_Free(kernelIds);
+   free(kernels);
+   kernelIds = NULL;
+   kernels = NULL;
+
+   return (&result);
+}
+
+VMCLContextAllocateStatus *
+vmcpu_contextalloc_1(VMCLContextAllocateDesc *argp) {
+   static VMCLContextAllocateStatus result;
+   unsigned int cid = argp->clientId;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!IdentifierDB_AcquireId(contextIds, cid)) {
+      VMACCEL_WARNING("%s: ERROR: Context ID %d already active...\n",
+                      __FUNCTION__, cid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_contextdestroy_1(VMCLContextId *argp) {
+   static VMAccelStatus result;
+   unsigned int cid = *((unsigned int *)argp);
+
+   memset(&result, 0, sizeof(result));
+
+   IdentifierDB_ReleaseId(contextIds, cid);
+
+   return (&result);
+}
+
+VMAccelSurfaceAllocateStatus *
+vmcpu_surfacealloc_1(VMCLSurfaceAllocateDesc *argp) {
+   static VMAccelSurfaceAllocateStatus result;
+   unsigned int cid = (unsigned int)argp->client.cid;
+   unsigned int sid = (unsigned int)argp->client.accel.id;
+   pthread_mutexattr_t attr;
+   void *ptr;
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(surfaceIds, sid)) {
+      VMACCEL_WARNING("%s: ERROR: Surface ID %d already active...\n",
+                      __FUNCTION__, sid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   if (argp->desc.type != VMACCEL_SURFACE_BUFFER) {
+      VMACCEL_WARNING("%s: Surface type %d unsupported\n", __FUNCTION__,
+                      argp->desc.type);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   ptr = calloc(1, argp->desc.width);
+
+   if (ptr == NULL) {
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (!IdentifierDB_AcquireId(surfaceIds, sid)) {
+      free(ptr);
+      assert(0);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+   memset(&surfaces[sid], 0, sizeof(surfaces[0]));
+   pthread_mutex_init(&surfaces[sid].mutex, &attr);
+   surfaces[sid].cid = cid;
+   surfaces[sid].desc = argp->desc;
+   surfaces[sid].ptr = ptr;
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_surfacedestroy_1(VMCLSurfaceId *argp) {
+   static VMAccelStatus result;
+   unsigned int sid = (unsigned int)argp->accel.id;
+
+   memset(&result, 0, sizeof(result));
+
+   assert(IdentifierDB_ActiveId(surfaceIds, sid));
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+   free(surfaces[sid].ptr);
+   surfaces[sid].ptr = NULL;
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+   pthread_mutex_destroy(&surfaces[sid].mutex);
+
+   memset(&surfaces[sid], 0, sizeof(surfaces[0]));
+
+   IdentifierDB_ReleaseId(surfaceIds, sid);
+
+   return (&result);
+}
+
+VMAccelQueueStatus *vmcpu_queuealloc_1(VMCLQueueAllocateDesc *argp) {
+   static VMAccelQueueStatus result;
+   unsigned int qid = (unsigned int)argp->client.id;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!IdentifierDB_AcquireId(queueIds, qid)) {
+      VMACCEL_WARNING("%s: ERROR: Queue ID %d already active...\n",
+                      __FUNCTION__, qid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_queuedestroy_1(VMCLQueueId *argp) {
+   static VMAccelStatus result;
+   unsigned int qid = (unsigned int)argp->id;
+
+   memset(&result, 0, sizeof(result));
+
+   assert(IdentifierDB_ActiveId(queueIds, qid));
+
+   IdentifierDB_ReleaseId(queueIds, qid);
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_queueflush_1(VMCLQueueId *argp) {
+   static VMAccelStatus result;
+
+   /*
+    * Operations complete before returning, nothing to flush.
+    */
+   memset(&result, 0, sizeof(result));
+
+   return (&result);
+}
+
+/*
+ * VMCPUSurface_CheckGeneration
+ *
+ * Validates the requested generation against the surface contents, see
+ * the generation protocol in vmwopencl_ops.c.
+ */
+static VMAccelStatusCode VMCPUSurface_CheckGeneration(unsigned int sid,
+                                                      unsigned int gen) {
+   if (surfaces[sid].generation > gen) {
+      VMACCEL_WARNING("Out-of-order update detected, client/server"
+                      " out of sync...\n");
+      return VMACCEL_SEMANTIC_ERROR;
+   } else if (surfaces[sid].generation < gen) {
+      return VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return VMACCEL_SUCCESS;
+}
+
+/*
+ * VMCPUSurface_Active
+ *
+ * Surface identifiers are supplied by the client, only allocated surfaces
+ * may be referenced.
+ */
+static bool VMCPUSurface_Active(unsigned int sid) {
+   return (sid < VMCL_MAX_SURFACES) && IdentifierDB_ActiveId(surfaceIds, sid);
+}
+
+static bool VMCPUSurface_InBounds(unsigned int sid, size_t offset,
+                                  size_t size) {
+   return (offset <= surfaces[sid].desc.width) &&
+          (size <= surfaces[sid].desc.width - offset);
+}
+
+/*
+ * VMCPUSurface_CopyRegion
+ *
+ * Copies a region of a surface to or from tightly packed host memory, see
+ * VMAccel_SurfaceRegionLayout.
+ */
+static bool VMCPUSurface_CopyRegion(unsigned int sid,
+                                    const VMAccelSurfaceRegion *rgn,
+                                    char *ptr, size_t len, bool write) {
+   size_t origin[3], region[3], rowPitch, slicePitch;
+   size_t offset;
+   size_t y, z;
+
+   if (!VMAccel_SurfaceRegionLayout(&surfaces[sid].desc, rgn, origin, region,
+                                    &rowPitch, &slicePitch) ||
+       (len < region[0] * region[1] * region[2])) {
+      return false;
+   }
+
+   for (z = 0; z < region[2]; z++) {
+      for (y = 0; y < region[1]; y++) {
+         offset = (origin[2] + z) * slicePitch + (origin[1] + y) * rowPitch +
+                  origin[0];
+
+         if (write) {
+            memcpy((char *)surfaces[sid].ptr + offset, ptr, region[0]);
+         } else {
+            memcpy(ptr, (char *)surfaces[sid].ptr + offset, region[0]);
+         }
+
+         ptr += region[0];
+      }
+   }
+
+   return true;
+}
+
+VMAccelStatus *vmcpu_imageupload_1(VMCLImageUploadOp *argp) {
+   static VMAccelStatus result;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(sid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   if (surfaces[sid].generation > gen) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+   } else if (!VMCPUSurface_CopyRegion(sid, &argp->op.imgRegion,
+                                       argp->op.ptr.ptr_val,
+                                       argp->op.ptr.ptr_len, true)) {
+      result.status = VMACCEL_FAIL;
+   } else {
+      surfaces[sid].generation = gen;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelDownloadStatus *vmcpu_imagedownload_1(VMCLImageDownloadOp *argp) {
+   static VMAccelDownloadStatus result;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+   size_t rows = MAX(argp->op.imgRegion.size.y, 1);
+   size_t slices = MAX(argp->op.imgRegion.size.z, 1);
+   size_t size = argp->op.imgRegion.size.x * rows * slices;
+   void *ptr;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(sid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   result.status = VMCPUSurface_CheckGeneration(sid, gen);
+
+   if (result.status != VMACCEL_SUCCESS) {
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+      return (&result);
+   }
+
+   if ((argp->op.ptr.ptr_val != NULL) && (argp->op.ptr.ptr_len < size)) {
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (argp->op.ptr.ptr_val == NULL) {
+      ptr = calloc(1, size);
+   } else {
+      ptr = argp->op.ptr.ptr_val;
+   }
+
+   if ((ptr == NULL) ||
+       !VMCPUSurface_CopyRegion(sid, &argp->op.imgRegion, ptr, size, false)) {
+      if (ptr != argp->op.ptr.ptr_val) {
+         free(ptr);
+      }
+      result.status = VMACCEL_FAIL;
+   } else {
+      result.ptr.ptr_len = size;
+      result.ptr.ptr_val = ptr;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelSurfaceMapStatus *vmcpu_surfacemap_1(VMCLSurfaceMapOp *argp) {
+   static VMAccelSurfaceMapStatus result;
+   unsigned int sid = (unsigned int)argp->op.surf.id;
+   unsigned int gen = (unsigned int)argp->op.surf.generation;
+   size_t offset = argp->op.coord.x;
+   size_t size = argp->op.size.x;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(sid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   if (surfaces[sid].generation > gen) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+   } else if (!VMCPUSurface_InBounds(sid, offset, size)) {
+      result.status = VMACCEL_FAIL;
+   } else {
+      /*
+       * Surfaces are host memory, the mapping is the surface itself.
+       */
+      surfaces[sid].mapping.refCount++;
+      surfaces[sid].mapping.ptr = (char *)surfaces[sid].ptr + offset;
+
+      result.ptr.ptr_val = surfaces[sid].mapping.ptr;
+      result.ptr.ptr_len = size;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_surfaceunmap_1(VMCLSurfaceUnmapOp *argp) {
+   static VMAccelStatus result;
+   unsigned int sid = (unsigned int)argp->op.surf.id;
+   unsigned int gen = (unsigned int)argp->op.surf.generation;
+   void *ptr;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(sid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   ptr = surfaces[sid].mapping.ptr;
+
+   if ((ptr == NULL) ||
+       ((char *)ptr + argp->op.ptr.ptr_len >
+        (char *)surfaces[sid].ptr + surfaces[sid].desc.width)) {
+      result.status = VMACCEL_FAIL;
+   } else {
+      /*
+       * Local clients write through the mapping, remote clients return
+       * the contents.
+       */
+      if (ptr != argp->op.ptr.ptr_val) {
+         memcpy(ptr, argp->op.ptr.ptr_val, argp->op.ptr.ptr_len);
+      }
+
+      surfaces[sid].generation = gen;
+   }
+
+   /*
+    * We are done with the contents, free the pointer.
+    */
+   if (((argp->op.mapFlags & VMACCEL_MAP_NO_FREE_PTR_FLAG) == 0) &&
+       (ptr != argp->op.ptr.ptr_val)) {
+      free(argp->op.ptr.ptr_val);
+      argp->op.ptr.ptr_val = NULL;
+      argp->op.ptr.ptr_len = 0;
+   }
+
+   if ((surfaces[sid].mapping.refCount > 0) &&
+       (--surfaces[sid].mapping.refCount == 0)) {
+      surfaces[sid].mapping.ptr = NULL;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_surfacecopy_1(VMCLSurfaceCopyOp *argp) {
+   static VMAccelStatus result;
+   unsigned int dstSid = (unsigned int)argp->dst.accel.id;
+   unsigned int dstGen = (unsigned int)argp->dst.accel.generation;
+   unsigned int srcSid = (unsigned int)argp->src.accel.id;
+   unsigned int srcGen = (unsigned int)argp->src.accel.generation;
+   size_t size = argp->op.dstRegion.size.x;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(srcSid) || !VMCPUSurface_Active(dstSid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[srcSid].mutex);
+   pthread_mutex_lock(&surfaces[dstSid].mutex);
+
+   if (surfaces[srcSid].generation < srcGen) {
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   } else if ((surfaces[srcSid].generation > srcGen) ||
+              (surfaces[dstSid].generation > dstGen)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+   } else if (!VMCPUSurface_InBounds(srcSid, argp->op.srcRegion.coord.x,
+                                     size) ||
+              !VMCPUSurface_InBounds(dstSid, argp->op.dstRegion.coord.x,
+                                     size)) {
+      result.status = VMACCEL_FAIL;
+   } else {
+      memmove((char *)surfaces[dstSid].ptr + argp->op.dstRegion.coord.x,
+              (char *)surfaces[srcSid].ptr + argp->op.srcRegion.coord.x, size);
+   }
+
+   pthread_mutex_unlock(&surfaces[dstSid].mutex);
+   pthread_mutex_unlock(&surfaces[srcSid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_imagefill_1(VMCLImageFillOp *argp) {
+   static VMAccelStatus result;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+   size_t offset = argp->op.dstRegion.coord.x;
+   size_t size = argp->op.dstRegion.size.x;
+   const char *pattern = (const char *)&argp->op.u;
+   size_t i;
+
+   memset(&result, 0, sizeof(result));
+
+   if (!VMCPUSurface_Active(sid)) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   result.status = VMCPUSurface_CheckGeneration(sid, gen);
+
+   if (result.status == VMACCEL_SUCCESS) {
+      if (!VMCPUSurface_InBounds(sid, offset, size) ||
+          (size % sizeof(argp->op.u) != 0)) {
+         result.status = VMACCEL_FAIL;
+      } else {
+         for (i = 0; i < size; i += sizeof(argp->op.u)) {
+            memcpy((char *)surfaces[sid].ptr + offset + i, pattern,
+                   sizeof(argp->op.u));
+         }
+      }
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMCLSamplerAllocateStatus *vmcpu_sampleralloc_1(VMCLSamplerAllocateDesc *argp) {
+   static VMCLSamplerAllocateStatus result;
+
+   memset(&result, 0, sizeof(result));
+
+   result.status = VMACCEL_FAIL;
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_samplerdestroy_1(VMCLSamplerId *argp) {
+   static VMAccelStatus result;
+
+   memset(&result, 0, sizeof(result));
+
+   result.status = VMACCEL_FAIL;
+
+   return (&result);
+}
+
+VMCLKernelAllocateStatus *vmcpu_kernelalloc_1(VMCLKernelAllocateDesc *argp) {
+   static VMCLKernelAllocateStatus result;
+   unsigned int kid = (unsigned int)argp->client.id;
+   VMCPUKernelFunc func;
+
+   memset(&result, 0, sizeof(result));
+
+   if (nullDispatch != VMCPU_NULL_DISPATCH_NONE) {
+      /*
+       * Loopback kernels are never executed.
+       */
+      if (!IdentifierDB_AcquireId(kernelIds, kid)) {
+         result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      }
+      return (&result);
+   }
+
+   if (argp->language != VMCL_NATIVE_CPP) {
+      VMACCEL_WARNING("%s: Kernel language %d unsupported\n", __FUNCTION__,
+                      argp->language);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   func = VMCPU_LookupKernel(argp->kernelName.kernelName_val);
+
+   if (func == NULL) {
+      VMACCEL_WARNING("%s: Native kernel %s not registered\n", __FUNCTION__,
+                      argp->kernelName.kernelName_val);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (!IdentifierDB_AcquireId(kernelIds, kid)) {
+      VMACCEL_WARNING("%s: ERROR: Kernel ID %d already active...\n",
+                      __FUNCTION__, kid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   kernels[kid].func = func;
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_kerneldestroy_1(VMCLKernelId *argp) {
+   static VMAccelStatus result;
+   unsigned int kid = (unsigned int)argp->id;
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(kernelIds, kid)) {
+      memset(&kernels[kid], 0, sizeof(kernels[0]));
+      IdentifierDB_ReleaseId(kernelIds, kid);
+   }
+
+   return (&result);
+}
+
+/*
+ * VMCPUDispatch_Loopback
+ *
+ * Replaces the kernel execution in loopback mode, the surface with the
+ * lowest argument index is copied to the other surface arguments. Takes
+ * the arguments of the iteration, so swaps apply as they do to kernels.
+ */
+static void VMCPUDispatch_Loopback(const VMCPUKernelArg *args,
+                                   const bool *isSurface,
+                                   unsigned int numArgs) {
+   const VMCPUKernelArg *src = NULL;
+   unsigned int i;
+
+   if (nullDispatch != VMCPU_NULL_DISPATCH_MEMCPY) {
+      return;
+   }
+
+   for (i = 0; i < numArgs; i++) {
+      if (!isSurface[i]) {
+         continue;
+      }
+
+      if (src == NULL) {
+         src = &args[i];
+      } else if (args[i].ptr != src->ptr) {
+         memcpy(args[i].ptr, src->ptr, MIN(args[i].size, src->size));
+      }
+   }
+}
+
+static void VMCPUDispatch_Execute(void *data, unsigned int begin,
+                                  unsigned int end) {
+   VMCPUDispatch *dispatch = (VMCPUDispatch *)data;
+   VMCPUWorkGroup group = dispatch->group;
+   VMCPUKernelArg localArgs[VMCPU_MAX_KERNEL_ARGS];
+   const VMCPUKernelArg *args = dispatch->args;
+   char *local = NULL;
+   unsigned int index;
+   unsigned int i;
+
+   /*
+    * Local arguments are the only arguments without a pointer, the scratch
+    * memory is private to this task and reused by each of its work-groups.
+    */
+   if (dispatch->localSize > 0) {
+      size_t offset = 0;
+
+      local = malloc(dispatch->localSize);
+
+      if (local == NULL) {
+         VMACCEL_WARNING("%s: Unable to allocate %zu bytes of local memory\n",
+                         __FUNCTION__, dispatch->localSize);
+         return;
+      }
+
+      memcpy(localArgs, dispatch->args,
+             sizeof(localArgs[0]) * dispatch->numArgs);
+
+      for (i = 0; i < dispatch->numArgs; i++) {
+         if ((localArgs[i].ptr == NULL) && (localArgs[i].size > 0)) {
+            localArgs[i].ptr = &local[offset];
+            offset += VMCPU_LOCAL_ALIGN(localArgs[i].size);
+         }
+      }
+
+      args = &localArgs[0];
+   }
+
+   for (index = begin; index < end; index++) {
+      size_t linear = index;
+
+      for (i = 0; i < group.dimension; i++) {
+         group.groupId[i] = linear % group.numGroups[i];
+         linear /= group.numGroups[i];
+      }
+
+      dispatch->func(&group, args, dispatch->numArgs);
+   }
+
+   free(local);
+}
+
+VMAccelStatus *vmcpu_dispatch_1(VMCLDispatchOp *argp) {
+   static VMAccelStatus result;
+   unsigned int kid = (unsigned int)argp->kernel.id;
+   VMCPUKernelArg args[VMCPU_MAX_KERNEL_ARGS];
+   bool isSurface[VMCPU_MAX_KERNEL_ARGS];
+   VMCPUDispatch dispatch;
+   size_t numGroups = 1;
+   unsigned int repeatCount;
+   unsigned int iter;
+   int argIndex;
+   unsigned int i;
+
+   memset(&result, 0, sizeof(result));
+   memset(&dispatch, 0, sizeof(dispatch));
+   memset(&args, 0, sizeof(args));
+   memset(&isSurface, 0, sizeof(isSurface));
+
+   if ((kid >= VMCL_MAX_KERNELS) || !IdentifierDB_ActiveId(kernelIds, kid) ||
+       (argp->dimension > VMCPU_MAX_DIMENSIONS)) {
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   dispatch.func = kernels[kid].func;
+   dispatch.args = &args[0];
+   dispatch.group.dimension = argp->dimension;
+
+   for (i = 0; i < argp->dimension; i++) {
+      size_t globalSize = argp->globalWorkSize.globalWorkSize_val[i];
+      size_t localSize = argp->localWorkSize.localWorkSize_val[i];
+
+      if (localSize == 0) {
+         localSize = globalSize;
+      }
+
+      dispatch.group.globalOffset[i] =
+         argp->globalWorkOffset.globalWorkOffset_val[i];
+      dispatch.group.globalSize[i] = globalSize;
+      dispatch.group.localSize[i] = localSize;
+      dispatch.group.numGroups[i] =
+         (localSize > 0) ? (globalSize + localSize - 1) / localSize : 0;
+
+      numGroups *= dispatch.group.numGroups[i];
+   }
+
+   for (argIndex = 0; argIndex < argp->args.args_len; argIndex++) {
+      VMCLKernelArgDesc *arg = &argp->args.args_val[argIndex];
+
+      if ((arg->type == VMCL_ARG_SURFACE) &&
+          (arg->index < VMCPU_MAX_KERNEL_ARGS)) {
+         unsigned int sid = (unsigned int)arg->surf.id;
+
+         if (!VMCPUSurface_Active(sid)) {
+            result.status = VMACCEL_SEMANTIC_ERROR;
+            goto cleanup;
+         }
+
+         pthread_mutex_lock(&surfaces[sid].mutex);
+
+         result.status =
+            VMCPUSurface_CheckGeneration(sid, arg->surf.generation);
+
+         args[arg->index].ptr = surfaces[sid].ptr;
+         args[arg->index].size = surfaces[sid].desc.width;
+         isSurface[arg->index] = true;
+         dispatch.numArgs = MAX(dispatch.numArgs, arg->index + 1);
+      } else if ((arg->type == VMCL_ARG_IMMEDIATE) &&
+                 (arg->index < VMCPU_MAX_KERNEL_ARGS) &&
+                 (arg->data.data_len > 0)) {
+         /*
+          * The immediate value lives in the request for the whole dispatch.
+          */
+         args[arg->index].ptr = arg->data.data_val;
+         args[arg->index].size = arg->data.data_len;
+         dispatch.numArgs = MAX(dispatch.numArgs, arg->index + 1);
+      } else if ((arg->type == VMCL_ARG_LOCAL) &&
+                 (arg->index < VMCPU_MAX_KERNEL_ARGS) &&
+                 (arg->localSize > 0)) {
+         args[arg->index].ptr = NULL;
+         args[arg->index].size = arg->localSize;
+         dispatch.localSize += VMCPU_LOCAL_ALIGN(arg->localSize);
+         dispatch.numArgs = MAX(dispatch.numArgs, arg->index + 1);
+      } else {
+         VMACCEL_WARNING("%s: Unsupported argument type %d at index %u\n",
+                         __FUNCTION__, arg->type, arg->index);
+         result.status = VMACCEL_SEMANTIC_ERROR;
+         goto cleanup;
+      }
+
+      if (result.status != VMACCEL_SUCCESS) {
+         argIndex++;
+         goto cleanup;
+      }
+   }
+
+   for (i = 0; i < argp->swaps.swaps_len; i++) {
+      if ((argp->swaps.swaps_val[i].first >= dispatch.numArgs) ||
+          (argp->swaps.swaps_val[i].second >= dispatch.numArgs)) {
+         result.status = VMACCEL_SEMANTIC_ERROR;
+         goto cleanup;
+      }
+   }
+
+   repeatCount = MAX(argp->repeatCount, 1);
+
+   for (iter = 0; iter < repeatCount; iter++) {
+      /*
+       * Exchange the arguments of each pair between iterations, the pool
+       * completes an iteration before the next is started.
+       */
+      for (i = 0; (iter > 0) && (i < argp->swaps.swaps_len); i++) {
+         unsigned int first = argp->swaps.swaps_val[i].first;
+         unsigned int second = argp->swaps.swaps_val[i].second;
+         VMCPUKernelArg tmp = args[first];
+         bool tmpIsSurface = isSurface[first];
+
+         args[first] = args[second];
+         args[second] = tmp;
+         isSurface[first] = isSurface[second];
+         isSurface[second] = tmpIsSurface;
+      }
+
+      if (nullDispatch != VMCPU_NULL_DISPATCH_NONE) {
+         VMCPUDispatch_Loopback(args, isSurface, dispatch.numArgs);
+      } else {
+         VMCPUPool_Run(pool, VMCPUDispatch_Execute, &dispatch, numGroups,
+                       MAX(numGroups / (VMCPUPool_NumWorkers(pool) * 8), 1));
+      }
+   }
+
+cleanup:
+
+   for (argIndex = argIndex - 1; argIndex >= 0; argIndex--) {
+      VMCLKernelArgDesc *arg = &argp->args.args_val[argIndex];
+
+      if ((arg->type == VMCL_ARG_SURFACE) &&
+          (arg->index < VMCPU_MAX_KERNEL_ARGS)) {
+         pthread_mutex_unlock(&surfaces[arg->surf.id].mutex);
+      }
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmcpu_dispatchlist_1(VMCLDispatchListOp *argp) {
+   static VMAccelStatus result;
+   bool locked[VMCL_MAX_SURFACES];
+   unsigned int i;
+   int argIndex;
+
+   memset(&result, 0, sizeof(result));
+   memset(&locked[0], 0, sizeof(locked));
+
+   /*
+    * Validate the generations of the union of the referenced surfaces up
+    * front, so a list the client retries is not partially executed.
+    */
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      VMCLDispatchOp *op = &argp->dispatches.dispatches_val[i];
+
+      for (argIndex = 0; argIndex < op->args.args_len; argIndex++) {
+         VMCLKernelArgDesc *arg = &op->args.args_val[argIndex];
+         unsigned int sid = (unsigned int)arg->surf.id;
+
+         if (arg->type != VMCL_ARG_SURFACE) {
+            continue;
+         }
+
+         if (!VMCPUSurface_Active(sid)) {
+            result.status = VMACCEL_SEMANTIC_ERROR;
+            goto cleanup;
+         }
+
+         if (!locked[sid]) {
+            pthread_mutex_lock(&surfaces[sid].mutex);
+            locked[sid] = true;
+         }
+
+         result.status =
+            VMCPUSurface_CheckGeneration(sid, arg->surf.generation);
+
+         if (result.status != VMACCEL_SUCCESS) {
+            goto cleanup;
+         }
+      }
+   }
+
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      if (vmcpu_dispatch_1(&argp->dispatches.dispatches_val[i])->status !=
+          VMACCEL_SUCCESS) {
+         result.status = VMACCEL_FAIL;
+         break;
+      }
+   }
+
+cleanup:
+
+   for (i = 0; i < VMCL_MAX_SURFACES; i++) {
+      if (locked[i]) {
+         pthread_mutex_unlock(&surfaces[i].mutex);
+      }
+   }
+
+   return (&result);
+}
+
+VMCLOps vmcpuOps = {
+   vmcpu_poweron,
+   vmcpu_poweroff,
+   NULL,
+   NULL,
+   vmcpu_contextalloc_1,
+   vmcpu_contextdestroy_1,
+   vmcpu_surfacealloc_1,
+   vmcpu_surfacedestroy_1,
+   vmcpu_queuealloc_1,
+   vmcpu_queuedestroy_1,
+   vmcpu_sampleralloc_1,
+   vmcpu_samplerdestroy_1,
+   vmcpu_kernelalloc_1,
+   vmcpu_kerneldestroy_1,
+   vmcpu_queueflush_1,
+   vmcpu_imageupload_1,
+   vmcpu_imagedownload_1,
+   vmcpu_surfacemap_1,
+   vmcpu_surfaceunmap_1,
+   vmcpu_surfacecopy_1,
+   vmcpu_imagefill_1,
+   vmcpu_dispatch_1,
+   NULL,
+   vmcpu_dispatchlist_1,
+   NULL,
+};
+
+VMCLOps vmnullOps = {
+   vmnull_poweron,
+   vmcpu_poweroff,
+   NULL,
+   NULL,
+   vmcpu_contextalloc_1,
+   vmcpu_contextdestroy_1,
+   vmcpu_surfacealloc_1,
+   vmcpu_surfacedestroy_1,
+   vmcpu_queuealloc_1,
+   vmcpu_queuedestroy_1,
+   vmcpu_sampleralloc_1,
+   vmcpu_samplerdestroy_1,
+   vmcpu_kernelalloc_1,
+   vmcpu_kerneldestroy_1,
+   vmcpu_queueflush_1,
+   vmcpu_imageupload_1,
+   vmcpu_imagedownload_1,
+   vmcpu_surfacemap_1,
+   vmcpu_surfaceunmap_1,
+   vmcpu_surfacecopy_1,
+   vmcpu_imagefill_1,
+   vmcpu_dispatch_1,
+   NULL,
+   vmcpu_dispatchlist_1,
+   NULL,
+};
@@ -0,0 +1,372 @@
+/******************************************************************************
+
+Copyright (c) 2022 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+/*
+ * vmcpu_pool.c
+ *
+ * Work-stealing thread pool for the CPU backend, see vmcpu_pool.h.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmcpu_pool.h"
+
+#include "log_level.h"
+
+/*
+ * Splitting halves the executing range, so a deque holds at most one entry
+ * per halving of the initial range.
+ */
+#define VMCPU_DEQUE_SIZE 64
+
+typedef struct VMCPURange {
+   unsigned int begin;
+   unsigned int end;
+} VMCPURange;
+
+typedef struct VMCPUDeque {
+   pthread_mutex_t mutex;
+   unsigned int head;
+   unsigned int tail;
+   VMCPURange ranges[VMCPU_DEQUE_SIZE];
+} VMCPUDeque;
+
+typedef struct VMCPUWorker {
+   struct VMCPUPool *pool;
+   unsigned int index;
+   pthread_t thread;
+} VMCPUWorker;
+
+struct VMCPUPool {
+   unsigned int numWorkers;
+   VMCPUWorker *workers;
+   VMCPUDeque *deques;
+
+   /*
+    * Serializes jobs submitted to the pool.
+    */
+   pthread_mutex_t runMutex;
+
+   pthread_mutex_t mutex;
+   pthread_cond_t workCond;
+   pthread_cond_t doneCond;
+   unsigned int serial;
+   bool shutdown;
+
+   /*
+    * Current job.
+    */
+   VMCPUTaskFunc func;
+   void *data;
+   unsigned int grain;
+   unsigned int remaining;
+};
+
+static bool VMCPUDeque_Push(VMCPUDeque *deque, VMCPURange range) {
+   bool ret = false;
+
+   pthread_mutex_lock(&deque->mutex);
+
+   if (deque->tail - deque->head < VMCPU_DEQUE_SIZE) {
+      deque->ranges[deque->tail % VMCPU_DEQUE_SIZE] = range;
+      deque->tail++;
+      ret = true;
+   }
+
+   pthread_mutex_unlock(&deque->mutex);
+
+   return ret;
+}
+
+/*
+ * The owner pops the most recently pushed range.
+ */
+static bool VMCPUDeque_Pop(VMCPUDeque *deque, VMCPURange *range) {
+   bool ret = false;
+
+   pthread_mutex_lock(&deque->mutex);
+
+   if (deque->tail != deque->head) {
+      deque->tail--;
+      *range = deque->ranges[deque->tail % VMCPU_DEQUE_SIZE];
+      ret = true;
+   }
+
+   pthread_mutex_unlock(&deque->mutex);
+
+   return ret;
+}
+
+/*
+ * Thieves take the oldest range.
+ */
+static bool VMCPUDeque_Steal(VMCPUDeque *deque, VMCPURange *range) {
+   bool ret = false;
+
+   pthread_mutex_lock(&deque->mutex);
+
+   if (deque->tail != deque->head) {
+      *range = deque->ranges[deque->head % VMCPU_DEQUE_SIZE];
+      deque->head++;
+      ret = true;
+   }
+
+   pthread_mutex_unlock(&deque->mutex);
+
+   return ret;
+}
+
+static bool VMCPUPool_Acquire(VMCPUPool *pool, unsigned int self,
+                              VMCPURange *range) {
+   unsigned int i;
+
+   if (VMCPUDeque_Pop(&pool->deques[self], range)) {
+      return true;
+   }
+
+   for (i = 1; i < pool->numWorkers; i++) {
+      unsigned int victim = (self + i) % pool->numWorkers;
+
+      if (VMCPUDeque_Steal(&pool->deques[victim], range)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void VMCPUPool_Work(VMCPUPool *pool, unsigned int self) {
+   VMCPURange range;
+
+   while (VMCPUPool_Acquire(pool, self, &range)) {
+      /*
+       * Leave the upper halves for thieves, the deque being full simply
+       * coarsens the range executed.
+       */
+      while (range.end - range.begin > pool->grain) {
+         VMCPURange upper;
+
+         upper.begin = range.begin + (range.end - range.begin) / 2;
+         upper.end = range.end;
+
+         if (!VMCPUDeque_Push(&pool->deques[self], upper)) {
+            break;
+         }
+
+         range.end = upper.begin;
+      }
+
+      pool->func(pool->data, range.begin, range.end);
+
+      pthread_mutex_lock(&pool->mutex);
+
+      assert(pool->remaining >= range.end - range.begin);
+
+      pool->remaining -= range.end - range.begin;
+
+      if (pool->remaining == 0) {
+         pthread_cond_broadcast(&pool->doneCond);
+      }
+
+      pthread_mutex_unlock(&pool->mutex);
+   }
+}
+
+static void *VMCPUPool_Worker(void *arg) {
+   VMCPUWorker *worker = (VMCPUWorker *)arg;
+   VMCPUPool *pool = worker->pool;
+   unsigned int serial = 0;
+
+   for (;;) {
+      pthread_mutex_lock(&pool->mutex);
+
+      while (!pool->shutdown && (pool->serial == serial)) {
+         pthread_cond_wait(&pool->workCond, &pool->mutex);
+      }
+
+      if (pool->shutdown) {
+         pthread_mutex_unlock(&pool->mutex);
+         break;
+      }
+
+      serial = pool->serial;
+
+      pthread_mutex_unlock(&pool->mutex);
+
+      VMCPUPool_Work(pool, worker->index);
+   }
+
+   return NULL;
+}
+
+VMCPUPool *VMCPUPool_Create(unsigned int numWorkers) {
+   VMCPUPool *pool;
+   unsigned int i;
+
+   assert(numWorkers > 0);
+
+   pool = calloc(1, sizeof(VMCPUPool));
+
+   if (pool == NULL) {
+      return NULL;
+   }
+
+   pool->workers = calloc(numWorkers, sizeof(VMCPUWorker));
+   pool->deques = calloc(numWorkers, sizeof(VMCPUDeque));
+
+   if ((pool->workers == NULL) || (pool->deques == NULL)) {
+      free(pool->workers);
+      free(pool->deques);
+      free(pool);
+      return NULL;
+   }
+
+   pthread_mutex_init(&pool->runMutex, NULL);
+   pthread_mutex_init(&pool->mutex, NULL);
+   pthread_cond_init(&pool->workCond, NULL);
+   pthread_cond_init(&pool->doneCond, NULL);
+
+   for (i = 0; i < numWorkers; i++) {
+      pthread_mutex_init(&pool->deques[i].mutex, NULL);
+   }
+
+   for (i = 0; i < numWorkers; i++) {
+      pool->workers[i].pool = pool;
+      pool->workers[i].index = i;
+
+      if (pthread_create(&pool->workers[i].thread, NULL, VMCPUPool_Worker,
+                         &pool->workers[i]) != 0) {
+         VMACCEL_WARNING("%s: Unable to create worker %d\n", __FUNCTION__, i);
+         break;
+      }
+   }
+
+   pool->numWorkers = i;
+
+   if (pool->numWorkers == 0) {
+      VMCPUPool_Destroy(pool);
+      return NULL;
+   }
+
+   return pool;
+}
+
+void VMCPUPool_Destroy(VMCPUPool *pool) {
+   unsigned int i;
+
+   if (pool == NULL) {
+      return;
+   }
+
+   pthread_mutex_lock(&pool->mutex);
+   pool->shutdown = true;
+   pthread_cond_broadcast(&pool->workCond);
+   pthread_mutex_unlock(&pool->mutex);
+
+   for (i = 0; i < pool->numWorkers; i++) {
+      pthread_join(pool->workers[i].thread, NULL);
+   }
+
+   for (i = 0; i < pool->numWorkers; i++) {
+      pthread_mutex_destroy(&pool->deques[i].mutex);
+   }
+
+   pthread_cond_destroy(&pool->doneCond);
+   pthread_cond_destroy(&pool->workCond);
+   pthread_mutex_destroy(&pool->mutex);
+   pthread_mutex_destroy(&pool->runMutex);
+
+   free(pool->deques);
+   free(pool->workers);
+   free(pool);
+}
+
+unsigned int VMCPUPool_NumWorkers(VMCPUPool *pool) {
+   return pool->numWorkers;
+}
+
+/*
+ * VMCPUPool_Run
+ *
+ * Executes func over the task indices [0, count) and returns once all the
+ * tasks have completed.
+ */
+void VMCPUPool_Run(VMCPUPool *pool, VMCPUTaskFunc func, void *data,
+                   unsigned int count, unsigned int grain) {
+   unsigned int chunk;
+   unsigned int i;
+
+   if (count == 0) {
+      return;
+   }
+
+   pthread_mutex_lock(&pool->runMutex);
+
+   pthread_mutex_lock(&pool->mutex);
+
+   pool->func = func;
+   pool->data = data;
+   pool->grain = (grain > 0) ? grain : 1;
+   pool->remaining = count;
+
+   /*
+    * Seed each worker with an even share of the range.
+    */
+   chunk = (count + pool->numWorkers - 1) / pool->numWorkers;
+
+   for (i = 0; i < pool->numWorkers; i++) {
+      VMCPURange range;
+
+      range.begin = i * chunk;
+      range.end = (i + 1) * chunk;
+
+      if (range.begin >= count) {
+         break;
+      }
+
+      if (range.end > count) {
+         range.end = count;
+      }
+
+      VMCPUDeque_Push(&pool->deques[i], range);
+   }
+
+   pool->serial++;
+   pthread_cond_broadcast(&pool->workCond);
+
+   while (pool->remaining > 0) {
+      pthread_cond_wait(&pool->doneCond, &pool->mutex);
+   }
+
+   pthread_mutex_unlock(&pool->mutex);
+
+   pthread_mutex_unlock(&pool->runMutex);
+}
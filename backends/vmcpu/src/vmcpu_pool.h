@@ -0,0 +1,53 @@
+/******************************************************************************
+
+Copyright (c) 2022 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#ifndef _VMCPU_POOL_H_
+#define _VMCPU_POOL_H_ 1
+
+#include <stdbool.h>
+
+/*
+ * Work-stealing thread pool.
+ *
+ * A job is a range of task indices, each worker owns a deque of sub-ranges
+ * and splits the range it is executing in half until it reaches the grain
+ * size, pushing the upper halves onto its deque. Idle workers steal the
+ * oldest, and therefore largest, sub-range from the other workers.
+ */
+typedef void (*VMCPUTaskFunc)(void *data, unsigned int begin,
+                              unsigned int end);
+
+typedef struct VMCPUPool VMCPUPool;
+
+VMCPUPool *VMCPUPool_Create(unsigned int numWorkers);
+void VMCPUPool_Destroy(VMCPUPool *pool);
+unsigned int VMCPUPool_NumWorkers(VMCPUPool *pool);
+void VMCPUPool_Run(VMCPUPool *pool, VMCPUTaskFunc func, void *data,
+                   unsigned int count, unsigned int grain);
+
+#endif /* _VMCPU_POOL_H_ */
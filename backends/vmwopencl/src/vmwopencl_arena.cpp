@@ -0,0 +1,147 @@
+/******************************************************************************
+
+Copyright (c) 2016-2019 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+/*
+ * vmwopencl_arena.cpp
+ *
+ * Range placement for surfaces sub-allocated from a per-context arena. The
+ * arena itself is a single cl_mem owned by the backend, this module only
+ * tracks which ranges are in use.
+ */
+
+extern "C" {
+#include "vmcl_defs.h"
+#include "vmwopencl_arena.h"
+}
+
+#include <pthread.h>
+
+#include "vmaccel_allocator.hpp"
+#include "vmaccel_types_allocrange.hpp"
+
+#include "log_level.h"
+
+/*
+ * Each context registers a single range with its own allocator, placement
+ * never crosses contexts.
+ */
+static VMAccelAllocator<AllocRange, AllocRangeCmp> *arenas[VMCL_MAX_CONTEXTS];
+static VMAccelId arenaIds[VMCL_MAX_CONTEXTS];
+static pthread_mutex_t arenaMutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool VMWOpenCLArena_Register(unsigned int cid, size_t size) {
+   VMAccelAllocateStatus *result;
+   AllocRange range;
+
+   assert(cid < VMCL_MAX_CONTEXTS);
+
+   memset(&range, 0, sizeof(range));
+   range.size = size;
+   range.begin = 0;
+   range.end = size - 1;
+
+   pthread_mutex_lock(&arenaMutex);
+
+   assert(arenas[cid] == NULL);
+
+   arenas[cid] = new VMAccelAllocator<AllocRange, AllocRangeCmp>(
+      VMCL_MAX_SURFACES * VMACCEL_MAX_SURFACE_INSTANCE);
+
+   result = arenas[cid]->Register(&range);
+
+   if (result->status != VMACCEL_SUCCESS) {
+      delete arenas[cid];
+      arenas[cid] = NULL;
+      pthread_mutex_unlock(&arenaMutex);
+      return false;
+   }
+
+   arenaIds[cid] = result->id;
+
+   pthread_mutex_unlock(&arenaMutex);
+
+   return true;
+}
+
+void VMWOpenCLArena_Unregister(unsigned int cid) {
+   pthread_mutex_lock(&arenaMutex);
+
+   if (arenas[cid] != NULL) {
+      if (arenas[cid]->Unregister(arenaIds[cid])->status != VMACCEL_SUCCESS) {
+         VMACCEL_WARNING("%s: Arena for context %d still has active ranges\n",
+                         __FUNCTION__, cid);
+      }
+
+      delete arenas[cid];
+      arenas[cid] = NULL;
+   }
+
+   pthread_mutex_unlock(&arenaMutex);
+}
+
+bool VMWOpenCLArena_Alloc(unsigned int cid, size_t size, VMAccelId *rangeId,
+                          size_t *offset) {
+   VMAccelAllocateStatus *result;
+   AllocRange req;
+   AllocRange range;
+
+   memset(&req, 0, sizeof(req));
+   memset(&range, 0, sizeof(range));
+   req.size = size;
+
+   pthread_mutex_lock(&arenaMutex);
+
+   if (arenas[cid] == NULL) {
+      pthread_mutex_unlock(&arenaMutex);
+      return false;
+   }
+
+   result = arenas[cid]->Alloc(arenaIds[cid], &req, range);
+
+   if (result->status != VMACCEL_SUCCESS) {
+      pthread_mutex_unlock(&arenaMutex);
+      return false;
+   }
+
+   *rangeId = result->id;
+   *offset = range.begin;
+
+   pthread_mutex_unlock(&arenaMutex);
+
+   return true;
+}
+
+void VMWOpenCLArena_Free(unsigned int cid, VMAccelId rangeId) {
+   pthread_mutex_lock(&arenaMutex);
+
+   if (arenas[cid] != NULL) {
+      arenas[cid]->Free(rangeId);
+   }
+
+   pthread_mutex_unlock(&arenaMutex);
+}
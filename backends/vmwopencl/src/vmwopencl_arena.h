@@ -0,0 +1,55 @@
+/******************************************************************************
+
+Copyright (c) 2016-2019 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#ifndef _VMWOPENCL_ARENA_H_
+#define _VMWOPENCL_ARENA_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vmaccel_rpc.h"
+
+/*
+ * Placement of sub-allocated surfaces within the per-context arena, see
+ * vmwopencl_arena.cpp.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool VMWOpenCLArena_Register(unsigned int cid, size_t size);
+void VMWOpenCLArena_Unregister(unsigned int cid);
+bool VMWOpenCLArena_Alloc(unsigned int cid, size_t size, VMAccelId *rangeId,
+                          size_t *offset);
+void VMWOpenCLArena_Free(unsigned int cid, VMAccelId rangeId);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VMWOPENCL_ARENA_H_ */
@@ -27,12 +27,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "vmaccel_stream.h"
 #include "vmaccel_utils.h"
 #include "vmwopencl.h"
+#include "vmwopencl_arena.h"
 #include "vmwopencl_utils.h"
 
 typedef struct VMWOpenCLCaps {
@@ -45,53 +53,177 @@ typedef struct VMWOpenCLCaps {
    size_t *DEVICE_MAX_WORK_ITEM_SIZES;
 } VMWOpenCLCaps;
 
+/*
+ * Device powered on by vmwopencl_poweron, the index of the device in the
+ * backend is returned as the identifier of the allocation status.
+ */
+typedef struct VMWOpenCLDevice {
+   unsigned int accelArch;
+   cl_platform_id platformId;
+   /*
+    * Index of the device among the platform's devices of the same type.
+    */
+   unsigned int platformIndex;
+   VMWOpenCLCaps caps;
+} VMWOpenCLDevice;
+
+#if ENABLE_VMCL_STAGING_POOL
+/*
+ * Pinned host buffer image transfers are staged through, mapped for the
+ * lifetime of the buffer.
+ */
+typedef struct VMWOpenCLStaging {
+   cl_mem mem;
+   void *ptr;
+   size_t size;
+   /*
+    * Acquired by a transfer being enqueued.
+    */
+   bool busy;
+   /*
+    * Last transfer through the buffer, the buffer is idle once it completes.
+    */
+   cl_event event;
+} VMWOpenCLStaging;
+#endif
+
 typedef struct VMWOpenCLContext {
    cl_context context;
    cl_platform_id platformId;
+   /*
+    * Backend device the context was placed on, sub-devices follow it.
+    */
+   unsigned int device;
+   unsigned int numSubDevices;
    cl_device_id deviceIds[VMCL_MAX_SUBDEVICES];
    int majorVersion;
    int minorVersion;
    VMWOpenCLCaps *caps;
+   /*
+    * Slab small buffer surfaces are sub-allocated from, allocated on demand.
+    */
+   cl_mem arena;
+#if ENABLE_VMCL_STAGING_POOL
+   VMWOpenCLStaging staging[VMCL_STAGING_POOL_SIZE];
+#endif
 } VMWOpenCLContext;
 
 typedef struct VMWOpenCLMapping {
    void *ptr;
    unsigned int refCount;
+   unsigned int generation;
+   bool write;
+   /*
+    * Images are mapped through a tightly packed copy of the mapped region.
+    */
+   VMAccelSurfaceRegion region;
 } VMWOpenCLMapping;
 
 typedef struct VMWOpenCLSurfaceInstance {
    cl_mem mem;
    void *svm_ptr;
+   /*
+    * Memory of a local client the buffer was created on, if any.
+    */
+   void *host_ptr;
    unsigned int generation;
+   /*
+    * Last command referencing the instance, used to determine if the
+    * instance can be renamed to a new generation.
+    */
+   cl_event event;
    VMWOpenCLMapping mapping;
+   /*
+    * Range of the context's arena backing the instance, if any.
+    */
+   bool arena;
+   VMAccelId rangeId;
+   /*
+    * Unique for each allocation, see VMWOpenCLKernel.boundArgs.
+    */
+   uint64_t bindId;
    pthread_mutex_t mutex;
 } VMWOpenCLSurfaceInstance;
 
+/*
+ * Surfaces are backed by a ring of instances. A write-discard update to a
+ * new generation is renamed to an idle instance, leaving the instance that
+ * holds the previous generation to in-flight commands. Instances beyond the
+ * first are allocated on demand.
+ */
 typedef struct VMWOpenCLSurface {
    unsigned int cid;
    VMAccelSurfaceDesc desc;
+   unsigned int latest;
    VMWOpenCLSurfaceInstance inst[VMACCEL_MAX_SURFACE_INSTANCE];
    pthread_mutex_t mutex;
 } VMWOpenCLSurface;
 
 typedef struct VMWOpenCLQueue {
+   unsigned int cid;
+   unsigned int subDevice;
    VMAccelQueueDesc desc;
    cl_command_queue queue;
+   /*
+    * Most recent command of each class, retained for profiling queues.
+    */
+   bool profiling;
+   cl_event profile[VMCL_PROFILE_MAX];
 } VMWOpenCLQueue;
 
 typedef struct VMWOpenCLSampler {
+   unsigned int cid;
+   VMCLSamplerDesc desc;
    cl_sampler sampler;
 } VMWOpenCLSampler;
 
+/*
+ * Programs are shared by all kernels allocated from the same source for a
+ * given context and device, and released with the last kernel. The source
+ * is kept to confirm a match by key, restored programs have none.
+ */
+typedef struct VMWOpenCLProgram {
+   unsigned int cid;
+   cl_device_id deviceId;
+   uint64_t key;
+   char *source;
+   size_t sourceLen;
+   cl_program program;
+   unsigned int refCount;
+} VMWOpenCLProgram;
+
+/*
+ * Arguments beyond the tracked range are set on every dispatch.
+ */
+#define VMWOPENCL_MAX_BOUND_ARGS 32
+
+/*
+ * Wait lists of dispatches with up to this many arguments are kept on the
+ * stack, larger wait lists are allocated per dispatch.
+ */
+#define VMWOPENCL_DISPATCH_WAIT_EVENTS 32
+
 typedef struct VMWOpenCLKernel {
+   unsigned int pid;
+   char *name;
+   cl_kernel unbound;
    /*
-    * ???: Does one program per kernel affect variable sharing?
+    * Kernel objects are handed out per queue, argument state set for a
+    * dispatch can't be clobbered by a concurrent dispatch on another queue.
     */
-   cl_program program;
-   cl_kernel kernel;
+   cl_kernel kernel[VMCL_MAX_QUEUES];
+   /*
+    * Binding identifiers of the surface instances last set to the arguments
+    * of each per queue kernel object, unchanged arguments are not set again
+    * by a dispatch. Identifiers are used rather than the memory objects, as
+    * the handle of a freed object may be reused by the driver. Zero denotes
+    * an argument that must be set.
+    */
+   uint64_t boundArgs[VMCL_MAX_QUEUES][VMWOPENCL_MAX_BOUND_ARGS];
 } VMWOpenCLKernel;
 
-static VMWOpenCLCaps caps[VMACCEL_SELECT_MAX];
+static VMWOpenCLDevice devices[VMCL_MAX_DEVICES];
+static unsigned int numDevices = 0;
 
 static VMWOpenCLContext *contexts = NULL;
 static IdentifierDB *contextIds = NULL;
@@ -101,13 +233,42 @@ static IdentifierDB *surfaceIds = NULL;
 
 static VMWOpenCLQueue *queues = NULL;
 static IdentifierDB *queueIds = NULL;
+static pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static VMWOpenCLSampler *samplers = NULL;
 static IdentifierDB *samplerIds = NULL;
 
+static VMWOpenCLProgram programs[VMCL_MAX_KERNELS];
+static pthread_mutex_t programMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static VMWOpenCLKernel *kernels = NULL;
 static IdentifierDB *kernelIds = NULL;
 
+static uint64_t nextBindId = 1;
+static pthread_mutex_t bindIdMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#if ENABLE_VMCL_SURFACE_ARENA
+/*
+ * Arena ranges of freed instances are recycled once the last command
+ * referencing the instance retires.
+ */
+typedef struct VMWOpenCLArenaRetire {
+   unsigned int cid;
+   VMAccelId rangeId;
+   cl_event event;
+} VMWOpenCLArenaRetire;
+
+#define VMWOPENCL_MAX_RETIRE (VMCL_MAX_SURFACES * VMACCEL_MAX_SURFACE_INSTANCE)
+
+static VMWOpenCLArenaRetire retiring[VMWOPENCL_MAX_RETIRE];
+static unsigned int numRetiring = 0;
+static pthread_mutex_t retireMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#if ENABLE_VMCL_STAGING_POOL
+static pthread_mutex_t stagingMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 const cl_int clDeviceTypes[VMACCEL_SELECT_MAX] = {
    CL_DEVICE_TYPE_GPU,
    CL_DEVICE_TYPE_ACCELERATOR,
@@ -119,1599 +280,4779 @@ VMAccelStatus *vmwopencl_poweroff();
 VMAccelSurfaceMapStatus *vmwopencl_surfacemap_1(VMCLSurfaceMapOp *argp);
 VMAccelStatus *vmwopencl_surfaceunmap_1(VMCLSurfaceUnmapOp *argp);
 
-VMAccelAllocateStatus *vmwopencl_poweron(VMCLOps *ops, unsigned int accelArch,
-                                         unsigned int accelIndex,
-                                         unsigned int useDataStreaming) {
-   static VMAccelAllocateStatus result;
-   size_t sizeRet;
-   cl_platform_id platforms[16];
-   cl_uint numPlatforms = 0;
-   cl_int errNum = CL_SUCCESS;
-   char platformName[128] = {'\0'};
-   char platformVendor[128] = {'\0'};
-   char platformVersion[128] = {'\0'};
-   char platformExtensions[128] = {'\0'};
-   char deviceName[128];
-   char prefix[64];
-   char capPrefix[128];
-   cl_device_id deviceId;
-   int i, j;
-   bool platformFound = false;
+static cl_mem_flags VMWOpenCLSurface_MemFlags(const VMAccelSurfaceDesc *desc) {
+   cl_mem_flags clMemFlags = 0;
 
-   memset(&result, 0, sizeof(result));
+   if (desc->usage == VMACCEL_SURFACE_USAGE_READONLY) {
+      clMemFlags |= CL_MEM_READ_ONLY;
+   } else if (desc->usage == VMACCEL_SURFACE_USAGE_WRITEONLY) {
+      clMemFlags |= CL_MEM_WRITE_ONLY;
+   } else if (desc->usage == VMACCEL_SURFACE_USAGE_READWRITE) {
+      clMemFlags |= CL_MEM_READ_WRITE;
+   }
 
-   VMACCEL_LOG("Powering on vmwopencl backend...\n");
+   return clMemFlags;
+}
 
-   errNum = clGetPlatformIDs(sizeof(platforms) / sizeof(platforms[0]),
-                             &platforms[0], &numPlatforms);
+/*
+ * VMWOpenCLSurface_ImageFormat
+ *
+ * Translates a surface format to an OpenCL image format. Three component
+ * formats have no OpenCL equivalent outside of packed channel types.
+ */
+#define VMWOPENCL_IMAGE_FORMAT(_FMT, _ORDER, _TYPE)                            \
+   case VMACCEL_FORMAT_##_FMT:                                                 \
+      imgFormat->image_channel_order = _ORDER;                                 \
+      imgFormat->image_channel_data_type = _TYPE;                              \
+      return true;
+
+#define VMWOPENCL_IMAGE_FORMATS(_ORDER, _F8, _F16, _F32)                       \
+   VMWOPENCL_IMAGE_FORMAT(_F8##_UNORM, _ORDER, CL_UNORM_INT8)                  \
+   VMWOPENCL_IMAGE_FORMAT(_F8##_SNORM, _ORDER, CL_SNORM_INT8)                  \
+   VMWOPENCL_IMAGE_FORMAT(_F8##_UINT, _ORDER, CL_UNSIGNED_INT8)                \
+   VMWOPENCL_IMAGE_FORMAT(_F8##_SINT, _ORDER, CL_SIGNED_INT8)                  \
+   VMWOPENCL_IMAGE_FORMAT(_F8##_TYPELESS, _ORDER, CL_UNSIGNED_INT8)            \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_UNORM, _ORDER, CL_UNORM_INT16)                \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_SNORM, _ORDER, CL_SNORM_INT16)                \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_UINT, _ORDER, CL_UNSIGNED_INT16)              \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_SINT, _ORDER, CL_SIGNED_INT16)                \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_HALFFLOAT, _ORDER, CL_HALF_FLOAT)             \
+   VMWOPENCL_IMAGE_FORMAT(_F16##_TYPELESS, _ORDER, CL_UNSIGNED_INT16)          \
+   VMWOPENCL_IMAGE_FORMAT(_F32##_UINT, _ORDER, CL_UNSIGNED_INT32)              \
+   VMWOPENCL_IMAGE_FORMAT(_F32##_SINT, _ORDER, CL_SIGNED_INT32)                \
+   VMWOPENCL_IMAGE_FORMAT(_F32##_FLOAT, _ORDER, CL_FLOAT)                      \
+   VMWOPENCL_IMAGE_FORMAT(_F32##_TYPELESS, _ORDER, CL_UNSIGNED_INT32)
+
+static bool VMWOpenCLSurface_ImageFormat(VMAccelSurfaceFormat format,
+                                         cl_image_format *imgFormat) {
+   switch (format) {
+      VMWOPENCL_IMAGE_FORMATS(CL_R, R8, R16, R32)
+      VMWOPENCL_IMAGE_FORMATS(CL_RG, R8G8, R16G16, R32G32)
+      VMWOPENCL_IMAGE_FORMATS(CL_RGBA, R8G8B8A8, R16G16B16A16, R32G32B32A32)
+#if CL_VERSION_2_0
+      VMWOPENCL_IMAGE_FORMAT(R8G8B8A8_SRGB, CL_sRGBA, CL_UNORM_INT8)
+#endif
+   default:
+      return false;
+   }
+}
 
-   if (errNum != CL_SUCCESS) {
-      VMACCEL_WARNING("Failed to query platforms\n");
-      result.status = VMACCEL_FAIL;
-      return (&result);
+#undef VMWOPENCL_IMAGE_FORMATS
+#undef VMWOPENCL_IMAGE_FORMAT
+
+/*
+ * Integer image formats are filled with integer values, the remaining
+ * formats with floating point values.
+ */
+static bool VMWOpenCLSurface_IsIntegerImage(VMAccelSurfaceFormat format) {
+   cl_image_format imgFormat;
+
+   if (!VMWOpenCLSurface_ImageFormat(format, &imgFormat)) {
+      return false;
    }
 
-   VMACCEL_LOG("Number of platforms: %d\n", numPlatforms);
+   switch (imgFormat.image_channel_data_type) {
+   case CL_UNSIGNED_INT8:
+   case CL_UNSIGNED_INT16:
+   case CL_UNSIGNED_INT32:
+   case CL_SIGNED_INT8:
+   case CL_SIGNED_INT16:
+   case CL_SIGNED_INT32:
+      return true;
+   default:
+      return false;
+   }
+}
 
-   for (i = 0; i < numPlatforms; i++) {
-      errNum = clGetDeviceIDs(platforms[i], clDeviceTypes[accelArch], 1,
-                              &deviceId, NULL);
+#if ENABLE_VMCL_SURFACE_ARENA
+/*
+ * VMWOpenCLArena_Sweep
+ *
+ * Recycles the retired ranges of a context whose commands have completed,
+ * optionally waiting for the outstanding commands. Waits happen outside of
+ * the retire lock so other contexts can keep allocating.
+ */
+static void VMWOpenCLArena_Sweep(unsigned int cid, bool wait) {
+   unsigned int i = 0;
 
-      if (errNum != CL_SUCCESS) {
-         continue;
-      }
+   pthread_mutex_lock(&retireMutex);
 
-      errNum =
-         clGetPlatformInfo(platforms[i], CL_PLATFORM_VERSION,
-                           sizeof(platformVersion), platformVersion, &sizeRet);
+   while (i < numRetiring) {
+      VMWOpenCLArenaRetire entry;
+      cl_int status = CL_COMPLETE;
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform version\n");
-         result.status = VMACCEL_FAIL;
-         return (&result);
+      if (retiring[i].cid != cid) {
+         i++;
+         continue;
       }
 
-      VMACCEL_LOG("Version: %s\n", platformVersion);
-
-      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME,
-                                 sizeof(platformName), platformName, &sizeRet);
+      if (clGetEventInfo(retiring[i].event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                         sizeof(status), &status, NULL) != CL_SUCCESS) {
+         status = CL_COMPLETE;
+      }
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform name\n");
-         result.status = VMACCEL_FAIL;
-         return (&result);
+      if ((status != CL_COMPLETE) && !wait) {
+         i++;
+         continue;
       }
 
-      VMACCEL_LOG("Platform: %s\n", platformName);
+      entry = retiring[i];
+      retiring[i] = retiring[--numRetiring];
 
-      errNum =
-         clGetPlatformInfo(platforms[i], CL_PLATFORM_VENDOR,
-                           sizeof(platformVendor), platformVendor, &sizeRet);
+      if (status != CL_COMPLETE) {
+         pthread_mutex_unlock(&retireMutex);
+         clWaitForEvents(1, &entry.event);
+         pthread_mutex_lock(&retireMutex);
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform vendor\n");
-         result.status = VMACCEL_FAIL;
-         return (&result);
+         /*
+          * The list may have been compacted while unlocked, rescan it.
+          */
+         i = 0;
       }
 
-      VMACCEL_LOG("Vendor: %s\n", platformVendor);
+      VMWOpenCLArena_Free(cid, entry.rangeId);
+      clReleaseEvent(entry.event);
+   }
 
-      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_EXTENSIONS,
-                                 sizeof(platformExtensions), platformExtensions,
-                                 &sizeRet);
+   pthread_mutex_unlock(&retireMutex);
+}
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform extensions\n");
-      }
+/*
+ * VMWOpenCLArena_Retire
+ *
+ * Defers recycling a range until the event retires. When the retire list is
+ * full the oldest entry is evicted and waited upon outside of the lock.
+ */
+static void VMWOpenCLArena_Retire(unsigned int cid, VMAccelId rangeId,
+                                  cl_event event) {
+   VMWOpenCLArenaRetire evicted;
+   bool evict = false;
+
+   if (event == NULL) {
+      VMWOpenCLArena_Free(cid, rangeId);
+      return;
+   }
 
-      VMACCEL_LOG("Extensions: %s\n", platformExtensions);
+   clRetainEvent(event);
 
-      caps[accelArch].deviceId = deviceId;
+   pthread_mutex_lock(&retireMutex);
 
-      errNum = clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(deviceName),
-                               deviceName, &sizeRet);
+   if (numRetiring == VMWOPENCL_MAX_RETIRE) {
+      evicted = retiring[0];
+      retiring[0] = retiring[--numRetiring];
+      evict = true;
+   }
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Unable to query CL_DEVICE_NAME\n");
-         continue;
-      }
+   retiring[numRetiring].cid = cid;
+   retiring[numRetiring].rangeId = rangeId;
+   retiring[numRetiring].event = event;
+   numRetiring++;
 
-      snprintf(prefix, sizeof(prefix), "Device[%p]", deviceId);
+   pthread_mutex_unlock(&retireMutex);
 
-      VMACCEL_LOG("%s: DEVICE_NAME = %s\n", prefix, deviceName);
+   if (evict) {
+      clWaitForEvents(1, &evicted.event);
+      VMWOpenCLArena_Free(evicted.cid, evicted.rangeId);
+      clReleaseEvent(evicted.event);
+   }
+}
 
-#define CAP(__TYPE, __NAME)                                                    \
-   do {                                                                        \
-      __TYPE val;                                                              \
-      errNum = clGetDeviceInfo(deviceId, CL_##__NAME, sizeof(__TYPE), &val,    \
-                               &sizeRet);                                      \
-      if (errNum != CL_SUCCESS) {                                              \
-         VMACCEL_WARNING("Unable to query %s\n", "CL_" #__NAME);               \
-      } else {                                                                 \
-         snprintf(capPrefix, sizeof(capPrefix), "%s: %s", prefix, #__NAME);    \
-         Log_##__TYPE(capPrefix, val);                                         \
-         caps[accelArch].__NAME = val;                                         \
-      }                                                                        \
-   } while (0);
-#include "vmwopencl_caps.h"
-#undef CAP
+/*
+ * VMWOpenCLSurface_AllocArenaInstance
+ *
+ * Sub-allocates a buffer instance from the context's arena.
+ */
+static int
+VMWOpenCLSurface_AllocArenaInstance(unsigned int cid,
+                                    const VMAccelSurfaceDesc *desc,
+                                    VMWOpenCLSurfaceInstance *inst) {
+   size_t align = MAX(contexts[cid].caps->DEVICE_MEM_BASE_ADDR_ALIGN / 8, 1);
+   size_t size = ((desc->width + align - 1) / align) * align;
+   cl_buffer_region region;
+   VMAccelId rangeId;
+   size_t offset;
+   cl_int errNum;
 
-      caps[accelArch].DEVICE_MAX_WORK_ITEM_SIZES = calloc(
-         caps[accelArch].DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(size_t));
+   if ((desc->width == 0) || (size > VMCL_SURFACE_ARENA_MAX_ALLOC_SIZE)) {
+      return VMACCEL_FAIL;
+   }
 
-      errNum = clGetDeviceInfo(
-         deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES,
-         caps[accelArch].DEVICE_MAX_WORK_ITEM_DIMENSIONS * sizeof(size_t),
-         caps[accelArch].DEVICE_MAX_WORK_ITEM_SIZES, &sizeRet);
+   pthread_mutex_lock(&retireMutex);
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Unable to query CL_DEVICE_MAX_WORK_ITEM_SIZES\n");
-         continue;
-      } else {
-         for (j = 0; j < caps[accelArch].DEVICE_MAX_WORK_ITEM_DIMENSIONS; j++) {
-            snprintf(capPrefix, sizeof(capPrefix),
-                     "%s: DEVICE_MAX_WORK_ITEM_SIZES[%d]", prefix, j);
-            Log_size_t(capPrefix,
-                       caps[accelArch].DEVICE_MAX_WORK_ITEM_SIZES[j]);
-         }
-      }
+   if (contexts[cid].arena == NULL) {
+      contexts[cid].arena =
+         clCreateBuffer(contexts[cid].context, CL_MEM_READ_WRITE,
+                        VMCL_SURFACE_ARENA_SIZE, NULL, &errNum);
 
-      /*
-       * Report back first platform found.
-       */
-      platformFound = true;
-      break;
+      if ((contexts[cid].arena != NULL) &&
+          !VMWOpenCLArena_Register(cid, VMCL_SURFACE_ARENA_SIZE)) {
+         clReleaseMemObject(contexts[cid].arena);
+         contexts[cid].arena = NULL;
+      }
    }
 
-   if (!platformFound) {
-      result.status = VMACCEL_FAIL;
-      return &result;
+   pthread_mutex_unlock(&retireMutex);
+
+   if (contexts[cid].arena == NULL) {
+      return VMACCEL_FAIL;
    }
 
-   if ((strstr(platformVersion, "OpenCL 1.2") == NULL) &&
-       (strstr(platformVersion, "OpenCL 2.0") == NULL) &&
-       (strstr(platformVersion, "OpenCL 2.") == NULL) &&
-       (strstr(platformVersion, "OpenCL 3.") == NULL)) {
-      VMACCEL_WARNING("Unknown version detected: %s\n", platformVersion);
+   VMWOpenCLArena_Sweep(cid, false);
+
+   if (!VMWOpenCLArena_Alloc(cid, size, &rangeId, &offset)) {
+      return VMACCEL_FAIL;
    }
 
-   /*
-    * Derive VMAccelAllocateStatus from the OpenCL device.
-    *
-    * We have shown that when there is a contention for an Accelerator's
-    * local memory resource, the cost of paging out a resource and paging
-    * in new content for a resource is not only the transfer of the data.
-    * Since, a high level API interface can only enqueue paging operations,
-    * all previous operations must complete before paging can occur. If
-    * this ultimate blocks the backend, due to an operating system level
-    * response to a lack of physical memory to pin for the DMA operation,
-    * the backpressure is realized as "resource contention latency".
-    *
-    * The goal is to never over-commit the processor, but saturate it to
-    * ~99% usage and leave a portion of the processor time for management
-    * tasks. We achieve this by exporting the capabilities below to
-    * maintain a stable system.
-    */
-   result.desc.typeMask = VMACCEL_COMPUTE_ACCELERATOR_MASK;
-   result.desc.architecture = accelArch;
-   result.desc.caps = VMACCEL_SURFACEMAP;
+   region.origin = offset;
+   region.size = desc->width;
 
-   /*
-    * Format caps.
-    */
-   result.desc.formatCaps.formatCaps_len = 0;
-   result.desc.formatCaps.formatCaps_val = NULL;
+   inst->mem =
+      clCreateSubBuffer(contexts[cid].arena, VMWOpenCLSurface_MemFlags(desc),
+                        CL_BUFFER_CREATE_TYPE_REGION, &region, &errNum);
 
-   /*
-    * OpenCL work hierarchy:
-    *
-    * Work Group
-    * +-> Work Items(x, y, z, ...)
-    */
-   result.desc.capacity.megaFlops = caps[accelArch].DEVICE_MAX_COMPUTE_UNITS *
-                                    caps[accelArch].DEVICE_MAX_CLOCK_FREQUENCY;
+   if ((inst->mem == NULL) || (errNum != CL_SUCCESS)) {
+      VMWOpenCLArena_Free(cid, rangeId);
+      inst->mem = NULL;
+      return VMACCEL_FAIL;
+   }
 
-   result.desc.capacity.megaOps = result.desc.capacity.megaFlops;
+   inst->arena = true;
+   inst->rangeId = rangeId;
 
-   /*
-    * Cache capabilities.
-    */
-   result.desc.capacity.llcSizeKB =
-      caps[accelArch].DEVICE_GLOBAL_MEM_CACHE_SIZE / 1000;
-   result.desc.capacity.llcBandwidthMBSec =
-      result.desc.capacity.llcSizeKB *
-      (caps[accelArch].DEVICE_MAX_CLOCK_FREQUENCY / 1000);
+   return VMACCEL_SUCCESS;
+}
+#endif
+
+static int VMWOpenCLSurface_AllocStorage(unsigned int cid,
+                                         const VMAccelSurfaceDesc *desc,
+                                         void *hostPtr,
+                                         VMWOpenCLSurfaceInstance *inst) {
+   cl_context context = contexts[cid].context;
+   cl_mem_flags clMemFlags = VMWOpenCLSurface_MemFlags(desc);
 
    /*
-    * Local memory capabilities.
+    * Integrated and CPU devices access the memory of the client in place.
     */
-   result.desc.capacity.localMemSizeKB =
-      caps[accelArch].DEVICE_LOCAL_MEM_SIZE / 1000;
-
-   // TODO: Query clock/bus information for the MMU.
-   result.desc.capacity.localMemBandwidthMBSec = 0;
+   if ((hostPtr != NULL) && (desc->type == VMACCEL_SURFACE_BUFFER)) {
+      inst->mem = clCreateBuffer(context, clMemFlags | CL_MEM_USE_HOST_PTR,
+                                 desc->width, hostPtr, NULL);
+      inst->host_ptr = (inst->mem != NULL) ? hostPtr : NULL;
+      return (inst->mem != NULL) ? VMACCEL_SUCCESS : VMACCEL_FAIL;
+   }
 
+#if ENABLE_VMCL_SURFACE_ARENA
    /*
-    * Non-local memory capabilities.
+    * Small buffers are sub-allocated from the arena regardless of the pool,
+    * larger buffers fall through to SVM or a dedicated allocation.
     */
-   result.desc.capacity.nonLocalMemSizeKB =
-      caps[accelArch].DEVICE_GLOBAL_MEM_SIZE / 1000;
+   if ((desc->type == VMACCEL_SURFACE_BUFFER) &&
+       (VMWOpenCLSurface_AllocArenaInstance(cid, desc, inst) ==
+        VMACCEL_SUCCESS)) {
+      return VMACCEL_SUCCESS;
+   }
+#endif
 
-   // TODO: Query the clock/bus information for PCI-E or NUMA.
-   result.desc.capacity.nonLocalMemBandwidthMBSec = 0;
+#if CL_VERSION_2_0
+   if ((desc->type == VMACCEL_SURFACE_BUFFER) &&
+       (desc->pool == VMACCEL_SURFACE_POOL_SYSTEM_MEMORY) &&
+       (contexts[cid].majorVersion >= 2) && (contexts[cid].minorVersion >= 0)) {
+      inst->svm_ptr = clSVMAlloc(context, clMemFlags, desc->width, 0);
+      return (inst->svm_ptr != NULL) ? VMACCEL_SUCCESS : VMACCEL_FAIL;
+   } else
+#endif
+      if (desc->type == VMACCEL_SURFACE_BUFFER) {
+      assert(desc->format == VMACCEL_FORMAT_R8_TYPELESS);
 
-   /*
-    * Accelerator Interconnect capabilities.
-    *
-    * TODO: Query the clock/bus information for PCI-E or NUMA.
-    */
-   result.desc.capacity.interconnectBandwidthMBSec = 0;
+      inst->mem = clCreateBuffer(context, clMemFlags, desc->width, NULL, NULL);
+      return (inst->mem != NULL) ? VMACCEL_SUCCESS : VMACCEL_FAIL;
+   }
 
-   contexts = calloc(VMCL_MAX_CONTEXTS, sizeof(VMWOpenCLContext));
-   contextIds = IdentifierDB_Alloc(VMCL_MAX_CONTEXTS);
+   if (VMAccel_SurfaceIsImage(desc)) {
+      cl_image_format imgFormat;
+      cl_image_desc imgDesc;
 
-   surfaces = calloc(VMCL_MAX_SURFACES, sizeof(VMWOpenCLSurface));
-   surfaceIds = IdentifierDB_Alloc(VMCL_MAX_SURFACES);
+      if (!VMWOpenCLSurface_ImageFormat(desc->format, &imgFormat)) {
+         VMACCEL_WARNING("%s: Unsupported image format %d\n", __FUNCTION__,
+                         desc->format);
+         return VMACCEL_FAIL;
+      }
 
-   queues = calloc(VMCL_MAX_QUEUES, sizeof(VMWOpenCLQueue));
-   queueIds = IdentifierDB_Alloc(VMCL_MAX_QUEUES);
+      memset(&imgDesc, 0, sizeof(imgDesc));
+      imgDesc.image_width = desc->width;
 
-   samplers = calloc(VMCL_MAX_SAMPLERS, sizeof(VMWOpenCLSampler));
-   samplerIds = IdentifierDB_Alloc(VMCL_MAX_SAMPLERS);
+      if (desc->type == VMACCEL_SURFACE_1D_IMAGE) {
+         imgDesc.image_type = CL_MEM_OBJECT_IMAGE1D;
+      } else if (desc->type == VMACCEL_SURFACE_2D_IMAGE) {
+         imgDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
+         imgDesc.image_height = desc->height;
+      } else {
+         imgDesc.image_type = CL_MEM_OBJECT_IMAGE3D;
+         imgDesc.image_height = desc->height;
+         imgDesc.image_depth = desc->depth;
+      }
 
-   kernels = calloc(VMCL_MAX_KERNELS, sizeof(VMWOpenCLKernel));
-   kernelIds = IdentifierDB_Alloc(VMCL_MAX_KERNELS);
+      inst->mem =
+         clCreateImage(context, clMemFlags, &imgFormat, &imgDesc, NULL, NULL);
+      return (inst->mem != NULL) ? VMACCEL_SUCCESS : VMACCEL_FAIL;
+   }
 
-   /*
-    * Final check for allocation failure.
-    */
-   if ((contexts == NULL) || (contextIds == NULL) || (surfaces == NULL) ||
-       (surfaceIds == NULL) || (queues == NULL) || (queueIds == NULL) ||
-       (samplers == NULL) || (samplerIds == NULL) || (kernels == NULL) ||
-       (kernelIds == NULL)) {
-      VMACCEL_WARNING("Unable to allocate object database...\n");
-      result.status = VMACCEL_FAIL;
-      vmwopencl_poweroff();
-   } else {
-      result.status = VMACCEL_SUCCESS;
+   return VMACCEL_FAIL;
+}
+
+static int VMWOpenCLSurface_AllocInstance(unsigned int cid,
+                                          const VMAccelSurfaceDesc *desc,
+                                          void *hostPtr,
+                                          VMWOpenCLSurfaceInstance *inst) {
+   if (VMWOpenCLSurface_AllocStorage(cid, desc, hostPtr, inst) !=
+       VMACCEL_SUCCESS) {
+      return VMACCEL_FAIL;
    }
 
-   result.desc.maxContexts = VMCL_MAX_CONTEXTS;
-   result.desc.maxQueues = VMCL_MAX_QUEUES;
-   result.desc.maxSurfaces = VMCL_MAX_SURFACES;
-   result.desc.maxMappings = VMCL_MAX_SURFACES;
+   pthread_mutex_lock(&bindIdMutex);
+   inst->bindId = nextBindId++;
+   pthread_mutex_unlock(&bindIdMutex);
 
-#if ENABLE_DATA_STREAMING
-   if (useDataStreaming) {
-      VMAccelStreamCallbacks cb;
-      cb.clSurfacemap_1 = vmwopencl_surfacemap_1;
-      cb.clSurfaceunmap_1 = vmwopencl_surfaceunmap_1;
-      vmaccel_stream_server(VMACCEL_STREAM_TYPE_VMCL_UPLOAD,
-                            VMACCEL_VMCL_BASE_PORT, &cb);
+   return VMACCEL_SUCCESS;
+}
+
+static void VMWOpenCLSurface_FreeInstance(unsigned int cid,
+                                          VMWOpenCLSurfaceInstance *inst) {
+#if ENABLE_VMCL_SURFACE_ARENA
+   if (inst->arena) {
+      VMWOpenCLArena_Retire(cid, inst->rangeId, inst->event);
+      inst->arena = false;
    }
 #endif
 
-   return (&result);
+   if (inst->event != NULL) {
+      clReleaseEvent(inst->event);
+      inst->event = NULL;
+   }
+
+#if CL_VERSION_2_0
+   if (inst->svm_ptr != NULL) {
+      clSVMFree(contexts[cid].context, inst->svm_ptr);
+      inst->svm_ptr = NULL;
+   }
+#endif
+
+   if (inst->mem != NULL) {
+      clReleaseMemObject(inst->mem);
+      inst->mem = NULL;
+   }
+
+   inst->host_ptr = NULL;
 }
 
-VMAccelStatus *vmwopencl_poweroff() {
-   static VMAccelStatus result;
-   int i;
+static bool VMWOpenCLSurface_IsAllocated(VMWOpenCLSurfaceInstance *inst) {
+   return (inst->mem != NULL) || (inst->svm_ptr != NULL);
+}
 
-   memset(&result, 0, sizeof(result));
+/*
+ * An instance is idle when it is not mapped and the last command
+ * referencing it has completed.
+ */
+static bool VMWOpenCLSurface_IsIdle(VMWOpenCLSurfaceInstance *inst) {
+   cl_int status = CL_COMPLETE;
+   cl_int errNum;
 
-   for (i = 0; i < VMACCEL_SELECT_MAX; i++) {
-      free(caps[i].DEVICE_MAX_WORK_ITEM_SIZES);
+   if (inst->mapping.refCount > 0) {
+      return false;
    }
 
-   memset(&caps, 0, sizeof(caps));
+   if (inst->event == NULL) {
+      return true;
+   }
 
-   IdentifierDB_Free(contextIds);
-   free(contexts);
+   errNum = clGetEventInfo(inst->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                           sizeof(status), &status, NULL);
 
-   IdentifierDB_Free(surfaceIds);
-   free(surfaces);
+   if ((errNum != CL_SUCCESS) || (status <= CL_COMPLETE)) {
+      clReleaseEvent(inst->event);
+      inst->event = NULL;
+      return true;
+   }
 
-   IdentifierDB_Free(queueIds);
-   free(queues);
+   return false;
+}
 
-   IdentifierDB_Free(samplerIds);
-   free(samplers);
+/*
+ * Records the last command referencing the instance.
+ */
+static void VMWOpenCLSurface_AttachEvent(VMWOpenCLSurfaceInstance *inst,
+                                         cl_event event) {
+   if (event == NULL) {
+      return;
+   }
 
-   IdentifierDB_Free(kernelIds);
-   free(kernels);
+   if (inst->event != NULL) {
+      clReleaseEvent(inst->event);
+   }
 
-   return (&result);
+   clRetainEvent(event);
+   inst->event = event;
 }
 
-VMCLContextAllocateStatus *
-vmwopencl_contextalloc_1(VMCLContextAllocateDesc *argp) {
-   unsigned int cid = argp->clientId;
-   static VMCLContextAllocateStatus result;
-   size_t sizeRet;
-   cl_uint numPlatforms;
-   cl_platform_id platforms[16];
-   cl_context context = NULL;
-   cl_device_id deviceIds[VMCL_MAX_SUBDEVICES] = {
-      0,
-   };
+/*
+ * VMWOpenCLSurface_WaitList
+ *
+ * Appends the last command referencing an instance to a wait list. Commands
+ * referencing a surface are ordered across the queues of a context, queues
+ * don't order commands with each other.
+ */
+static cl_uint VMWOpenCLSurface_WaitList(const VMWOpenCLSurfaceInstance *inst,
+                                         cl_event *waitList,
+                                         cl_uint numEvents) {
+   unsigned int i;
+
+   if (inst->event == NULL) {
+      return numEvents;
+   }
+
+   for (i = 0; i < numEvents; i++) {
+      if (waitList[i] == inst->event) {
+         return numEvents;
+      }
+   }
+
+   waitList[numEvents] = inst->event;
+
+   return numEvents + 1;
+}
+
+#if ENABLE_VMCL_STAGING_POOL
+/*
+ * VMWOpenCLStaging_IsIdle
+ *
+ * Must be called with stagingMutex held.
+ */
+static bool VMWOpenCLStaging_IsIdle(VMWOpenCLStaging *stg) {
+   cl_int status = CL_COMPLETE;
    cl_int errNum;
-   char platformName[128] = {'\0'};
-   char platformVersion[128] = {'\0'};
-   int majorVersion;
-   int minorVersion;
-   VMWOpenCLCaps *ctxCaps = NULL;
-   int i = 0, j = 0, k = 0;
 
-   memset(&result, 0, sizeof(result));
+   if (stg->busy) {
+      return false;
+   }
 
-   if (IdentifierDB_ActiveId(contextIds, cid)) {
-      VMACCEL_WARNING("%s: ERROR: Context ID %d already active...\n",
-                      __FUNCTION__, cid);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-      return (&result);
+   if (stg->event == NULL) {
+      return true;
    }
 
-   // First, select an OpenCL platform to run on.  For this example, we
-   // simply choose the first available platform.  Normally, you would
-   // query for all available platforms and select the most appropriate one.
-   errNum = clGetPlatformIDs(sizeof(platforms) / sizeof(platforms[0]),
-                             &platforms[0], &numPlatforms);
+   errNum = clGetEventInfo(stg->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                           sizeof(status), &status, NULL);
 
-   if (errNum != CL_SUCCESS || numPlatforms <= 0) {
-      VMACCEL_WARNING("Failed to find any OpenCL platforms.\n");
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-      return (&result);
+   if ((errNum != CL_SUCCESS) || (status <= CL_COMPLETE)) {
+      clReleaseEvent(stg->event);
+      stg->event = NULL;
+      return true;
    }
 
-   for (i = 0; i < numPlatforms; i++) {
-      // Next, create an OpenCL context on the platform.  Attempt to
-      // create a GPU-based context, and if that fails, try to create
-      // a CPU-based context.
-      errNum =
-         clGetPlatformInfo(platforms[i], CL_PLATFORM_VERSION,
-                           sizeof(platformVersion), platformVersion, &sizeRet);
+   return false;
+}
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform version\n");
-         continue;
-      }
+/*
+ * VMWOpenCLStaging_Free
+ *
+ * Unmaps and releases a staging buffer once its last transfer completes,
+ * a temporary queue is used when no queue is given. The unmap is only
+ * flushed, the runtime defers freeing the buffer until the unmap has
+ * executed. The caller must own the buffer, either by marking it busy or
+ * by destroying the context, and must not hold stagingMutex.
+ */
+static void VMWOpenCLStaging_Free(unsigned int cid, cl_command_queue queue,
+                                  VMWOpenCLStaging *stg) {
+   cl_command_queue tmpQueue = NULL;
 
-      if (strstr(platformVersion, "OpenCL 1.2") != NULL) {
-         majorVersion = 1;
-         minorVersion = 2;
-      } else if (strstr(platformVersion, "OpenCL 2.0") != NULL) {
-         majorVersion = 2;
-         minorVersion = 0;
-      } else if (strstr(platformVersion, "OpenCL 2.") != NULL) {
-         majorVersion = 2;
-         minorVersion = 1;
-      } else if (strstr(platformVersion, "OpenCL 3.") != NULL) {
-         majorVersion = 3;
-         minorVersion = 0;
-      } else {
-         majorVersion = 3;
-         minorVersion = 0;
-         VMACCEL_WARNING("Unknown version detected: %s\n", platformVersion);
+   if (stg->event != NULL) {
+      clWaitForEvents(1, &stg->event);
+      clReleaseEvent(stg->event);
+   }
+
+   if (stg->mem != NULL) {
+      if (queue == NULL) {
+         tmpQueue = clCreateCommandQueueWithProperties(
+            contexts[cid].context, contexts[cid].deviceIds[0], NULL, NULL);
+         queue = tmpQueue;
       }
 
-      // SPIR-V 1.0 requires OpenCL 2.1
-      if ((argp->requiredCaps & VMCL_SPIRV_1_0_CAP) &&
-          ((majorVersion < 2) || (minorVersion < 1))) {
-         VMACCEL_WARNING("SPIRV 1.0 requires OpenCL 2.1+\n");
-         continue;
-      } else {
-         result.caps |= VMCL_SPIRV_1_0_CAP;
+      if (queue != NULL) {
+         clEnqueueUnmapMemObject(queue, stg->mem, stg->ptr, 0, NULL, NULL);
+         clFlush(queue);
       }
 
-      // SPIR-V 1.1/1.2 requires OpenCL 2.2
-      if (((argp->requiredCaps & VMCL_SPIRV_1_1_CAP) ||
-           (argp->requiredCaps & VMCL_SPIRV_1_2_CAP)) &&
-          ((majorVersion < 2) || (minorVersion < 2))) {
-         VMACCEL_WARNING("SPIRV 1.1/1.2 requires OpenCL 2.2+\n");
-         continue;
-      } else {
-         result.caps |= VMCL_SPIRV_1_1_CAP | VMCL_SPIRV_1_2_CAP;
+      if (tmpQueue != NULL) {
+         clReleaseCommandQueue(tmpQueue);
       }
 
-      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME,
-                                 sizeof(platformName), platformName, &sizeRet);
+      clReleaseMemObject(stg->mem);
+   }
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("Failed to query platform name\n");
-         continue;
-      }
+   memset(stg, 0, sizeof(*stg));
+}
 
-      VMACCEL_LOG("Using Platform: %s\n", platformName);
-      VMACCEL_LOG("  Version: %s\n", platformVersion);
+/*
+ * VMWOpenCLStaging_Acquire
+ *
+ * Returns an idle staging buffer of at least the requested size, allocating
+ * or growing a buffer of the context's pool on demand. Returns NULL if the
+ * transfer is too large or every buffer is busy, the caller then transfers
+ * from pageable memory. The buffer belongs to the caller until
+ * VMWOpenCLStaging_Release.
+ */
+static VMWOpenCLStaging *VMWOpenCLStaging_Acquire(unsigned int cid,
+                                                  cl_command_queue queue,
+                                                  size_t size) {
+   VMWOpenCLStaging *pool = &contexts[cid].staging[0];
+   VMWOpenCLStaging *stg = NULL;
+   size_t allocSize = 4096;
+   cl_int errNum;
+   int i;
 
-      for (j = 0; j < VMACCEL_SELECT_MAX; j++) {
-         char deviceName[128];
-         unsigned int numSubDevices = MAX(1, argp->numSubDevices);
+   if ((size == 0) || (size > VMCL_STAGING_MAX_ALLOC_SIZE)) {
+      return NULL;
+   }
 
-         if ((argp->selectionMask & (1 << j)) == 0) {
-            continue;
-         }
+   pthread_mutex_lock(&stagingMutex);
 
-         errNum = clGetDeviceIDs(platforms[i], clDeviceTypes[j], numSubDevices,
-                                 &deviceIds[0], NULL);
+   for (i = 0; i < VMCL_STAGING_POOL_SIZE; i++) {
+      if (pool[i].busy) {
+         continue;
+      }
 
-         if (errNum != CL_SUCCESS) {
-            continue;
+      if (pool[i].mem == NULL) {
+         if ((stg == NULL) || (stg->mem != NULL)) {
+            stg = &pool[i];
+         }
+      } else if (VMWOpenCLStaging_IsIdle(&pool[i])) {
+         if (pool[i].size >= size) {
+            pool[i].busy = true;
+            pthread_mutex_unlock(&stagingMutex);
+            return &pool[i];
          }
 
-         for (k = 0; k < numSubDevices; k++) {
-            cl_uint id;
+         if (stg == NULL) {
+            stg = &pool[i];
+         }
+      }
+   }
 
-            errNum = clGetDeviceInfo(deviceIds[k], CL_DEVICE_NAME,
-                                     sizeof(deviceName), deviceName, &sizeRet);
+   if (stg == NULL) {
+      pthread_mutex_unlock(&stagingMutex);
+      return NULL;
+   }
 
-            if (errNum != CL_SUCCESS) {
-               VMACCEL_WARNING("Failed to query device name\n");
-               continue;
-            }
+   /*
+    * Claim the buffer, the allocation and mapping below block and are done
+    * without holding the lock.
+    */
+   stg->busy = true;
 
-            VMACCEL_LOG("Device[%d]: Allocated %s\n", k, deviceName);
+   pthread_mutex_unlock(&stagingMutex);
 
-#define CL_DEVICE_PCI_BUS_ID_NV 0x4008
-            errNum = clGetDeviceInfo(deviceIds[k], CL_DEVICE_PCI_BUS_ID_NV,
-                                     sizeof(cl_uint), &id, NULL);
+   /*
+    * Replace an idle buffer that is too small when the pool is full.
+    */
+   if (stg->mem != NULL) {
+      VMWOpenCLStaging_Free(cid, queue, stg);
+   }
 
-            if (errNum == CL_SUCCESS) {
-               VMACCEL_LOG("Device[%d]: id=%02x\n", k, id);
-            }
-         }
+   while (allocSize < size) {
+      allocSize <<= 1;
+   }
 
-         context = clCreateContext(0, numSubDevices, &deviceIds[0], NULL, NULL,
-                                   &errNum);
+   stg->mem = clCreateBuffer(contexts[cid].context,
+                             CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                             allocSize, NULL, &errNum);
 
-         if (errNum != CL_SUCCESS) {
-            VMACCEL_WARNING("Unable to create context, errNum=%d\n", errNum);
-         } else if (context != NULL) {
-            ctxCaps = &caps[j];
-            break;
-         }
-      }
+   if (stg->mem != NULL) {
+      stg->ptr = clEnqueueMapBuffer(queue, stg->mem, CL_TRUE,
+                                    CL_MAP_READ | CL_MAP_WRITE, 0, allocSize,
+                                    0, NULL, NULL, &errNum);
 
-      if (context != NULL) {
-         break;
+      if (stg->ptr == NULL) {
+         clReleaseMemObject(stg->mem);
+         stg->mem = NULL;
       }
    }
 
-   if ((context == NULL) || (errNum != CL_SUCCESS)) {
-      VMACCEL_WARNING("Failed to create an OpenCL context.\n");
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-      return (&result);
-   }
+   pthread_mutex_lock(&stagingMutex);
 
-   if (IdentifierDB_AcquireId(contextIds, cid)) {
-      contexts[cid].context = context;
-      contexts[cid].platformId = platforms[i];
-      memcpy(contexts[cid].deviceIds, deviceIds, sizeof(deviceIds));
-      contexts[cid].majorVersion = majorVersion;
-      contexts[cid].minorVersion = minorVersion;
-      contexts[cid].caps = ctxCaps;
+   if (stg->mem == NULL) {
+      memset(stg, 0, sizeof(*stg));
+      stg = NULL;
    } else {
-      assert(0);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      stg->size = allocSize;
    }
 
-   return (&result);
-}
+   pthread_mutex_unlock(&stagingMutex);
 
-VMAccelStatus *vmwopencl_contextdestroy_1(VMCLContextId *argp) {
-   static VMAccelStatus result;
-   unsigned int cid = *((unsigned int *)argp);
+   return stg;
+}
 
-   memset(&result, 0, sizeof(result));
+/*
+ * VMWOpenCLStaging_Release
+ *
+ * Returns a staging buffer to the pool, the buffer is recycled once the
+ * transfer completes.
+ */
+static void VMWOpenCLStaging_Release(VMWOpenCLStaging *stg, cl_event event) {
+   pthread_mutex_lock(&stagingMutex);
 
-   if (IdentifierDB_ActiveId(contextIds, cid) && contexts[cid].context) {
-      clReleaseContext(contexts[cid].context);
-      contexts[cid].context = NULL;
-   } else {
-      VMACCEL_WARNING("%s: Destroying id %d, already destroyed\n", __FUNCTION__,
-                      cid);
+   if (event != NULL) {
+      clRetainEvent(event);
+      stg->event = event;
    }
 
-   IdentifierDB_ReleaseId(contextIds, cid);
+   stg->busy = false;
 
-   if (IdentifierDB_Count(contextIds) == 0) {
-      if (IdentifierDB_Count(surfaceIds) != 0) {
-         VMACCEL_WARNING(
-            "%s: Semantic error: Missing destructor call, %d surfaces "
-            "still active...\n",
-            __FUNCTION__, IdentifierDB_Count(surfaceIds));
-      }
+   pthread_mutex_unlock(&stagingMutex);
+}
+#endif
 
-      if (IdentifierDB_Count(queueIds) != 0) {
-         VMACCEL_WARNING(
-            "%s: Semantic error: Missing destructor call, %d queues "
-            "still active...\n",
-            __FUNCTION__, IdentifierDB_Count(queueIds));
-      }
+/*
+ * Records the most recent command of a class for profiling queues.
+ */
+static void VMWOpenCLQueue_Profile(unsigned int qid, VMCLProfileOpType type,
+                                   cl_event event) {
+   if ((event == NULL) || !queues[qid].profiling) {
+      return;
+   }
 
-      if (IdentifierDB_Count(samplerIds) != 0) {
-         VMACCEL_WARNING(
-            "%s: Semantic error: Missing destructor call, %d samplers "
-            "still active...\n",
-            __FUNCTION__, IdentifierDB_Count(samplerIds));
-      }
+   pthread_mutex_lock(&profileMutex);
 
-      if (IdentifierDB_Count(kernelIds) != 0) {
-         VMACCEL_WARNING(
-            "%s: Semantic error: Missing destructor call, %d kernels "
-            "still active...\n",
-            __FUNCTION__, IdentifierDB_Count(kernelIds));
-      }
+   if (queues[qid].profile[type] != NULL) {
+      clReleaseEvent(queues[qid].profile[type]);
    }
 
-   return (&result);
+   clRetainEvent(event);
+   queues[qid].profile[type] = event;
+
+   pthread_mutex_unlock(&profileMutex);
 }
 
-VMAccelSurfaceAllocateStatus *
-vmwopencl_surfacealloc_1(VMCLSurfaceAllocateDesc *argp) {
-   static VMAccelSurfaceAllocateStatus result;
-   unsigned int cid = (unsigned int)argp->client.cid;
-   unsigned int sid = (unsigned int)argp->client.accel.id;
-   cl_context context = contexts[cid].context;
-   cl_mem memObject[VMACCEL_MAX_SURFACE_INSTANCE] = {
-      NULL,
-   };
-   void *svmPtr[VMACCEL_MAX_SURFACE_INSTANCE] = {
-      NULL,
-   };
-   unsigned int clMemFlags = 0;
+/*
+ * Returns the event for a profiled command, if the queue is profiling.
+ */
+static cl_event *VMWOpenCLQueue_ProfileEvent(unsigned int qid,
+                                             cl_event *event) {
+   return queues[qid].profiling ? event : NULL;
+}
 
-   memset(&result, 0, sizeof(result));
+/*
+ * VMWOpenCLSurface_Transfer
+ *
+ * Enqueues a transfer of a region between a surface and tightly packed host
+ * memory, see VMAccel_SurfaceRegionLayout.
+ */
+static cl_int VMWOpenCLSurface_Transfer(const VMAccelSurfaceDesc *desc,
+                                        cl_command_queue queue, cl_mem mem,
+                                        bool write, cl_bool blocking,
+                                        const size_t origin[3],
+                                        const size_t region[3],
+                                        size_t rowPitch, size_t slicePitch,
+                                        void *ptr, cl_event wait,
+                                        cl_event *event) {
+   const size_t hostOrigin[3] = {0, 0, 0};
+   cl_uint numEvents = (wait != NULL) ? 1 : 0;
+   const cl_event *waitList = (wait != NULL) ? &wait : NULL;
+   size_t offset;
+
+   if (VMAccel_SurfaceIsImage(desc)) {
+      size_t elementSize = VMAccel_SurfaceFormatSize(desc->format);
+      size_t imgOrigin[3] = {origin[0] / elementSize, origin[1], origin[2]};
+      size_t imgRegion[3] = {region[0] / elementSize, region[1], region[2]};
+      size_t hostRowPitch =
+         (desc->type != VMACCEL_SURFACE_1D_IMAGE) ? region[0] : 0;
+      size_t hostSlicePitch =
+         (desc->type == VMACCEL_SURFACE_3D_IMAGE) ? region[0] * region[1] : 0;
+
+      if (write) {
+         return clEnqueueWriteImage(queue, mem, blocking, imgOrigin, imgRegion,
+                                    hostRowPitch, hostSlicePitch, ptr,
+                                    numEvents, waitList, event);
+      }
 
-   if (IdentifierDB_ActiveId(surfaceIds, sid)) {
-      VMACCEL_WARNING("%s: ERROR: Surface ID %d already active...\n",
-                      __FUNCTION__, sid);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-      return (&result);
+      return clEnqueueReadImage(queue, mem, blocking, imgOrigin, imgRegion,
+                                hostRowPitch, hostSlicePitch, ptr, numEvents,
+                                waitList, event);
    }
 
-#if DEBUG_STREAMS
-   VMACCEL_LOG("%s: sid=%d...\n", __FUNCTION__, sid);
-#endif
+   if ((region[1] == 1) && (region[2] == 1)) {
+      offset = origin[2] * slicePitch + origin[1] * rowPitch + origin[0];
 
-   if (argp->desc.usage == VMACCEL_SURFACE_USAGE_READONLY) {
-      clMemFlags |= CL_MEM_READ_ONLY;
-   } else if (argp->desc.usage == VMACCEL_SURFACE_USAGE_WRITEONLY) {
-      clMemFlags |= CL_MEM_WRITE_ONLY;
-   } else if (argp->desc.usage == VMACCEL_SURFACE_USAGE_READWRITE) {
-      clMemFlags |= CL_MEM_READ_WRITE;
+      if (write) {
+         return clEnqueueWriteBuffer(queue, mem, blocking, offset, region[0],
+                                     ptr, numEvents, waitList, event);
+      }
+
+      return clEnqueueReadBuffer(queue, mem, blocking, offset, region[0], ptr,
+                                 numEvents, waitList, event);
    }
 
-#if CL_VERSION_2_0
-   if ((argp->desc.type == VMACCEL_SURFACE_BUFFER) &&
-       (argp->desc.pool == VMACCEL_SURFACE_POOL_SYSTEM_MEMORY) &&
-       (contexts[cid].majorVersion >= 2) && (contexts[cid].minorVersion >= 0)) {
-      for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
-         svmPtr[i] = clSVMAlloc(context, clMemFlags, argp->desc.width, 0);
-         if (svmPtr[i] == NULL) {
-            result.status = VMACCEL_FAIL;
-            for (i; i > 0; i--) {
-               clSVMFree(context, svmPtr[i - 1]);
-            }
-            return (&result);
-         }
-      }
+   if (write) {
+      return clEnqueueWriteBufferRect(
+         queue, mem, blocking, origin, hostOrigin, region, rowPitch,
+         slicePitch, region[0], region[0] * region[1], ptr, numEvents,
+         waitList, event);
+   }
 
-   } else
-#endif
-      if (argp->desc.type == VMACCEL_SURFACE_BUFFER) {
-      assert(argp->desc.format == VMACCEL_FORMAT_R8_TYPELESS);
+   return clEnqueueReadBufferRect(queue, mem, blocking, origin, hostOrigin,
+                                  region, rowPitch, slicePitch, region[0],
+                                  region[0] * region[1], ptr, numEvents,
+                                  waitList, event);
+}
 
-      for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
-         memObject[i] =
-            clCreateBuffer(context, clMemFlags, argp->desc.width, NULL, NULL);
-         if (memObject[i] == NULL) {
-            result.status = VMACCEL_FAIL;
-            for (i; i > 0; i--) {
-               clReleaseMemObject(memObject[i - 1]);
-            }
-            return (&result);
-         }
-      }
-   } else {
-      assert(argp->desc.usage == VMACCEL_SURFACE_USAGE_READWRITE);
+/*
+ * VMWOpenCLSurface_IsHostTransfer
+ *
+ * Transfers of a whole buffer from or to the memory the buffer was created
+ * on only need to synchronize the buffer with the memory.
+ */
+static bool
+VMWOpenCLSurface_IsHostTransfer(const VMAccelSurfaceDesc *desc,
+                                const VMWOpenCLSurfaceInstance *inst,
+                                const size_t region[3], const void *ptr) {
+   return (inst->host_ptr != NULL) && (inst->host_ptr == ptr) &&
+          (region[0] * region[1] * region[2] == desc->width);
+}
+
+/*
+ * VMWOpenCLSurface_SyncHost
+ *
+ * Synchronizes a buffer with the memory it was created on. Mapping the
+ * buffer copies the contents on devices that don't share the memory, and
+ * is free on devices that do.
+ */
+static cl_int VMWOpenCLSurface_SyncHost(cl_command_queue queue,
+                                        VMWOpenCLSurfaceInstance *inst,
+                                        size_t size, bool write,
+                                        cl_event *event) {
+   cl_event waitList[1];
+   cl_uint numEvents = VMWOpenCLSurface_WaitList(inst, waitList, 0);
+   cl_map_flags flags = write ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_READ;
+   cl_int errNum;
+   void *ptr;
 
-      /* Image from buffer? */
+   ptr = clEnqueueMapBuffer(queue, inst->mem, CL_TRUE, flags, 0, size,
+                            numEvents, (numEvents > 0) ? waitList : NULL, NULL,
+                            &errNum);
 
-      result.status = VMACCEL_FAIL;
-      return (&result);
+   if (ptr == NULL) {
+      return errNum;
    }
 
-   if (memObject == NULL) {
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-      return (&result);
+   assert(ptr == inst->host_ptr);
+
+   return clEnqueueUnmapMemObject(queue, inst->mem, ptr, 0, NULL, event);
+}
+
+/*
+ * VMWOpenCLSurface_ImageRegion
+ *
+ * Validates a region of an image, returning the origin and extent in
+ * elements of the image format.
+ */
+static bool VMWOpenCLSurface_ImageRegion(const VMAccelSurfaceDesc *desc,
+                                         const VMAccelSurfaceRegion *rgn,
+                                         size_t origin[3], size_t region[3]) {
+   size_t elementSize = VMAccel_SurfaceFormatSize(desc->format);
+   size_t rowPitch, slicePitch;
+
+   if (!VMAccel_SurfaceIsImage(desc) ||
+       !VMAccel_SurfaceRegionLayout(desc, rgn, origin, region, &rowPitch,
+                                    &slicePitch)) {
+      return false;
    }
 
-   /*
-    * Initialize mutexes to provide data coherency and consistency
-    * contracts.
-    */
-   pthread_mutexattr_t attr;
-   pthread_mutexattr_init(&attr);
-   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+   origin[0] /= elementSize;
+   region[0] /= elementSize;
 
-   pthread_mutex_init(&surfaces[sid].mutex, &attr);
-   if (IdentifierDB_AcquireId(surfaceIds, sid)) {
-      pthread_mutex_lock(&surfaces[sid].mutex);
-      surfaces[sid].cid = cid;
-      surfaces[sid].desc = argp->desc;
-      for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
-         surfaces[sid].inst[i].mem = memObject[i];
-         surfaces[sid].inst[i].svm_ptr = svmPtr[i];
-         surfaces[sid].inst[i].mapping.refCount = 0;
-         pthread_mutex_init(&surfaces[sid].inst[i].mutex, &attr);
+   return true;
+}
+
+/*
+ * Returns the instance holding the requested generation, otherwise the
+ * instance holding the latest generation. Callers validate the generation
+ * of the returned instance.
+ */
+static unsigned int VMWOpenCLSurface_LookupInstance(VMWOpenCLSurface *surf,
+                                                    unsigned int gen) {
+   for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
+      if (VMWOpenCLSurface_IsAllocated(&surf->inst[i]) &&
+          (surf->inst[i].generation == gen)) {
+         return i;
       }
-      pthread_mutex_unlock(&surfaces[sid].mutex);
-   } else {
-      assert(0);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
    }
 
-#if DEBUG_STREAMS
-   VMACCEL_LOG("%s: sid=%d allocated\n", __FUNCTION__, sid);
-#endif
-
-   return (&result);
+   return surf->latest;
 }
 
-VMAccelStatus *vmwopencl_surfacedestroy_1(VMCLSurfaceId *argp) {
-   static VMAccelStatus result;
-   unsigned int sid = (unsigned int)argp->accel.id;
+/*
+ * Selects the instance that will receive a write-discard update.
+ *
+ * The instance holding the latest generation is updated in place when idle.
+ * Otherwise the update is renamed to an idle or newly allocated instance,
+ * so commands still consuming the latest generation are not serialized
+ * against the update. If every instance is busy, the instance holding the
+ * oldest generation is reclaimed once its last command completes.
+ */
+static unsigned int VMWOpenCLSurface_RenameInstance(unsigned int sid) {
+   VMWOpenCLSurface *surf = &surfaces[sid];
+   unsigned int latest = surf->latest;
+   int oldest = -1;
+   /*
+    * A surface on user memory has the single instance backed by the memory,
+    * renaming would replace it with a copy.
+    */
+   bool rename = (surf->desc.pool != VMACCEL_SURFACE_POOL_USER_MEMORY);
 
-#if DEBUG_STREAMS
-   VMACCEL_LOG("%s: Destroying sid=%d...\n", __FUNCTION__, sid);
-#endif
+   if (VMWOpenCLSurface_IsIdle(&surf->inst[latest])) {
+      return latest;
+   }
 
-   pthread_mutex_lock(&surfaces[sid].mutex);
+   for (int i = 0; rename && (i < VMACCEL_MAX_SURFACE_INSTANCE); i++) {
+      VMWOpenCLSurfaceInstance *inst = &surf->inst[i];
 
-   memset(&result, 0, sizeof(result));
+      if (i == latest) {
+         continue;
+      }
 
-   assert(IdentifierDB_ActiveId(surfaceIds, sid));
+      if (!VMWOpenCLSurface_IsAllocated(inst)) {
+         if (VMWOpenCLSurface_AllocInstance(surf->cid, &surf->desc, NULL,
+                                            inst) == VMACCEL_SUCCESS) {
+            inst->generation = 0;
+            inst->mapping.refCount = 0;
+            return i;
+         }
+         continue;
+      }
 
-   for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
-      pthread_mutex_lock(&surfaces[sid].inst[i].mutex);
-#if CL_VERSION_2_0
-      if (surfaces[sid].inst[i].svm_ptr) {
-         unsigned int cid = (unsigned int)surfaces[sid].cid;
-         cl_context context = contexts[cid].context;
-         clSVMFree(context, surfaces[sid].inst[i].svm_ptr);
-      } else
-#endif
-      {
-         clReleaseMemObject(surfaces[sid].inst[i].mem);
+      if (VMWOpenCLSurface_IsIdle(inst)) {
+         return i;
+      }
+
+      if ((inst->mapping.refCount == 0) &&
+          ((oldest < 0) ||
+           (inst->generation < surf->inst[oldest].generation))) {
+         oldest = i;
       }
-      surfaces[sid].inst[i].mem = NULL;
-      pthread_mutex_unlock(&surfaces[sid].inst[i].mutex);
-      pthread_mutex_destroy(&surfaces[sid].inst[i].mutex);
    }
 
-   memset(&surfaces[sid], 0, sizeof(surfaces[0]));
+   if (oldest < 0) {
+      oldest = latest;
+   }
 
-   pthread_mutex_unlock(&surfaces[sid].mutex);
-   pthread_mutex_destroy(&surfaces[sid].mutex);
+   if (surf->inst[oldest].event != NULL) {
+      clWaitForEvents(1, &surf->inst[oldest].event);
+      clReleaseEvent(surf->inst[oldest].event);
+      surf->inst[oldest].event = NULL;
+   }
 
-   IdentifierDB_ReleaseId(surfaceIds, sid);
-   result.status = VMACCEL_SUCCESS;
+   return oldest;
+}
 
-#if DEBUG_STREAMS
-   VMACCEL_LOG("%s: sid=%d released...\n", __FUNCTION__, sid);
-#endif
+/*
+ * Marks the instance as holding the given generation.
+ */
+static void VMWOpenCLSurface_CommitInstance(VMWOpenCLSurface *surf,
+                                            unsigned int inst,
+                                            unsigned int gen) {
+   surf->inst[inst].generation = gen;
 
-   return (&result);
+   if (gen >= surf->inst[surf->latest].generation) {
+      surf->latest = inst;
+   }
 }
 
-VMAccelQueueStatus *vmwopencl_queuealloc_1(VMCLQueueAllocateDesc *argp) {
-   static VMAccelQueueStatus result;
-   unsigned int cid = (unsigned int)argp->client.cid;
-   unsigned int qid = (unsigned int)argp->client.id;
-   unsigned int subDevice = (unsigned int)argp->subDevice;
-   cl_context context = contexts[cid].context;
-   cl_int errNum;
-   cl_device_id *devices;
-   cl_command_queue commandQueue = NULL;
-   size_t deviceBufferSize = -1;
+VMAccelAllocateStatus *vmwopencl_poweron(VMCLOps *ops, unsigned int accelArch,
+                                         unsigned int accelIndex,
+                                         unsigned int useDataStreaming) {
+   static VMAccelAllocateStatus result;
+   size_t sizeRet;
+   cl_platform_id platforms[16];
+   cl_uint numPlatforms = 0;
+   cl_int errNum = CL_SUCCESS;
+   char platformName[128] = {'\0'};
+   char platformVendor[128] = {'\0'};
+   char platformVersion[128] = {'\0'};
+   char platformExtensions[128] = {'\0'};
+   char deviceName[128];
+   char prefix[64];
+   char capPrefix[128];
+   cl_device_id deviceId;
+   VMWOpenCLCaps *caps;
+   unsigned int deviceIndex = accelIndex;
+   int i, j;
+   bool platformFound = false;
 
    memset(&result, 0, sizeof(result));
 
-   if (IdentifierDB_ActiveId(queueIds, qid)) {
-      VMACCEL_WARNING("%s: ERROR: Queue ID %d already active...\n",
-                      __FUNCTION__, qid);
+   if (numDevices >= VMCL_MAX_DEVICES) {
       result.status = VMACCEL_RESOURCE_UNAVAILABLE;
       return (&result);
    }
 
-   // First get the size of the devices buffer
-   errNum =
-      clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
+   caps = &devices[numDevices].caps;
+
+   VMACCEL_LOG("Powering on vmwopencl backend, architecture=%u index=%u...\n",
+               accelArch, accelIndex);
+
+   errNum = clGetPlatformIDs(sizeof(platforms) / sizeof(platforms[0]),
+                             &platforms[0], &numPlatforms);
 
    if (errNum != CL_SUCCESS) {
-      VMACCEL_WARNING(
-         "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)");
+      VMACCEL_WARNING("Failed to query platforms\n");
       result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   if (deviceBufferSize <= 0) {
-      VMACCEL_WARNING("No devices available.");
-      result.status = VMACCEL_FAIL;
-      return (&result);
-   }
+   VMACCEL_LOG("Number of platforms: %d\n", numPlatforms);
 
-   // Allocate memory for the devices buffer
-   devices =
-      calloc(deviceBufferSize / sizeof(cl_device_id), sizeof(cl_device_id));
+   for (i = 0; i < numPlatforms; i++) {
+      cl_device_id platformDevices[VMCL_MAX_SUBDEVICES];
+      cl_uint numPlatformDevices = 0;
 
-   errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize,
-                             devices, NULL);
+      errNum = clGetDeviceIDs(platforms[i], clDeviceTypes[accelArch],
+                              VMCL_MAX_SUBDEVICES, &platformDevices[0],
+                              &numPlatformDevices);
 
-   if (errNum != CL_SUCCESS ||
-       subDevice >= (deviceBufferSize / sizeof(cl_device_id))) {
-      free(devices);
-      result.status = VMACCEL_FAIL;
-      return (&result);
-   }
+      if (errNum != CL_SUCCESS) {
+         continue;
+      }
 
-   // In this example, we just choose the first available device.  In a
-   // real program, you would likely use all available devices or choose
-   // the highest performance device based on OpenCL device queries
-   commandQueue =
-      clCreateCommandQueueWithProperties(context, devices[subDevice], 0, NULL);
-   VMACCEL_WARNING("Device[%d]: Allocating queue %d on device id 0x%x\n",
-                   subDevice, qid, devices[subDevice]);
-   if (commandQueue == NULL) {
-      VMACCEL_WARNING("Failed to create commandQueue for device 0");
-      free(devices);
-      result.status = VMACCEL_FAIL;
-      return (&result);
-   }
+      /*
+       * Devices are indexed across all platforms.
+       */
+      if (numPlatformDevices > VMCL_MAX_SUBDEVICES) {
+         numPlatformDevices = VMCL_MAX_SUBDEVICES;
+      }
 
-   free(devices);
+      if (deviceIndex >= numPlatformDevices) {
+         deviceIndex -= numPlatformDevices;
+         continue;
+      }
 
-   if (IdentifierDB_AcquireId(queueIds, qid)) {
-      queues[qid].desc = argp->desc;
-      queues[qid].queue = commandQueue;
-   } else {
-      clReleaseCommandQueue(commandQueue);
-      assert(0);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-   }
+      deviceId = platformDevices[deviceIndex];
 
-   return (&result);
-}
+      /*
+       * Architectures may share a device type, power on each device once.
+       */
+      for (j = 0; j < numDevices; j++) {
+         if (devices[j].caps.deviceId == deviceId) {
+            result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+            return (&result);
+         }
+      }
+
+      errNum =
+         clGetPlatformInfo(platforms[i], CL_PLATFORM_VERSION,
+                           sizeof(platformVersion), platformVersion, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform version\n");
+         result.status = VMACCEL_FAIL;
+         return (&result);
+      }
+
+      VMACCEL_LOG("Version: %s\n", platformVersion);
+
+      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME,
+                                 sizeof(platformName), platformName, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform name\n");
+         result.status = VMACCEL_FAIL;
+         return (&result);
+      }
+
+      VMACCEL_LOG("Platform: %s\n", platformName);
+
+      errNum =
+         clGetPlatformInfo(platforms[i], CL_PLATFORM_VENDOR,
+                           sizeof(platformVendor), platformVendor, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform vendor\n");
+         result.status = VMACCEL_FAIL;
+         return (&result);
+      }
+
+      VMACCEL_LOG("Vendor: %s\n", platformVendor);
+
+      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_EXTENSIONS,
+                                 sizeof(platformExtensions), platformExtensions,
+                                 &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform extensions\n");
+      }
+
+      VMACCEL_LOG("Extensions: %s\n", platformExtensions);
+
+      caps->deviceId = deviceId;
+
+      errNum = clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(deviceName),
+                               deviceName, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Unable to query CL_DEVICE_NAME\n");
+         continue;
+      }
+
+      snprintf(prefix, sizeof(prefix), "Device[%p]", deviceId);
+
+      VMACCEL_LOG("%s: DEVICE_NAME = %s\n", prefix, deviceName);
+
+#define CAP(__TYPE, __NAME)                                                    \
+   do {                                                                        \
+      __TYPE val;                                                              \
+      errNum = clGetDeviceInfo(deviceId, CL_##__NAME, sizeof(__TYPE), &val,    \
+                               &sizeRet);                                      \
+      if (errNum != CL_SUCCESS) {                                              \
+         VMACCEL_WARNING("Unable to query %s\n", "CL_" #__NAME);               \
+      } else {                                                                 \
+         snprintf(capPrefix, sizeof(capPrefix), "%s: %s", prefix, #__NAME);    \
+         Log_##__TYPE(capPrefix, val);                                         \
+         caps->__NAME = val;                                                  \
+      }                                                                        \
+   } while (0);
+#include "vmwopencl_caps.h"
+#undef CAP
+
+      caps->DEVICE_MAX_WORK_ITEM_SIZES =
+         calloc(caps->DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(size_t));
+
+      errNum = clGetDeviceInfo(
+         deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+         caps->DEVICE_MAX_WORK_ITEM_DIMENSIONS * sizeof(size_t),
+         caps->DEVICE_MAX_WORK_ITEM_SIZES, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Unable to query CL_DEVICE_MAX_WORK_ITEM_SIZES\n");
+         continue;
+      } else {
+         for (j = 0; j < caps->DEVICE_MAX_WORK_ITEM_DIMENSIONS; j++) {
+            snprintf(capPrefix, sizeof(capPrefix),
+                     "%s: DEVICE_MAX_WORK_ITEM_SIZES[%d]", prefix, j);
+            Log_size_t(capPrefix, caps->DEVICE_MAX_WORK_ITEM_SIZES[j]);
+         }
+      }
+
+      devices[numDevices].accelArch = accelArch;
+      devices[numDevices].platformId = platforms[i];
+      devices[numDevices].platformIndex = deviceIndex;
+
+      platformFound = true;
+      break;
+   }
+
+   if (!platformFound) {
+      result.status = VMACCEL_FAIL;
+      return &result;
+   }
+
+   if ((strstr(platformVersion, "OpenCL 1.2") == NULL) &&
+       (strstr(platformVersion, "OpenCL 2.0") == NULL) &&
+       (strstr(platformVersion, "OpenCL 2.") == NULL) &&
+       (strstr(platformVersion, "OpenCL 3.") == NULL)) {
+      VMACCEL_WARNING("Unknown version detected: %s\n", platformVersion);
+   }
+
+   /*
+    * Derive VMAccelAllocateStatus from the OpenCL device.
+    *
+    * We have shown that when there is a contention for an Accelerator's
+    * local memory resource, the cost of paging out a resource and paging
+    * in new content for a resource is not only the transfer of the data.
+    * Since, a high level API interface can only enqueue paging operations,
+    * all previous operations must complete before paging can occur. If
+    * this ultimate blocks the backend, due to an operating system level
+    * response to a lack of physical memory to pin for the DMA operation,
+    * the backpressure is realized as "resource contention latency".
+    *
+    * The goal is to never over-commit the processor, but saturate it to
+    * ~99% usage and leave a portion of the processor time for management
+    * tasks. We achieve this by exporting the capabilities below to
+    * maintain a stable system.
+    */
+   result.id = numDevices++;
+   result.desc.typeMask = VMACCEL_COMPUTE_ACCELERATOR_MASK;
+   result.desc.architecture = accelArch;
+   result.desc.caps = VMACCEL_SURFACEMAP;
+
+   /*
+    * Format caps.
+    */
+   result.desc.formatCaps.formatCaps_len = 0;
+   result.desc.formatCaps.formatCaps_val = NULL;
+
+   /*
+    * OpenCL work hierarchy:
+    *
+    * Work Group
+    * +-> Work Items(x, y, z, ...)
+    */
+   result.desc.capacity.megaFlops = caps->DEVICE_MAX_COMPUTE_UNITS *
+                                    caps->DEVICE_MAX_CLOCK_FREQUENCY;
+
+   result.desc.capacity.megaOps = result.desc.capacity.megaFlops;
+
+   /*
+    * Cache capabilities.
+    */
+   result.desc.capacity.llcSizeKB = caps->DEVICE_GLOBAL_MEM_CACHE_SIZE / 1000;
+   result.desc.capacity.llcBandwidthMBSec =
+      result.desc.capacity.llcSizeKB *
+      (caps->DEVICE_MAX_CLOCK_FREQUENCY / 1000);
+
+   /*
+    * Local memory capabilities.
+    */
+   result.desc.capacity.localMemSizeKB = caps->DEVICE_LOCAL_MEM_SIZE / 1000;
+
+   // TODO: Query clock/bus information for the MMU.
+   result.desc.capacity.localMemBandwidthMBSec = 0;
+
+   /*
+    * Non-local memory capabilities.
+    */
+   result.desc.capacity.nonLocalMemSizeKB = caps->DEVICE_GLOBAL_MEM_SIZE / 1000;
+
+   // TODO: Query the clock/bus information for PCI-E or NUMA.
+   result.desc.capacity.nonLocalMemBandwidthMBSec = 0;
+
+   /*
+    * Accelerator Interconnect capabilities.
+    *
+    * TODO: Query the clock/bus information for PCI-E or NUMA.
+    */
+   result.desc.capacity.interconnectBandwidthMBSec = 0;
+
+   result.desc.maxContexts = VMCL_MAX_CONTEXTS;
+   result.desc.maxQueues = VMCL_MAX_QUEUES;
+   result.desc.maxSurfaces = VMCL_MAX_SURFACES;
+   result.desc.maxMappings = VMCL_MAX_SURFACES;
+
+   /*
+    * The object databases are shared by all devices.
+    */
+   if (contexts != NULL) {
+      result.status = VMACCEL_SUCCESS;
+      return (&result);
+   }
+
+   contexts = calloc(VMCL_MAX_CONTEXTS, sizeof(VMWOpenCLContext));
+   contextIds = IdentifierDB_Alloc(VMCL_MAX_CONTEXTS);
+
+   surfaces = calloc(VMCL_MAX_SURFACES, sizeof(VMWOpenCLSurface));
+   surfaceIds = IdentifierDB_Alloc(VMCL_MAX_SURFACES);
+
+   queues = calloc(VMCL_MAX_QUEUES, sizeof(VMWOpenCLQueue));
+   queueIds = IdentifierDB_Alloc(VMCL_MAX_QUEUES);
+
+   samplers = calloc(VMCL_MAX_SAMPLERS, sizeof(VMWOpenCLSampler));
+   samplerIds = IdentifierDB_Alloc(VMCL_MAX_SAMPLERS);
+
+   kernels = calloc(VMCL_MAX_KERNELS, sizeof(VMWOpenCLKernel));
+   kernelIds = IdentifierDB_Alloc(VMCL_MAX_KERNELS);
+
+   /*
+    * Final check for allocation failure.
+    */
+   if ((contexts == NULL) || (contextIds == NULL) || (surfaces == NULL) ||
+       (surfaceIds == NULL) || (queues == NULL) || (queueIds == NULL) ||
+       (samplers == NULL) || (samplerIds == NULL) || (kernels == NULL) ||
+       (kernelIds == NULL)) {
+      VMACCEL_WARNING("Unable to allocate object database...\n");
+      result.status = VMACCEL_FAIL;
+      vmwopencl_poweroff();
+   } else {
+      result.status = VMACCEL_SUCCESS;
+   }
+
+#if ENABLE_DATA_STREAMING
+   if (useDataStreaming) {
+      VMAccelStreamCallbacks cb;
+      cb.clSurfacemap_1 = vmwopencl_surfacemap_1;
+      cb.clSurfaceunmap_1 = vmwopencl_surfaceunmap_1;
+      vmaccel_stream_server(VMACCEL_STREAM_TYPE_VMCL_UPLOAD,
+                            VMACCEL_VMCL_BASE_PORT, &cb);
+   }
+#endif
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_poweroff() {
+   static VMAccelStatus result;
+   int i;
+
+   memset(&result, 0, sizeof(result));
+
+   for (i = 0; i < numDevices; i++) {
+      free(devices[i].caps.DEVICE_MAX_WORK_ITEM_SIZES);
+   }
+
+   memset(&devices, 0, sizeof(devices));
+   numDevices = 0;
+
+   IdentifierDB_Free(contextIds);
+   free(contexts);
+   contexts = NULL;
+
+   IdentifierDB_Free(surfaceIds);
+   free(surfaces);
+
+   IdentifierDB_Free(queueIds);
+   free(queues);
+
+   IdentifierDB_Free(samplerIds);
+   free(samplers);
+
+   IdentifierDB_Free(kernelIds);
+   free(kernels);
+
+   return (&result);
+}
+
+static bool VMWOpenCLDevice_IsSelected(unsigned int device,
+                                       unsigned int selectionMask) {
+   return (selectionMask == VMACCEL_AUTO_SELECT_MASK) ||
+          ((selectionMask & (1 << devices[device].accelArch)) != 0);
+}
+
+VMCLContextAllocateStatus *
+vmwopencl_contextalloc_1(VMCLContextAllocateDesc *argp) {
+   unsigned int cid = argp->clientId;
+   static VMCLContextAllocateStatus result;
+   size_t sizeRet;
+   cl_uint numPlatforms;
+   cl_platform_id platforms[16];
+   cl_context context = NULL;
+   cl_device_id deviceIds[VMCL_MAX_SUBDEVICES] = {
+      0,
+   };
+   cl_device_id platformDevices[VMCL_MAX_SUBDEVICES];
+   cl_uint numPlatformDevices = 0;
+   unsigned int numSubDevices = MAX(1, argp->numSubDevices);
+   cl_int errNum;
+   char deviceName[128];
+   char platformName[128] = {'\0'};
+   char platformVersion[128] = {'\0'};
+   int majorVersion;
+   int minorVersion;
+   VMWOpenCLCaps *ctxCaps = NULL;
+   VMWOpenCLDevice *dev = NULL;
+   bool profiling = true;
+   int i = 0, j = 0, k = 0;
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(contextIds, cid)) {
+      VMACCEL_WARNING("%s: ERROR: Context ID %d already active...\n",
+                      __FUNCTION__, cid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   /*
+    * Place the context on the requested device, or on the first device of a
+    * selected architecture.
+    */
+   if ((argp->accelId < numDevices) &&
+       VMWOpenCLDevice_IsSelected(argp->accelId, argp->selectionMask)) {
+      dev = &devices[argp->accelId];
+   } else {
+      for (j = 0; j < numDevices; j++) {
+         if (VMWOpenCLDevice_IsSelected(j, argp->selectionMask)) {
+            dev = &devices[j];
+            break;
+         }
+      }
+   }
+
+   if (dev == NULL) {
+      VMACCEL_WARNING("%s: No device matches selection mask 0x%x\n",
+                      __FUNCTION__, argp->selectionMask);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   // First, select an OpenCL platform to run on.  For this example, we
+   // simply choose the first available platform.  Normally, you would
+   // query for all available platforms and select the most appropriate one.
+   errNum = clGetPlatformIDs(sizeof(platforms) / sizeof(platforms[0]),
+                             &platforms[0], &numPlatforms);
+
+   if (errNum != CL_SUCCESS || numPlatforms <= 0) {
+      VMACCEL_WARNING("Failed to find any OpenCL platforms.\n");
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   for (i = 0; i < numPlatforms; i++) {
+      if (platforms[i] != dev->platformId) {
+         continue;
+      }
+
+      // Next, create an OpenCL context on the platform.
+      errNum =
+         clGetPlatformInfo(platforms[i], CL_PLATFORM_VERSION,
+                           sizeof(platformVersion), platformVersion, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform version\n");
+         continue;
+      }
+
+      if (strstr(platformVersion, "OpenCL 1.2") != NULL) {
+         majorVersion = 1;
+         minorVersion = 2;
+      } else if (strstr(platformVersion, "OpenCL 2.0") != NULL) {
+         majorVersion = 2;
+         minorVersion = 0;
+      } else if (strstr(platformVersion, "OpenCL 2.") != NULL) {
+         majorVersion = 2;
+         minorVersion = 1;
+      } else if (strstr(platformVersion, "OpenCL 3.") != NULL) {
+         majorVersion = 3;
+         minorVersion = 0;
+      } else {
+         majorVersion = 3;
+         minorVersion = 0;
+         VMACCEL_WARNING("Unknown version detected: %s\n", platformVersion);
+      }
+
+      // SPIR-V 1.0 requires OpenCL 2.1
+      if ((argp->requiredCaps & VMCL_SPIRV_1_0_CAP) &&
+          ((majorVersion < 2) || (minorVersion < 1))) {
+         VMACCEL_WARNING("SPIRV 1.0 requires OpenCL 2.1+\n");
+         continue;
+      } else {
+         result.caps |= VMCL_SPIRV_1_0_CAP;
+      }
+
+      // SPIR-V 1.1/1.2 requires OpenCL 2.2
+      if (((argp->requiredCaps & VMCL_SPIRV_1_1_CAP) ||
+           (argp->requiredCaps & VMCL_SPIRV_1_2_CAP)) &&
+          ((majorVersion < 2) || (minorVersion < 2))) {
+         VMACCEL_WARNING("SPIRV 1.1/1.2 requires OpenCL 2.2+\n");
+         continue;
+      } else {
+         result.caps |= VMCL_SPIRV_1_1_CAP | VMCL_SPIRV_1_2_CAP;
+      }
+
+      errNum = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME,
+                                 sizeof(platformName), platformName, &sizeRet);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Failed to query platform name\n");
+         continue;
+      }
+
+      VMACCEL_LOG("Using Platform: %s\n", platformName);
+      VMACCEL_LOG("  Version: %s\n", platformVersion);
+
+      /*
+       * Sub-devices are the selected device and the devices following it.
+       */
+      errNum = clGetDeviceIDs(platforms[i], clDeviceTypes[dev->accelArch],
+                              VMCL_MAX_SUBDEVICES, &platformDevices[0],
+                              &numPlatformDevices);
+
+      if (numPlatformDevices > VMCL_MAX_SUBDEVICES) {
+         numPlatformDevices = VMCL_MAX_SUBDEVICES;
+      }
+
+      if ((errNum != CL_SUCCESS) ||
+          (dev->platformIndex + numSubDevices > numPlatformDevices)) {
+         VMACCEL_WARNING("Unable to select %u sub-devices\n", numSubDevices);
+         break;
+      }
+
+      memcpy(&deviceIds[0], &platformDevices[dev->platformIndex],
+             numSubDevices * sizeof(cl_device_id));
+
+      for (k = 0; k < numSubDevices; k++) {
+         cl_command_queue_properties queueProps = 0;
+         cl_uint id;
+
+         /*
+          * Profiling is offered when every sub-device timestamps commands.
+          */
+         errNum = clGetDeviceInfo(deviceIds[k],
+                                  CL_DEVICE_QUEUE_ON_HOST_PROPERTIES,
+                                  sizeof(queueProps), &queueProps, NULL);
+
+         if ((errNum != CL_SUCCESS) ||
+             !(queueProps & CL_QUEUE_PROFILING_ENABLE)) {
+            profiling = false;
+         }
+
+         errNum = clGetDeviceInfo(deviceIds[k], CL_DEVICE_NAME,
+                                  sizeof(deviceName), deviceName, &sizeRet);
+
+         if (errNum != CL_SUCCESS) {
+            VMACCEL_WARNING("Failed to query device name\n");
+            continue;
+         }
+
+         VMACCEL_LOG("Device[%d]: Allocated %s\n", k, deviceName);
+
+#define CL_DEVICE_PCI_BUS_ID_NV 0x4008
+         errNum = clGetDeviceInfo(deviceIds[k], CL_DEVICE_PCI_BUS_ID_NV,
+                                  sizeof(cl_uint), &id, NULL);
+
+         if (errNum == CL_SUCCESS) {
+            VMACCEL_LOG("Device[%d]: id=%02x\n", k, id);
+         }
+      }
+
+      context = clCreateContext(0, numSubDevices, &deviceIds[0], NULL, NULL,
+                                &errNum);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("Unable to create context, errNum=%d\n", errNum);
+      } else if (context != NULL) {
+         ctxCaps = &dev->caps;
+      }
+
+      if (profiling) {
+         result.caps |= VMCL_PROFILING_CAP;
+      } else if (argp->requiredCaps & VMCL_PROFILING_CAP) {
+         VMACCEL_WARNING("Device doesn't support queue profiling\n");
+      }
+
+      break;
+   }
+
+   if ((context == NULL) || (errNum != CL_SUCCESS)) {
+      VMACCEL_WARNING("Failed to create an OpenCL context.\n");
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   if (IdentifierDB_AcquireId(contextIds, cid)) {
+      contexts[cid].context = context;
+      contexts[cid].platformId = platforms[i];
+      contexts[cid].device = dev - &devices[0];
+      contexts[cid].numSubDevices = numSubDevices;
+      memcpy(contexts[cid].deviceIds, deviceIds, sizeof(deviceIds));
+      contexts[cid].majorVersion = majorVersion;
+      contexts[cid].minorVersion = minorVersion;
+      contexts[cid].caps = ctxCaps;
+   } else {
+      assert(0);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_contextdestroy_1(VMCLContextId *argp) {
+   static VMAccelStatus result;
+   unsigned int cid = *((unsigned int *)argp);
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(contextIds, cid) && contexts[cid].context) {
+#if ENABLE_VMCL_SURFACE_ARENA
+      if (contexts[cid].arena != NULL) {
+         VMWOpenCLArena_Sweep(cid, true);
+         VMWOpenCLArena_Unregister(cid);
+         clReleaseMemObject(contexts[cid].arena);
+         contexts[cid].arena = NULL;
+      }
+#endif
+#if ENABLE_VMCL_STAGING_POOL
+      for (int i = 0; i < VMCL_STAGING_POOL_SIZE; i++) {
+         VMWOpenCLStaging_Free(cid, NULL, &contexts[cid].staging[i]);
+      }
+#endif
+      clReleaseContext(contexts[cid].context);
+      contexts[cid].context = NULL;
+   } else {
+      VMACCEL_WARNING("%s: Destroying id %d, already destroyed\n", __FUNCTION__,
+                      cid);
+   }
+
+   IdentifierDB_ReleaseId(contextIds, cid);
+
+   if (IdentifierDB_Count(contextIds) == 0) {
+      if (IdentifierDB_Count(surfaceIds) != 0) {
+         VMACCEL_WARNING(
+            "%s: Semantic error: Missing destructor call, %d surfaces "
+            "still active...\n",
+            __FUNCTION__, IdentifierDB_Count(surfaceIds));
+      }
+
+      if (IdentifierDB_Count(queueIds) != 0) {
+         VMACCEL_WARNING(
+            "%s: Semantic error: Missing destructor call, %d queues "
+            "still active...\n",
+            __FUNCTION__, IdentifierDB_Count(queueIds));
+      }
+
+      if (IdentifierDB_Count(samplerIds) != 0) {
+         VMACCEL_WARNING(
+            "%s: Semantic error: Missing destructor call, %d samplers "
+            "still active...\n",
+            __FUNCTION__, IdentifierDB_Count(samplerIds));
+      }
+
+      if (IdentifierDB_Count(kernelIds) != 0) {
+         VMACCEL_WARNING(
+            "%s: Semantic error: Missing destructor call, %d kernels "
+            "still active...\n",
+            __FUNCTION__, IdentifierDB_Count(kernelIds));
+      }
+   }
+
+   return (&result);
+}
+
+/*
+ * VMWOpenCLSurface_Alloc
+ *
+ * Allocates a surface, with the first instance created on the memory of a
+ * local client if given.
+ */
+static VMAccelSurfaceAllocateStatus *
+VMWOpenCLSurface_Alloc(VMCLSurfaceAllocateDesc *argp, void *hostPtr) {
+   static VMAccelSurfaceAllocateStatus result;
+   unsigned int cid = (unsigned int)argp->client.cid;
+   unsigned int sid = (unsigned int)argp->client.accel.id;
+   VMWOpenCLSurfaceInstance inst = {
+      0,
+   };
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(surfaceIds, sid)) {
+      VMACCEL_WARNING("%s: ERROR: Surface ID %d already active...\n",
+                      __FUNCTION__, sid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+#if DEBUG_STREAMS
+   VMACCEL_LOG("%s: sid=%d...\n", __FUNCTION__, sid);
+#endif
+
+   /*
+    * Only the first instance is allocated up front, the remaining instances
+    * are allocated when the surface is renamed.
+    */
+   if (VMWOpenCLSurface_AllocInstance(cid, &argp->desc, hostPtr, &inst) !=
+       VMACCEL_SUCCESS) {
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   /*
+    * Initialize mutexes to provide data coherency and consistency
+    * contracts.
+    */
+   pthread_mutexattr_t attr;
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+   pthread_mutex_init(&surfaces[sid].mutex, &attr);
+   if (IdentifierDB_AcquireId(surfaceIds, sid)) {
+      pthread_mutex_lock(&surfaces[sid].mutex);
+      surfaces[sid].cid = cid;
+      surfaces[sid].desc = argp->desc;
+      surfaces[sid].latest = 0;
+      for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
+         memset(&surfaces[sid].inst[i], 0, sizeof(surfaces[sid].inst[i]));
+         pthread_mutex_init(&surfaces[sid].inst[i].mutex, &attr);
+      }
+      surfaces[sid].inst[0].mem = inst.mem;
+      surfaces[sid].inst[0].svm_ptr = inst.svm_ptr;
+      surfaces[sid].inst[0].host_ptr = inst.host_ptr;
+      surfaces[sid].inst[0].arena = inst.arena;
+      surfaces[sid].inst[0].rangeId = inst.rangeId;
+      surfaces[sid].inst[0].bindId = inst.bindId;
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+   } else {
+      VMWOpenCLSurface_FreeInstance(cid, &inst);
+      assert(0);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+#if DEBUG_STREAMS
+   VMACCEL_LOG("%s: sid=%d allocated\n", __FUNCTION__, sid);
+#endif
+
+   return (&result);
+}
+
+VMAccelSurfaceAllocateStatus *
+vmwopencl_surfacealloc_1(VMCLSurfaceAllocateDesc *argp) {
+   return VMWOpenCLSurface_Alloc(argp, NULL);
+}
+
+/*
+ * vmwopencl_surfaceallocuser_1
+ *
+ * Allocates a buffer on the memory of a local client, the memory holds the
+ * contents of the buffer until it is destroyed. Devices only access page
+ * aligned memory in place, other memory is rejected and the caller falls
+ * back to a copying allocation.
+ */
+VMAccelSurfaceAllocateStatus *
+vmwopencl_surfaceallocuser_1(VMCLSurfaceAllocateInitOp *argp) {
+   static VMAccelSurfaceAllocateStatus result;
+   long pageSize = sysconf(_SC_PAGESIZE);
+
+   if ((argp->alloc.desc.type != VMACCEL_SURFACE_BUFFER) ||
+       (argp->data.data_len < argp->alloc.desc.width) || (pageSize <= 0) ||
+       (((uintptr_t)argp->data.data_val % pageSize) != 0)) {
+      memset(&result, 0, sizeof(result));
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
+   }
+
+   return VMWOpenCLSurface_Alloc(&argp->alloc, argp->data.data_val);
+}
+
+VMAccelStatus *vmwopencl_surfacedestroy_1(VMCLSurfaceId *argp) {
+   static VMAccelStatus result;
+   unsigned int sid = (unsigned int)argp->accel.id;
+
+#if DEBUG_STREAMS
+   VMACCEL_LOG("%s: Destroying sid=%d...\n", __FUNCTION__, sid);
+#endif
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   memset(&result, 0, sizeof(result));
+
+   assert(IdentifierDB_ActiveId(surfaceIds, sid));
+
+   for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
+      pthread_mutex_lock(&surfaces[sid].inst[i].mutex);
+      VMWOpenCLSurface_FreeInstance(surfaces[sid].cid, &surfaces[sid].inst[i]);
+      pthread_mutex_unlock(&surfaces[sid].inst[i].mutex);
+      pthread_mutex_destroy(&surfaces[sid].inst[i].mutex);
+   }
+
+   memset(&surfaces[sid], 0, sizeof(surfaces[0]));
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+   pthread_mutex_destroy(&surfaces[sid].mutex);
+
+   IdentifierDB_ReleaseId(surfaceIds, sid);
+   result.status = VMACCEL_SUCCESS;
+
+#if DEBUG_STREAMS
+   VMACCEL_LOG("%s: sid=%d released...\n", __FUNCTION__, sid);
+#endif
+
+   return (&result);
+}
+
+VMAccelQueueStatus *vmwopencl_queuealloc_1(VMCLQueueAllocateDesc *argp) {
+   static VMAccelQueueStatus result;
+   unsigned int cid = (unsigned int)argp->client.cid;
+   unsigned int qid = (unsigned int)argp->client.id;
+   unsigned int subDevice = (unsigned int)argp->subDevice;
+   cl_context context = contexts[cid].context;
+   cl_int errNum;
+   cl_device_id *devices;
+   cl_command_queue commandQueue = NULL;
+   cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, 0, 0};
+   size_t deviceBufferSize = -1;
+
+   memset(&result, 0, sizeof(result));
+
+   if (IdentifierDB_ActiveId(queueIds, qid)) {
+      VMACCEL_WARNING("%s: ERROR: Queue ID %d already active...\n",
+                      __FUNCTION__, qid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   // First get the size of the devices buffer
+   errNum =
+      clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
+
+   if (errNum != CL_SUCCESS) {
+      VMACCEL_WARNING(
+         "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)");
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (deviceBufferSize <= 0) {
+      VMACCEL_WARNING("No devices available.");
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   // Allocate memory for the devices buffer
+   devices =
+      calloc(deviceBufferSize / sizeof(cl_device_id), sizeof(cl_device_id));
+
+   errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize,
+                             devices, NULL);
+
+   if (errNum != CL_SUCCESS ||
+       subDevice >= (deviceBufferSize / sizeof(cl_device_id))) {
+      free(devices);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (argp->desc.flags & VMACCEL_QUEUE_OUT_OF_ORDER_EXEC_FLAG) {
+      properties[1] |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+   }
+
+   if (argp->desc.flags & VMACCEL_QUEUE_ENABLE_PROFILING_FLAG) {
+      properties[1] |= CL_QUEUE_PROFILING_ENABLE;
+   }
+
+   commandQueue = clCreateCommandQueueWithProperties(
+      context, devices[subDevice], properties, NULL);
+   VMACCEL_WARNING("Device[%d]: Allocating queue %d on device id 0x%x\n",
+                   subDevice, qid, devices[subDevice]);
+   if (commandQueue == NULL) {
+      VMACCEL_WARNING("Failed to create commandQueue for device 0");
+      free(devices);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   free(devices);
+
+   if (IdentifierDB_AcquireId(queueIds, qid)) {
+      memset(&queues[qid], 0, sizeof(queues[0]));
+      queues[qid].cid = cid;
+      queues[qid].subDevice = subDevice;
+      queues[qid].desc = argp->desc;
+      queues[qid].queue = commandQueue;
+      queues[qid].profiling =
+         (argp->desc.flags & VMACCEL_QUEUE_ENABLE_PROFILING_FLAG) != 0;
+   } else {
+      clReleaseCommandQueue(commandQueue);
+      assert(0);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return (&result);
+}
 
 VMAccelStatus *vmwopencl_queuedestroy_1(VMCLQueueId *argp) {
    static VMAccelStatus result;
-   unsigned int qid = (unsigned int)argp->id;
+   unsigned int qid = (unsigned int)argp->id;
+
+   memset(&result, 0, sizeof(result));
+
+   assert(IdentifierDB_ActiveId(queueIds, qid));
+
+   pthread_mutex_lock(&profileMutex);
+   for (int i = 0; i < VMCL_PROFILE_MAX; i++) {
+      if (queues[qid].profile[i] != NULL) {
+         clReleaseEvent(queues[qid].profile[i]);
+      }
+   }
+   pthread_mutex_unlock(&profileMutex);
+
+   clReleaseCommandQueue(queues[qid].queue);
+   memset(&queues[qid], 0, sizeof(queues[0]));
+
+   IdentifierDB_ReleaseId(queueIds, qid);
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_queueflush_1(VMCLQueueId *argp) {
+   static VMAccelStatus result;
+   unsigned int qid = (unsigned int)argp->id;
+   cl_int errNum;
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: flushing qid=%d\n", __FUNCTION__, qid);
+#endif
+
+   memset(&result, 0, sizeof(result));
+
+   errNum = clFlush(queues[qid].queue);
+
+   if (errNum != CL_SUCCESS) {
+      result.status = VMACCEL_FAIL;
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_imageupload_1(VMCLImageUploadOp *argp) {
+   static VMAccelStatus result;
+   unsigned int cid = (unsigned int)argp->queue.cid;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+   unsigned int inst;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   cl_int errNum;
+#if ENABLE_VMCL_STAGING_POOL
+   VMWOpenCLStaging *stg = NULL;
+#endif
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   /*
+    * Write-discard updates of a new generation are renamed, allowing the
+    * update to proceed while the previous generation is in use.
+    */
+   if ((argp->mode == VMACCEL_SURFACE_WRITE_DISCARD) &&
+       (surfaces[sid].inst[surfaces[sid].latest].generation < gen)) {
+      inst = VMWOpenCLSurface_RenameInstance(sid);
+   } else {
+      inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+   }
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d\n", __FUNCTION__, sid, gen, inst);
+   VMACCEL_LOG("%s: cid=%d, qid=%d\n", __FUNCTION__, cid, qid);
+
+   for (int i = 0; i < argp->op.imgRegion.size.x / 4; i++) {
+      VMACCEL_LOG("%s: uint32[%d] = 0x%x\n", __FUNCTION__, i,
+                  ((unsigned int *)argp->op.ptr.ptr_val)[i]);
+   }
+#endif
+
+   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+   if (surfaces[sid].inst[inst].generation > gen) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+
+      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+
+      return (&result);
+   }
+
+   memset(&result, 0, sizeof(result));
+
+   assert(cid == argp->img.cid);
+
+   if ((surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER ||
+        VMAccel_SurfaceIsImage(&surfaces[sid].desc)) &&
+       surfaces[sid].inst[inst].svm_ptr == NULL) {
+      size_t origin[3], region[3], rowPitch, slicePitch;
+      void *ptr = argp->op.ptr.ptr_val;
+      cl_bool blocking = CL_TRUE;
+
+      if (!VMAccel_SurfaceRegionLayout(&surfaces[sid].desc,
+                                       &argp->op.imgRegion, origin, region,
+                                       &rowPitch, &slicePitch) ||
+          (argp->op.ptr.ptr_len < region[0] * region[1] * region[2])) {
+         VMACCEL_WARNING("%s: Invalid region for sid=%d\n", __FUNCTION__,
+                         sid);
+         result.status = VMACCEL_SEMANTIC_ERROR;
+
+         pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+         pthread_mutex_unlock(&surfaces[sid].mutex);
+
+         return (&result);
+      }
+
+      if (VMWOpenCLSurface_IsHostTransfer(&surfaces[sid].desc,
+                                          &surfaces[sid].inst[inst], region,
+                                          ptr)) {
+         errNum = VMWOpenCLSurface_SyncHost(queue, &surfaces[sid].inst[inst],
+                                            surfaces[sid].desc.width, true,
+                                            &event);
+      } else {
+#if ENABLE_VMCL_STAGING_POOL
+         /*
+          * Copy the update to pinned memory, the transfer to the device is
+          * asynchronous and ordered by the queue.
+          */
+         stg = VMWOpenCLStaging_Acquire(cid, queue,
+                                        region[0] * region[1] * region[2]);
+
+         if (stg != NULL) {
+            memcpy(stg->ptr, ptr, region[0] * region[1] * region[2]);
+            ptr = stg->ptr;
+            blocking = CL_FALSE;
+         }
+#endif
+
+         errNum = VMWOpenCLSurface_Transfer(
+            &surfaces[sid].desc, queue, surfaces[sid].inst[inst].mem, true,
+            blocking, origin, region, rowPitch, slicePitch, ptr,
+            surfaces[sid].inst[inst].event, &event);
+      }
+
+#if ENABLE_VMCL_STAGING_POOL
+      if (stg != NULL) {
+         VMWOpenCLStaging_Release(stg, event);
+      }
+#endif
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("%s: Failed to enqueuew update\n", __FUNCTION__);
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_UPLOAD, event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[sid].inst[inst], event);
+         VMWOpenCLSurface_CommitInstance(&surfaces[sid], inst, gen);
+      }
+
+      if (event != NULL) {
+         clReleaseEvent(event);
+      }
+#if CL_VERSION_2_0
+   } else if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
+      VMWOpenCLSurfaceInstance *buf = &surfaces[sid].inst[inst];
+      size_t offset = argp->op.imgRegion.coord.x;
+      size_t size = argp->op.imgRegion.size.x;
+      cl_event waitList[1];
+      cl_uint numEvents = VMWOpenCLSurface_WaitList(buf, waitList, 0);
+
+      /*
+       * Shared virtual memory buffers are updated in place, the update is
+       * blocking since the contents are owned by the request.
+       */
+      if ((offset + size > surfaces[sid].desc.width) ||
+          (argp->op.ptr.ptr_len < size)) {
+         result.status = VMACCEL_SEMANTIC_ERROR;
+      } else {
+         errNum = clEnqueueSVMMemcpy(
+            queue, CL_TRUE, (char *)buf->svm_ptr + offset,
+            argp->op.ptr.ptr_val, size, numEvents,
+            (numEvents > 0) ? waitList : NULL,
+            VMWOpenCLQueue_ProfileEvent(qid, &event));
+
+         if (errNum != CL_SUCCESS) {
+            result.status = VMACCEL_FAIL;
+         } else {
+            VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_UPLOAD, event);
+            VMWOpenCLSurface_CommitInstance(&surfaces[sid], inst, gen);
+         }
+      }
+
+      if (event != NULL) {
+         clReleaseEvent(event);
+      }
+#endif
+   } else {
+      assert(0);
+
+      result.status = VMACCEL_FAIL;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelDownloadStatus *vmwopencl_imagedownload_1(VMCLImageDownloadOp *argp) {
+   static VMAccelDownloadStatus result;
+   unsigned int cid = (unsigned int)argp->queue.cid;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+   unsigned int inst;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   void *ptr;
+   cl_int errNum;
+#if ENABLE_VMCL_STAGING_POOL
+   VMWOpenCLStaging *stg = NULL;
+#endif
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+
+   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+   if (surfaces[sid].inst[inst].generation != gen) {
+      if (surfaces[sid].inst[inst].generation > gen) {
+         VMACCEL_WARNING("Out-of-order update detected, client/server"
+                         " out of sync...\n");
+         result.status = VMACCEL_SEMANTIC_ERROR;
+      } else {
+         result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      }
+
+      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+
+      return (&result);
+   }
+
+   memset(&result, 0, sizeof(result));
+
+   assert(cid == argp->img.cid);
+
+   if ((surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER ||
+        VMAccel_SurfaceIsImage(&surfaces[sid].desc)) &&
+       surfaces[sid].inst[inst].svm_ptr == NULL) {
+      size_t origin[3], region[3], rowPitch, slicePitch, size;
+      unsigned int blocking = 0;
+      bool hostTransfer;
+
+      if (!VMAccel_SurfaceRegionLayout(&surfaces[sid].desc,
+                                       &argp->op.imgRegion, origin, region,
+                                       &rowPitch, &slicePitch) ||
+          ((argp->op.ptr.ptr_val != NULL) &&
+           (argp->op.ptr.ptr_len < region[0] * region[1] * region[2]))) {
+         VMACCEL_WARNING("%s: Invalid region for sid=%d\n", __FUNCTION__,
+                         sid);
+         result.status = VMACCEL_SEMANTIC_ERROR;
+
+         pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+         pthread_mutex_unlock(&surfaces[sid].mutex);
+
+         return (&result);
+      }
+
+      size = region[0] * region[1] * region[2];
+
+      if (argp->op.ptr.ptr_val == NULL) {
+         ptr = calloc(1, size);
+      } else {
+         ptr = argp->op.ptr.ptr_val;
+      }
+
+      if (argp->mode == VMACCEL_SURFACE_READ_SYNCHRONOUS) {
+         VMACCEL_LOG("%s: Enqueing blocking read sid=%d -> %p\n", __FUNCTION__,
+                     sid, ptr);
+         blocking = TRUE;
+      }
+
+      hostTransfer = VMWOpenCLSurface_IsHostTransfer(
+         &surfaces[sid].desc, &surfaces[sid].inst[inst], region, ptr);
+
+#if ENABLE_VMCL_STAGING_POOL
+      /*
+       * Synchronous reads land in pinned memory before the copy out.
+       */
+      if (blocking && !hostTransfer) {
+         stg = VMWOpenCLStaging_Acquire(cid, queue, size);
+      }
+
+      if (stg != NULL) {
+         errNum = VMWOpenCLSurface_Transfer(
+            &surfaces[sid].desc, queue, surfaces[sid].inst[inst].mem, false,
+            CL_TRUE, origin, region, rowPitch, slicePitch, stg->ptr,
+            surfaces[sid].inst[inst].event, &event);
+
+         if (errNum == CL_SUCCESS) {
+            memcpy(ptr, stg->ptr, size);
+         }
+
+         VMWOpenCLStaging_Release(stg, event);
+      } else
+#endif
+         if (hostTransfer) {
+         errNum = VMWOpenCLSurface_SyncHost(queue, &surfaces[sid].inst[inst],
+                                            size, false, &event);
+      } else {
+         errNum = VMWOpenCLSurface_Transfer(
+            &surfaces[sid].desc, queue, surfaces[sid].inst[inst].mem, false,
+            blocking, origin, region, rowPitch, slicePitch, ptr,
+            surfaces[sid].inst[inst].event, &event);
+      }
+
+      if (errNum != CL_SUCCESS) {
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_DOWNLOAD, event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[sid].inst[inst], event);
+         clReleaseEvent(event);
+
+         result.ptr.ptr_len = size;
+         result.ptr.ptr_val = ptr;
+      }
+   } else {
+      assert(0);
+
+      result.status = VMACCEL_FAIL;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelSurfaceMapStatus *vmwopencl_surfacemap_1(VMCLSurfaceMapOp *argp) {
+   static VMAccelSurfaceMapStatus result;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int sid = (unsigned int)argp->op.surf.id;
+   unsigned int gen = (unsigned int)argp->op.surf.generation;
+   unsigned int inst;
+   unsigned int blocking = TRUE;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   void *ptr;
+   cl_map_flags flags = 0;
+   cl_int errNum = CL_SUCCESS;
+
+   memset(&result, 0, sizeof(result));
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   /*
+    * Write-discard mappings of a new generation are renamed, the mapping
+    * is committed to the surface upon unmap.
+    */
+   if ((argp->op.mapFlags & VMACCEL_MAP_WRITE_DISCARD_FLAG) &&
+       (surfaces[sid].inst[surfaces[sid].latest].generation < gen)) {
+      inst = VMWOpenCLSurface_RenameInstance(sid);
+   } else {
+      inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+   }
+
+   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+   if (surfaces[sid].inst[inst].generation > gen) {
+      result.status = VMACCEL_SEMANTIC_ERROR;
+
+      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+
+      return (&result);
+   }
+
+   if (argp->op.mapFlags & VMACCEL_MAP_READ_FLAG) {
+      flags |= CL_MAP_READ;
+   }
+
+   if (argp->op.mapFlags & VMACCEL_MAP_WRITE_FLAG) {
+      flags |= CL_MAP_WRITE;
+   }
+
+   if (argp->op.mapFlags & VMACCEL_MAP_WRITE_DISCARD_FLAG) {
+      flags |= CL_MAP_WRITE_INVALIDATE_REGION;
+   }
+
+   if (argp->op.mapFlags & VMACCEL_MAP_ASYNC_FLAG) {
+      blocking = FALSE;
+   }
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d\n", __FUNCTION__, sid, gen, inst);
+#endif
+
+   if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
+      if (++surfaces[sid].inst[inst].mapping.refCount == 1) {
+         if (surfaces[sid].inst[inst].svm_ptr) {
+            if (blocking) {
+               errNum = clFinish(queues[qid].queue);
+            }
+            if (errNum == CL_SUCCESS) {
+               ptr = surfaces[sid].inst[inst].svm_ptr;
+            }
+         } else {
+            ptr = clEnqueueMapBuffer(
+               queue, surfaces[sid].inst[inst].mem, blocking, flags,
+               argp->op.coord.x, argp->op.size.x, 0, NULL,
+               VMWOpenCLQueue_ProfileEvent(qid, &event), &errNum);
+         }
+
+         surfaces[sid].inst[inst].mapping.write =
+            (flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION)) != 0;
+      } else {
+         errNum = CL_SUCCESS;
+         ptr = surfaces[sid].inst[inst].mapping.ptr;
+      }
+
+#if DEBUG_SURFACE_CONSISTENCY
+      for (int i = 0; i < argp->op.size.x / 4; i++) {
+         VMACCEL_LOG("%s: uint32[%d] = 0x%x\n", __FUNCTION__, i,
+                     ((unsigned int *)ptr)[i]);
+      }
+#endif
+
+      if (errNum != CL_SUCCESS) {
+         result.status = VMACCEL_FAIL;
+      } else {
+         /*
+          * Read-only mappings transfer the surface contents to the client.
+          */
+         if (!surfaces[sid].inst[inst].mapping.write) {
+            VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_DOWNLOAD, event);
+         }
+
+         surfaces[sid].inst[inst].mapping.ptr = ptr;
+         surfaces[sid].inst[inst].mapping.generation = gen;
+
+         result.ptr.ptr_val = ptr;
+         result.ptr.ptr_len = argp->op.size.x;
+      }
+   } else if (VMAccel_SurfaceIsImage(&surfaces[sid].desc)) {
+      VMWOpenCLSurfaceInstance *img = &surfaces[sid].inst[inst];
+      unsigned int depth = MAX(surfaces[sid].desc.depth, 1);
+      size_t origin[3], region[3], rowPitch, slicePitch;
+
+      /*
+       * The device layout of a mapped image is implementation defined, the
+       * mapped region is read back into tightly packed memory instead. An
+       * image mapping spans the slices from the mapped coordinate onwards.
+       */
+      if (++img->mapping.refCount == 1) {
+         img->mapping.region.coord = argp->op.coord;
+         img->mapping.region.size.x = argp->op.size.x;
+         img->mapping.region.size.y = argp->op.size.y;
+         img->mapping.region.size.z = depth - argp->op.coord.z;
+      }
+
+      ptr = img->mapping.ptr;
+
+      if ((argp->op.coord.z >= depth) ||
+          !VMAccel_SurfaceRegionLayout(&surfaces[sid].desc,
+                                       &img->mapping.region, origin, region,
+                                       &rowPitch, &slicePitch)) {
+         errNum = CL_INVALID_VALUE;
+      } else if (img->mapping.refCount == 1) {
+         ptr = malloc(region[0] * region[1] * region[2]);
+
+         if (ptr == NULL) {
+            errNum = CL_OUT_OF_HOST_MEMORY;
+         } else if ((flags & CL_MAP_WRITE_INVALIDATE_REGION) == 0) {
+            errNum = VMWOpenCLSurface_Transfer(
+               &surfaces[sid].desc, queue, img->mem, false, CL_TRUE, origin,
+               region, rowPitch, slicePitch, ptr, img->event,
+               VMWOpenCLQueue_ProfileEvent(qid, &event));
+         }
+
+         img->mapping.write =
+            (flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION)) != 0;
+      }
+
+      if (errNum != CL_SUCCESS) {
+         if (--img->mapping.refCount == 0) {
+            free(ptr);
+         }
+         result.status = VMACCEL_FAIL;
+      } else {
+         if (!img->mapping.write) {
+            VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_DOWNLOAD, event);
+         }
+
+         img->mapping.ptr = ptr;
+         img->mapping.generation = gen;
+
+         result.ptr.ptr_val = ptr;
+         result.ptr.ptr_len = region[0] * region[1] * region[2];
+      }
+   } else {
+      assert(0);
+      result.status = VMACCEL_FAIL;
+   }
+
+   if (event != NULL) {
+      clReleaseEvent(event);
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_surfaceunmap_1(VMCLSurfaceUnmapOp *argp) {
+   static VMAccelStatus result;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int sid = (unsigned int)argp->op.surf.id;
+   unsigned int gen = (unsigned int)argp->op.surf.generation;
+   unsigned int inst;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   void *ptr;
+   cl_int errNum = CL_SUCCESS;
+
+   memset(&result, 0, sizeof(result));
+
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   /*
+    * Locate the instance mapped for this generation, which may have been
+    * renamed by the map operation.
+    */
+   inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+
+   for (int i = 0; i < VMACCEL_MAX_SURFACE_INSTANCE; i++) {
+      if ((surfaces[sid].inst[i].mapping.refCount > 0) &&
+          (surfaces[sid].inst[i].mapping.generation == gen)) {
+         inst = i;
+         break;
+      }
+   }
+
+   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+   /*
+    * memcpy the data from the incoming mapping object.
+    */
+   ptr = surfaces[sid].inst[inst].mapping.ptr;
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d, *ptr=%x, %x, %x, %x\n",
+               __FUNCTION__, sid, gen, inst,
+               ((unsigned int *)argp->op.ptr.ptr_val)[0],
+               ((unsigned int *)argp->op.ptr.ptr_val)[1],
+               ((unsigned int *)argp->op.ptr.ptr_val)[2],
+               ((unsigned int *)argp->op.ptr.ptr_val)[3]);
+#endif
+
+   memcpy(ptr, argp->op.ptr.ptr_val, argp->op.ptr.ptr_len);
+
+   /*
+    * We are done with the contents, free the pointer.
+    */
+   if ((argp->op.mapFlags & VMACCEL_MAP_NO_FREE_PTR_FLAG) == 0) {
+      free(argp->op.ptr.ptr_val);
+      argp->op.ptr.ptr_val = NULL;
+      argp->op.ptr.ptr_len = 0;
+   }
+
+   if (--surfaces[sid].inst[inst].mapping.refCount == 0) {
+      if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
+         if (surfaces[sid].inst[inst].svm_ptr == NULL) {
+            errNum = clEnqueueUnmapMemObject(
+               queue, surfaces[sid].inst[inst].mem, ptr, 0, NULL,
+               VMWOpenCLQueue_ProfileEvent(qid, &event));
+         }
+
+         /*
+          * Writable mappings transfer the client contents to the surface.
+          */
+         if ((errNum == CL_SUCCESS) &&
+             surfaces[sid].inst[inst].mapping.write) {
+            VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_UPLOAD, event);
+         }
+
+         if (event != NULL) {
+            clReleaseEvent(event);
+         }
+      } else if (VMAccel_SurfaceIsImage(&surfaces[sid].desc)) {
+         VMWOpenCLSurfaceInstance *img = &surfaces[sid].inst[inst];
+         size_t origin[3], region[3], rowPitch, slicePitch;
+
+         /*
+          * Writable mappings of an image are written back from the packed
+          * copy of the mapped region.
+          */
+         if (img->mapping.write) {
+            VMAccel_SurfaceRegionLayout(&surfaces[sid].desc,
+                                        &img->mapping.region, origin, region,
+                                        &rowPitch, &slicePitch);
+
+            errNum = VMWOpenCLSurface_Transfer(
+               &surfaces[sid].desc, queue, img->mem, true, CL_TRUE, origin,
+               region, rowPitch, slicePitch, ptr, img->event,
+               VMWOpenCLQueue_ProfileEvent(qid, &event));
+
+            if (errNum == CL_SUCCESS) {
+               VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_UPLOAD, event);
+            }
+
+            if (event != NULL) {
+               clReleaseEvent(event);
+            }
+         }
+
+         free(ptr);
+      }
+      surfaces[sid].inst[inst].mapping.ptr = NULL;
+   }
+
+   if (errNum != CL_SUCCESS) {
+      VMACCEL_WARNING("Unable to unmap sid=%d instance=%d generation=%d\n", sid,
+                      inst, gen);
+      result.status = VMACCEL_FAIL;
+   } else {
+      VMWOpenCLSurface_CommitInstance(&surfaces[sid], inst, gen);
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_surfacecopy_1(VMCLSurfaceCopyOp *argp) {
+   static VMAccelStatus result;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int dstSid = (unsigned int)argp->dst.accel.id;
+   unsigned int dstGen = (unsigned int)argp->dst.accel.generation;
+   unsigned int dstInst;
+   unsigned int srcSid = (unsigned int)argp->src.accel.id;
+   unsigned int srcGen = (unsigned int)argp->src.accel.generation;
+   unsigned int srcInst;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   cl_event waitList[2];
+   cl_uint numEvents;
+   cl_int errNum;
+
+   memset(&result, 0, sizeof(result));
+
+   /*
+    * Cross context surface copy is not currently supported.
+    */
+   if (argp->dst.cid != argp->src.cid) {
+      assert(0);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   pthread_mutex_lock(&surfaces[srcSid].mutex);
+   pthread_mutex_lock(&surfaces[dstSid].mutex);
+
+   srcInst = VMWOpenCLSurface_LookupInstance(&surfaces[srcSid], srcGen);
+   dstInst = VMWOpenCLSurface_LookupInstance(&surfaces[dstSid], dstGen);
+
+   pthread_mutex_lock(&surfaces[srcSid].inst[srcInst].mutex);
+   pthread_mutex_lock(&surfaces[dstSid].inst[dstInst].mutex);
+
+   if (surfaces[srcSid].inst[srcInst].generation < srcGen) {
+      VMACCEL_LOG("%s: generation %d < %d\n", __FUNCTION__,
+                  surfaces[srcSid].inst[srcInst].generation, srcGen);
+
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+
+      pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
+      pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
+
+      pthread_mutex_unlock(&surfaces[dstSid].mutex);
+      pthread_mutex_unlock(&surfaces[srcSid].mutex);
+
+      return (&result);
+   }
+
+   if ((surfaces[srcSid].inst[srcInst].generation > srcGen) ||
+       (surfaces[dstSid].inst[dstInst].generation > dstGen)) {
+      VMACCEL_LOG("%s: semantic error backend.srcGen=%d srcGen=%d"
+                  " backend.dstGen=%d dstGen=%d\n",
+                  __FUNCTION__, surfaces[srcSid].inst[srcInst].generation,
+                  srcGen, surfaces[dstSid].inst[dstInst].generation, dstGen);
+
+      result.status = VMACCEL_SEMANTIC_ERROR;
+
+      pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
+      pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
+
+      pthread_mutex_unlock(&surfaces[dstSid].mutex);
+      pthread_mutex_unlock(&surfaces[srcSid].mutex);
+
+      return (&result);
+   }
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: srcSid=%d, srcGen=%d, dstSid=%d, dstGen=%d\n", __FUNCTION__,
+               srcSid, srcGen, dstSid, dstGen);
+#endif
+
+   numEvents =
+      VMWOpenCLSurface_WaitList(&surfaces[srcSid].inst[srcInst], waitList, 0);
+   numEvents = VMWOpenCLSurface_WaitList(&surfaces[dstSid].inst[dstInst],
+                                         waitList, numEvents);
+
+   if (surfaces[srcSid].inst[srcInst].svm_ptr ||
+       surfaces[dstSid].inst[dstInst].svm_ptr) {
+      VMACCEL_WARNING("%s: Copy with SVM unsupported.\n", __FUNCTION__);
+      result.status = VMACCEL_FAIL;
+   } else if ((surfaces[dstSid].desc.type == VMACCEL_SURFACE_BUFFER) &&
+              (surfaces[srcSid].desc.type == VMACCEL_SURFACE_BUFFER)) {
+      errNum = clEnqueueCopyBuffer(
+         queue, surfaces[srcSid].inst[srcInst].mem,
+         surfaces[dstSid].inst[dstInst].mem, argp->op.srcRegion.coord.x,
+         argp->op.dstRegion.coord.x, argp->op.dstRegion.size.x, numEvents,
+         (numEvents > 0) ? waitList : NULL, &event);
+
+      if (errNum != CL_SUCCESS) {
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_COPY, event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[srcSid].inst[srcInst], event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[dstSid].inst[dstInst], event);
+         clReleaseEvent(event);
+      }
+   } else if (VMAccel_SurfaceIsImage(&surfaces[dstSid].desc) ||
+              VMAccel_SurfaceIsImage(&surfaces[srcSid].desc)) {
+      size_t srcOrigin[3], srcRegion[3], dstOrigin[3], dstRegion[3];
+      cl_mem srcMem = surfaces[srcSid].inst[srcInst].mem;
+      cl_mem dstMem = surfaces[dstSid].inst[dstInst].mem;
+      bool srcImage = VMWOpenCLSurface_ImageRegion(
+         &surfaces[srcSid].desc, &argp->op.srcRegion, srcOrigin, srcRegion);
+      bool dstImage = VMWOpenCLSurface_ImageRegion(
+         &surfaces[dstSid].desc, &argp->op.dstRegion, dstOrigin, dstRegion);
+
+      errNum = CL_INVALID_VALUE;
+
+      /*
+       * Image regions are in elements, buffer regions are tightly packed
+       * and addressed by the byte offset of the region.
+       */
+      if (srcImage && dstImage) {
+         errNum = clEnqueueCopyImage(queue, srcMem, dstMem, srcOrigin,
+                                     dstOrigin, dstRegion, numEvents,
+                                     (numEvents > 0) ? waitList : NULL,
+                                     &event);
+      } else if (dstImage && (surfaces[srcSid].desc.type ==
+                              VMACCEL_SURFACE_BUFFER)) {
+         errNum = clEnqueueCopyBufferToImage(
+            queue, srcMem, dstMem, argp->op.srcRegion.coord.x, dstOrigin,
+            dstRegion, numEvents, (numEvents > 0) ? waitList : NULL, &event);
+      } else if (srcImage && (surfaces[dstSid].desc.type ==
+                              VMACCEL_SURFACE_BUFFER)) {
+         errNum = clEnqueueCopyImageToBuffer(
+            queue, srcMem, dstMem, srcOrigin, srcRegion,
+            argp->op.dstRegion.coord.x, numEvents,
+            (numEvents > 0) ? waitList : NULL, &event);
+      }
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("%s: Copy failed errNum=%d\n", __FUNCTION__, errNum);
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_COPY, event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[srcSid].inst[srcInst], event);
+         VMWOpenCLSurface_AttachEvent(&surfaces[dstSid].inst[dstInst], event);
+         clReleaseEvent(event);
+      }
+   } else {
+      assert(0);
+      result.status = VMACCEL_FAIL;
+   }
+
+   pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
+   pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
+
+   pthread_mutex_unlock(&surfaces[dstSid].mutex);
+   pthread_mutex_unlock(&surfaces[srcSid].mutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_imagefill_1(VMCLImageFillOp *argp) {
+   static VMAccelStatus result;
+   unsigned int qid = (unsigned int)argp->queue.id;
+   unsigned int sid = (unsigned int)argp->img.accel.id;
+   unsigned int gen = (unsigned int)argp->img.accel.generation;
+   unsigned int inst;
+   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   cl_event wait;
+   cl_int errNum;
+
+   memset(&result, 0, sizeof(result));
+
+   /*
+    * Cross context surface copy is not currently supported.
+    */
+   pthread_mutex_lock(&surfaces[sid].mutex);
+
+   inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+
+   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+   if (surfaces[sid].inst[inst].generation < gen) {
+      VMACCEL_LOG("%s: generation %d < %d\n", __FUNCTION__,
+                  surfaces[sid].inst[inst].generation, gen);
+
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+
+      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+
+      return (&result);
+   }
+
+   if (surfaces[sid].inst[inst].generation > gen) {
+      VMACCEL_LOG("%s: semantic error backend.gen=%d gen=%d", __FUNCTION__,
+                  surfaces[sid].inst[inst].generation, gen);
+
+      result.status = VMACCEL_SEMANTIC_ERROR;
+
+      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+
+      pthread_mutex_unlock(&surfaces[sid].mutex);
+
+      return (&result);
+   }
+
+#if DEBUG_SURFACE_CONSISTENCY
+   VMACCEL_LOG("%s: sid=%d, gen=%d\n", __FUNCTION__, sid, gen);
+#endif
+
+   wait = surfaces[sid].inst[inst].event;
+
+   if (surfaces[sid].inst[inst].svm_ptr) {
+      VMACCEL_WARNING("%s: Fill with SVM unsupported.\n", __FUNCTION__);
+      result.status = VMACCEL_FAIL;
+   } else if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
+      errNum = clEnqueueFillBuffer(
+         queue, surfaces[sid].inst[inst].mem, (const void *)&argp->op.u,
+         sizeof(argp->op.u), argp->op.dstRegion.coord.x,
+         argp->op.dstRegion.size.x, (wait != NULL) ? 1 : 0,
+         (wait != NULL) ? &wait : NULL, &event);
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("%s: Fill failed errNum=%d\n", __FUNCTION__, errNum);
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLSurface_AttachEvent(&surfaces[sid].inst[inst], event);
+         clReleaseEvent(event);
+         VMWOpenCLSurface_CommitInstance(&surfaces[sid], inst, gen);
+      }
+   } else if (VMAccel_SurfaceIsImage(&surfaces[sid].desc)) {
+      size_t origin[3], region[3];
+      const void *color =
+         VMWOpenCLSurface_IsIntegerImage(surfaces[sid].desc.format)
+            ? (const void *)&argp->op.u
+            : (const void *)&argp->op.f;
+
+      errNum = CL_INVALID_VALUE;
+
+      if (VMWOpenCLSurface_ImageRegion(&surfaces[sid].desc,
+                                       &argp->op.dstRegion, origin, region)) {
+         errNum = clEnqueueFillImage(
+            queue, surfaces[sid].inst[inst].mem, color, origin, region,
+            (wait != NULL) ? 1 : 0, (wait != NULL) ? &wait : NULL, &event);
+      }
+
+      if (errNum != CL_SUCCESS) {
+         VMACCEL_WARNING("%s: Fill failed errNum=%d\n", __FUNCTION__, errNum);
+         result.status = VMACCEL_FAIL;
+      } else {
+         VMWOpenCLSurface_AttachEvent(&surfaces[sid].inst[inst], event);
+         clReleaseEvent(event);
+         VMWOpenCLSurface_CommitInstance(&surfaces[sid], inst, gen);
+      }
+   } else {
+      assert(0);
+      result.status = VMACCEL_FAIL;
+   }
+
+   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+
+   pthread_mutex_unlock(&surfaces[sid].mutex);
+
+   return (&result);
+}
+
+VMCLSamplerAllocateStatus *
+vmwopencl_sampleralloc_1(VMCLSamplerAllocateDesc *argp) {
+   static VMCLSamplerAllocateStatus result;
+   unsigned int cid = (unsigned int)argp->client.cid;
+   unsigned int id = (unsigned int)argp->client.id;
+   const cl_addressing_mode addressModes[] = {
+      CL_ADDRESS_MIRRORED_REPEAT, CL_ADDRESS_REPEAT, CL_ADDRESS_CLAMP_TO_EDGE,
+      CL_ADDRESS_CLAMP, CL_ADDRESS_NONE,
+   };
+   cl_sampler_properties properties[] = {
+      CL_SAMPLER_NORMALIZED_COORDS,
+      argp->desc.normalizedCoords ? CL_TRUE : CL_FALSE,
+      CL_SAMPLER_ADDRESSING_MODE,
+      CL_ADDRESS_NONE,
+      CL_SAMPLER_FILTER_MODE,
+      (argp->desc.filterMode == VMCL_FILTER_LINEAR) ? CL_FILTER_LINEAR
+                                                     : CL_FILTER_NEAREST,
+      0,
+   };
+   cl_sampler sampler;
+   cl_int errNum;
+
+   memset(&result, 0, sizeof(result));
+
+   if (id >= VMCL_MAX_SAMPLERS) {
+      VMACCEL_WARNING("%s: ERROR: Sampler ID %d out of range...\n",
+                      __FUNCTION__, id);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   if (IdentifierDB_ActiveId(samplerIds, id)) {
+      VMACCEL_WARNING("%s: ERROR: Sampler ID %d already active...\n",
+                      __FUNCTION__, id);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   if (argp->desc.addressMode <= VMCL_ADDRESS_NONE) {
+      properties[3] = addressModes[argp->desc.addressMode];
+   }
+
+   sampler = clCreateSamplerWithProperties(contexts[cid].context, properties,
+                                           &errNum);
+
+   if ((sampler == NULL) || (errNum != CL_SUCCESS)) {
+      VMACCEL_WARNING("%s: Unable to create sampler %d, errNum=%d\n",
+                      __FUNCTION__, id, errNum);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
+
+   if (IdentifierDB_AcquireId(samplerIds, id)) {
+      samplers[id].cid = cid;
+      samplers[id].desc = argp->desc;
+      samplers[id].sampler = sampler;
+   } else {
+      clReleaseSampler(sampler);
+      assert(0);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_samplerdestroy_1(VMCLSamplerId *argp) {
+   static VMAccelStatus result;
+   unsigned int id = (unsigned int)argp->id;
+
+   memset(&result, 0, sizeof(result));
+
+   assert(IdentifierDB_ActiveId(samplerIds, id));
+
+   clReleaseSampler(samplers[id].sampler);
+   memset(&samplers[id], 0, sizeof(samplers[0]));
+
+   IdentifierDB_ReleaseId(samplerIds, id);
+
+   return (&result);
+}
+
+static cl_program VMWOpenCLProgram_Build(unsigned int cid,
+                                         cl_device_id deviceId,
+                                         VMCLKernelAllocateDesc *argp,
+                                         const char *options) {
+   cl_context context = contexts[cid].context;
+   cl_program program = NULL;
+   cl_int errNum;
+   size_t sourceLength = argp->source.source_len;
+
+   if ((argp->language == VMCL_OPENCL_C_1_0) ||
+       (argp->language == VMCL_OPENCL_C_1_1) ||
+       (argp->language == VMCL_OPENCL_C_1_2)
+#if CL_VERSION_2_0
+       || ((contexts[cid].majorVersion >= 2) &&
+           (contexts[cid].minorVersion >= 2) &&
+           (argp->language == VMCL_OPENCL_C_2_0))
+#endif
+   ) {
+      VMACCEL_LOG("Creating OpenCL C program\n");
+
+#if DEBUG_COMPUTE_OPERATION
+      VMACCEL_LOG("%s\n", argp->source.source_val);
+#endif
+
+      program = clCreateProgramWithSource(
+         context, 1, (const char **)&argp->source.source_val, &sourceLength,
+         &errNum);
+#if CL_VERSION_2_2
+   } else if ((contexts[cid].majorVersion >= 2) &&
+              (contexts[cid].minorVersion >= 2) &&
+              (argp->language == VMCL_OPENCL_CPP_1_0)) {
+      VMACCEL_LOG("Creating OpenCL CPP program\n");
+
+      program = clCreateProgramWithSource(
+         context, 1, (const char **)&argp->source.source_val, &sourceLength,
+         &errNum);
+   } else if ((contexts[cid].majorVersion >= 2) &&
+              (contexts[cid].minorVersion >= 2) &&
+              ((argp->language == VMCL_SPIRV_1_1) ||
+               (argp->language == VMCL_SPIRV_1_2))) {
+      VMACCEL_LOG("Creating SPIR-V 1.1/1.2 program\n");
+
+      program = clCreateProgramWithIL(context, (void *)argp->source.source_val,
+                                      argp->source.source_len, &errNum);
+#endif
+#if CL_VERSION_2_1
+   } else if ((contexts[cid].majorVersion >= 2) &&
+              (contexts[cid].minorVersion >= 1) &&
+              (argp->language == VMCL_SPIRV_1_0)) {
+      VMACCEL_LOG("Creating SPIR-V 1.0 program\n");
+
+      FILE *fp;
+      fp = fopen("/tmp/server.spirv", "wb");
+
+      if (fp) {
+         fwrite(argp->source.source_val, argp->source.source_len, 1, fp);
+
+         fflush(fp);
+         fclose(fp);
+      }
+
+      program = clCreateProgramWithIL(context, (void *)argp->source.source_val,
+                                      argp->source.source_len, &errNum);
+#endif
+   } else {
+      assert(0);
+      return NULL;
+   }
+
+   if ((program == NULL) || (errNum != CL_SUCCESS)) {
+      VMACCEL_WARNING("Failed to create CL program\n");
+      return NULL;
+   }
+
+   VMACCEL_LOG("Building program %p\n", program);
+
+   errNum = clBuildProgram(program, 1, &deviceId, options, NULL, NULL);
+
+   if (errNum != CL_SUCCESS) {
+      char *buildLog;
+
+      VMACCEL_WARNING("Error in kernel:\n");
+
+      buildLog = malloc(sizeof(char) * 16384);
+
+      if (buildLog) {
+         clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, 16384,
+                               buildLog, NULL);
+         VMACCEL_WARNING("%s\n", buildLog);
+         free(buildLog);
+      }
+
+      clReleaseProgram(program);
+      return NULL;
+   }
+
+   return program;
+}
+
+/*
+ * Identifies a program by its source, language, build options and the
+ * device and driver it is built for.
+ */
+static uint64_t VMWOpenCLProgram_Key(cl_device_id deviceId,
+                                     unsigned int language,
+                                     uint64_t sourceHash, const char *options,
+                                     char *desc, size_t *descLen) {
+   const cl_device_info deviceInfo[] = {
+      CL_DEVICE_NAME,
+      CL_DEVICE_VENDOR,
+      CL_DEVICE_VERSION,
+      CL_DRIVER_VERSION,
+   };
+   char str[4][256];
+   const char *strs[4];
+   unsigned int i;
+
+   for (i = 0; i < sizeof(deviceInfo) / sizeof(deviceInfo[0]); i++) {
+      str[i][0] = '\0';
+
+      if (clGetDeviceInfo(deviceId, deviceInfo[i], sizeof(str[i]) - 1, str[i],
+                          NULL) == CL_SUCCESS) {
+         str[i][sizeof(str[i]) - 1] = '\0';
+      } else {
+         str[i][0] = '\0';
+      }
+
+      strs[i] = str[i];
+   }
+
+   *descLen = VMAccel_ProgramKeyDesc(desc, VMCL_PROGRAM_KEY_DESC_MAX,
+                                     sourceHash, language, options, strs, i);
+
+   if (*descLen == 0) {
+      uint64_t key = VMAccel_Hash64(&language, sizeof(language), sourceHash);
+
+      /*
+       * Unusually long build options, the program is not cached.
+       */
+      return (options != NULL) ? VMAccel_Hash64(options, strlen(options), key)
+                               : key;
+   }
+
+   return VMAccel_Hash64(desc, *descLen, 0);
+}
+
+/*
+ * VMWOpenCLProgram_Binary
+ *
+ * Retrieves the binary of a program for the device it was built for, only
+ * the size is returned when binary is NULL.
+ */
+static bool VMWOpenCLProgram_Binary(cl_program program, cl_device_id deviceId,
+                                    unsigned char *binary, size_t *size) {
+   cl_device_id *devices = NULL;
+   unsigned char **binaries = NULL;
+   size_t *sizes = NULL;
+   cl_uint numDevices = 0;
+   cl_uint i;
+   bool ret = false;
+
+   if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(numDevices),
+                        &numDevices, NULL) != CL_SUCCESS ||
+       (numDevices == 0)) {
+      return false;
+   }
+
+   devices = calloc(numDevices, sizeof(cl_device_id));
+   sizes = calloc(numDevices, sizeof(size_t));
+   binaries = calloc(numDevices, sizeof(unsigned char *));
+
+   if ((devices == NULL) || (sizes == NULL) || (binaries == NULL)) {
+      goto cleanup;
+   }
+
+   if ((clGetProgramInfo(program, CL_PROGRAM_DEVICES,
+                         numDevices * sizeof(cl_device_id), devices,
+                         NULL) != CL_SUCCESS) ||
+       (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+                         numDevices * sizeof(size_t), sizes,
+                         NULL) != CL_SUCCESS)) {
+      goto cleanup;
+   }
+
+   for (i = 0; i < numDevices; i++) {
+      if ((devices[i] == deviceId) && (sizes[i] > 0)) {
+         break;
+      }
+   }
+
+   if (i == numDevices) {
+      goto cleanup;
+   }
+
+   if (binary == NULL) {
+      *size = sizes[i];
+      ret = true;
+      goto cleanup;
+   }
+
+   if (*size < sizes[i]) {
+      goto cleanup;
+   }
+
+   /*
+    * Only retrieve the binary for the device the program was built for.
+    */
+   binaries[i] = binary;
+
+   if (clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+                        numDevices * sizeof(unsigned char *), binaries,
+                        NULL) == CL_SUCCESS) {
+      *size = sizes[i];
+      ret = true;
+   }
+
+cleanup:
+
+   free(binaries);
+   free(sizes);
+   free(devices);
+
+   return ret;
+}
+
+/*
+ * VMWOpenCLProgram_CreateWithBinary
+ *
+ * Creates and builds a program from a binary retrieved with
+ * VMWOpenCLProgram_Binary.
+ */
+static cl_program VMWOpenCLProgram_CreateWithBinary(
+   cl_context context, cl_device_id deviceId, const unsigned char *binary,
+   size_t size, const char *options, cl_int *errNumRet) {
+   cl_program program;
+   cl_int binaryStatus;
+   cl_int errNum;
+
+   program = clCreateProgramWithBinary(context, 1, &deviceId, &size, &binary,
+                                       &binaryStatus, &errNum);
+
+   if ((program != NULL) && (errNum == CL_SUCCESS) &&
+       (binaryStatus == CL_SUCCESS)) {
+      errNum = clBuildProgram(program, 1, &deviceId, options, NULL, NULL);
+   } else if (errNum == CL_SUCCESS) {
+      errNum = binaryStatus;
+   }
+
+   if ((errNum != CL_SUCCESS) && (program != NULL)) {
+      clReleaseProgram(program);
+      program = NULL;
+   }
+
+   *errNumRet = errNum;
+
+   return program;
+}
 
-   memset(&result, 0, sizeof(result));
+#if ENABLE_VMCL_PROGRAM_CACHE
+/*
+ * Persistent program binary cache.
+ *
+ * Program binaries are stored as <cache dir>/<key>.bin, prefixed by the
+ * description of the key, see VMWOpenCLProgram_Key, and the full source.
+ * The key is not collision resistant, a binary is only loaded for a client
+ * supplying the same source. Binaries are executed by the server, so the
+ * directory and the binaries must be private to the user of the server,
+ * otherwise the cache is disabled.
+ */
+static char programCacheDir[PATH_MAX];
+static int programCacheState = 0;
 
-   assert(IdentifierDB_ActiveId(queueIds, qid));
+/*
+ * VMWOpenCLProgramCache_IsPrivate
+ *
+ * A file of the cache must be owned by the user of the server, and not be
+ * writable by others.
+ */
+static bool VMWOpenCLProgramCache_IsPrivate(const struct stat *st) {
+   return (st->st_uid == geteuid()) &&
+          ((st->st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
 
-   clReleaseCommandQueue(queues[qid].queue);
-   memset(&queues[qid], 0, sizeof(queues[0]));
+/*
+ * VMWOpenCLProgramCache_MakeDir
+ *
+ * Creates a directory private to the user, unless it exists. RPC types
+ * shadow errno, an existing directory is detected by lstat instead.
+ */
+static bool VMWOpenCLProgramCache_MakeDir(const char *dir) {
+   struct stat st;
 
-   IdentifierDB_ReleaseId(queueIds, qid);
+   mkdir(dir, 0700);
 
-   return (&result);
+   return (lstat(dir, &st) == 0) && S_ISDIR(st.st_mode);
 }
 
-VMAccelStatus *vmwopencl_queueflush_1(VMCLQueueId *argp) {
-   static VMAccelStatus result;
-   unsigned int qid = (unsigned int)argp->id;
-   cl_int errNum;
+/*
+ * VMWOpenCLProgramCache_Dir
+ *
+ * Returns the cache directory, NULL if the cache is disabled. The directory
+ * is VMCL_PROGRAM_CACHE_DIR from the environment, or the directory of the
+ * build, or else VMCL_PROGRAM_CACHE_NAME in the cache directory of the user.
+ * Must be called with programMutex held.
+ */
+static const char *VMWOpenCLProgramCache_Dir() {
+   const char *dir = getenv("VMCL_PROGRAM_CACHE_DIR");
+   const char *base;
+   struct stat st;
+   int ret;
+
+   if (programCacheState != 0) {
+      return (programCacheState > 0) ? programCacheDir : NULL;
+   }
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: flushing qid=%d\n", __FUNCTION__, qid);
+   programCacheState = -1;
+
+#ifdef VMCL_PROGRAM_CACHE_DIR
+   if (dir == NULL) {
+      dir = VMCL_PROGRAM_CACHE_DIR;
+   }
 #endif
 
-   memset(&result, 0, sizeof(result));
+   if (dir != NULL) {
+      ret = snprintf(programCacheDir, sizeof(programCacheDir), "%s", dir);
+   } else if ((base = getenv("XDG_CACHE_HOME")) != NULL) {
+      ret = snprintf(programCacheDir, sizeof(programCacheDir), "%s/%s", base,
+                     VMCL_PROGRAM_CACHE_NAME);
+   } else if ((base = getenv("HOME")) != NULL) {
+      ret = snprintf(programCacheDir, sizeof(programCacheDir), "%s/.cache",
+                     base);
+
+      if ((ret > 0) && ((size_t)ret < sizeof(programCacheDir)) &&
+          VMWOpenCLProgramCache_MakeDir(programCacheDir)) {
+         ret = snprintf(programCacheDir, sizeof(programCacheDir),
+                        "%s/.cache/%s", base, VMCL_PROGRAM_CACHE_NAME);
+      } else {
+         ret = -1;
+      }
+   } else {
+      ret = -1;
+   }
 
-   errNum = clFlush(queues[qid].queue);
+   if ((ret <= 0) || ((size_t)ret >= sizeof(programCacheDir))) {
+      VMACCEL_WARNING("%s: No cache directory, program cache disabled\n",
+                      __FUNCTION__);
+      return NULL;
+   }
 
-   if (errNum != CL_SUCCESS) {
-      result.status = VMACCEL_FAIL;
+   if (!VMWOpenCLProgramCache_MakeDir(programCacheDir) ||
+       (lstat(programCacheDir, &st) != 0) ||
+       !VMWOpenCLProgramCache_IsPrivate(&st)) {
+      VMACCEL_WARNING("%s: %s is not a private directory, program cache "
+                      "disabled\n",
+                      __FUNCTION__, programCacheDir);
+      return NULL;
    }
 
-   return (&result);
+   programCacheState = 1;
+
+   return programCacheDir;
 }
 
-VMAccelStatus *vmwopencl_imageupload_1(VMCLImageUploadOp *argp) {
-   static VMAccelStatus result;
-   unsigned int cid = (unsigned int)argp->queue.cid;
-   unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int sid = (unsigned int)argp->img.accel.id;
-   unsigned int gen = (unsigned int)argp->img.accel.generation;
-   unsigned int inst = (unsigned int)argp->img.accel.instance;
-   cl_command_queue queue = queues[qid].queue;
+static cl_program VMWOpenCLProgramCache_Load(cl_context context,
+                                             cl_device_id deviceId,
+                                             uint64_t key, const char *desc,
+                                             size_t descLen,
+                                             const VMCLKernelAllocateDesc *argp,
+                                             const char *options) {
+   const char *dir = VMWOpenCLProgramCache_Dir();
+   size_t sourceLen = argp->source.source_len;
+   size_t prefixLen = 2 * sizeof(uint32_t) + descLen + sourceLen;
+   char path[PATH_MAX];
+   unsigned char *data = NULL;
+   cl_program program = NULL;
    cl_int errNum;
+   uint32_t len[2] = {0, 0};
+   struct stat st;
+   size_t size = 0;
+   int fd;
+   FILE *fp;
+   int ret;
+
+   if ((dir == NULL) || (descLen == 0) || (sourceLen == 0) ||
+       (sourceLen > UINT32_MAX)) {
+      return NULL;
+   }
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d\n", __FUNCTION__, sid, gen, inst);
-   VMACCEL_LOG("%s: cid=%d, qid=%d\n", __FUNCTION__, cid, qid);
+   ret = snprintf(path, sizeof(path), "%s/%016llx.bin", dir,
+                  (unsigned long long)key);
 
-   for (int i = 0; i < argp->op.imgRegion.size.x / 4; i++) {
-      VMACCEL_LOG("%s: uint32[%d] = 0x%x\n", __FUNCTION__, i,
-                  ((unsigned int *)argp->op.ptr.ptr_val)[i]);
+   if ((ret < 0) || ((size_t)ret >= sizeof(path))) {
+      return NULL;
    }
-#endif
 
-   pthread_mutex_lock(&surfaces[sid].mutex);
-   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+   fd = open(path, O_RDONLY | O_NOFOLLOW);
 
-   if (surfaces[sid].inst[inst].generation > gen) {
-      result.status = VMACCEL_SEMANTIC_ERROR;
+   if (fd < 0) {
+      return NULL;
+   }
 
-      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-      pthread_mutex_unlock(&surfaces[sid].mutex);
+   if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) ||
+       !VMWOpenCLProgramCache_IsPrivate(&st) ||
+       ((size_t)st.st_size <= prefixLen)) {
+      VMACCEL_WARNING("%s: Ignoring program binary %s\n", __FUNCTION__, path);
+      close(fd);
+      return NULL;
+   }
 
-      return (&result);
+   fp = fdopen(fd, "rb");
+
+   if (fp == NULL) {
+      close(fd);
+      return NULL;
    }
 
-   memset(&result, 0, sizeof(result));
+   /*
+    * The binary is only used if the stored key and source match in full.
+    */
+   if ((fread(len, sizeof(len), 1, fp) == 1) && (len[0] == descLen) &&
+       (len[1] == sourceLen)) {
+      data = malloc(st.st_size - sizeof(len));
+
+      if ((data != NULL) &&
+          (fread(data, st.st_size - sizeof(len), 1, fp) == 1) &&
+          (memcmp(data, desc, descLen) == 0) &&
+          (memcmp(data + descLen, argp->source.source_val, sourceLen) == 0)) {
+         size = st.st_size - prefixLen;
+      }
+   }
 
-   assert(cid == argp->img.cid);
+   fclose(fp);
 
-   if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER &&
-       surfaces[sid].inst[inst].svm_ptr == NULL) {
-      errNum = clEnqueueWriteBuffer(queue, surfaces[sid].inst[inst].mem,
-                                    CL_TRUE, argp->op.imgRegion.coord.x,
-                                    argp->op.imgRegion.size.x,
-                                    argp->op.ptr.ptr_val, 0, NULL, NULL);
+   if (size == 0) {
+      VMACCEL_WARNING("%s: Key mismatch for program binary %s\n",
+                      __FUNCTION__, path);
+      free(data);
+      return NULL;
+   }
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("%s: Failed to enqueuew update\n", __FUNCTION__);
-         result.status = VMACCEL_FAIL;
-      } else {
-         surfaces[sid].inst[inst].generation = gen;
+   program = VMWOpenCLProgram_CreateWithBinary(
+      context, deviceId, data + descLen + sourceLen, size, options, &errNum);
+
+   free(data);
+
+   if (program == NULL) {
+      VMACCEL_WARNING("%s: Discarding stale program binary %s, errNum=%d\n",
+                      __FUNCTION__, path, errNum);
+
+      unlink(path);
+
+      return NULL;
+   }
+
+   VMACCEL_LOG("Loaded program binary %s\n", path);
+
+   return program;
+}
+
+static void VMWOpenCLProgramCache_Store(cl_program program,
+                                        cl_device_id deviceId, uint64_t key,
+                                        const char *desc, size_t descLen,
+                                        const VMCLKernelAllocateDesc *argp) {
+   const char *dir = VMWOpenCLProgramCache_Dir();
+   char path[PATH_MAX];
+   char tmpPath[PATH_MAX];
+   unsigned char *binary = NULL;
+   uint32_t len[2] = {descLen, argp->source.source_len};
+   size_t size = 0;
+   bool written;
+   int fd;
+   FILE *fp;
+   int ret;
+
+   if ((dir == NULL) || (descLen == 0) || (argp->source.source_len == 0) ||
+       (argp->source.source_len > UINT32_MAX)) {
+      return;
+   }
+
+   if (!VMWOpenCLProgram_Binary(program, deviceId, NULL, &size) ||
+       ((binary = malloc(size)) == NULL) ||
+       !VMWOpenCLProgram_Binary(program, deviceId, binary, &size)) {
+      goto cleanup;
+   }
+
+   /*
+    * Write to a temporary file and rename, so concurrent servers never
+    * observe a partial binary.
+    */
+   ret = snprintf(path, sizeof(path), "%s/%016llx.bin", dir,
+                  (unsigned long long)key);
+
+   if ((ret < 0) || ((size_t)ret >= sizeof(path))) {
+      goto cleanup;
+   }
+
+   ret = snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, getpid());
+
+   if ((ret < 0) || ((size_t)ret >= sizeof(tmpPath))) {
+      goto cleanup;
+   }
+
+   fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+
+   if ((fd < 0) || ((fp = fdopen(fd, "wb")) == NULL)) {
+      if (fd >= 0) {
+         close(fd);
+         unlink(tmpPath);
       }
+      goto cleanup;
+   }
+
+   written = (fwrite(len, sizeof(len), 1, fp) == 1) &&
+             (fwrite(desc, descLen, 1, fp) == 1) &&
+             (fwrite(argp->source.source_val, len[1], 1, fp) == 1) &&
+             (fwrite(binary, size, 1, fp) == 1);
+
+   if (((fclose(fp) != 0) | !written) || (rename(tmpPath, path) != 0)) {
+      VMACCEL_WARNING("%s: Unable to store program binary %s\n", __FUNCTION__,
+                      path);
+      unlink(tmpPath);
    } else {
-      assert(0);
+      VMACCEL_LOG("Stored program binary %s\n", path);
+   }
 
-      result.status = VMACCEL_FAIL;
+cleanup:
+
+   free(binary);
+}
+#endif
+
+/*
+ * VMWOpenCLProgram_Matches
+ *
+ * A probe by hash only matches the programs of its own context, a request
+ * with the source must also match the source of the program in full.
+ */
+static bool VMWOpenCLProgram_Matches(const VMWOpenCLProgram *prog,
+                                     unsigned int cid, cl_device_id deviceId,
+                                     uint64_t key,
+                                     const VMCLKernelAllocateDesc *argp) {
+   if ((prog->refCount == 0) || (prog->cid != cid) ||
+       (prog->deviceId != deviceId) || (prog->key != key)) {
+      return false;
    }
 
-   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-   pthread_mutex_unlock(&surfaces[sid].mutex);
+   return (argp->source.source_len == 0) ||
+          ((prog->sourceLen == argp->source.source_len) &&
+           (memcmp(prog->source, argp->source.source_val, prog->sourceLen) ==
+            0));
+}
 
-   return (&result);
+/*
+ * VMWOpenCLProgram_Acquire
+ *
+ * Returns the program matching the key for the context and device, loading
+ * or building it on a miss. The persistent cache is only consulted when the
+ * source is supplied, a probe by hash is answered from the programs of the
+ * context. Must be called with programMutex held.
+ */
+static VMAccelStatusCode
+VMWOpenCLProgram_Acquire(unsigned int cid, cl_device_id deviceId, uint64_t key,
+                         const char *keyDesc, size_t keyDescLen,
+                         VMCLKernelAllocateDesc *argp, const char *options,
+                         unsigned int *pid) {
+   cl_program program = NULL;
+   unsigned int freeId = VMCL_MAX_KERNELS;
+   char *source;
+   unsigned int i;
+
+   for (i = 0; i < VMCL_MAX_KERNELS; i++) {
+      if (programs[i].refCount == 0) {
+         freeId = MIN(freeId, i);
+      } else if (VMWOpenCLProgram_Matches(&programs[i], cid, deviceId, key,
+                                          argp)) {
+         programs[i].refCount++;
+         *pid = i;
+         return VMACCEL_SUCCESS;
+      }
+   }
+
+   if (argp->source.source_len == 0) {
+      /*
+       * Program miss, the client must supply the source.
+       */
+      return VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   if (freeId == VMCL_MAX_KERNELS) {
+      return VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   source = malloc(argp->source.source_len);
+
+   if (source == NULL) {
+      return VMACCEL_FAIL;
+   }
+
+   memcpy(source, argp->source.source_val, argp->source.source_len);
+
+#if ENABLE_VMCL_PROGRAM_CACHE
+   program = VMWOpenCLProgramCache_Load(contexts[cid].context, deviceId, key,
+                                        keyDesc, keyDescLen, argp, options);
+#endif
+
+   if (program == NULL) {
+      program = VMWOpenCLProgram_Build(cid, deviceId, argp, options);
+
+      if (program == NULL) {
+         free(source);
+         return VMACCEL_FAIL;
+      }
+
+#if ENABLE_VMCL_PROGRAM_CACHE
+      VMWOpenCLProgramCache_Store(program, deviceId, key, keyDesc, keyDescLen,
+                                  argp);
+#endif
+   }
+
+   programs[freeId].cid = cid;
+   programs[freeId].deviceId = deviceId;
+   programs[freeId].key = key;
+   programs[freeId].source = source;
+   programs[freeId].sourceLen = argp->source.source_len;
+   programs[freeId].program = program;
+   programs[freeId].refCount = 1;
+
+   *pid = freeId;
+
+   return VMACCEL_SUCCESS;
 }
 
-VMAccelDownloadStatus *vmwopencl_imagedownload_1(VMCLImageDownloadOp *argp) {
-   static VMAccelDownloadStatus result;
-   unsigned int cid = (unsigned int)argp->queue.cid;
-   unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int sid = (unsigned int)argp->img.accel.id;
-   unsigned int gen = (unsigned int)argp->img.accel.generation;
-   unsigned int inst = (unsigned int)argp->img.accel.instance;
-   cl_command_queue queue = queues[qid].queue;
-   void *ptr;
-   cl_int errNum;
+/*
+ * VMWOpenCLProgram_Release
+ *
+ * Must be called with programMutex held.
+ */
+static void VMWOpenCLProgram_Release(unsigned int pid) {
+   assert(programs[pid].refCount > 0);
 
-   pthread_mutex_lock(&surfaces[sid].mutex);
-   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+   if (--programs[pid].refCount == 0) {
+      clReleaseProgram(programs[pid].program);
+      free(programs[pid].source);
+      memset(&programs[pid], 0, sizeof(programs[0]));
+   }
+}
 
-   if (surfaces[sid].inst[inst].generation != gen) {
-      if (surfaces[sid].inst[inst].generation > gen) {
-         VMACCEL_WARNING("Out-of-order update detected, client/server"
-                         " out of sync...\n");
-         result.status = VMACCEL_SEMANTIC_ERROR;
+/*
+ * VMWOpenCLKernel_Acquire
+ *
+ * Returns the kernel object of the kernel for a queue, creating it on the
+ * first dispatch to the queue.
+ */
+static cl_kernel VMWOpenCLKernel_Acquire(unsigned int kid, unsigned int qid) {
+   cl_kernel kernel;
+
+   pthread_mutex_lock(&programMutex);
+
+   kernel = kernels[kid].kernel[qid];
+
+   if (kernel == NULL) {
+      if (kernels[kid].unbound != NULL) {
+         kernel = kernels[kid].unbound;
+         kernels[kid].unbound = NULL;
       } else {
-         result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+         kernel = clCreateKernel(programs[kernels[kid].pid].program,
+                                 kernels[kid].name, NULL);
       }
 
-      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-      pthread_mutex_unlock(&surfaces[sid].mutex);
+      kernels[kid].kernel[qid] = kernel;
+   }
+
+   pthread_mutex_unlock(&programMutex);
+
+   return kernel;
+}
+
+VMCLKernelAllocateStatus *
+vmwopencl_kernelalloc_1(VMCLKernelAllocateDesc *argp) {
+   static VMCLKernelAllocateStatus result;
+   unsigned int cid = (unsigned int)argp->client.cid;
+   unsigned int kid = (unsigned int)argp->client.id;
+   unsigned int subDevice = (unsigned int)argp->subDevice;
+   cl_device_id deviceId = contexts[cid].deviceIds[subDevice];
+   cl_kernel kernel = 0;
+   const char *options = NULL;
+   uint64_t sourceHash = argp->sourceHash;
+   char keyDesc[VMCL_PROGRAM_KEY_DESC_MAX];
+   size_t keyDescLen;
+   uint64_t key;
+   unsigned int pid;
+
+   memset(&result, 0, sizeof(result));
+
+   VMACCEL_LOG("Allocating kernel id=%d\n", kid);
+
+   if (IdentifierDB_ActiveId(kernelIds, kid)) {
+      VMACCEL_WARNING("%s: ERROR: Kernel ID %d already active...\n",
+                      __FUNCTION__, kid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
+
+   if (argp->source.source_len > 0) {
+      sourceHash = VMAccel_Hash64(argp->source.source_val,
+                                  argp->source.source_len, 0);
 
+      if ((argp->sourceHash != 0) && (argp->sourceHash != sourceHash)) {
+         VMACCEL_WARNING("%s: Source hash mismatch for kernel id=%d\n",
+                         __FUNCTION__, kid);
+      }
+   }
+
+   key = VMWOpenCLProgram_Key(deviceId, argp->language, sourceHash, options,
+                              keyDesc, &keyDescLen);
+
+   pthread_mutex_lock(&programMutex);
+
+   result.status = VMWOpenCLProgram_Acquire(cid, deviceId, key, keyDesc,
+                                            keyDescLen, argp, options, &pid);
+
+   if (result.status != VMACCEL_SUCCESS) {
+      pthread_mutex_unlock(&programMutex);
+      return (&result);
+   }
+
+   /*
+    * Create the kernel up front to validate the kernel name, the kernel
+    * object is retained for use by the first queue it is dispatched to.
+    */
+   kernel = clCreateKernel(programs[pid].program,
+                           argp->kernelName.kernelName_val, NULL);
+   if (kernel == NULL) {
+      VMACCEL_WARNING("Failed to create kernel\n");
+      VMWOpenCLProgram_Release(pid);
+      pthread_mutex_unlock(&programMutex);
+      result.status = VMACCEL_FAIL;
       return (&result);
    }
 
+   if (IdentifierDB_AcquireId(kernelIds, kid)) {
+      memset(&kernels[kid], 0, sizeof(kernels[0]));
+      kernels[kid].pid = pid;
+      kernels[kid].name = strdup(argp->kernelName.kernelName_val);
+      kernels[kid].unbound = kernel;
+   } else {
+      assert(0);
+      clReleaseKernel(kernel);
+      VMWOpenCLProgram_Release(pid);
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   }
+
+   pthread_mutex_unlock(&programMutex);
+
+   return (&result);
+}
+
+VMAccelStatus *vmwopencl_kerneldestroy_1(VMCLKernelId *argp) {
+   static VMAccelStatus result;
+   unsigned int kid = (unsigned int)argp->id;
+   unsigned int qid;
+
    memset(&result, 0, sizeof(result));
 
-   assert(cid == argp->img.cid);
+   VMACCEL_LOG("Destroying kernel id=%d\n", kid);
+
+   if (!IdentifierDB_ActiveId(kernelIds, kid)) {
+      result.status = VMACCEL_SUCCESS;
+      return &result;
+   }
+
+   pthread_mutex_lock(&programMutex);
+
+   if (kernels[kid].unbound != NULL) {
+      clReleaseKernel(kernels[kid].unbound);
+   }
+
+   for (qid = 0; qid < VMCL_MAX_QUEUES; qid++) {
+      if (kernels[kid].kernel[qid] != NULL) {
+         clReleaseKernel(kernels[kid].kernel[qid]);
+      }
+   }
+
+   VMWOpenCLProgram_Release(kernels[kid].pid);
+
+   pthread_mutex_unlock(&programMutex);
+
+   free(kernels[kid].name);
+   memset(&kernels[kid], 0, sizeof(kernels[0]));
+
+   IdentifierDB_ReleaseId(kernelIds, kid);
+
+   result.status = VMACCEL_SUCCESS;
+
+   return (&result);
+}
+
+/*
+ * VMWOpenCLDispatch_FindArg
+ *
+ * Returns the position in the dispatch of the surface argument bound to a
+ * kernel argument index, -1 if there is none.
+ */
+static int VMWOpenCLDispatch_FindArg(const VMCLDispatchOp *argp,
+                                     unsigned int index) {
+   for (int i = 0; i < argp->args.args_len; i++) {
+      if ((argp->args.args_val[i].index == index) &&
+          (argp->args.args_val[i].type == VMCL_ARG_SURFACE)) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+/*
+ * VMWOpenCLDispatch_SetSurfaceArg
+ *
+ * Binds the instance of a surface to a kernel argument.
+ */
+static cl_int VMWOpenCLDispatch_SetSurfaceArg(cl_kernel kernel,
+                                              unsigned int index,
+                                              const VMCLKernelArgDesc *arg) {
+   VMWOpenCLSurfaceInstance *inst =
+      &surfaces[arg->surf.id].inst[arg->surf.instance];
+
+#if CL_VERSION_2_0
+   if (inst->svm_ptr != NULL) {
+      return clSetKernelArgSVMPointer(kernel, index, inst->svm_ptr);
+   }
+#endif
 
-   if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER &&
-       surfaces[sid].inst[inst].svm_ptr == NULL) {
-      unsigned int blocking = 0;
+   return clSetKernelArg(kernel, index, sizeof(cl_mem), &inst->mem);
+}
 
-      if (argp->op.ptr.ptr_val == NULL) {
-         ptr = calloc(1, argp->op.imgRegion.size.x);
-      } else {
-         ptr = argp->op.ptr.ptr_val;
-      }
+/*
+ * VMWOpenCLDispatch_SwapArgs
+ *
+ * Binds the surfaces of each swapped pair of arguments for an iteration of
+ * a repeated dispatch, odd iterations exchange the surfaces of the pair.
+ */
+static cl_int VMWOpenCLDispatch_SwapArgs(cl_kernel kernel,
+                                         const VMCLDispatchOp *argp,
+                                         unsigned int iter) {
+   cl_int errNum = CL_SUCCESS;
 
-      if (argp->mode == VMACCEL_SURFACE_READ_SYNCHRONOUS) {
-         VMACCEL_LOG("%s: Enqueing blocking read sid=%d -> %p\n", __FUNCTION__,
-                     sid, ptr);
-         blocking = TRUE;
+   for (int i = 0; i < argp->swaps.swaps_len && errNum == CL_SUCCESS; i++) {
+      const VMCLKernelArgSwap *swap = &argp->swaps.swaps_val[i];
+      const VMCLKernelArgDesc *first =
+         &argp->args.args_val[VMWOpenCLDispatch_FindArg(argp, swap->first)];
+      const VMCLKernelArgDesc *second =
+         &argp->args.args_val[VMWOpenCLDispatch_FindArg(argp, swap->second)];
+
+      if (iter & 1) {
+         const VMCLKernelArgDesc *tmp = first;
+         first = second;
+         second = tmp;
       }
 
-      errNum =
-         clEnqueueReadBuffer(queue, surfaces[sid].inst[inst].mem, blocking,
-                             argp->op.imgRegion.coord.x,
-                             argp->op.imgRegion.size.x, ptr, 0, NULL, NULL);
+      errNum = VMWOpenCLDispatch_SetSurfaceArg(kernel, swap->first, first);
 
-      if (errNum != CL_SUCCESS) {
-         result.status = VMACCEL_FAIL;
-      } else {
-         result.ptr.ptr_len = argp->op.imgRegion.size.x;
-         result.ptr.ptr_val = ptr;
+      if (errNum == CL_SUCCESS) {
+         errNum = VMWOpenCLDispatch_SetSurfaceArg(kernel, swap->second, second);
       }
-   } else {
-      assert(0);
-
-      result.status = VMACCEL_FAIL;
    }
 
-   pthread_mutex_unlock(&surfaces[sid].mutex);
-
-   return (&result);
+   return errNum;
 }
 
-VMAccelSurfaceMapStatus *vmwopencl_surfacemap_1(VMCLSurfaceMapOp *argp) {
-   static VMAccelSurfaceMapStatus result;
+VMAccelStatus *vmwopencl_dispatch_1(VMCLDispatchOp *argp) {
+   static VMAccelStatus result;
    unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int sid = (unsigned int)argp->op.surf.id;
-   unsigned int gen = (unsigned int)argp->op.surf.generation;
-   unsigned int inst = (unsigned int)argp->op.surf.instance;
-   unsigned int blocking = TRUE;
+   unsigned int kid = (unsigned int)argp->kernel.id;
    cl_command_queue queue = queues[qid].queue;
-   void *ptr;
-   cl_map_flags flags = 0;
-   cl_int errNum = CL_SUCCESS;
+   cl_kernel kernel = VMWOpenCLKernel_Acquire(kid, qid);
+   cl_event event = NULL;
+   cl_int errNum;
+   size_t globalWorkOffset[VMCL_MAX_DIMENSIONS];
+   size_t globalWorkSize[VMCL_MAX_DIMENSIONS];
+   size_t localWorkSize[VMCL_MAX_DIMENSIONS];
+   uint64_t *boundArgs = kernels[kid].boundArgs[qid];
+   cl_event waitEvents[VMWOPENCL_DISPATCH_WAIT_EVENTS];
+   cl_event *waitList = waitEvents;
+   cl_uint numEvents = 0;
+   unsigned int repeatCount;
+   unsigned int iter;
+   int argIndex;
 
    memset(&result, 0, sizeof(result));
 
-   pthread_mutex_lock(&surfaces[sid].mutex);
-   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
-
-   if (surfaces[sid].inst[inst].generation > gen) {
-      result.status = VMACCEL_SEMANTIC_ERROR;
-
-      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-      pthread_mutex_unlock(&surfaces[sid].mutex);
+#if DEBUG_COMPUTE_OPERATION
+   VMACCEL_LOG("%s: qid=%d, kid=%d, kernel=%p\n", __FUNCTION__, qid, kid,
+               kernel);
+#endif
 
+   if (kernel == NULL) {
+      VMACCEL_WARNING("%s: Unable to create kernel id=%d for queue id=%d\n",
+                      __FUNCTION__, kid, qid);
+      result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   if (argp->op.mapFlags & VMACCEL_MAP_READ_FLAG) {
-      flags |= CL_MAP_READ;
+   if ((argp->dimension > VMCL_MAX_DIMENSIONS) ||
+       (argp->globalWorkOffset.globalWorkOffset_len < argp->dimension) ||
+       (argp->globalWorkSize.globalWorkSize_len < argp->dimension) ||
+       (argp->localWorkSize.localWorkSize_len < argp->dimension)) {
+      VMACCEL_WARNING("%s: Invalid dimension %d\n", __FUNCTION__,
+                      argp->dimension);
+      result.status = VMACCEL_SEMANTIC_ERROR;
+      return (&result);
    }
 
-   if (argp->op.mapFlags & VMACCEL_MAP_WRITE_FLAG) {
-      flags |= CL_MAP_WRITE;
-   }
+   for (iter = 0; iter < argp->swaps.swaps_len; iter++) {
+      const VMCLKernelArgSwap *swap = &argp->swaps.swaps_val[iter];
 
-   if (argp->op.mapFlags & VMACCEL_MAP_WRITE_DISCARD_FLAG) {
-      flags |= CL_MAP_WRITE_INVALIDATE_REGION;
+      if ((VMWOpenCLDispatch_FindArg(argp, swap->first) < 0) ||
+          (VMWOpenCLDispatch_FindArg(argp, swap->second) < 0)) {
+         VMACCEL_WARNING("%s: Swapped arguments must be surfaces\n",
+                         __FUNCTION__);
+         result.status = VMACCEL_SEMANTIC_ERROR;
+         return (&result);
+      }
    }
 
-   if (argp->op.mapFlags & VMACCEL_MAP_ASYNC_FLAG) {
-      blocking = FALSE;
-   }
+   for (argIndex = 0; argIndex < argp->args.args_len; argIndex++) {
+      unsigned int index = argp->args.args_val[argIndex].index;
+      uint64_t *bound = (index < VMWOPENCL_MAX_BOUND_ARGS) ? &boundArgs[index]
+                                                           : NULL;
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d\n", __FUNCTION__, sid, gen, inst);
+      if (argp->args.args_val[argIndex].type == VMCL_ARG_SURFACE) {
+         unsigned int sid = (unsigned int)argp->args.args_val[argIndex].surf.id;
+         unsigned int gen =
+            (unsigned int)argp->args.args_val[argIndex].surf.generation;
+         unsigned int inst;
+         uint64_t bindId;
+
+         pthread_mutex_lock(&surfaces[sid].mutex);
+
+         /*
+          * Bind the instance holding the requested generation, the resolved
+          * instance is recorded for the cleanup below.
+          */
+         inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+         argp->args.args_val[argIndex].surf.instance = inst;
+
+         pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+
+#if DEBUG_COMPUTE_OPERATION
+         VMACCEL_LOG("%s: arg[%d]: index=%d, sid=%d, gen=%d, inst=%d,"
+                     " mem=%p\n",
+                     __FUNCTION__, argIndex,
+                     argp->args.args_val[argIndex].index, sid, gen, inst, mem);
 #endif
 
-   if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
-      if (++surfaces[sid].inst[inst].mapping.refCount == 1) {
-         if (surfaces[sid].inst[inst].svm_ptr) {
-            if (blocking) {
-               errNum = clFinish(queues[qid].queue);
+         if (surfaces[sid].inst[inst].generation != gen) {
+            if (surfaces[sid].inst[inst].generation > gen) {
+               VMACCEL_WARNING("Out-of-order update detected, client/server"
+                               " out of sync...\n");
+               result.status = VMACCEL_SEMANTIC_ERROR;
+            } else {
+#if DEBUG_SURFACE_CONSISTENCY
+               VMACCEL_WARNING(
+                  "%s: arg[%d]: surf[%d].gen=%d, expected gen=%d\n",
+                  __FUNCTION__, argIndex, sid,
+                  surfaces[sid].inst[inst].generation, gen);
+#endif
+               result.status = VMACCEL_RESOURCE_UNAVAILABLE;
             }
+
+            goto cleanup;
+         }
+
+         bindId = surfaces[sid].inst[inst].bindId;
+         errNum = CL_SUCCESS;
+
+         /*
+          * SVM pointers are always set, the execution info only holds the
+          * pointer of the most recent argument.
+          */
+#if CL_VERSION_2_0
+         if (surfaces[sid].inst[inst].svm_ptr != NULL) {
+            errNum = clSetKernelArgSVMPointer(
+               kernel, argp->args.args_val[argIndex].index,
+               surfaces[sid].inst[inst].svm_ptr);
             if (errNum == CL_SUCCESS) {
-               ptr = surfaces[sid].inst[inst].svm_ptr;
+               errNum = clSetKernelExecInfo(
+                  kernel, CL_KERNEL_EXEC_INFO_SVM_PTRS, sizeof(void *),
+                  &surfaces[sid].inst[inst].svm_ptr);
+            }
+            bindId = 0;
+         } else
+#endif
+            if ((bound == NULL) || (*bound != bindId)) {
+            cl_mem mem = NULL;
+
+            mem = surfaces[sid].inst[inst].mem;
+
+            errNum = clSetKernelArg(kernel, argp->args.args_val[argIndex].index,
+                                    sizeof(cl_mem), &mem);
+         }
+
+         if (bound != NULL) {
+            *bound = (errNum == CL_SUCCESS) ? bindId : 0;
+         }
+
+         if (errNum != CL_SUCCESS) {
+            VMACCEL_WARNING("Unable to set kernel argument, errNum=%d\n",
+                            errNum);
+            result.status = VMACCEL_FAIL;
+            goto cleanup;
+         }
+      } else if (argp->args.args_val[argIndex].type == VMCL_ARG_SAMPLER) {
+         unsigned int id =
+            (unsigned int)argp->args.args_val[argIndex].sampler.id;
+
+         if (bound != NULL) {
+            *bound = 0;
+         }
+
+         if ((id >= VMCL_MAX_SAMPLERS) ||
+             !IdentifierDB_ActiveId(samplerIds, id)) {
+            VMACCEL_WARNING("%s: Invalid sampler id=%d\n", __FUNCTION__, id);
+            result.status = VMACCEL_SEMANTIC_ERROR;
+            goto cleanup;
+         }
+
+         errNum = clSetKernelArg(kernel, argp->args.args_val[argIndex].index,
+                                 sizeof(cl_sampler), &samplers[id].sampler);
+
+         if (errNum != CL_SUCCESS) {
+            VMACCEL_WARNING("Unable to set kernel argument, errNum=%d\n",
+                            errNum);
+            result.status = VMACCEL_FAIL;
+            goto cleanup;
+         }
+      } else if (argp->args.args_val[argIndex].type == VMCL_ARG_IMMEDIATE ||
+                 argp->args.args_val[argIndex].type == VMCL_ARG_LOCAL) {
+         VMCLKernelArgDesc *arg = &argp->args.args_val[argIndex];
+
+         if (bound != NULL) {
+            *bound = 0;
+         }
+
+         /*
+          * Immediate arguments are copied by clSetKernelArg, local arguments
+          * only reserve work-group memory and have no value.
+          */
+         if (arg->type == VMCL_ARG_IMMEDIATE) {
+            if (arg->data.data_len == 0) {
+               VMACCEL_WARNING("%s: Empty immediate argument %d\n",
+                               __FUNCTION__, arg->index);
+               result.status = VMACCEL_SEMANTIC_ERROR;
+               goto cleanup;
             }
+            errNum = clSetKernelArg(kernel, arg->index, arg->data.data_len,
+                                    arg->data.data_val);
          } else {
-            ptr = clEnqueueMapBuffer(queue, surfaces[sid].inst[inst].mem,
-                                     blocking, flags, argp->op.coord.x,
-                                     argp->op.size.x, 0, NULL, NULL, &errNum);
+            if (arg->localSize == 0) {
+               VMACCEL_WARNING("%s: Empty local argument %d\n", __FUNCTION__,
+                               arg->index);
+               result.status = VMACCEL_SEMANTIC_ERROR;
+               goto cleanup;
+            }
+            errNum = clSetKernelArg(kernel, arg->index, arg->localSize, NULL);
+         }
+
+         if (errNum != CL_SUCCESS) {
+            VMACCEL_WARNING("Unable to set kernel argument, errNum=%d\n",
+                            errNum);
+            result.status = VMACCEL_FAIL;
+            goto cleanup;
          }
       } else {
-         errNum = CL_SUCCESS;
-         ptr = surfaces[sid].inst[inst].mapping.ptr;
+         assert(0);
+         result.status = VMACCEL_FAIL;
+         goto cleanup;
       }
+   }
 
-#if DEBUG_SURFACE_CONSISTENCY
-      for (int i = 0; i < argp->op.size.x / 4; i++) {
-         VMACCEL_LOG("%s: uint32[%d] = 0x%x\n", __FUNCTION__, i,
-                     ((unsigned int *)ptr)[i]);
-      }
+   /*
+    * TODO SVM: argp->refs --> clSetKernelExecInfo
+    */
+   for (int i = 0; i < argp->dimension; i++) {
+      globalWorkOffset[i] = argp->globalWorkOffset.globalWorkOffset_val[i];
+      globalWorkSize[i] = argp->globalWorkSize.globalWorkSize_val[i];
+      localWorkSize[i] = argp->localWorkSize.localWorkSize_val[i];
+#if DEBUG_COMPUTE_OPERATION
+      VMACCEL_LOG("%s: globalWorkOffset[%d]=%d, globalWorkSize[%d]=%d,"
+                  " localWorkSize[%d]=%d\n",
+                  __FUNCTION__, i, globalWorkOffset[i], i, globalWorkSize[i], i,
+                  localWorkSize[i]);
 #endif
+   }
 
-      if (errNum != CL_SUCCESS) {
+   /*
+    * The first iteration waits for the last command referencing each surface,
+    * which may have been enqueued on another queue of the context.
+    */
+   if (argp->args.args_len > VMWOPENCL_DISPATCH_WAIT_EVENTS) {
+      waitList = malloc(sizeof(cl_event) * argp->args.args_len);
+
+      if (waitList == NULL) {
          result.status = VMACCEL_FAIL;
+         goto cleanup;
+      }
+   }
+
+   for (iter = 0; iter < argp->args.args_len; iter++) {
+      VMCLKernelArgDesc *arg = &argp->args.args_val[iter];
+
+      if (arg->type == VMCL_ARG_SURFACE) {
+         numEvents = VMWOpenCLSurface_WaitList(
+            &surfaces[arg->surf.id].inst[arg->surf.instance], waitList,
+            numEvents);
+      }
+   }
+
+   /*
+    * Iterations of a repeated dispatch are chained by their events, the
+    * queue may execute out of order. The surfaces retain the event of the
+    * last iteration enqueued.
+    */
+   repeatCount = MAX(argp->repeatCount, 1);
+   errNum = CL_SUCCESS;
+
+   for (iter = 0; iter < repeatCount && errNum == CL_SUCCESS; iter++) {
+      cl_event wait = event;
+
+      event = NULL;
+
+      if ((iter > 0) && (argp->swaps.swaps_len > 0)) {
+         errNum = VMWOpenCLDispatch_SwapArgs(kernel, argp, iter);
+      }
+
+      if ((errNum == CL_SUCCESS) && (iter == 0)) {
+         errNum = clEnqueueNDRangeKernel(
+            queue, kernel, argp->dimension, globalWorkOffset, globalWorkSize,
+            localWorkSize, numEvents, (numEvents > 0) ? waitList : NULL,
+            &event);
+      } else if (errNum == CL_SUCCESS) {
+         errNum = clEnqueueNDRangeKernel(
+            queue, kernel, argp->dimension, globalWorkOffset, globalWorkSize,
+            localWorkSize, (wait != NULL) ? 1 : 0,
+            (wait != NULL) ? &wait : NULL, &event);
+      }
+
+      if (errNum == CL_SUCCESS) {
+         if (wait != NULL) {
+            clReleaseEvent(wait);
+         }
       } else {
-         surfaces[sid].inst[inst].mapping.ptr = ptr;
+         event = wait;
+      }
+   }
 
-         result.ptr.ptr_val = ptr;
-         result.ptr.ptr_len = argp->op.size.x;
+   /*
+    * The swapped arguments are left bound to either surface of the pair.
+    */
+   if ((repeatCount > 1) && (argp->swaps.swaps_len > 0)) {
+      for (iter = 0; iter < argp->swaps.swaps_len; iter++) {
+         if (argp->swaps.swaps_val[iter].first < VMWOPENCL_MAX_BOUND_ARGS) {
+            boundArgs[argp->swaps.swaps_val[iter].first] = 0;
+         }
+         if (argp->swaps.swaps_val[iter].second < VMWOPENCL_MAX_BOUND_ARGS) {
+            boundArgs[argp->swaps.swaps_val[iter].second] = 0;
+         }
       }
-   } else {
-      assert(0);
+   }
+
+   if (errNum != CL_SUCCESS) {
       result.status = VMACCEL_FAIL;
+   } else {
+      VMWOpenCLQueue_Profile(qid, VMCL_PROFILE_DISPATCH, event);
    }
 
+cleanup:
 
-   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-   pthread_mutex_unlock(&surfaces[sid].mutex);
+   for (argIndex = MIN(argIndex, argp->args.args_len - 1); argIndex >= 0;
+        argIndex--) {
+      if (argp->args.args_val[argIndex].type == VMCL_ARG_SURFACE) {
+         unsigned int sid = (unsigned int)argp->args.args_val[argIndex].surf.id;
+         unsigned int inst =
+            (unsigned int)argp->args.args_val[argIndex].surf.instance;
+
+         VMWOpenCLSurface_AttachEvent(&surfaces[sid].inst[inst], event);
+
+         pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+         pthread_mutex_unlock(&surfaces[sid].mutex);
+      }
+   }
+
+   if (event != NULL) {
+      clReleaseEvent(event);
+   }
+
+   if (waitList != waitEvents) {
+      free(waitList);
+   }
 
    return (&result);
 }
 
-VMAccelStatus *vmwopencl_surfaceunmap_1(VMCLSurfaceUnmapOp *argp) {
+VMAccelStatus *vmwopencl_dispatchlist_1(VMCLDispatchListOp *argp) {
    static VMAccelStatus result;
-   unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int sid = (unsigned int)argp->op.surf.id;
-   unsigned int gen = (unsigned int)argp->op.surf.generation;
-   unsigned int inst = (unsigned int)argp->op.surf.instance;
-   cl_command_queue queue = queues[qid].queue;
-   void *ptr;
-   cl_int errNum = CL_SUCCESS;
+   bool locked[VMCL_MAX_SURFACES];
+   unsigned int i;
+   int argIndex;
 
    memset(&result, 0, sizeof(result));
-
-   pthread_mutex_lock(&surfaces[sid].mutex);
+   memset(&locked[0], 0, sizeof(locked));
 
    /*
-    * memcpy the data from the incoming mapping object.
+    * Lock the union of the surfaces referenced by the list and validate the
+    * requested generations before enqueuing, so a list the client retries
+    * is not partially executed. The surface mutexes are recursive, each
+    * dispatch acquires its instances as usual.
     */
-   ptr = surfaces[sid].inst[inst].mapping.ptr;
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      VMCLDispatchOp *op = &argp->dispatches.dispatches_val[i];
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: sid=%d, gen=%d, inst=%d, *ptr=%x, %x, %x, %x\n",
-               __FUNCTION__, sid, gen, inst,
-               ((unsigned int *)argp->op.ptr.ptr_val)[0],
-               ((unsigned int *)argp->op.ptr.ptr_val)[1],
-               ((unsigned int *)argp->op.ptr.ptr_val)[2],
-               ((unsigned int *)argp->op.ptr.ptr_val)[3]);
-#endif
+      for (argIndex = 0; argIndex < op->args.args_len; argIndex++) {
+         unsigned int sid = (unsigned int)op->args.args_val[argIndex].surf.id;
+         unsigned int gen =
+            (unsigned int)op->args.args_val[argIndex].surf.generation;
+         unsigned int inst;
 
-   memcpy(ptr, argp->op.ptr.ptr_val, argp->op.ptr.ptr_len);
+         if (op->args.args_val[argIndex].type != VMCL_ARG_SURFACE) {
+            continue;
+         }
 
-   /*
-    * We are done with the contents, free the pointer.
-    */
-   if ((argp->op.mapFlags & VMACCEL_MAP_NO_FREE_PTR_FLAG) == 0) {
-      free(argp->op.ptr.ptr_val);
-      argp->op.ptr.ptr_val = NULL;
-      argp->op.ptr.ptr_len = 0;
-   }
+         if ((sid >= VMCL_MAX_SURFACES) ||
+             !IdentifierDB_ActiveId(surfaceIds, sid)) {
+            VMACCEL_WARNING("%s: Invalid surface id=%d\n", __FUNCTION__, sid);
+            result.status = VMACCEL_SEMANTIC_ERROR;
+            goto cleanup;
+         }
 
-   if (--surfaces[sid].inst[inst].mapping.refCount == 0) {
-      if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
-         if (surfaces[sid].inst[inst].svm_ptr == NULL) {
-            errNum = clEnqueueUnmapMemObject(
-               queue, surfaces[sid].inst[inst].mem, ptr, 0, NULL, NULL);
+         if (!locked[sid]) {
+            pthread_mutex_lock(&surfaces[sid].mutex);
+            locked[sid] = true;
+         }
+
+         inst = VMWOpenCLSurface_LookupInstance(&surfaces[sid], gen);
+
+         if (surfaces[sid].inst[inst].generation > gen) {
+            VMACCEL_WARNING("Out-of-order update detected, client/server"
+                            " out of sync...\n");
+            result.status = VMACCEL_SEMANTIC_ERROR;
+            goto cleanup;
+         } else if (surfaces[sid].inst[inst].generation != gen) {
+            result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+            goto cleanup;
          }
       }
-      surfaces[sid].inst[inst].mapping.ptr = NULL;
    }
 
-   if (errNum != CL_SUCCESS) {
-      VMACCEL_WARNING("Unable to unmap sid=%d instance=%d generation=%d\n", sid,
-                      inst, gen);
-      result.status = VMACCEL_FAIL;
-   } else {
-      surfaces[sid].inst[inst].generation = gen;
+   /*
+    * The list is not atomic, a dispatch failing past validation leaves the
+    * dispatches before it enqueued and fails the list with VMACCEL_FAIL.
+    */
+   for (i = 0; i < argp->dispatches.dispatches_len; i++) {
+      if (vmwopencl_dispatch_1(&argp->dispatches.dispatches_val[i])->status !=
+          VMACCEL_SUCCESS) {
+         VMACCEL_WARNING("%s: Dispatch %d of %d failed\n", __FUNCTION__, i,
+                         argp->dispatches.dispatches_len);
+         result.status = VMACCEL_FAIL;
+         break;
+      }
    }
 
-   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-   pthread_mutex_unlock(&surfaces[sid].mutex);
+cleanup:
+
+   for (i = 0; i < VMCL_MAX_SURFACES; i++) {
+      if (locked[i]) {
+         pthread_mutex_unlock(&surfaces[i].mutex);
+      }
+   }
 
    return (&result);
 }
 
-VMAccelStatus *vmwopencl_surfacecopy_1(VMCLSurfaceCopyOp *argp) {
-   static VMAccelStatus result;
+VMCLProfileStatus *vmwopencl_profilequery_1(VMCLProfileQueryOp *argp) {
+   static VMCLProfileStatus result;
    unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int dstSid = (unsigned int)argp->dst.accel.id;
-   unsigned int dstGen = (unsigned int)argp->dst.accel.generation;
-   unsigned int dstInst = 0; //(unsigned int)argp->dst.accel.instance;
-   unsigned int srcSid = (unsigned int)argp->src.accel.id;
-   unsigned int srcGen = (unsigned int)argp->src.accel.generation;
-   unsigned int srcInst = 0; //(unsigned int)argp->src.accel.instance;
-   cl_command_queue queue = queues[qid].queue;
+   cl_event event = NULL;
+   cl_ulong timestamps[4];
+   cl_profiling_info params[4] = {
+      CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+      CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+   cl_int status = CL_COMPLETE;
    cl_int errNum;
+   int i;
 
    memset(&result, 0, sizeof(result));
 
-   /*
-    * Cross context surface copy is not currently supported.
-    */
-   if (argp->dst.cid != argp->src.cid) {
-      assert(0);
+   if ((argp->type >= VMCL_PROFILE_MAX) ||
+       !IdentifierDB_ActiveId(queueIds, qid) || !queues[qid].profiling) {
       result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   pthread_mutex_lock(&surfaces[srcSid].mutex);
-   pthread_mutex_lock(&surfaces[dstSid].mutex);
+   pthread_mutex_lock(&profileMutex);
+   event = queues[qid].profile[argp->type];
+   if (event != NULL) {
+      clRetainEvent(event);
+   }
+   pthread_mutex_unlock(&profileMutex);
 
-   pthread_mutex_lock(&surfaces[srcSid].inst[srcInst].mutex);
-   pthread_mutex_lock(&surfaces[dstSid].inst[dstInst].mutex);
+   if (event == NULL) {
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
 
-   if (surfaces[srcSid].inst[srcInst].generation < srcGen) {
-      VMACCEL_LOG("%s: generation %d < %d\n", __FUNCTION__,
-                  surfaces[srcSid].inst[srcInst].generation, srcGen);
+   /*
+    * Timestamps are available once the command completes, the query doesn't
+    * wait for it.
+    */
+   errNum = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                           sizeof(status), &status, NULL);
 
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   if ((errNum == CL_SUCCESS) && (status > CL_COMPLETE)) {
+      clReleaseEvent(event);
+      result.status = VMACCEL_TIMEOUT;
+      return (&result);
+   }
 
-      pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
-      pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
+   if ((errNum == CL_SUCCESS) && (status < CL_COMPLETE)) {
+      errNum = status;
+   }
 
-      pthread_mutex_unlock(&surfaces[dstSid].mutex);
-      pthread_mutex_unlock(&surfaces[srcSid].mutex);
+   for (i = 0; (i < 4) && (errNum == CL_SUCCESS); i++) {
+      errNum = clGetEventProfilingInfo(event, params[i], sizeof(cl_ulong),
+                                       &timestamps[i], NULL);
+   }
+
+   clReleaseEvent(event);
 
+   if (errNum != CL_SUCCESS) {
+      VMACCEL_WARNING("%s: Unable to profile queue %d, errNum=%d\n",
+                      __FUNCTION__, qid, errNum);
+      result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   if ((surfaces[srcSid].inst[srcInst].generation > srcGen) ||
-       (surfaces[dstSid].inst[dstInst].generation > dstGen)) {
-      VMACCEL_LOG("%s: semantic error backend.srcGen=%d srcGen=%d"
-                  " backend.dstGen=%d dstGen=%d\n",
-                  __FUNCTION__, surfaces[srcSid].inst[srcInst].generation,
-                  srcGen, surfaces[dstSid].inst[dstInst].generation, dstGen);
+   result.queued = timestamps[0];
+   result.submit = timestamps[1];
+   result.start = timestamps[2];
+   result.end = timestamps[3];
 
-      result.status = VMACCEL_SEMANTIC_ERROR;
+   return (&result);
+}
 
-      pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
-      pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
+#if ENABLE_VMCL_SNAPSHOT
+/*
+ * Backend snapshot.
+ *
+ * The objects of every active context are written to a memory-mapped file
+ * by vmwopencl_checkpoint, and rebuilt under the same identifiers by
+ * vmwopencl_restore. Clients of a restarted server resume without
+ * re-uploading surfaces or recompiling kernels. The file is a header
+ * followed by records, in the order they are restored, each record is
+ * followed by its data padded to 8 bytes.
+ */
+#define VMWOPENCL_SNAPSHOT_MAGIC 0x50414e534c434d56ULL
+#define VMWOPENCL_SNAPSHOT_VERSION 1
+
+enum VMWOpenCLSnapshotRecordType {
+   VMWOPENCL_SNAPSHOT_CONTEXT = 0,
+   VMWOPENCL_SNAPSHOT_PROGRAM = 1,
+   VMWOPENCL_SNAPSHOT_KERNEL = 2,
+   VMWOPENCL_SNAPSHOT_QUEUE = 3,
+   VMWOPENCL_SNAPSHOT_SURFACE = 4,
+   VMWOPENCL_SNAPSHOT_SAMPLER = 5,
+};
 
-      pthread_mutex_unlock(&surfaces[dstSid].mutex);
-      pthread_mutex_unlock(&surfaces[srcSid].mutex);
+typedef struct VMWOpenCLSnapshotHeader {
+   uint64_t magic;
+   uint32_t version;
+   uint32_t numRecords;
+   uint64_t size;
+} VMWOpenCLSnapshotHeader;
 
-      return (&result);
+typedef struct VMWOpenCLSnapshotRecord {
+   uint32_t type;
+   uint32_t id;
+   /*
+    * Size of the data following the record, excluding padding.
+    */
+   uint64_t size;
+   union {
+      struct {
+         uint32_t device;
+         uint32_t numSubDevices;
+      } context;
+      /*
+       * Followed by the program binary.
+       */
+      struct {
+         uint32_t cid;
+         uint32_t subDevice;
+         uint64_t key;
+      } program;
+      /*
+       * Followed by the kernel name.
+       */
+      struct {
+         uint32_t pid;
+      } kernel;
+      struct {
+         uint32_t cid;
+         uint32_t subDevice;
+         VMAccelQueueDesc desc;
+      } queue;
+      /*
+       * Followed by the contents of the latest generation.
+       */
+      struct {
+         uint32_t cid;
+         uint32_t generation;
+         VMAccelSurfaceDesc desc;
+      } surface;
+      struct {
+         uint32_t cid;
+         VMCLSamplerDesc desc;
+      } sampler;
+   } u;
+} VMWOpenCLSnapshotRecord;
+
+#define VMWOPENCL_SNAPSHOT_ALIGN(_SIZE) (((_SIZE) + 7) & ~((uint64_t)7))
+
+typedef struct VMWOpenCLSnapshot {
+   /*
+    * NULL while the snapshot is sized.
+    */
+   unsigned char *base;
+   size_t size;
+   size_t offset;
+   uint32_t numRecords;
+} VMWOpenCLSnapshot;
+
+static const char *VMWOpenCLSnapshot_Path() {
+   return getenv("VMCL_SNAPSHOT_PATH");
+}
+
+/*
+ * VMWOpenCLSnapshot_Append
+ *
+ * Appends a record, returning the location of its data or NULL while the
+ * snapshot is sized. Records beyond the size of the snapshot are counted,
+ * but not written.
+ */
+static unsigned char *
+VMWOpenCLSnapshot_Append(VMWOpenCLSnapshot *snap,
+                         const VMWOpenCLSnapshotRecord *rec) {
+   unsigned char *data = NULL;
+
+   if ((snap->base != NULL) &&
+       (snap->offset + sizeof(*rec) + rec->size <= snap->size)) {
+      memcpy(snap->base + snap->offset, rec, sizeof(*rec));
+      data = snap->base + snap->offset + sizeof(*rec);
    }
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: srcSid=%d, srcGen=%d, dstSid=%d, dstGen=%d\n", __FUNCTION__,
-               srcSid, srcGen, dstSid, dstGen);
-#endif
+   snap->offset += sizeof(*rec) + VMWOPENCL_SNAPSHOT_ALIGN(rec->size);
+   snap->numRecords++;
 
-   if (surfaces[srcSid].inst[srcInst].svm_ptr ||
-       surfaces[dstSid].inst[dstInst].svm_ptr) {
-      VMACCEL_WARNING("%s: Copy with SVM unsupported.\n", __FUNCTION__);
-      result.status = VMACCEL_FAIL;
-   } else if ((surfaces[dstSid].desc.type == VMACCEL_SURFACE_BUFFER) &&
-              (surfaces[srcSid].desc.type == VMACCEL_SURFACE_BUFFER)) {
-      errNum = clEnqueueCopyBuffer(
-         queue, surfaces[srcSid].inst[srcInst].mem,
-         surfaces[dstSid].inst[dstInst].mem, argp->op.srcRegion.coord.x,
-         argp->op.dstRegion.coord.x, argp->op.dstRegion.size.x, 0, NULL, NULL);
+   return data;
+}
 
-      if (errNum != CL_SUCCESS) {
-         result.status = VMACCEL_FAIL;
+/*
+ * VMWOpenCLSnapshot_Transfer
+ *
+ * Copies the contents of a surface instance to or from host memory, once
+ * the last command referencing the instance has completed.
+ */
+static bool VMWOpenCLSnapshot_Transfer(unsigned int cid,
+                                       const VMAccelSurfaceDesc *desc,
+                                       VMWOpenCLSurfaceInstance *inst,
+                                       size_t size, void *ptr, bool write) {
+   const cl_event *waitList = (inst->event != NULL) ? &inst->event : NULL;
+   cl_uint numEvents = (inst->event != NULL) ? 1 : 0;
+   cl_command_queue queue;
+   cl_int errNum;
+
+   queue = clCreateCommandQueueWithProperties(
+      contexts[cid].context, contexts[cid].deviceIds[0], NULL, &errNum);
+
+   if (queue == NULL) {
+      return false;
+   }
+
+#if CL_VERSION_2_0
+   if (inst->svm_ptr != NULL) {
+      errNum = clEnqueueSVMMemcpy(queue, CL_TRUE,
+                                  write ? inst->svm_ptr : ptr,
+                                  write ? ptr : inst->svm_ptr, size, numEvents,
+                                  waitList, NULL);
+   } else
+#endif
+      if (VMAccel_SurfaceIsImage(desc)) {
+      const size_t origin[3] = {0, 0, 0};
+      const size_t region[3] = {desc->width, MAX(desc->height, 1),
+                                MAX(desc->depth, 1)};
+
+      if (write) {
+         errNum = clEnqueueWriteImage(queue, inst->mem, CL_TRUE, origin,
+                                      region, 0, 0, ptr, numEvents, waitList,
+                                      NULL);
+      } else {
+         errNum = clEnqueueReadImage(queue, inst->mem, CL_TRUE, origin, region,
+                                     0, 0, ptr, numEvents, waitList, NULL);
       }
+   } else if (write) {
+      errNum = clEnqueueWriteBuffer(queue, inst->mem, CL_TRUE, 0, size, ptr,
+                                    numEvents, waitList, NULL);
    } else {
-      assert(0);
-      result.status = VMACCEL_FAIL;
+      errNum = clEnqueueReadBuffer(queue, inst->mem, CL_TRUE, 0, size, ptr,
+                                   numEvents, waitList, NULL);
    }
 
-   pthread_mutex_unlock(&surfaces[dstSid].inst[dstInst].mutex);
-   pthread_mutex_unlock(&surfaces[srcSid].inst[srcInst].mutex);
-
-   pthread_mutex_unlock(&surfaces[dstSid].mutex);
-   pthread_mutex_unlock(&surfaces[srcSid].mutex);
+   clReleaseCommandQueue(queue);
 
-   return (&result);
+   return (errNum == CL_SUCCESS);
 }
 
-VMAccelStatus *vmwopencl_imagefill_1(VMCLImageFillOp *argp) {
-   static VMAccelStatus result;
-   unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int sid = (unsigned int)argp->img.accel.id;
-   unsigned int gen = (unsigned int)argp->img.accel.generation;
-   unsigned int inst = 0; //(unsigned int)argp->img.accel.instance;
-   cl_command_queue queue = queues[qid].queue;
-   cl_int errNum;
+static unsigned int VMWOpenCLSnapshot_SubDevice(unsigned int cid,
+                                                cl_device_id deviceId) {
+   unsigned int i;
 
-   memset(&result, 0, sizeof(result));
+   for (i = 0; i < contexts[cid].numSubDevices; i++) {
+      if (contexts[cid].deviceIds[i] == deviceId) {
+         break;
+      }
+   }
 
-   /*
-    * Cross context surface copy is not currently supported.
-    */
-   pthread_mutex_lock(&surfaces[sid].mutex);
+   return i;
+}
 
-   pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+/*
+ * VMWOpenCLSnapshot_Write
+ *
+ * Appends a record for each active object, the snapshot is sized when it
+ * has no backing.
+ */
+static bool VMWOpenCLSnapshot_Write(VMWOpenCLSnapshot *snap) {
+   VMWOpenCLSnapshotRecord rec;
+   unsigned char *data;
+   unsigned int id;
+
+   for (id = 0; id < VMCL_MAX_CONTEXTS; id++) {
+      if (!IdentifierDB_ActiveId(contextIds, id) ||
+          (contexts[id].context == NULL)) {
+         continue;
+      }
 
-   if (surfaces[sid].inst[inst].generation < gen) {
-      VMACCEL_LOG("%s: generation %d < %d\n", __FUNCTION__,
-                  surfaces[sid].inst[inst].generation, gen);
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_CONTEXT;
+      rec.id = id;
+      rec.u.context.device = contexts[id].device;
+      rec.u.context.numSubDevices = contexts[id].numSubDevices;
 
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      VMWOpenCLSnapshot_Append(snap, &rec);
+   }
 
-      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   for (id = 0; id < VMCL_MAX_KERNELS; id++) {
+      size_t size = 0;
 
-      pthread_mutex_unlock(&surfaces[sid].mutex);
+      if ((programs[id].refCount == 0) ||
+          !VMWOpenCLProgram_Binary(programs[id].program, programs[id].deviceId,
+                                   NULL, &size)) {
+         continue;
+      }
 
-      return (&result);
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_PROGRAM;
+      rec.id = id;
+      rec.size = size;
+      rec.u.program.cid = programs[id].cid;
+      rec.u.program.subDevice =
+         VMWOpenCLSnapshot_SubDevice(programs[id].cid, programs[id].deviceId);
+      rec.u.program.key = programs[id].key;
+
+      data = VMWOpenCLSnapshot_Append(snap, &rec);
+
+      if ((data != NULL) &&
+          !VMWOpenCLProgram_Binary(programs[id].program, programs[id].deviceId,
+                                   data, &size)) {
+         VMACCEL_WARNING("%s: Unable to retrieve binary of program %u\n",
+                         __FUNCTION__, id);
+         return false;
+      }
    }
 
-   if (surfaces[sid].inst[inst].generation > gen) {
-      VMACCEL_LOG("%s: semantic error backend.gen=%d gen=%d", __FUNCTION__,
-                  surfaces[sid].inst[inst].generation, gen);
-
-      result.status = VMACCEL_SEMANTIC_ERROR;
+   for (id = 0; id < VMCL_MAX_KERNELS; id++) {
+      if (!IdentifierDB_ActiveId(kernelIds, id)) {
+         continue;
+      }
 
-      pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_KERNEL;
+      rec.id = id;
+      rec.size = strlen(kernels[id].name) + 1;
+      rec.u.kernel.pid = kernels[id].pid;
 
-      pthread_mutex_unlock(&surfaces[sid].mutex);
+      data = VMWOpenCLSnapshot_Append(snap, &rec);
 
-      return (&result);
+      if (data != NULL) {
+         memcpy(data, kernels[id].name, rec.size);
+      }
    }
 
-#if DEBUG_SURFACE_CONSISTENCY
-   VMACCEL_LOG("%s: sid=%d, gen=%d\n", __FUNCTION__, sid, gen);
-#endif
+   for (id = 0; id < VMCL_MAX_QUEUES; id++) {
+      if (!IdentifierDB_ActiveId(queueIds, id)) {
+         continue;
+      }
 
-   if (surfaces[sid].inst[inst].svm_ptr) {
-      VMACCEL_WARNING("%s: Fill with SVM unsupported.\n", __FUNCTION__);
-      result.status = VMACCEL_FAIL;
-   } else if (surfaces[sid].desc.type == VMACCEL_SURFACE_BUFFER) {
-      errNum = clEnqueueFillBuffer(
-         queue, surfaces[sid].inst[inst].mem, (const void *)&argp->op.u,
-         sizeof(argp->op.u), argp->op.dstRegion.coord.x,
-         argp->op.dstRegion.size.x, 0, NULL, NULL);
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_QUEUE;
+      rec.id = id;
+      rec.u.queue.cid = queues[id].cid;
+      rec.u.queue.subDevice = queues[id].subDevice;
+      rec.u.queue.desc = queues[id].desc;
 
-      if (errNum != CL_SUCCESS) {
-         VMACCEL_WARNING("%s: Fill failed errNum=%d\n", __FUNCTION__, errNum);
-         result.status = VMACCEL_FAIL;
-      } else {
-         surfaces[sid].inst[inst].generation = gen;
-      }
-   } else {
-      assert(0);
-      result.status = VMACCEL_FAIL;
+      VMWOpenCLSnapshot_Append(snap, &rec);
    }
 
-   pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
+   for (id = 0; id < VMCL_MAX_SAMPLERS; id++) {
+      if (!IdentifierDB_ActiveId(samplerIds, id)) {
+         continue;
+      }
 
-   pthread_mutex_unlock(&surfaces[sid].mutex);
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_SAMPLER;
+      rec.id = id;
+      rec.u.sampler.cid = samplers[id].cid;
+      rec.u.sampler.desc = samplers[id].desc;
 
-   return (&result);
-}
+      VMWOpenCLSnapshot_Append(snap, &rec);
+   }
 
-VMCLSamplerAllocateStatus *
-vmwopencl_sampleralloc_1(VMCLSamplerAllocateDesc *argp) {
-   static VMCLSamplerAllocateStatus result;
+   for (id = 0; id < VMCL_MAX_SURFACES; id++) {
+      VMWOpenCLSurface *surf = &surfaces[id];
+      VMWOpenCLSurfaceInstance *inst;
 
-   memset(&result, 0, sizeof(result));
+      if (!IdentifierDB_ActiveId(surfaceIds, id)) {
+         continue;
+      }
 
-   assert(0);
+      pthread_mutex_lock(&surf->mutex);
 
-   result.status = VMACCEL_FAIL;
+      inst = &surf->inst[surf->latest];
 
-   return (&result);
-}
+      memset(&rec, 0, sizeof(rec));
+      rec.type = VMWOPENCL_SNAPSHOT_SURFACE;
+      rec.id = id;
+      rec.size = ((surf->desc.type == VMACCEL_SURFACE_BUFFER) ||
+                  VMAccel_SurfaceIsImage(&surf->desc))
+                    ? VMAccel_SurfaceSize(&surf->desc)
+                    : 0;
+      rec.u.surface.cid = surf->cid;
+      rec.u.surface.generation = inst->generation;
+      rec.u.surface.desc = surf->desc;
 
-VMAccelStatus *vmwopencl_samplerdestroy_1(VMCLSamplerId *argp) {
-   static VMAccelStatus result;
+      data = VMWOpenCLSnapshot_Append(snap, &rec);
 
-   memset(&result, 0, sizeof(result));
+      if (data != NULL) {
+         bool ret;
 
-   assert(0);
+         if (inst->mapping.refCount > 0) {
+            VMACCEL_WARNING("%s: Surface %u is mapped, unmapped writes are "
+                            "not captured\n",
+                            __FUNCTION__, id);
+         }
 
-   result.status = VMACCEL_FAIL;
+         pthread_mutex_lock(&inst->mutex);
+         ret = VMWOpenCLSnapshot_Transfer(surf->cid, &surf->desc, inst,
+                                          rec.size, data, false);
+         pthread_mutex_unlock(&inst->mutex);
 
-   return (&result);
+         if (!ret) {
+            VMACCEL_WARNING("%s: Unable to read back surface %u\n",
+                            __FUNCTION__, id);
+            pthread_mutex_unlock(&surf->mutex);
+            return false;
+         }
+      }
+
+      pthread_mutex_unlock(&surf->mutex);
+   }
+
+   return true;
 }
 
-VMCLKernelAllocateStatus *
-vmwopencl_kernelalloc_1(VMCLKernelAllocateDesc *argp) {
-   static VMCLKernelAllocateStatus result;
-   unsigned int cid = (unsigned int)argp->client.cid;
-   unsigned int kid = (unsigned int)argp->client.id;
-   unsigned int subDevice = (unsigned int)argp->subDevice;
-   cl_context context = contexts[cid].context;
-   cl_device_id deviceId = contexts[cid].deviceIds[subDevice];
-   cl_kernel kernel = 0;
-   cl_int errNum;
-   cl_program program;
-   size_t sourceLength = argp->source.source_len;
+VMAccelStatus *vmwopencl_checkpoint() {
+   static VMAccelStatus result;
+   const char *path = VMWOpenCLSnapshot_Path();
+   VMWOpenCLSnapshot snap = {NULL, 0, sizeof(VMWOpenCLSnapshotHeader), 0};
+   VMWOpenCLSnapshotHeader *hdr;
+   char tmpPath[PATH_MAX];
+   void *base;
+   size_t size;
+   bool ret;
+   int fd;
 
    memset(&result, 0, sizeof(result));
 
-   VMACCEL_LOG("Allocating kernel id=%d\n", kid);
-
-   if (IdentifierDB_ActiveId(kernelIds, kid)) {
-      VMACCEL_WARNING("%s: ERROR: Kernel ID %d already active...\n",
-                      __FUNCTION__, kid);
+   if ((path == NULL) || (contexts == NULL)) {
       result.status = VMACCEL_RESOURCE_UNAVAILABLE;
       return (&result);
    }
 
-   if ((argp->language == VMCL_OPENCL_C_1_0) ||
-       (argp->language == VMCL_OPENCL_C_1_1) ||
-       (argp->language == VMCL_OPENCL_C_1_2)
-#if CL_VERSION_2_0
-       || ((contexts[cid].majorVersion >= 2) &&
-           (contexts[cid].minorVersion >= 2) &&
-           (argp->language == VMCL_OPENCL_C_2_0))
-#endif
-   ) {
-      VMACCEL_LOG("Creating OpenCL C program\n");
-
-#if DEBUG_COMPUTE_OPERATION
-      VMACCEL_LOG("%s\n", argp->source.source_val);
-#endif
+   VMWOpenCLSnapshot_Write(&snap);
 
-      program = clCreateProgramWithSource(
-         context, 1, (const char **)&argp->source.source_val, &sourceLength,
-         &errNum);
-#if CL_VERSION_2_2
-   } else if ((contexts[cid].majorVersion >= 2) &&
-              (contexts[cid].minorVersion >= 2) &&
-              (argp->language == VMCL_OPENCL_CPP_1_0)) {
-      VMACCEL_LOG("Creating OpenCL CPP program\n");
+   size = snap.offset;
 
-      program = clCreateProgramWithSource(
-         context, 1, (const char **)&argp->source.source_val, &sourceLength,
-         &errNum);
-   } else if ((contexts[cid].majorVersion >= 2) &&
-              (contexts[cid].minorVersion >= 2) &&
-              ((argp->language == VMCL_SPIRV_1_1) ||
-               (argp->language == VMCL_SPIRV_1_2))) {
-      VMACCEL_LOG("Creating SPIR-V 1.1/1.2 program\n");
+   /*
+    * Write to a temporary file and rename, a failed checkpoint never
+    * replaces a complete snapshot.
+    */
+   snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, getpid());
 
-      program = clCreateProgramWithIL(context, (void *)argp->source.source_val,
-                                      argp->source.source_len, &errNum);
-#endif
-#if CL_VERSION_2_1
-   } else if ((contexts[cid].majorVersion >= 2) &&
-              (contexts[cid].minorVersion >= 1) &&
-              (argp->language == VMCL_SPIRV_1_0)) {
-      VMACCEL_LOG("Creating SPIR-V 1.0 program\n");
+   fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
 
-      FILE *fp;
-      fp = fopen("/tmp/server.spirv", "wb");
+   if (fd < 0) {
+      VMACCEL_WARNING("%s: Unable to create %s\n", __FUNCTION__, tmpPath);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
 
-      if (fp) {
-         fwrite(argp->source.source_val, argp->source.source_len, 1, fp);
+   if (ftruncate(fd, size) != 0) {
+      base = MAP_FAILED;
+   } else {
+      base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   }
 
-         fflush(fp);
-         fclose(fp);
-      }
+   close(fd);
 
-      program = clCreateProgramWithIL(context, (void *)argp->source.source_val,
-                                      argp->source.source_len, &errNum);
-#endif
-   } else {
-      assert(0);
+   if (base == MAP_FAILED) {
+      VMACCEL_WARNING("%s: Unable to map %s\n", __FUNCTION__, tmpPath);
+      unlink(tmpPath);
       result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   if ((program == NULL) || (errNum != CL_SUCCESS)) {
-      VMACCEL_WARNING("Failed to create CL program\n");
+   snap.base = base;
+   snap.size = size;
+   snap.offset = sizeof(VMWOpenCLSnapshotHeader);
+   snap.numRecords = 0;
+
+   ret = VMWOpenCLSnapshot_Write(&snap) && (snap.offset == size);
+
+   hdr = (VMWOpenCLSnapshotHeader *)base;
+   hdr->magic = VMWOPENCL_SNAPSHOT_MAGIC;
+   hdr->version = VMWOPENCL_SNAPSHOT_VERSION;
+   hdr->numRecords = snap.numRecords;
+   hdr->size = size;
+
+   ret = ret && (msync(base, size, MS_SYNC) == 0);
+
+   munmap(base, size);
+
+   if (!ret || (rename(tmpPath, path) != 0)) {
+      VMACCEL_WARNING("%s: Unable to checkpoint to %s\n", __FUNCTION__, path);
+      unlink(tmpPath);
       result.status = VMACCEL_FAIL;
       return (&result);
    }
 
-   VMACCEL_LOG("Building program %p\n", program);
+   VMACCEL_LOG("Checkpointed %u objects to %s, size=%zu\n", snap.numRecords,
+               path, size);
 
-   errNum = clBuildProgram(program, 1, &deviceId, NULL, NULL, NULL);
+   return (&result);
+}
 
-   if (errNum != CL_SUCCESS) {
-      char *buildLog;
+static VMAccelStatusCode
+VMWOpenCLSnapshot_RestoreProgram(const VMWOpenCLSnapshotRecord *rec,
+                                 const unsigned char *data) {
+   unsigned int cid = rec->u.program.cid;
+   cl_program program;
+   cl_device_id deviceId;
+   cl_int errNum;
 
-      VMACCEL_WARNING("Error in kernel:\n");
+   if ((rec->id >= VMCL_MAX_KERNELS) || (cid >= VMCL_MAX_CONTEXTS) ||
+       !IdentifierDB_ActiveId(contextIds, cid) ||
+       (rec->u.program.subDevice >= contexts[cid].numSubDevices)) {
+      return VMACCEL_SEMANTIC_ERROR;
+   }
 
-      buildLog = malloc(sizeof(char) * 16384);
+   deviceId = contexts[cid].deviceIds[rec->u.program.subDevice];
 
-      if (buildLog) {
-         clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, 16384,
-                               buildLog, NULL);
-         VMACCEL_WARNING("%s\n", buildLog);
-         free(buildLog);
-      }
+   program = VMWOpenCLProgram_CreateWithBinary(
+      contexts[cid].context, deviceId, data, rec->size, NULL, &errNum);
 
-      clReleaseProgram(program);
-      result.status = VMACCEL_FAIL;
-      return (&result);
+   if (program == NULL) {
+      VMACCEL_WARNING("%s: Unable to load program %u, errNum=%d\n",
+                      __FUNCTION__, rec->id, errNum);
+      return VMACCEL_FAIL;
+   }
+
+   /*
+    * References are taken by the restored kernels.
+    */
+   programs[rec->id].cid = cid;
+   programs[rec->id].deviceId = deviceId;
+   programs[rec->id].key = rec->u.program.key;
+   programs[rec->id].program = program;
+   programs[rec->id].refCount = 0;
+
+   return VMACCEL_SUCCESS;
+}
+
+static VMAccelStatusCode
+VMWOpenCLSnapshot_RestoreKernel(const VMWOpenCLSnapshotRecord *rec,
+                                const unsigned char *data) {
+   unsigned int pid = rec->u.kernel.pid;
+   const char *name = (const char *)data;
+   cl_kernel kernel;
+
+   if ((rec->id >= VMCL_MAX_KERNELS) || (pid >= VMCL_MAX_KERNELS) ||
+       (programs[pid].program == NULL) || (rec->size == 0) ||
+       (name[rec->size - 1] != '\0')) {
+      return VMACCEL_SEMANTIC_ERROR;
    }
 
-   // Create OpenCL kernel
-   kernel = clCreateKernel(program, argp->kernelName.kernelName_val, NULL);
+   kernel = clCreateKernel(programs[pid].program, name, NULL);
+
    if (kernel == NULL) {
-      VMACCEL_WARNING("Failed to create kernel\n");
-      clReleaseProgram(program);
-      result.status = VMACCEL_FAIL;
-      return (&result);
+      return VMACCEL_FAIL;
    }
 
-   if (IdentifierDB_AcquireId(kernelIds, kid)) {
-      kernels[kid].program = program;
-      kernels[kid].kernel = kernel;
-   } else {
-      assert(0);
-      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+   if (!IdentifierDB_AcquireId(kernelIds, rec->id)) {
+      clReleaseKernel(kernel);
+      return VMACCEL_RESOURCE_UNAVAILABLE;
    }
 
-   result.status = VMACCEL_SUCCESS;
+   memset(&kernels[rec->id], 0, sizeof(kernels[0]));
+   kernels[rec->id].pid = pid;
+   kernels[rec->id].name = strdup(name);
+   kernels[rec->id].unbound = kernel;
+   programs[pid].refCount++;
 
-   return (&result);
+   return VMACCEL_SUCCESS;
 }
 
-VMAccelStatus *vmwopencl_kerneldestroy_1(VMCLKernelId *argp) {
-   static VMAccelStatus result;
-   unsigned int kid = (unsigned int)argp->id;
-
-   memset(&result, 0, sizeof(result));
+static VMAccelStatusCode
+VMWOpenCLSnapshot_RestoreSurface(const VMWOpenCLSnapshotRecord *rec,
+                                 const unsigned char *data) {
+   VMCLSurfaceAllocateDesc desc;
+   VMWOpenCLSurfaceInstance *inst;
+   VMAccelStatusCode status;
+
+   memset(&desc, 0, sizeof(desc));
+   desc.client.cid = rec->u.surface.cid;
+   desc.client.accel.id = rec->id;
+   desc.desc = rec->u.surface.desc;
+
+   if ((rec->id >= VMCL_MAX_SURFACES) ||
+       (rec->size > VMAccel_SurfaceSize(&rec->u.surface.desc))) {
+      return VMACCEL_SEMANTIC_ERROR;
+   }
 
-   VMACCEL_LOG("Destroying kernel id=%d\n", kid);
+   status = vmwopencl_surfacealloc_1(&desc)->status;
 
-   if (!IdentifierDB_ActiveId(kernelIds, kid)) {
-      result.status = VMACCEL_SUCCESS;
-      return &result;
+   if (status != VMACCEL_SUCCESS) {
+      return status;
    }
 
-   clReleaseProgram(kernels[kid].program);
-   clReleaseKernel(kernels[kid].kernel);
-   memset(&kernels[kid], 0, sizeof(kernels[0]));
-
-   IdentifierDB_ReleaseId(kernelIds, kid);
+   inst = &surfaces[rec->id].inst[0];
+   inst->generation = rec->u.surface.generation;
 
-   result.status = VMACCEL_SUCCESS;
+   if ((rec->size > 0) &&
+       !VMWOpenCLSnapshot_Transfer(rec->u.surface.cid,
+                                   &rec->u.surface.desc, inst, rec->size,
+                                   (void *)data, true)) {
+      VMACCEL_WARNING("%s: Unable to restore contents of surface %u\n",
+                      __FUNCTION__, rec->id);
+      return VMACCEL_FAIL;
+   }
 
-   return (&result);
+   return VMACCEL_SUCCESS;
 }
 
-VMAccelStatus *vmwopencl_dispatch_1(VMCLDispatchOp *argp) {
+VMAccelStatus *vmwopencl_restore() {
    static VMAccelStatus result;
-   unsigned int qid = (unsigned int)argp->queue.id;
-   unsigned int kid = (unsigned int)argp->kernel.id;
-   cl_command_queue queue = queues[qid].queue;
-   cl_kernel kernel = kernels[kid].kernel;
-   cl_int errNum;
-   size_t *globalWorkOffset = NULL;
-   size_t *globalWorkSize = NULL;
-   size_t *localWorkSize = NULL;
-   int argIndex;
+   const char *path = VMWOpenCLSnapshot_Path();
+   const VMWOpenCLSnapshotHeader *hdr;
+   unsigned int numRestored = 0;
+   unsigned int i;
+   unsigned char *base;
+   struct stat st;
+   size_t offset;
+   int fd;
 
    memset(&result, 0, sizeof(result));
 
-#if DEBUG_COMPUTE_OPERATION
-   VMACCEL_LOG("%s: qid=%d, kid=%d, kernel=%p\n", __FUNCTION__, qid, kid,
-               kernel);
-#endif
+   if ((path == NULL) || (contexts == NULL)) {
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
 
-   for (argIndex = 0; argIndex < argp->args.args_len; argIndex++) {
-      if (argp->args.args_val[argIndex].type == VMCL_ARG_SURFACE) {
-         unsigned int sid = (unsigned int)argp->args.args_val[argIndex].surf.id;
-         unsigned int gen =
-            (unsigned int)argp->args.args_val[argIndex].surf.generation;
-         unsigned int inst =
-            (unsigned int)argp->args.args_val[argIndex].surf.instance;
+   fd = open(path, O_RDONLY);
 
-         pthread_mutex_lock(&surfaces[sid].mutex);
-         pthread_mutex_lock(&surfaces[sid].inst[inst].mutex);
+   if (fd < 0) {
+      result.status = VMACCEL_RESOURCE_UNAVAILABLE;
+      return (&result);
+   }
 
-#if DEBUG_COMPUTE_OPERATION
-         VMACCEL_LOG("%s: arg[%d]: index=%d, sid=%d, gen=%d, inst=%d,"
-                     " mem=%p\n",
-                     __FUNCTION__, argIndex,
-                     argp->args.args_val[argIndex].index, sid, gen, inst, mem);
-#endif
+   if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(*hdr))) {
+      base = MAP_FAILED;
+   } else {
+      base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
 
-         if (surfaces[sid].inst[inst].generation != gen) {
-            if (surfaces[sid].inst[inst].generation > gen) {
-               VMACCEL_WARNING("Out-of-order update detected, client/server"
-                               " out of sync...\n");
-               result.status = VMACCEL_SEMANTIC_ERROR;
-            } else {
-#if DEBUG_SURFACE_CONSISTENCY
-               VMACCEL_WARNING(
-                  "%s: arg[%d]: surf[%d].gen=%d, expected gen=%d\n",
-                  __FUNCTION__, argIndex, sid,
-                  surfaces[sid].inst[inst].generation, gen);
-#endif
-               result.status = VMACCEL_RESOURCE_UNAVAILABLE;
-            }
+   close(fd);
 
-            goto cleanup;
-         }
+   if (base == MAP_FAILED) {
+      VMACCEL_WARNING("%s: Unable to map %s\n", __FUNCTION__, path);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
 
-#if CL_VERSION_2_0
-         if (surfaces[sid].inst[inst].svm_ptr != NULL) {
-            errNum = clSetKernelArgSVMPointer(
-               kernel, argp->args.args_val[argIndex].index,
-               surfaces[sid].inst[inst].svm_ptr);
-            if (errNum == CL_SUCCESS) {
-               errNum = clSetKernelExecInfo(
-                  kernel, CL_KERNEL_EXEC_INFO_SVM_PTRS, sizeof(void *),
-                  &surfaces[sid].inst[inst].svm_ptr);
-            }
-         } else
-#endif
-         {
-            cl_mem mem = NULL;
+   hdr = (const VMWOpenCLSnapshotHeader *)base;
 
-            mem = surfaces[sid].inst[inst].mem;
+   if ((hdr->magic != VMWOPENCL_SNAPSHOT_MAGIC) ||
+       (hdr->version != VMWOPENCL_SNAPSHOT_VERSION) ||
+       (hdr->size != st.st_size)) {
+      VMACCEL_WARNING("%s: Discarding incompatible snapshot %s\n",
+                      __FUNCTION__, path);
+      munmap(base, st.st_size);
+      unlink(path);
+      result.status = VMACCEL_FAIL;
+      return (&result);
+   }
 
-            errNum = clSetKernelArg(kernel, argp->args.args_val[argIndex].index,
-                                    sizeof(cl_mem), &mem);
-         }
+   offset = sizeof(*hdr);
 
-         if (errNum != CL_SUCCESS) {
-            VMACCEL_WARNING("Unable to set kernel argument, errNum=%d\n",
-                            errNum);
-            result.status = VMACCEL_FAIL;
-            goto cleanup;
-         }
-      } else {
-         assert(0);
+   for (i = 0; i < hdr->numRecords; i++) {
+      const VMWOpenCLSnapshotRecord *rec =
+         (const VMWOpenCLSnapshotRecord *)(base + offset);
+      const unsigned char *data = base + offset + sizeof(*rec);
+      VMAccelStatusCode status = VMACCEL_SEMANTIC_ERROR;
+
+      if ((offset + sizeof(*rec) > hdr->size) ||
+          (rec->size > hdr->size - offset - sizeof(*rec))) {
+         VMACCEL_WARNING("%s: Truncated snapshot %s\n", __FUNCTION__, path);
          result.status = VMACCEL_FAIL;
-         goto cleanup;
+         break;
       }
-   }
-
-   /*
-    * TODO SVM: argp->refs --> clSetKernelExecInfo
-    */
-   assert(argp->dimension <= CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS);
 
-   globalWorkOffset = calloc(argp->dimension, sizeof(*globalWorkOffset));
-   globalWorkSize = calloc(argp->dimension, sizeof(*globalWorkSize));
-   localWorkSize = calloc(argp->dimension, sizeof(*localWorkSize));
+      if (rec->type == VMWOPENCL_SNAPSHOT_CONTEXT) {
+         VMCLContextAllocateDesc desc = {
+            rec->u.context.device,     rec->id, VMACCEL_AUTO_SELECT_MASK,
+            rec->u.context.numSubDevices, 0,
+         };
 
-   for (int i = 0; i < argp->dimension; i++) {
-      globalWorkOffset[i] = argp->globalWorkOffset.globalWorkOffset_val[i];
-      globalWorkSize[i] = argp->globalWorkSize.globalWorkSize_val[i];
-      localWorkSize[i] = argp->localWorkSize.localWorkSize_val[i];
-#if DEBUG_COMPUTE_OPERATION
-      VMACCEL_LOG("%s: globalWorkOffset[%d]=%d, globalWorkSize[%d]=%d,"
-                  " localWorkSize[%d]=%d\n",
-                  __FUNCTION__, i, globalWorkOffset[i], i, globalWorkSize[i], i,
-                  localWorkSize[i]);
-#endif
-   }
+         if ((rec->id < VMCL_MAX_CONTEXTS) &&
+             (rec->u.context.device < numDevices)) {
+            status = vmwopencl_contextalloc_1(&desc)->status;
+         }
+      } else if (rec->type == VMWOPENCL_SNAPSHOT_PROGRAM) {
+         status = VMWOpenCLSnapshot_RestoreProgram(rec, data);
+      } else if (rec->type == VMWOPENCL_SNAPSHOT_KERNEL) {
+         status = VMWOpenCLSnapshot_RestoreKernel(rec, data);
+      } else if (rec->type == VMWOPENCL_SNAPSHOT_QUEUE) {
+         VMCLQueueAllocateDesc desc;
+
+         desc.client.cid = rec->u.queue.cid;
+         desc.client.id = rec->id;
+         desc.subDevice = rec->u.queue.subDevice;
+         desc.desc = rec->u.queue.desc;
+
+         if ((rec->id < VMCL_MAX_QUEUES) &&
+             (rec->u.queue.cid < VMCL_MAX_CONTEXTS) &&
+             IdentifierDB_ActiveId(contextIds, rec->u.queue.cid)) {
+            status = vmwopencl_queuealloc_1(&desc)->status;
+         }
+      } else if (rec->type == VMWOPENCL_SNAPSHOT_SURFACE) {
+         if ((rec->u.surface.cid < VMCL_MAX_CONTEXTS) &&
+             IdentifierDB_ActiveId(contextIds, rec->u.surface.cid)) {
+            status = VMWOpenCLSnapshot_RestoreSurface(rec, data);
+         }
+      } else if (rec->type == VMWOPENCL_SNAPSHOT_SAMPLER) {
+         VMCLSamplerAllocateDesc desc;
 
-   /*
-    * TODO: Evaluate events blocking this kernel and inserting an event here
-    */
-   errNum =
-      clEnqueueNDRangeKernel(queue, kernel, argp->dimension, globalWorkOffset,
-                             globalWorkSize, localWorkSize, 0, NULL, NULL);
+         desc.client.cid = rec->u.sampler.cid;
+         desc.client.id = rec->id;
+         desc.desc = rec->u.sampler.desc;
 
-   if (errNum != CL_SUCCESS) {
-      result.status = VMACCEL_FAIL;
-   }
+         if ((rec->id < VMCL_MAX_SAMPLERS) &&
+             (rec->u.sampler.cid < VMCL_MAX_CONTEXTS) &&
+             IdentifierDB_ActiveId(contextIds, rec->u.sampler.cid)) {
+            status = vmwopencl_sampleralloc_1(&desc)->status;
+         }
+      }
 
-cleanup:
+      if (status == VMACCEL_SUCCESS) {
+         numRestored++;
+      } else {
+         VMACCEL_WARNING("%s: Unable to restore object %u of type %u, "
+                         "status=%d\n",
+                         __FUNCTION__, rec->id, rec->type, status);
+      }
 
-   for (argIndex = MIN(argIndex, argp->args.args_len - 1); argIndex >= 0;
-        argIndex--) {
-      if (argp->args.args_val[argIndex].type == VMCL_ARG_SURFACE) {
-         unsigned int sid = (unsigned int)argp->args.args_val[argIndex].surf.id;
-         unsigned int inst =
-            (unsigned int)argp->args.args_val[argIndex].surf.instance;
+      offset += sizeof(*rec) + VMWOPENCL_SNAPSHOT_ALIGN(rec->size);
+   }
 
-         pthread_mutex_unlock(&surfaces[sid].inst[inst].mutex);
-         pthread_mutex_unlock(&surfaces[sid].mutex);
+   /*
+    * Release the programs no restored kernel references.
+    */
+   for (i = 0; i < VMCL_MAX_KERNELS; i++) {
+      if ((programs[i].program != NULL) && (programs[i].refCount == 0)) {
+         clReleaseProgram(programs[i].program);
+         memset(&programs[i], 0, sizeof(programs[0]));
       }
    }
 
-   if (localWorkSize != NULL) {
-      free(localWorkSize);
-   }
+   VMACCEL_LOG("Restored %u of %u objects from %s\n", numRestored,
+               hdr->numRecords, path);
 
-   if (globalWorkSize != NULL) {
-      free(globalWorkSize);
-   }
+   munmap(base, st.st_size);
 
-   if (globalWorkOffset != NULL) {
-      free(globalWorkOffset);
-   }
+   /*
+    * The snapshot is consumed, a later restart must not resurrect objects
+    * destroyed since.
+    */
+   unlink(path);
 
    return (&result);
 }
+#endif
 
 /*
  * Setup the backend op dispatch
@@ -1719,8 +5060,13 @@ cleanup:
 VMCLOps vmwopenclOps = {
    vmwopencl_poweron,
    vmwopencl_poweroff,
+#if ENABLE_VMCL_SNAPSHOT
+   vmwopencl_checkpoint,
+   vmwopencl_restore,
+#else
    NULL,
    NULL,
+#endif
    vmwopencl_contextalloc_1,
    vmwopencl_contextdestroy_1,
    vmwopencl_surfacealloc_1,
@@ -1739,4 +5085,7 @@ VMCLOps vmwopenclOps = {
    vmwopencl_surfacecopy_1,
    vmwopencl_imagefill_1,
    vmwopencl_dispatch_1,
+   vmwopencl_profilequery_1,
+   vmwopencl_dispatchlist_1,
+   vmwopencl_surfaceallocuser_1,
 };
@@ -56,11 +56,35 @@ extern "C" {
 }
 
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
+/*
+ * Awaitable requests require C++20 coroutine support from the compiler.
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define VMACCEL_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifndef VMACCEL_HAS_COROUTINES
+#define VMACCEL_HAS_COROUTINES 0
+#endif
+
 namespace vmaccel {
 
 class context;
@@ -572,6 +596,43 @@ private:
    std::map<VMAccelId, ref_object<surface>> surfaces;
 };
 
+/**
+ * alloc_user_backing
+ *
+ * Allocates page aligned memory for the backing of a surface on user memory,
+ * see VMACCEL_SURFACE_POOL_USER_MEMORY. Huge pages are aligned to the size
+ * of a huge page and advised as such, the kernel may still back the memory
+ * with regular pages.
+ *
+ * @param size Size of the surface in bytes.
+ * @param hugePages Request transparent huge pages for the memory.
+ * @return Backing for the surface, empty if the allocation failed.
+ */
+inline std::shared_ptr<char> alloc_user_backing(size_t size,
+                                                bool hugePages = false) {
+   long pageSize = sysconf(_SC_PAGESIZE);
+   size_t alignment = (pageSize > 0) ? (size_t)pageSize : 4096;
+   void *ptr = NULL;
+
+   if (hugePages) {
+      alignment = MAX(alignment, (size_t)2 * 1024 * 1024);
+   }
+
+   size = (size + alignment - 1) & ~(alignment - 1);
+
+   if (posix_memalign(&ptr, alignment, size) != 0) {
+      return std::shared_ptr<char>();
+   }
+
+#ifdef MADV_HUGEPAGE
+   if (hugePages) {
+      madvise(ptr, size, MADV_HUGEPAGE);
+   }
+#endif
+
+   return std::shared_ptr<char>((char *)ptr, free);
+}
+
 /**
  * VMAccel surface object class.
  *
@@ -603,7 +664,7 @@ public:
       desc = d;
       generation = 0;
       id = a->alloc_id();
-      backing = std::shared_ptr<char>(new char[d.width]);
+      backing = std::shared_ptr<char>(new char[VMAccel_SurfaceSize(&d)]);
       consistencyDB = IdentifierDB_Alloc(a->get_max_ref_objects());
       LOG_EXIT(("} surface::Constructor\n"));
    }
@@ -662,13 +723,52 @@ public:
 
    std::shared_ptr<char> &get_backing() { return backing; }
 
+   /**
+    * copy_region
+    *
+    * Copies a region of the backing to or from tightly packed memory, see
+    * VMAccel_SurfaceRegionLayout.
+    *
+    * @return True if the region is within the surface and the memory.
+    */
+   bool copy_region(const VMAccelSurfaceRegion &imgRegion, char *ptr,
+                    size_t size, bool toBacking) {
+      size_t origin[3], region[3], rowPitch, slicePitch;
+      char *base = backing.get();
+
+      if (!VMAccel_SurfaceRegionLayout(&desc, &imgRegion, origin, region,
+                                       &rowPitch, &slicePitch) ||
+          (size < region[0] * region[1] * region[2])) {
+         return false;
+      }
+
+      for (size_t z = 0; z < region[2]; z++) {
+         for (size_t y = 0; y < region[1]; y++) {
+            char *row = base + (origin[2] + z) * slicePitch +
+                        (origin[1] + y) * rowPitch + origin[0];
+
+            if (toBacking) {
+               memcpy(row, ptr, region[0]);
+            } else {
+               memcpy(ptr, row, region[0]);
+            }
+
+            ptr += region[0];
+         }
+      }
+
+      return true;
+   }
+
    /**
     * upload
     *
     * Uploads contents of "in" to a given image region within a surface.
     * Uploads to a surface to avoid holding open map operations. Concurrent
     * map operations can lead to contention between two or more threads for
-    * the same surface contents.
+    * the same surface contents. The region is in elements of "in" along x
+    * for buffers and in elements of the format for images, rows and slices
+    * of a sub-region follow the pitches of the surface.
     *
     * @return VMAccelStatusCodeEnum value.
     */
@@ -677,14 +777,33 @@ public:
 #if DEBUG_SURFACE_CONSISTENCY
       VMACCEL_LOG("%s: surface id=%d\n", __FUNCTION__, id);
 #endif
-      if (desc.format == VMACCEL_FORMAT_R8_TYPELESS && imgRegion.coord.x == 0 &&
+      if (desc.type == VMACCEL_SURFACE_BUFFER &&
+          desc.format == VMACCEL_FORMAT_R8_TYPELESS && imgRegion.coord.x == 0 &&
           imgRegion.coord.y == 0 && imgRegion.coord.z == 0 &&
           imgRegion.size.x * sizeof(E) == desc.width &&
           imgRegion.size.y == desc.height && imgRegion.size.z == desc.depth) {
-         memcpy(backing.get(), in.get_ptr(), MIN(desc.width, in.get_size()));
+         /*
+          * The contents of a backing updated in place are not copied.
+          */
+         if ((char *)in.get_ptr() != backing.get()) {
+            memcpy(backing.get(), in.get_ptr(),
+                   MIN(desc.width, in.get_size()));
+         }
          set_consistency_range(0, accel->get_max_ref_objects() - 1, false);
          generation++;
          return VMACCEL_SUCCESS;
+      } else if (VMAccel_SurfaceIsImage(&desc) ||
+                 desc.format == VMACCEL_FORMAT_R8_TYPELESS) {
+         if (!VMAccel_SurfaceIsImage(&desc)) {
+            imgRegion.coord.x *= sizeof(E);
+            imgRegion.size.x *= sizeof(E);
+         }
+         if (copy_region(imgRegion, (char *)in.get_ptr(), in.get_size(),
+                         true)) {
+            set_consistency_range(0, accel->get_max_ref_objects() - 1, false);
+            generation++;
+            return VMACCEL_SUCCESS;
+         }
       }
       return VMACCEL_FAIL;
    }
@@ -695,7 +814,8 @@ public:
     * Downloads from a given image region within a surface to the memory
     * referenced by "out". Downloads from a surface to avoid holding open
     * map operations. Concurrent map operations can lead to contention
-    * between two or more threads for the same surface contents.
+    * between two or more threads for the same surface contents. The region
+    * is in elements along x, see upload.
     *
     * @return VMAccelStatusCodeEnum value.
     */
@@ -704,7 +824,8 @@ public:
 #if DEBUG_SURFACE_CONSISTENCY
       VMACCEL_LOG("%s: surface id=%d\n", __FUNCTION__, id);
 #endif
-      if (desc.format == VMACCEL_FORMAT_R8_TYPELESS && imgRegion.coord.x == 0 &&
+      if (desc.type == VMACCEL_SURFACE_BUFFER &&
+          desc.format == VMACCEL_FORMAT_R8_TYPELESS && imgRegion.coord.x == 0 &&
           imgRegion.coord.y == 0 && imgRegion.coord.z == 0 &&
           imgRegion.size.x * sizeof(E) == desc.width &&
           imgRegion.size.y == desc.height && imgRegion.size.z == desc.depth) {
@@ -715,8 +836,21 @@ public:
                      ((unsigned int *)backing.get())[2],
                      ((unsigned int *)backing.get())[3]);
 #endif
-         memcpy(out.get_ptr(), backing.get(), MIN(desc.width, out.get_size()));
+         if ((char *)out.get_ptr() != backing.get()) {
+            memcpy(out.get_ptr(), backing.get(),
+                   MIN(desc.width, out.get_size()));
+         }
          return VMACCEL_SUCCESS;
+      } else if (VMAccel_SurfaceIsImage(&desc) ||
+                 desc.format == VMACCEL_FORMAT_R8_TYPELESS) {
+         if (!VMAccel_SurfaceIsImage(&desc)) {
+            imgRegion.coord.x *= sizeof(E);
+            imgRegion.size.x *= sizeof(E);
+         }
+         if (copy_region(imgRegion, (char *)out.get_ptr(), out.get_size(),
+                         false)) {
+            return VMACCEL_SUCCESS;
+         }
       }
       return VMACCEL_FAIL;
    }
@@ -842,7 +976,9 @@ public:
     * @param a Accelerator class used to instantiate the compute operation.
     * @param q Queue ID for the accelerator surface.
     * @param d Descriptor for the surface.
-    * @param backingPtr Backing allocation for the surface.
+    * @param backingPtr Backing allocation for the surface, used in place.
+    *                   Local Accelerators also use the backing of a surface
+    *                   on user memory in place, see alloc_user_backing.
     */
    accelerator_surface(const std::shared_ptr<accelerator> &a, VMAccelId q,
                        VMAccelSurfaceDesc d,
@@ -892,11 +1028,55 @@ public:
     * Constructor.
     */
    binding(VMAccelResourceType typeMask, VMAccelSurfaceBindFlags bindFlags,
-           VMAccelSurfaceUsage bindUsage, ref_object<surface> &target) {
+           VMAccelSurfaceUsage bindUsage, ref_object<surface> &target,
+           size_t shardStride = 0) {
       accelMask = typeMask;
       flags = bindFlags;
       usage = bindUsage;
       surf = target;
+      stride = shardStride;
+      argType = VMCL_ARG_SURFACE;
+      localSize = 0;
+   }
+
+   /**
+    * Constructor for a sampler binding, which has no backing surface.
+    */
+   binding(VMAccelResourceType typeMask, const VMCLSamplerDesc &desc) {
+      accelMask = typeMask;
+      flags = 0;
+      usage = VMACCEL_SURFACE_USAGE_READONLY;
+      stride = 0;
+      argType = VMCL_ARG_SAMPLER;
+      samplerDesc = desc;
+      localSize = 0;
+   }
+
+   /**
+    * Constructor for an immediate binding, the value is copied into the
+    * binding and passed by value with each dispatch.
+    */
+   binding(VMAccelResourceType typeMask, const void *data, size_t size) {
+      accelMask = typeMask;
+      flags = 0;
+      usage = VMACCEL_SURFACE_USAGE_READONLY;
+      stride = 0;
+      argType = VMCL_ARG_IMMEDIATE;
+      value.assign((const char *)data, (const char *)data + size);
+      localSize = 0;
+   }
+
+   /**
+    * Constructor for a local memory binding of the given size in bytes,
+    * allocated per work-group by the accelerator.
+    */
+   binding(VMAccelResourceType typeMask, size_t localBytes) {
+      accelMask = typeMask;
+      flags = 0;
+      usage = VMACCEL_SURFACE_USAGE_READWRITE;
+      stride = 0;
+      argType = VMCL_ARG_LOCAL;
+      localSize = localBytes;
    }
 
    /**
@@ -920,6 +1100,58 @@ public:
     */
    ref_object<surface> &get_surf() { return surf; }
 
+   /**
+    * get_shard_stride
+    *
+    * Retrieves the number of bytes of the surface accessed by each work-item
+    * along the first dimension of a sharded operation. A stride of zero
+    * declares that every work-item may access the entire surface.
+    */
+   size_t get_shard_stride() { return stride; }
+
+   /**
+    * set_shard_stride
+    *
+    * Declares the access range of each work-item, allowing the surface to be
+    * partitioned when an operation is split across sub-devices.
+    */
+   void set_shard_stride(size_t shardStride) { stride = shardStride; }
+
+   /**
+    * get_arg_type
+    *
+    * Retrieves the kind of kernel argument bound.
+    */
+   VMCLKernelArgType get_arg_type() { return argType; }
+
+   /**
+    * is_sampler
+    *
+    * Returns true if the binding is a sampler rather than a surface.
+    */
+   bool is_sampler() { return argType == VMCL_ARG_SAMPLER; }
+
+   /**
+    * get_sampler_desc
+    *
+    * Retrieves the sampler descriptor of a sampler binding.
+    */
+   const VMCLSamplerDesc &get_sampler_desc() { return samplerDesc; }
+
+   /**
+    * get_value
+    *
+    * Retrieves the value of an immediate binding.
+    */
+   std::vector<char> &get_value() { return value; }
+
+   /**
+    * get_local_size
+    *
+    * Retrieves the size in bytes of a local memory binding.
+    */
+   size_t get_local_size() { return localSize; }
+
 private:
    /*
     * Accelerator resource type for this binding.
@@ -940,6 +1172,27 @@ private:
     * Surface Object referenced by this binding.
     */
    ref_object<surface> surf;
+
+   /*
+    * Bytes accessed per work-item when sharded, zero if not partitionable.
+    */
+   size_t stride;
+
+   /*
+    * Kind of kernel argument, only surface bindings reference a surface.
+    */
+   VMCLKernelArgType argType;
+
+   /*
+    * Sampler bindings are allocated per context from the descriptor.
+    */
+   VMCLSamplerDesc samplerDesc;
+
+   /*
+    * Immediate value, or size of the local memory argument.
+    */
+   std::vector<char> value;
+   size_t localSize;
 };
 
 /**
@@ -1098,6 +1351,150 @@ private:
    std::vector<unsigned int> localSizes;
 };
 
+/**
+ * VMAccel I/O thread class.
+ *
+ * Executes the requests posted to it in order on a background thread, so
+ * a single application thread can keep many requests in flight. The thread
+ * is started by the first request and stopped once the pending requests
+ * have been executed. The I/O thread must not be stopped or destroyed by a
+ * request it executes.
+ */
+class io_thread {
+
+public:
+   /**
+    * Default constructor.
+    */
+   io_thread() {
+      running = false;
+      stopping = false;
+   }
+
+   /**
+    * Destructor.
+    */
+   ~io_thread() { stop(); }
+
+   /**
+    * post
+    *
+    * Posts a request, the returned future is completed by the thread. Only
+    * the requests executed by the thread may post while it is stopping,
+    * other requests are dropped and their future reports a broken promise.
+    */
+   template <class F>
+   auto post(F f) -> std::future<decltype(f())> {
+      auto task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+      auto ret = task->get_future();
+
+      std::unique_lock<std::mutex> lock(m);
+
+      if (stopping && (workerId != std::this_thread::get_id())) {
+         return ret;
+      }
+
+      if (!running && !stopping) {
+         running = true;
+         worker = std::thread(&io_thread::execute, this);
+         workerId = worker.get_id();
+      }
+
+      requests.push_back([task]() { (*task)(); });
+      cv.notify_one();
+
+      return ret;
+   }
+
+   /**
+    * stop
+    *
+    * Executes the pending requests and stops the thread, returns once the
+    * thread has exited.
+    */
+   void stop() {
+      std::unique_lock<std::mutex> lock(m);
+
+      if (!running) {
+         return;
+      }
+
+      if (workerId == std::this_thread::get_id()) {
+         VMACCEL_WARNING("%s: Unable to stop the I/O thread from itself\n",
+                         __FUNCTION__);
+         return;
+      }
+
+      running = false;
+      stopping = true;
+      cv.notify_one();
+      lock.unlock();
+
+      worker.join();
+
+      lock.lock();
+      workerId = std::thread::id();
+      stopping = false;
+   }
+
+private:
+   void execute() {
+      std::unique_lock<std::mutex> lock(m);
+
+      while (running || !requests.empty()) {
+         if (requests.empty()) {
+            cv.wait(lock);
+            continue;
+         }
+
+         std::function<void()> request = requests.front();
+         requests.pop_front();
+
+         lock.unlock();
+         request();
+         lock.lock();
+      }
+   }
+
+   std::mutex m;
+   std::condition_variable cv;
+   std::deque<std::function<void()>> requests;
+   std::thread worker;
+   std::thread::id workerId;
+   bool running;
+   bool stopping;
+};
+
+#if VMACCEL_HAS_COROUTINES
+/**
+ * VMAccel awaitable request class.
+ *
+ * Awaits the result of a request posted to an I/O thread. The awaiting
+ * coroutine is resumed on the I/O thread, once the requests posted before
+ * its suspension have been executed.
+ */
+template <class T>
+class awaitable {
+
+public:
+   awaitable(io_thread &t, std::future<T> &&f) : io(t), result(std::move(f)) {}
+
+   bool await_ready() {
+      return result.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+   }
+
+   void await_suspend(std::coroutine_handle<> h) {
+      io.post([h]() { h.resume(); });
+   }
+
+   T await_resume() { return result.get(); }
+
+private:
+   io_thread &io;
+   std::future<T> result;
+};
+#endif
 
 /**
  * VMAccel context object class.
@@ -57,10 +57,15 @@ extern "C" {
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <list>
 #include <map>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #define RETRY_MAX_COUNT 100
@@ -87,6 +92,9 @@ public:
       LOG_ENTRY(("clcontext::Constructor(a=%p) {\n", a.get()));
       accelId = VMACCEL_INVALID_ID;
       contextId = VMACCEL_INVALID_ID;
+      caps = 0;
+      residentBytes = 0;
+      residencyLimit = 0;
 
       VMAccelStatusCodeEnum ret = (VMAccelStatusCodeEnum)alloc(
          megaFlops, selectionMask, numSubDevices, numQueues, requiredCaps);
@@ -103,6 +111,7 @@ public:
     */
    ~clcontext() {
       LOG_ENTRY(("clcontext::Destructor {\n"));
+      io.stop();
       destroy();
 
       LOG_TIME_STAT(alloc_surface);
@@ -128,7 +137,12 @@ public:
       clnt = obj.clnt;
       accelId = obj.accelId;
       contextId = obj.contextId;
+      numSubDevices = obj.numSubDevices;
       numQueues = obj.numQueues;
+      caps = obj.caps;
+      subDeviceThroughput = obj.subDeviceThroughput;
+      residentBytes = 0;
+      residencyLimit = obj.residencyLimit;
       unlock();
       LOG_EXIT(("} clcontext::CopyConstructor\n"));
    }
@@ -158,19 +172,136 @@ public:
       return TRUE;
    }
 
+   /**
+    * query_profile
+    *
+    * Retrieves the device timestamps of the most recent command of a class
+    * executed by a queue. Fails without waiting if the command has not
+    * completed. Requires a context allocated with VMCL_PROFILING_CAP.
+    */
+   bool query_profile(VMAccelId qid, VMCLProfileOpType type,
+                      VMCLProfileStatus &profile) {
+      VMCLProfileQueryOp vmcl_profilequery_2_arg;
+      VMCLProfileReturnStatus *result_1;
+      CLIENT *client = get_client();
+      bool ret = false;
+
+      if (!is_profiling()) {
+         return false;
+      }
+
+      memset(&vmcl_profilequery_2_arg, 0, sizeof(vmcl_profilequery_2_arg));
+      vmcl_profilequery_2_arg.queue.cid = get_contextId();
+      vmcl_profilequery_2_arg.queue.id = qid;
+      vmcl_profilequery_2_arg.type = type;
+
+      result_1 = vmcl_profilequery_2(&vmcl_profilequery_2_arg, client);
+
+      if (result_1 == NULL) {
+         VMACCEL_WARNING("%s: Unable to profile queue %d of context %d\n",
+                         __FUNCTION__, qid, get_contextId());
+         return false;
+      }
+
+      if (result_1->VMCLProfileReturnStatus_u.ret != NULL &&
+          result_1->VMCLProfileReturnStatus_u.ret->status == VMACCEL_SUCCESS) {
+         profile = *result_1->VMCLProfileReturnStatus_u.ret;
+         ret = true;
+      }
+
+      if (client != NULL) {
+         vmaccel_xdr_free((xdrproc_t)xdr_VMCLProfileReturnStatus,
+                          (caddr_t)result_1);
+      }
+
+      return ret;
+   }
+
+   /**
+    * alloc_sampler
+    *
+    * Returns the sampler allocated for a descriptor, allocating it on first
+    * use. Samplers live until the context is destroyed.
+    *
+    * @return Identifier of the sampler, VMACCEL_INVALID_ID on failure.
+    */
+   VMAccelId alloc_sampler(const VMCLSamplerDesc &desc) {
+      VMCLSamplerAllocateReturnStatus *result_1;
+      VMCLSamplerAllocateDesc vmcl_sampleralloc_2_arg;
+      std::tuple<bool, unsigned int, unsigned int> key(
+         desc.normalizedCoords, desc.addressMode, desc.filterMode);
+      CLIENT *client = get_client();
+      VMAccelId id;
+
+      lock();
+
+      auto it = samplers.find(key);
+
+      if (it != samplers.end()) {
+         unlock();
+         return it->second;
+      }
+
+      id = get_accel()->alloc_id();
+
+      memset(&vmcl_sampleralloc_2_arg, 0, sizeof(vmcl_sampleralloc_2_arg));
+      vmcl_sampleralloc_2_arg.client.cid = get_contextId();
+      vmcl_sampleralloc_2_arg.client.id = id;
+      vmcl_sampleralloc_2_arg.desc = desc;
+
+      result_1 = vmcl_sampleralloc_2(&vmcl_sampleralloc_2_arg, client);
+
+      if ((result_1 == NULL) ||
+          (result_1->VMCLSamplerAllocateReturnStatus_u.ret == NULL) ||
+          (result_1->VMCLSamplerAllocateReturnStatus_u.ret->status !=
+           VMACCEL_SUCCESS)) {
+         VMACCEL_WARNING("%s: Unable to allocate sampler %d for context %d\n",
+                         __FUNCTION__, id, get_contextId());
+         if ((result_1 != NULL) && (client != NULL)) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMCLSamplerAllocateReturnStatus,
+                             (caddr_t)result_1);
+         }
+         get_accel()->release_id(id);
+         unlock();
+         return VMACCEL_INVALID_ID;
+      }
+
+      if (client != NULL) {
+         vmaccel_xdr_free((xdrproc_t)xdr_VMCLSamplerAllocateReturnStatus,
+                          (caddr_t)result_1);
+      }
+
+      samplers[key] = id;
+
+      unlock();
+
+      return id;
+   }
+
    /**
     * alloc_surface
     *
-    * Makes a surface resident for the context.
+    * Makes a surface resident for the context. An initializing allocation
+    * writes the backing of the surface to the new surface on the queue in
+    * the same request, and leaves the surface consistent.
+    *
+    * Least recently used surfaces are evicted when the residency limit of
+    * the context would be exceeded, or the Accelerator fails the
+    * allocation, see evict_surface.
     */
-   bool alloc_surface(ref_object<surface> surf) {
+   bool alloc_surface(ref_object<surface> surf, bool init = false,
+                      VMAccelId qid = VMACCEL_INVALID_ID) {
       VMAccelSurfaceAllocateReturnStatus *result_1;
       VMCLSurfaceAllocateDesc vmcl_surfacealloc_2_arg;
+      VMCLSurfaceAllocateInitOp vmcl_surfaceallocinit_2_arg;
+      size_t size = VMAccel_SurfaceSize(&surf->get_desc());
+      VMAccelStatusCode status;
 
       START_TIME_STAT(alloc_surface);
       lock();
 
       if (is_resident(surf->get_id())) {
+         touch_surface(surf->get_id(), size);
          unlock();
          END_TIME_STAT(alloc_surface);
          return true;
@@ -182,28 +313,102 @@ public:
       VMACCEL_LOG("%s: Allocating surface %d\n", __FUNCTION__, id);
 #endif
 
+      while ((residencyLimit != 0) && (residentBytes + size > residencyLimit) &&
+             evict_lru(surf->get_id())) {
+      }
+
+      memset(&vmcl_surfacealloc_2_arg, 0, sizeof(vmcl_surfacealloc_2_arg));
       vmcl_surfacealloc_2_arg.client.cid = get_contextId();
       vmcl_surfacealloc_2_arg.client.accel.id = surf->get_id();
+      vmcl_surfacealloc_2_arg.client.accel.generation = surf->get_generation();
       vmcl_surfacealloc_2_arg.desc = surf->get_desc();
 
-      assert(vmcl_surfacealloc_2_arg.desc.format == VMACCEL_FORMAT_R8_TYPELESS);
+      assert(VMAccel_SurfaceIsImage(&vmcl_surfacealloc_2_arg.desc) ||
+             vmcl_surfacealloc_2_arg.desc.format == VMACCEL_FORMAT_R8_TYPELESS);
+
+      /*
+       * A local Accelerator creates a surface on user memory in place, the
+       * memory is passed by an initializing allocation.
+       */
+      if ((surf->get_desc().pool == VMACCEL_SURFACE_POOL_USER_MEMORY) &&
+          (client == NULL)) {
+         init = true;
+      }
 
-      result_1 = vmcl_surfacealloc_2(&vmcl_surfacealloc_2_arg, client);
+      /*
+       * Streamed contents are not carried by the request.
+       */
+      init = init && (surf->get_backing().get() != NULL) &&
+             !get_accel()->is_data_streaming_enabled();
+
+      if (init) {
+         memset(&vmcl_surfaceallocinit_2_arg, 0,
+                sizeof(vmcl_surfaceallocinit_2_arg));
+         vmcl_surfaceallocinit_2_arg.queue.cid = get_contextId();
+         vmcl_surfaceallocinit_2_arg.queue.id =
+            (qid == VMACCEL_INVALID_ID) ? surf->get_queue_id() : qid;
+         vmcl_surfaceallocinit_2_arg.alloc = vmcl_surfacealloc_2_arg;
+         vmcl_surfaceallocinit_2_arg.data.data_len = size;
+         vmcl_surfaceallocinit_2_arg.data.data_val = surf->get_backing().get();
+      }
 
-      if (result_1 == NULL) {
-         VMACCEL_WARNING("%s: Unable to allocate surface %d for context %d.\n",
+      /*
+       * A failed allocation is retried once a surface has been evicted. An
+       * initializing allocation fails as a whole, the surface is then
+       * allocated without its contents and uploaded separately.
+       */
+      for (;;) {
+         if (init) {
+            result_1 = vmcl_surfaceallocinit_2(&vmcl_surfaceallocinit_2_arg,
+                                               client);
+         } else {
+            result_1 = vmcl_surfacealloc_2(&vmcl_surfacealloc_2_arg, client);
+         }
+
+         if (result_1 == NULL) {
+            VMACCEL_WARNING(
+               "%s: Unable to allocate surface %d for context %d.\n",
+               __FUNCTION__, surf->get_id(), get_contextId());
+            unlock();
+            END_TIME_STAT(alloc_surface);
+            return false;
+         }
+
+         if (result_1->VMAccelSurfaceAllocateReturnStatus_u.ret != NULL) {
+            status = result_1->VMAccelSurfaceAllocateReturnStatus_u.ret->status;
+         } else {
+            status = VMACCEL_FAIL;
+         }
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus,
+                             (caddr_t)result_1);
+         }
+
+         if (init && (status != VMACCEL_SUCCESS)) {
+            init = false;
+            continue;
+         }
+
+         if ((status != VMACCEL_FAIL) || !evict_lru(surf->get_id())) {
+            break;
+         }
+      }
+
+      if (status == VMACCEL_FAIL) {
+         VMACCEL_WARNING("%s: Out of memory for surface %d of context %d.\n",
                          __FUNCTION__, surf->get_id(), get_contextId());
          unlock();
          END_TIME_STAT(alloc_surface);
          return false;
       }
 
-      if (client != NULL) {
-         vmaccel_xdr_free((xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus,
-                          (caddr_t)result_1);
-      }
-
       set_residency(surf->get_id(), true);
+      touch_surface(surf->get_id(), size);
+
+      if (init) {
+         surf->set_consistency(get_contextId(), true);
+      }
 
       unlock();
       END_TIME_STAT(alloc_surface);
@@ -211,14 +416,95 @@ public:
       return true;
    }
 
+   /**
+    * set_residency_limit
+    *
+    * Limits the size in bytes of the surfaces resident for the context,
+    * zero for no limit.
+    */
+   void set_residency_limit(size_t bytes) {
+      lock();
+      residencyLimit = bytes;
+      unlock();
+   }
+
+   size_t get_resident_bytes() { return residentBytes; }
+
+   /**
+    * pin_surface
+    *
+    * Excludes a surface from eviction until it is unpinned, pins of a
+    * surface are counted.
+    */
+   void pin_surface(VMAccelId id, bool pin) {
+      lock();
+
+      if (pin) {
+         pins[id]++;
+      } else {
+         auto it = pins.find(id);
+
+         if ((it != pins.end()) && (--it->second == 0)) {
+            pins.erase(it);
+         }
+      }
+
+      unlock();
+   }
+
+   /**
+    * evict_surface
+    *
+    * Evicts a resident surface from the context. Contents the Accelerator
+    * may have written are read back into the backing of the surface first,
+    * unless the application has updated the backing since. The surface is
+    * allocated and updated from its backing on its next use.
+    *
+    * @return True if the surface is no longer resident.
+    */
+   bool evict_surface(VMAccelId id) {
+      std::map<VMAccelId, ref_object<surface>> &db =
+         get_accel()->get_surface_database();
+      bool ret = false;
+
+      lock();
+
+      auto it = db.find(id);
+
+      if (!is_resident(id)) {
+         untrack_surface(id);
+         ret = true;
+      } else if ((pins.find(id) == pins.end()) && (it != db.end())) {
+         ref_object<surface> surf = it->second;
+
+         if ((surf->get_desc().usage == VMACCEL_SURFACE_USAGE_READONLY) ||
+             !surf->is_consistent(get_contextId()) ||
+             download_surface(surf, true, ENABLE_IMAGE_DOWNLOAD)) {
+#if DEBUG_PERSISTENT_SURFACES
+            VMACCEL_LOG("%s: Evicting surface %d\n", __FUNCTION__, id);
+#endif
+            destroy_surface(id);
+            surf->set_consistency(get_contextId(), false);
+            ret = true;
+         }
+      }
+
+      unlock();
+
+      return ret;
+   }
+
    /**
     * upload_surface
     *
-    * Update a resident surface.
+    * Update a resident surface. A discarding update replaces the entire
+    * contents of the surface, allowing the Accelerator to rename the
+    * surface while the previous generation is in use.
     */
    bool upload_surface(ref_object<surface> surf, bool force = false,
                        bool flush = false, bool async = false,
-                       VMAccelId qid = VMACCEL_INVALID_ID) {
+                       VMAccelId qid = VMACCEL_INVALID_ID,
+                       bool discard = false) {
       VMCLSurfaceMapOp vmcl_surfacemap_2_arg;
       VMAccelSurfaceMapReturnStatus *result_2;
       VMCLSurfaceUnmapOp vmcl_surfaceunmap_2_arg;
@@ -234,6 +520,15 @@ public:
       START_TIME_STAT(upload_surface);
       lock();
 
+      /*
+       * An evicted surface is made resident again before the update.
+       */
+      if (!is_resident(surf->get_id()) && !alloc_surface(surf)) {
+         unlock();
+         END_TIME_STAT(upload_surface);
+         return false;
+      }
+
       CLIENT *client = get_client();
 
 #if DEBUG_SURFACE_CONSISTENCY
@@ -258,6 +553,18 @@ public:
          imgUpload = FALSE;
       }
 
+      /*
+       * Images are transferred by region, the layout of a mapped image is
+       * defined by the Accelerator. A discarding update of a remote surface
+       * is transferred the same way, mapping the surface would read back
+       * the contents being discarded.
+       */
+      if (VMAccel_SurfaceIsImage(&surf->get_desc()) ||
+          (discard && (client != NULL) &&
+           !get_accel()->is_data_streaming_enabled())) {
+         imgUpload = TRUE;
+      }
+
       if (qid == VMACCEL_INVALID_ID) {
          qid = surf->get_queue_id();
       }
@@ -270,9 +577,14 @@ public:
          vmcl_surfacemap_2_arg.op.surf.generation = surf->get_generation();
          vmcl_surfacemap_2_arg.op.size.x = surf->get_desc().width;
          vmcl_surfacemap_2_arg.op.size.y = surf->get_desc().height;
-         vmcl_surfacemap_2_arg.op.mapFlags = VMACCEL_MAP_READ_FLAG |
-                                             VMACCEL_MAP_WRITE_FLAG |
-                                             VMACCEL_MAP_ASYNC_FLAG;
+         if (discard) {
+            vmcl_surfacemap_2_arg.op.mapFlags =
+               VMACCEL_MAP_WRITE_DISCARD_FLAG | VMACCEL_MAP_ASYNC_FLAG;
+         } else {
+            vmcl_surfacemap_2_arg.op.mapFlags = VMACCEL_MAP_READ_FLAG |
+                                                VMACCEL_MAP_WRITE_FLAG |
+                                                VMACCEL_MAP_ASYNC_FLAG;
+         }
 
          if (client == NULL) {
 #if LOG_SURFACE_OP
@@ -292,10 +604,13 @@ public:
                   vmcl_surfacemap_2_arg.op.size.x);
 
                /*
-                * Memory copy the contents into the value
+                * Memory copy the contents into the value, unless the surface
+                * was created on the backing.
                 */
-               memcpy(ptr, surf->get_backing().get(),
-                      vmcl_surfacemap_2_arg.op.size.x);
+               if (ptr != surf->get_backing().get()) {
+                  memcpy(ptr, surf->get_backing().get(),
+                         vmcl_surfacemap_2_arg.op.size.x);
+               }
 
 #if DEBUG_COMPUTE_OPERATION
                for (int i = 0;
@@ -371,11 +686,14 @@ public:
          vmcl_imgupload_2_arg.op.imgRegion.size.y = surf->get_desc().height;
          vmcl_imgupload_2_arg.op.imgRegion.size.z = surf->get_desc().depth;
 
-         vmcl_imgupload_2_arg.op.ptr.ptr_len = surf->get_desc().width;
+         vmcl_imgupload_2_arg.op.ptr.ptr_len =
+            VMAccel_SurfaceSize(&surf->get_desc());
          vmcl_imgupload_2_arg.op.ptr.ptr_val = surf->get_backing().get();
 
          /* Manage the fencing in the client.. */
-         vmcl_imgupload_2_arg.mode = VMACCEL_SURFACE_WRITE_ASYNCHRONOUS;
+         vmcl_imgupload_2_arg.mode =
+            discard ? VMACCEL_SURFACE_WRITE_DISCARD
+                    : VMACCEL_SURFACE_WRITE_ASYNCHRONOUS;
 
          result_3 = vmcl_imageupload_2(&vmcl_imgupload_2_arg, client);
 
@@ -417,6 +735,15 @@ public:
       START_TIME_STAT(download_surface);
       lock();
 
+      /*
+       * The contents of an evicted surface were read back on eviction.
+       */
+      if (!is_resident(surf->get_id())) {
+         unlock();
+         END_TIME_STAT(download_surface);
+         return true;
+      }
+
       CLIENT *client = get_client();
 
 #if DEBUG_SURFACE_CONSISTENCY
@@ -427,6 +754,17 @@ public:
          qid = surf->get_queue_id();
       }
 
+      /*
+       * Images are read back by region, see upload_surface. Surfaces on user
+       * memory are read back whole, in place.
+       */
+      if (VMAccel_SurfaceIsImage(&surf->get_desc()) ||
+          (surf->get_desc().pool == VMACCEL_SURFACE_POOL_USER_MEMORY)) {
+         imgDownload =
+            imgDownload ||
+            (surf->get_desc().usage != VMACCEL_SURFACE_USAGE_READONLY) || force;
+      }
+
       if (!imgDownload &&
           (surf->get_desc().usage != VMACCEL_SURFACE_USAGE_READONLY || force)) {
 #if LOG_SURFACE_OP
@@ -468,8 +806,10 @@ public:
             }
 #endif
 
-            memcpy(surf->get_backing().get(), ptr,
-                   vmcl_surfacemap_2_arg.op.size.x);
+            if ((char *)ptr != surf->get_backing().get()) {
+               memcpy(surf->get_backing().get(), ptr,
+                      vmcl_surfacemap_2_arg.op.size.x);
+            }
 
             memset(&vmcl_surfaceunmap_2_arg, 0,
                    sizeof(vmcl_surfaceunmap_2_arg));
@@ -520,7 +860,8 @@ public:
          vmcl_imgdownload_2_arg.op.imgRegion.size.y = surf->get_desc().height;
          vmcl_imgdownload_2_arg.op.imgRegion.size.z = surf->get_desc().depth;
 
-         vmcl_imgdownload_2_arg.op.ptr.ptr_len = surf->get_desc().width;
+         vmcl_imgdownload_2_arg.op.ptr.ptr_len =
+            VMAccel_SurfaceSize(&surf->get_desc());
          vmcl_imgdownload_2_arg.op.ptr.ptr_val = surf->get_backing().get();
 
          vmcl_imgdownload_2_arg.mode = VMACCEL_SURFACE_READ_SYNCHRONOUS;
@@ -549,6 +890,151 @@ public:
       return true;
    }
 
+   /**
+    * upload_surface_region
+    *
+    * Updates a region of a resident surface from its backing, leaving the
+    * remainder of the surface untouched. The region is in bytes, rows and
+    * slices, see VMAccel_SurfaceRegionLayout. The consistency of the surface
+    * is unchanged, callers moving tiles track the regions they update.
+    */
+   bool upload_surface_region(ref_object<surface> surf,
+                              const VMAccelSurfaceRegion &region,
+                              VMAccelId qid = VMACCEL_INVALID_ID,
+                              bool flush = false) {
+      VMCLImageUploadOp vmcl_imgupload_2_arg;
+      VMAccelReturnStatus *result_1;
+      size_t origin[3], extent[3], rowPitch, slicePitch;
+      std::vector<char> packed;
+      CLIENT *client = get_client();
+      bool ret = false;
+
+      START_TIME_STAT(upload_surface);
+      lock();
+
+      if (!is_resident(surf->get_id()) ||
+          !VMAccel_SurfaceRegionLayout(&surf->get_desc(), &region, origin,
+                                       extent, &rowPitch, &slicePitch)) {
+         unlock();
+         END_TIME_STAT(upload_surface);
+         return false;
+      }
+
+      packed.resize(extent[0] * extent[1] * extent[2]);
+      surf->copy_region(region, packed.data(), packed.size(), false);
+
+      if (qid == VMACCEL_INVALID_ID) {
+         qid = surf->get_queue_id();
+      }
+
+      memset(&vmcl_imgupload_2_arg, 0, sizeof(vmcl_imgupload_2_arg));
+      vmcl_imgupload_2_arg.queue.cid = get_contextId();
+      vmcl_imgupload_2_arg.queue.id = qid;
+      vmcl_imgupload_2_arg.img.cid = get_contextId();
+      vmcl_imgupload_2_arg.img.accel.type = surf->get_desc().type;
+      vmcl_imgupload_2_arg.img.accel.handleType = VMACCEL_HANDLE_ID;
+      vmcl_imgupload_2_arg.img.accel.id = surf->get_id();
+      vmcl_imgupload_2_arg.img.accel.generation = surf->get_generation();
+      vmcl_imgupload_2_arg.op.imgRegion = region;
+      vmcl_imgupload_2_arg.op.ptr.ptr_len = packed.size();
+      vmcl_imgupload_2_arg.op.ptr.ptr_val = packed.data();
+      vmcl_imgupload_2_arg.mode = VMACCEL_SURFACE_WRITE_ASYNCHRONOUS;
+
+      result_1 = vmcl_imageupload_2(&vmcl_imgupload_2_arg, client);
+
+      if (result_1 != NULL) {
+         ret = (result_1->VMAccelReturnStatus_u.ret->status ==
+                VMACCEL_SUCCESS);
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                             (caddr_t)result_1);
+         }
+      }
+
+      if (flush) {
+         flush_queue(qid);
+      }
+
+      unlock();
+      END_TIME_STAT(upload_surface);
+
+      return ret;
+   }
+
+   /**
+    * download_surface_region
+    *
+    * Reads back a region of a resident surface into its backing, see
+    * upload_surface_region.
+    */
+   bool download_surface_region(ref_object<surface> surf,
+                                const VMAccelSurfaceRegion &region,
+                                VMAccelId qid = VMACCEL_INVALID_ID) {
+      VMCLImageDownloadOp vmcl_imgdownload_2_arg;
+      VMAccelDownloadReturnStatus *result_1;
+      size_t origin[3], extent[3], rowPitch, slicePitch;
+      std::vector<char> packed;
+      CLIENT *client = get_client();
+      bool ret = false;
+
+      START_TIME_STAT(download_surface);
+      lock();
+
+      if (!is_resident(surf->get_id()) ||
+          !VMAccel_SurfaceRegionLayout(&surf->get_desc(), &region, origin,
+                                       extent, &rowPitch, &slicePitch)) {
+         unlock();
+         END_TIME_STAT(download_surface);
+         return false;
+      }
+
+      packed.resize(extent[0] * extent[1] * extent[2]);
+
+      if (qid == VMACCEL_INVALID_ID) {
+         qid = surf->get_queue_id();
+      }
+
+      memset(&vmcl_imgdownload_2_arg, 0, sizeof(vmcl_imgdownload_2_arg));
+      vmcl_imgdownload_2_arg.queue.cid = get_contextId();
+      vmcl_imgdownload_2_arg.queue.id = qid;
+      vmcl_imgdownload_2_arg.img.cid = get_contextId();
+      vmcl_imgdownload_2_arg.img.accel.type = surf->get_desc().type;
+      vmcl_imgdownload_2_arg.img.accel.handleType = VMACCEL_HANDLE_ID;
+      vmcl_imgdownload_2_arg.img.accel.id = surf->get_id();
+      vmcl_imgdownload_2_arg.img.accel.generation = surf->get_generation();
+      vmcl_imgdownload_2_arg.op.imgRegion = region;
+      vmcl_imgdownload_2_arg.op.ptr.ptr_len = packed.size();
+      vmcl_imgdownload_2_arg.op.ptr.ptr_val = packed.data();
+      vmcl_imgdownload_2_arg.mode = VMACCEL_SURFACE_READ_SYNCHRONOUS;
+
+      result_1 = vmcl_imagedownload_2(&vmcl_imgdownload_2_arg, client);
+
+      if (result_1 != NULL) {
+         VMAccelDownloadStatus *status =
+            result_1->VMAccelDownloadReturnStatus_u.ret;
+
+         /*
+          * The contents are returned in the reply when remote.
+          */
+         if ((status->status == VMACCEL_SUCCESS) &&
+             (status->ptr.ptr_len >= packed.size())) {
+            ret = surf->copy_region(region, status->ptr.ptr_val,
+                                    packed.size(), true);
+         }
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelDownloadReturnStatus,
+                             (caddr_t)result_1);
+         }
+      }
+
+      unlock();
+      END_TIME_STAT(download_surface);
+
+      return ret;
+   }
+
    /**
     * fill_surface
     *
@@ -721,6 +1207,8 @@ public:
       }
 
       set_residency(id, false);
+      untrack_surface(id);
+      pins.erase(id);
 
       unlock();
       END_TIME_STAT(destroy_surface);
@@ -737,27 +1225,187 @@ public:
 
    int get_num_queues() { return numQueues; }
 
+   unsigned int get_num_sub_devices() { return numSubDevices; }
+
+   bool is_profiling() { return (caps & VMCL_PROFILING_CAP) != 0; }
+
    /**
-    * Thread safety
+    * get_sub_device_throughput
+    *
+    * @return The measured throughput of a sub-device in work-items per
+    *         second, zero if no work has been measured.
     */
-   void lock() { m.lock(); }
+   double get_sub_device_throughput(unsigned int subDevice) {
+      double throughput = 0.0;
 
-   void unlock() { m.unlock(); }
+      lock();
+      if (subDevice < subDeviceThroughput.size()) {
+         throughput = subDeviceThroughput[subDevice];
+      }
+      unlock();
+
+      return throughput;
+   }
 
-private:
    /**
-    * Reservation of a context and an associated queue.
+    * update_sub_device_throughput
+    *
+    * Folds a completed slice of work into the sub-device's throughput
+    * estimate. Samples are averaged with the previous estimate to dampen
+    * the noise of individual dispatches.
     */
-   int alloc(unsigned int megaFlops, unsigned int selectionMask,
-             unsigned int numSubDevices, unsigned int numQueues,
-             unsigned int requiredCaps) {
-      VMAccelAllocateReturnStatus *result_1;
-      VMAccelDesc vmaccelmgr_alloc_1_arg;
-      VMCLContextAllocateReturnStatus *result_2;
-      VMCLContextAllocateDesc vmcl_contextalloc_2_arg;
-      VMAccelQueueReturnStatus *result_3;
-      VMCLQueueAllocateDesc vmcl_queuealloc_2_arg;
-      char host[4 * VMACCEL_MAX_LOCATION_SIZE];
+   void update_sub_device_throughput(unsigned int subDevice,
+                                     unsigned int workItems, double seconds) {
+      double sample;
+
+      if (seconds <= 0.0 || workItems == 0) {
+         return;
+      }
+
+      sample = workItems / seconds;
+
+      lock();
+      if (subDevice < subDeviceThroughput.size()) {
+         if (subDeviceThroughput[subDevice] == 0.0) {
+            subDeviceThroughput[subDevice] = sample;
+         } else {
+            subDeviceThroughput[subDevice] =
+               (subDeviceThroughput[subDevice] + sample) * 0.5;
+         }
+      }
+      unlock();
+   }
+
+   /**
+    * Thread safety
+    */
+   void lock() { m.lock(); }
+
+   void unlock() { m.unlock(); }
+
+   /**
+    * async
+    *
+    * Executes a request on the I/O thread of the context, returning a
+    * future completed with the result of the request. Requests of a
+    * context are executed in order, and the objects referenced by a
+    * request must outlive it.
+    */
+   template <class F>
+   auto async(F f) -> std::future<decltype(f())> {
+      return io.post(f);
+   }
+
+#if VMACCEL_HAS_COROUTINES
+   /**
+    * await
+    *
+    * Awaitable form of a request executed by async().
+    */
+   template <class F>
+   auto await(F f) -> awaitable<decltype(f())> {
+      return awaitable<decltype(f())>(io, io.post(f));
+   }
+#endif
+
+   /**
+    * Asynchronous forms of the surface transfers, see upload_surface,
+    * download_surface and copy_surface.
+    */
+   std::future<bool> upload_surface_async(ref_object<surface> surf,
+                                          bool force = false,
+                                          VMAccelId qid = VMACCEL_INVALID_ID,
+                                          bool discard = false) {
+      return async([this, surf, force, qid, discard]() {
+         return alloc_surface(surf) &&
+                upload_surface(surf, force, true, true, qid, discard);
+      });
+   }
+
+   std::future<bool>
+   download_surface_async(ref_object<surface> surf, bool force = false,
+                          VMAccelId qid = VMACCEL_INVALID_ID) {
+      return async([this, surf, force, qid]() {
+         return download_surface(surf, force, ENABLE_IMAGE_DOWNLOAD, qid);
+      });
+   }
+
+   std::future<void> copy_surface_async(VMAccelId qid,
+                                        ref_object<surface> srcSurf,
+                                        VMAccelSurfaceRegion srcRegion,
+                                        ref_object<surface> dstSurf,
+                                        VMAccelSurfaceRegion dstRegion) {
+      return async([this, qid, srcSurf, srcRegion, dstSurf, dstRegion]() {
+         copy_surface(qid, srcSurf, srcRegion, dstSurf, dstRegion);
+      });
+   }
+
+private:
+   /**
+    * touch_surface
+    *
+    * Marks a resident surface as the most recently used.
+    */
+   void touch_surface(VMAccelId id, size_t size) {
+      auto it = residencyIndex.find(id);
+
+      if (it != residencyIndex.end()) {
+         residencyLRU.splice(residencyLRU.end(), residencyLRU,
+                             it->second.first);
+         return;
+      }
+
+      residencyLRU.push_back(id);
+      residencyIndex[id] = std::make_pair(--residencyLRU.end(), size);
+      residentBytes += size;
+   }
+
+   void untrack_surface(VMAccelId id) {
+      auto it = residencyIndex.find(id);
+
+      if (it != residencyIndex.end()) {
+         residentBytes -= it->second.second;
+         residencyLRU.erase(it->second.first);
+         residencyIndex.erase(it);
+      }
+   }
+
+   /**
+    * evict_lru
+    *
+    * Evicts the least recently used surface that is not pinned, other than
+    * the surface being made resident.
+    *
+    * @return True if a surface was evicted.
+    */
+   bool evict_lru(VMAccelId keep) {
+      for (auto it = residencyLRU.begin(); it != residencyLRU.end(); it++) {
+         if ((*it != keep) && (pins.find(*it) == pins.end()) &&
+             evict_surface(*it)) {
+            /*
+             * The eviction invalidates the iterator.
+             */
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   /**
+    * Reservation of a context and an associated queue.
+    */
+   int alloc(unsigned int megaFlops, unsigned int selectionMask,
+             unsigned int numSubDevices, unsigned int numQueues,
+             unsigned int requiredCaps) {
+      VMAccelAllocateReturnStatus *result_1;
+      VMAccelDesc vmaccelmgr_alloc_1_arg;
+      VMCLContextAllocateReturnStatus *result_2;
+      VMCLContextAllocateDesc vmcl_contextalloc_2_arg;
+      VMAccelQueueReturnStatus *result_3;
+      VMCLQueueAllocateDesc vmcl_queuealloc_2_arg;
+      char host[4 * VMACCEL_MAX_LOCATION_SIZE];
+      unsigned int device = 0;
       unsigned int i = 0, j = 0;
 
       // Allocate at least one queue
@@ -795,6 +1443,8 @@ private:
                return VMACCEL_FAIL;
             }
             accelId = result_1->VMAccelAllocateReturnStatus_u.ret->id;
+            device = result_1->VMAccelAllocateReturnStatus_u.ret->desc
+                        .parentAddr.subDevice;
             if (!accel->is_local_backend()) {
                vmaccel_xdr_free((xdrproc_t)xdr_VMAccelAllocateReturnStatus,
                                 (caddr_t)result_1);
@@ -835,11 +1485,12 @@ private:
        * Allocate a context from the Compute Accelerator.
        */
       memset(&vmcl_contextalloc_2_arg, 0, sizeof(vmcl_contextalloc_2_arg));
-      vmcl_contextalloc_2_arg.accelId = 0;
+      vmcl_contextalloc_2_arg.accelId = device;
       vmcl_contextalloc_2_arg.clientId = accel->alloc_id();
       vmcl_contextalloc_2_arg.selectionMask = selectionMask;
       vmcl_contextalloc_2_arg.numSubDevices = numSubDevices;
       vmcl_contextalloc_2_arg.requiredCaps = requiredCaps;
+      caps = requiredCaps;
 
       result_2 = vmcl_contextalloc_2(&vmcl_contextalloc_2_arg, get_client());
 
@@ -850,6 +1501,15 @@ private:
          return VMACCEL_FAIL;
       }
 
+      /*
+       * Profiling is only enabled if the devices of the context support it.
+       */
+      if ((result_2->VMCLContextAllocateReturnStatus_u.ret == NULL) ||
+          !(result_2->VMCLContextAllocateReturnStatus_u.ret->caps &
+            VMCL_PROFILING_CAP)) {
+         caps &= ~VMCL_PROFILING_CAP;
+      }
+
       if (!accel->is_local_backend()) {
          vmaccel_xdr_free((xdrproc_t)xdr_VMCLContextAllocateReturnStatus,
                           (caddr_t)result_2);
@@ -867,6 +1527,10 @@ private:
             vmcl_queuealloc_2_arg.client.id = i * numQueues + j;
             vmcl_queuealloc_2_arg.subDevice = i;
             vmcl_queuealloc_2_arg.desc.flags = VMACCEL_QUEUE_ON_DEVICE_FLAG;
+            if (is_profiling()) {
+               vmcl_queuealloc_2_arg.desc.flags |=
+                  VMACCEL_QUEUE_ENABLE_PROFILING_FLAG;
+            }
             vmcl_queuealloc_2_arg.desc.size = -1; /* Unbounded? */
 
             result_3 = vmcl_queuealloc_2(&vmcl_queuealloc_2_arg, get_client());
@@ -883,6 +1547,7 @@ private:
 
       this->numSubDevices = numSubDevices;
       this->numQueues = numQueues;
+      subDeviceThroughput.assign(numSubDevices, 0.0);
 
       if (!accel->is_local_backend()) {
          vmaccel_xdr_free((xdrproc_t)xdr_VMAccelQueueReturnStatus,
@@ -922,6 +1587,25 @@ private:
          }
       }
 
+      for (auto it = samplers.begin(); it != samplers.end(); it++) {
+         VMCLSamplerId vmcl_samplerdestroy_2_arg;
+
+         vmcl_samplerdestroy_2_arg.cid = contextId;
+         vmcl_samplerdestroy_2_arg.id = it->second;
+         result_1 =
+            vmcl_samplerdestroy_2(&vmcl_samplerdestroy_2_arg, get_client());
+         if (result_1 == NULL) {
+            VMACCEL_WARNING("%s: Unable to destroy sampler id = %u\n",
+                            __FUNCTION__, it->second);
+         } else if (!accel->is_local_backend()) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                             (caddr_t)result_1);
+         }
+         accel->release_id(it->second);
+      }
+
+      samplers.clear();
+
       if (contextId != VMACCEL_INVALID_ID) {
          unsigned int i;
          for (i = 0; i < numSubDevices; i++) {
@@ -968,7 +1652,24 @@ private:
    VMAccelId contextId;
    unsigned int numSubDevices;
    unsigned int numQueues;
-   std::mutex m;
+   unsigned int caps;
+   std::vector<double> subDeviceThroughput;
+   std::map<std::tuple<bool, unsigned int, unsigned int>, VMAccelId> samplers;
+   /**
+    * Residency of the surfaces, in least recently used order.
+    */
+   std::list<VMAccelId> residencyLRU;
+   std::map<VMAccelId, std::pair<std::list<VMAccelId>::iterator, size_t>>
+      residencyIndex;
+   std::map<VMAccelId, unsigned int> pins;
+   size_t residentBytes;
+   size_t residencyLimit;
+
+   /*
+    * Eviction transfers and destroys surfaces while the lock is held.
+    */
+   std::recursive_mutex m;
+   io_thread io;
 
    DECLARE_TIME_STAT(alloc_surface);
    DECLARE_TIME_STAT(destroy_surface);
@@ -1056,15 +1757,15 @@ public:
    operator std::map<unsigned int, ref_object<char>> &() { return kernels; }
 
    unsigned int get_id(const VMCLKernelLanguageType type,
-                       const std::string &func) {
-      auto var = variants.find(std::make_tuple(type, func));
+                       const std::string &func, unsigned int subDevice = 0) {
+      auto var = variants.find(std::make_tuple(type, func, subDevice));
 
       if (var != variants.end()) {
          return var->second;
       } else {
-         prepare(type, func);
+         prepare(type, func, subDevice);
 
-         var = variants.find(std::make_tuple(type, func));
+         var = variants.find(std::make_tuple(type, func, subDevice));
 
          if (var != variants.end()) {
             return var->second;
@@ -1079,13 +1780,16 @@ public:
     *
     * Prepares the kernel's state without taking into consideration the
     * arguments. This side-steps the stateless nature of dispatch for
-    * the purpose of using cached shaders.
+    * the purpose of using cached shaders. Programs are built for a single
+    * device, so each sub-device dispatched to requires its own variant.
     */
-   void prepare(const VMCLKernelLanguageType type, const std::string &func) {
+   void prepare(const VMCLKernelLanguageType type, const std::string &func,
+                unsigned int subDevice = 0) {
       VMCLKernelAllocateReturnStatus *result_1;
       VMCLKernelAllocateDesc vmcl_kernelalloc_2_arg;
       unsigned int kernelId = clctx->get_accel()->alloc_id();
       CLIENT *client = clctx->get_client();
+      VMAccelStatusCode status = VMACCEL_RESOURCE_UNAVAILABLE;
 
       /*
        * Allocate a Compute Kernel given the source/binaries provided.
@@ -1093,27 +1797,54 @@ public:
       memset(&vmcl_kernelalloc_2_arg, 0, sizeof(vmcl_kernelalloc_2_arg));
       vmcl_kernelalloc_2_arg.client.cid = clctx->get_contextId();
       vmcl_kernelalloc_2_arg.client.id = kernelId;
-      vmcl_kernelalloc_2_arg.subDevice = 0;
+      vmcl_kernelalloc_2_arg.subDevice = subDevice;
       // Include the NULL termination of the string.
       vmcl_kernelalloc_2_arg.kernelName.kernelName_len = func.length() + 1;
       vmcl_kernelalloc_2_arg.kernelName.kernelName_val = (char *)func.c_str();
       vmcl_kernelalloc_2_arg.language = type;
-      vmcl_kernelalloc_2_arg.source.source_len =
-         kernels.find(type)->second.get_size();
-      vmcl_kernelalloc_2_arg.source.source_val =
-         (char *)kernels.find(type)->second.get_ptr();
+      vmcl_kernelalloc_2_arg.sourceHash =
+         VMAccel_Hash64(kernels.find(type)->second.get_ptr(),
+                        kernels.find(type)->second.get_size(), 0);
 
-      result_1 = vmcl_kernelalloc_2(&vmcl_kernelalloc_2_arg, client);
+      /*
+       * Remote Accelerators may have the program cached, probe using the
+       * hash of the source before transferring the source.
+       */
+      if (client != NULL) {
+         result_1 = vmcl_kernelalloc_2(&vmcl_kernelalloc_2_arg, client);
 
-      if (result_1 != NULL) {
-         std::tuple<unsigned int, std::string> key;
+         if (result_1 != NULL) {
+            status =
+               result_1->VMCLKernelAllocateReturnStatus_u.ret->status;
+            vmaccel_xdr_free((xdrproc_t)xdr_VMCLKernelAllocateReturnStatus,
+                             (caddr_t)result_1);
+         }
+      }
 
-         key = std::make_tuple(type, func);
+      if (status == VMACCEL_RESOURCE_UNAVAILABLE) {
+         vmcl_kernelalloc_2_arg.source.source_len =
+            kernels.find(type)->second.get_size();
+         vmcl_kernelalloc_2_arg.source.source_val =
+            (char *)kernels.find(type)->second.get_ptr();
 
-         if (client != NULL) {
-            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
-                             (caddr_t)result_1);
+         result_1 = vmcl_kernelalloc_2(&vmcl_kernelalloc_2_arg, client);
+
+         if (result_1 != NULL) {
+            status =
+               result_1->VMCLKernelAllocateReturnStatus_u.ret->status;
+
+            if (client != NULL) {
+               vmaccel_xdr_free(
+                  (xdrproc_t)xdr_VMCLKernelAllocateReturnStatus,
+                  (caddr_t)result_1);
+            }
          }
+      }
+
+      if (status == VMACCEL_SUCCESS) {
+         std::tuple<unsigned int, std::string, unsigned int> key;
+
+         key = std::make_tuple(type, func, subDevice);
 
          variants[key] = kernelId;
       }
@@ -1122,7 +1853,8 @@ public:
 private:
    ref_object<clcontext> clctx;
    std::map<unsigned int, ref_object<char>> kernels;
-   std::map<std::tuple<unsigned int, std::string>, unsigned int> variants;
+   std::map<std::tuple<unsigned int, std::string, unsigned int>, unsigned int>
+      variants;
 };
 
 namespace compute {
@@ -1139,11 +1871,8 @@ bool prepareComputeArgs(ref_object<clcontext> &clctx,
                         VMCLKernelArgDesc *kernelArgs, unsigned int argIndex,
                         T arg) {
    VMAccelSurfaceAllocateReturnStatus *result_1;
-   VMCLSurfaceAllocateDesc vmcl_surfacealloc_2_arg;
-   VMAccelSurfaceMapReturnStatus *result_2;
-   VMCLSurfaceMapOp vmcl_surfacemap_2_arg;
-   VMAccelReturnStatus *result_3;
-   VMCLSurfaceUnmapOp vmcl_surfaceunmap_2_arg;
+   VMCLSurfaceAllocateInitOp vmcl_surfaceallocinit_2_arg;
+   VMAccelStatusCode status;
    CLIENT *client = clctx->get_client();
 
 #if DEBUG_TEMPLATE_TYPES
@@ -1154,16 +1883,25 @@ bool prepareComputeArgs(ref_object<clcontext> &clctx,
    kernelArgs[argIndex].surf.id = VMACCEL_INVALID_ID;
    kernelArgs[argIndex].index = -1;
 
-   memset(&vmcl_surfacealloc_2_arg, 0, sizeof(vmcl_surfacealloc_2_arg));
-   vmcl_surfacealloc_2_arg.client.cid = clctx->get_contextId();
-   vmcl_surfacealloc_2_arg.client.accel.id = argIndex;
-   vmcl_surfacealloc_2_arg.desc.type = VMACCEL_SURFACE_BUFFER;
-   vmcl_surfacealloc_2_arg.desc.width = arg.get_size();
-   vmcl_surfacealloc_2_arg.desc.format = VMACCEL_FORMAT_R8_TYPELESS;
-   vmcl_surfacealloc_2_arg.desc.usage = arg.get_usage();
-   vmcl_surfacealloc_2_arg.desc.bindFlags = VMACCEL_BIND_UNORDERED_ACCESS_FLAG;
-
-   result_1 = vmcl_surfacealloc_2(&vmcl_surfacealloc_2_arg, client);
+   /*
+    * Allocate the surface with the contents of the argument in a single
+    * request, the contents are not read back from the Accelerator.
+    */
+   memset(&vmcl_surfaceallocinit_2_arg, 0, sizeof(vmcl_surfaceallocinit_2_arg));
+   vmcl_surfaceallocinit_2_arg.queue.cid = clctx->get_contextId();
+   vmcl_surfaceallocinit_2_arg.queue.id = arg.get_queue_id();
+   vmcl_surfaceallocinit_2_arg.alloc.client.cid = clctx->get_contextId();
+   vmcl_surfaceallocinit_2_arg.alloc.client.accel.id = argIndex;
+   vmcl_surfaceallocinit_2_arg.alloc.desc.type = VMACCEL_SURFACE_BUFFER;
+   vmcl_surfaceallocinit_2_arg.alloc.desc.width = arg.get_size();
+   vmcl_surfaceallocinit_2_arg.alloc.desc.format = VMACCEL_FORMAT_R8_TYPELESS;
+   vmcl_surfaceallocinit_2_arg.alloc.desc.usage = arg.get_usage();
+   vmcl_surfaceallocinit_2_arg.alloc.desc.bindFlags =
+      VMACCEL_BIND_UNORDERED_ACCESS_FLAG;
+   vmcl_surfaceallocinit_2_arg.data.data_len = arg.get_size();
+   vmcl_surfaceallocinit_2_arg.data.data_val = (char *)arg.get_ptr();
+
+   result_1 = vmcl_surfaceallocinit_2(&vmcl_surfaceallocinit_2_arg, client);
 
    if (result_1 == NULL) {
       VMACCEL_WARNING("%s: Unable to allocate surface %d for context %d\n",
@@ -1171,86 +1909,33 @@ bool prepareComputeArgs(ref_object<clcontext> &clctx,
       return false;
    }
 
+   status = (result_1->VMAccelSurfaceAllocateReturnStatus_u.ret != NULL)
+               ? result_1->VMAccelSurfaceAllocateReturnStatus_u.ret->status
+               : VMACCEL_FAIL;
+
    if (client != NULL) {
       vmaccel_xdr_free((xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus,
                        (caddr_t)result_1);
    }
 
-   kernelArgs[argIndex].surf.id = vmcl_surfacealloc_2_arg.client.accel.id;
-   kernelArgs[argIndex].surf.generation =
-      vmcl_surfacealloc_2_arg.client.accel.generation;
-
-   memset(&vmcl_surfacemap_2_arg, 0, sizeof(vmcl_surfacemap_2_arg));
-   vmcl_surfacemap_2_arg.queue.cid = clctx->get_contextId();
-   vmcl_surfacemap_2_arg.queue.id = arg.get_queue_id();
-   vmcl_surfacemap_2_arg.op.surf.id = (VMAccelId)argIndex;
-   vmcl_surfacemap_2_arg.op.surf.generation =
-      kernelArgs[argIndex].surf.generation;
-   vmcl_surfacemap_2_arg.op.size.x = arg.get_size();
-   vmcl_surfacemap_2_arg.op.mapFlags =
-      VMACCEL_MAP_READ_FLAG | VMACCEL_MAP_WRITE_FLAG;
-
-   result_2 = vmcl_surfacemap_2(&vmcl_surfacemap_2_arg, client);
-
-   if (result_2 != NULL &&
-       result_2->VMAccelSurfaceMapReturnStatus_u.ret->status ==
-          VMACCEL_SUCCESS) {
-      void *ptr = result_2->VMAccelSurfaceMapReturnStatus_u.ret->ptr.ptr_val;
-
-      assert(result_2->VMAccelSurfaceMapReturnStatus_u.ret->ptr.ptr_len ==
-             vmcl_surfacemap_2_arg.op.size.x);
-
-      /*
-       * Memory copy the contents into the value
-       */
-      memcpy(ptr, arg.get_ptr(), vmcl_surfacemap_2_arg.op.size.x);
-
-#if DEBUG_TEMPLATE_TYPES
-      for (int i = 0;
-           i < vmcl_surfacemap_2_arg.op.size.x / sizeof(unsigned int); i++) {
-         VMACCEL_LOG("%s: in_uint32[%d]=%d\n", __FUNCTION__, i,
-                     ((unsigned int *)ptr)[i]);
-      }
-#endif
-
-      memset(&vmcl_surfaceunmap_2_arg, 0, sizeof(vmcl_surfaceunmap_2_arg));
-      vmcl_surfaceunmap_2_arg.queue.cid = clctx->get_contextId();
-      vmcl_surfaceunmap_2_arg.queue.id = arg.get_queue_id();
-      vmcl_surfaceunmap_2_arg.op.surf.id = argIndex;
-      vmcl_surfaceunmap_2_arg.op.surf.generation =
-         kernelArgs[argIndex].surf.generation;
-      vmcl_surfaceunmap_2_arg.op.ptr.ptr_len = vmcl_surfacemap_2_arg.op.size.x;
-      vmcl_surfaceunmap_2_arg.op.ptr.ptr_val = (char *)ptr;
-
-      result_3 = vmcl_surfaceunmap_2(&vmcl_surfaceunmap_2_arg, client);
-
-      if (client != NULL) {
-         vmaccel_xdr_free((xdrproc_t)xdr_VMAccelSurfaceMapReturnStatus,
-                          (caddr_t)result_2);
-      }
-
-      if (result_3 == NULL) {
-         return false;
-      }
-
-      if (client != NULL) {
-         vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
-                          (caddr_t)result_3);
-      }
-
-      kernelArgs[argIndex].index = argIndex;
-      kernelArgs[argIndex].type = VMCL_ARG_SURFACE;
-      kernelArgs[argIndex].surf.id = vmcl_surfacealloc_2_arg.client.accel.id;
-
-      return true;
+   if (status != VMACCEL_SUCCESS) {
+      VMACCEL_WARNING("%s: Unable to initialize surface %d for context %d "
+                      "queue %d\n",
+                      __FUNCTION__, argIndex, clctx->get_contextId(),
+                      arg.get_queue_id());
+      VMACCEL_WARNING("%s:   size=%zu usage=%d\n", __FUNCTION__,
+                      arg.get_size(), arg.get_usage());
+      return false;
    }
 
-   VMACCEL_WARNING("%s: Unable to map surface %d for context %d queue %d\n",
-                   __FUNCTION__, argIndex, clctx->get_contextId(),
-                   arg.get_queue_id());
-   VMACCEL_WARNING("%s:   size=%d usage=%d\n", arg.get_size(), arg.get_usage());
+   kernelArgs[argIndex].index = argIndex;
+   kernelArgs[argIndex].type = VMCL_ARG_SURFACE;
+   kernelArgs[argIndex].surf.id =
+      vmcl_surfaceallocinit_2_arg.alloc.client.accel.id;
+   kernelArgs[argIndex].surf.generation =
+      vmcl_surfaceallocinit_2_arg.alloc.client.accel.generation;
 
-   return false;
+   return true;
 }
 
 template <typename T, typename... R>
@@ -1284,7 +1969,11 @@ bool prepareComputeSurfaceArgs(ref_object<clcontext> &clctx, VMAccelId qid,
    kernelArgs[argIndex].surf.id = VMACCEL_INVALID_ID;
    kernelArgs[argIndex].index = -1;
 
-   if (!clctx->alloc_surface(arg)) {
+   /*
+    * A surface allocated for the argument is initialized by the allocation,
+    * the update is then skipped unless forced.
+    */
+   if (!clctx->alloc_surface(arg, true, qid)) {
       VMACCEL_LOG("%s: Unable to allocate surface for argIndex=%d\n",
                   __FUNCTION__, argIndex);
       return false;
@@ -1325,6 +2014,63 @@ bool prepareComputeSurfaceArgs(ref_object<clcontext> &clctx, VMAccelId qid,
                                     args...);
 }
 
+/**
+ * prepareComputeSamplerArgs
+ *
+ * Prepares a sampler argument for consumption by the Compute Kernel.
+ */
+template <typename... R>
+bool prepareComputeSamplerArgs(ref_object<clcontext> &clctx,
+                               VMCLKernelArgDesc *kernelArgs,
+                               unsigned int argIndex,
+                               const VMCLSamplerDesc &desc) {
+   VMAccelId id = clctx->alloc_sampler(desc);
+
+   kernelArgs[argIndex].surf.id = VMACCEL_INVALID_ID;
+   kernelArgs[argIndex].index = -1;
+
+   if (id == VMACCEL_INVALID_ID) {
+      return false;
+   }
+
+   kernelArgs[argIndex].index = argIndex;
+   kernelArgs[argIndex].type = VMCL_ARG_SAMPLER;
+   kernelArgs[argIndex].sampler.cid = clctx->get_contextId();
+   kernelArgs[argIndex].sampler.id = id;
+
+   return true;
+}
+
+/**
+ * prepareComputeValueArgs
+ *
+ * Prepares an argument without a backing surface, i.e. a sampler, an
+ * immediate value or local memory, for consumption by the Compute Kernel.
+ * Immediate values reference the binding, which must outlive the dispatch.
+ */
+template <typename... R>
+bool prepareComputeValueArgs(ref_object<clcontext> &clctx,
+                             VMCLKernelArgDesc *kernelArgs,
+                             unsigned int argIndex, vmaccel::binding *b) {
+   if (b->is_sampler()) {
+      return prepareComputeSamplerArgs(clctx, kernelArgs, argIndex,
+                                       b->get_sampler_desc());
+   }
+
+   kernelArgs[argIndex].surf.id = VMACCEL_INVALID_ID;
+   kernelArgs[argIndex].index = argIndex;
+   kernelArgs[argIndex].type = b->get_arg_type();
+
+   if (b->get_arg_type() == VMCL_ARG_IMMEDIATE) {
+      kernelArgs[argIndex].data.data_len = b->get_value().size();
+      kernelArgs[argIndex].data.data_val = b->get_value().data();
+   } else {
+      kernelArgs[argIndex].localSize = b->get_local_size();
+   }
+
+   return true;
+}
+
 /**
  * quiesceComputeArgs
  *
@@ -1508,11 +2254,48 @@ public:
     * @param bindFlags Bind flags for the object.
     * @param usage Usage flags for the object.
     * @param s Surface object for the binding.
+    * @param shardStride Bytes of the surface accessed per work-item along
+    *                    dimension 0, zero if the surface is not partitioned
+    *                    when the operation is sharded.
     */
-   binding(unsigned int bindFlags, unsigned int usage, ref_object<surface> &s) {
+   binding(unsigned int bindFlags, unsigned int usage, ref_object<surface> &s,
+           size_t shardStride = 0) {
       assert(usage == s->get_desc().usage);
+      clbinding = ref_object<vmaccel::binding>(
+         new vmaccel::binding(VMACCEL_COMPUTE_ACCELERATOR_MASK, bindFlags,
+                              usage, s, shardStride));
+   }
+
+   /**
+    * Constructor for a sampler argument of an image kernel.
+    *
+    * @param desc Sampler descriptor, addressing and filtering of the sampler.
+    */
+   binding(const VMCLSamplerDesc &desc) {
+      clbinding = ref_object<vmaccel::binding>(
+         new vmaccel::binding(VMACCEL_COMPUTE_ACCELERATOR_MASK, desc));
+   }
+
+   /**
+    * Constructor for an argument passed by value, e.g. a scalar or a small
+    * struct, without allocating a surface.
+    *
+    * @param data Value of the argument, copied by the binding.
+    * @param size Size of the value in bytes.
+    */
+   binding(const void *data, size_t size) {
+      clbinding = ref_object<vmaccel::binding>(new vmaccel::binding(
+         VMACCEL_COMPUTE_ACCELERATOR_MASK, data, size));
+   }
+
+   /**
+    * Constructor for a __local memory argument.
+    *
+    * @param localSize Bytes of local memory allocated per work-group.
+    */
+   explicit binding(size_t localSize) {
       clbinding = ref_object<vmaccel::binding>(new vmaccel::binding(
-         VMACCEL_COMPUTE_ACCELERATOR_MASK, bindFlags, usage, s));
+         VMACCEL_COMPUTE_ACCELERATOR_MASK, localSize));
    }
 
    /**
@@ -1604,9 +2387,20 @@ public:
       prepared = false;
       dispatched = false;
       quiesced = false;
+      sharded = false;
+      pinned = false;
+      repeatCount = 0;
+      queueIndex = 0;
 
       kernelArgs = NULL;
 
+      memset(&profiles[0], 0, sizeof(profiles));
+      for (unsigned int i = 0; i < VMCL_PROFILE_MAX; i++) {
+         profiles[i].status = VMACCEL_RESOURCE_UNAVAILABLE;
+      }
+      memset(&hostStartTime, 0, sizeof(hostStartTime));
+      memset(&hostEndTime, 0, sizeof(hostEndTime));
+
       LOG_EXIT(("} compute::operation::Constructor\n"));
    }
 
@@ -1621,6 +2415,7 @@ public:
                  "quiesced=%d {\n",
                  prepared, dispatched, quiesced));
       finish();
+      pin_surfaces(false);
 
       if (kernelArgs) {
          free(kernelArgs);
@@ -1660,11 +2455,80 @@ public:
       kernelFunc = func;
       computeTopology = topology;
 
-      kernel->prepare(kernelType, kernelFunc);
+      kernel->prepare(kernelType, kernelFunc, subDevice);
 
       prepared = true;
    }
 
+   /**
+    * set_sharding
+    *
+    * Splits the dispatch across all of the context's sub-devices. Dimension
+    * 0 of the global work range is divided in proportion to the measured
+    * throughput of each sub-device, and each slice is dispatched with the
+    * requested global offsets. Bindings that declare a shard stride are
+    * partitioned alongside the work range and merged back once quiesced,
+    * so partitioned arguments are indexed from the start of each slice.
+    * Bindings without a stride are shared by every slice and must be
+    * read-only, otherwise the operation is dispatched unsharded.
+    */
+   void set_sharding(bool enable) { sharded = enable; }
+
+   /**
+    * set_repeat
+    *
+    * Executes the kernel count times on the server with a single dispatch,
+    * each iteration ordered after the previous one. The surfaces bound to
+    * each pair of argument indices in swaps are exchanged between
+    * iterations, so an iteration reads what the previous one wrote. The
+    * last iteration is exchanged when count is even. Swapped arguments
+    * must be surfaces, and a repeated operation is dispatched unsharded.
+    */
+   void set_repeat(unsigned int count,
+                   const std::vector<VMCLKernelArgSwap> &argSwaps =
+                      std::vector<VMCLKernelArgSwap>()) {
+      repeatCount = count;
+      swaps = argSwaps;
+   }
+
+   /**
+    * get_profile
+    *
+    * Retrieves the device timestamps, in nanoseconds, recorded when the
+    * operation was quiesced for its most recent command of a class on the
+    * operation's queue. A sharded operation reports the span of the command
+    * across its sub-devices. Requires a context allocated with
+    * VMCL_PROFILING_CAP.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int get_profile(VMCLProfileOpType type, VMCLProfileStatus &profile) {
+      if (type >= VMCL_PROFILE_MAX) {
+         return VMACCEL_FAIL;
+      }
+
+      profile = profiles[type];
+
+      return profile.status;
+   }
+
+   /**
+    * get_host_time_ns
+    *
+    * @return Time from the start of dispatch until the operation was
+    *         quiesced as observed by the client, in nanoseconds. The
+    *         difference from the device timestamps is the transport and
+    *         scheduling overhead of the operation.
+    */
+   unsigned long long get_host_time_ns() {
+      if (!quiesced) {
+         return 0;
+      }
+
+      return (hostEndTime.tv_sec - hostStartTime.tv_sec) * 1000000000ULL +
+             hostEndTime.tv_nsec - hostStartTime.tv_nsec;
+   }
+
    /**
     * dispatch
     *
@@ -1672,17 +2536,7 @@ public:
     */
    int dispatch(bool force = false) {
       VMCLDispatchOp vmcl_dispatch_2_arg;
-      VMAccelReturnStatus *result_1;
-      VMAccelReturnStatus *result_2;
-      VMCLQueueId vmcl_queueflush_1_arg;
-      unsigned int numArguments = bindings.size();
-      unsigned int contextId = clctx->get_contextId();
-      unsigned int queueId = subDevice * clctx->get_num_queues();
-      unsigned int i;
       unsigned int res;
-      unsigned int retryCount = 0;
-      unsigned int kid = kernel->get_id(kernelType, kernelFunc);
-      CLIENT *client = clctx->get_client();
       START_TIME_STAT(dispatch);
 
       if (!prepared) {
@@ -1695,28 +2549,117 @@ public:
          return VMACCEL_FAIL;
       }
 
-      kernelArgs =
-         (VMCLKernelArgDesc *)malloc(sizeof(VMCLKernelArgDesc) * numArguments);
+      clock_gettime(CLOCK_MONOTONIC, &hostStartTime);
 
-      if (kernelArgs == NULL) {
-         VMACCEL_WARNING(
-            "%s: Unable to create a kernel arguments and surface ids\n",
-            __FUNCTION__);
+      if (can_shard()) {
+         res = dispatch_shards();
          END_TIME_STAT(dispatch);
-         return VMACCEL_FAIL;
+         return res;
       }
 
-      /*
-       * Zero out the arguments to ensure variable sized members are not
-       * encoded by the RPC stack.
-       */
-      memset(&kernelArgs[0], 0, sizeof(VMCLKernelArgDesc) * numArguments);
+      res = encode(vmcl_dispatch_2_arg);
 
-      for (i = 0; i < numArguments; i++) {
-         // Enqueue surface update on compute kernel queue.
-         if (!prepareComputeSurfaceArgs<ref_object<surface>>(
-                clctx, subDevice * clctx->get_num_queues(), kernelArgs, i,
-                bindings[i]->get_surf())) {
+      if (res == VMACCEL_SUCCESS) {
+         res = submit(vmcl_dispatch_2_arg);
+      }
+
+      if (res == VMACCEL_SUCCESS) {
+         dispatched = true;
+      }
+
+      END_TIME_STAT(dispatch);
+
+      return res;
+   }
+
+   /**
+    * dispatch_async
+    *
+    * Dispatches the operation on the I/O thread of its context, see
+    * clcontext::async. The operation must outlive the request.
+    */
+   std::future<int> dispatch_async(bool force = false) {
+      return clctx->async([this, force]() { return dispatch(force); });
+   }
+
+   /**
+    * quiesce_async
+    *
+    * Quiesces the operation on the I/O thread of its context, after the
+    * requests posted before it.
+    */
+   std::future<int> quiesce_async() {
+      return clctx->async([this]() { return quiesce(); });
+   }
+
+#if VMACCEL_HAS_COROUTINES
+   /**
+    * Awaitable forms of dispatch_async and quiesce_async.
+    */
+   awaitable<int> dispatch_await(bool force = false) {
+      return clctx->await([this, force]() { return dispatch(force); });
+   }
+
+   awaitable<int> quiesce_await() {
+      return clctx->await([this]() { return quiesce(); });
+   }
+#endif
+
+   /**
+    * encode
+    *
+    * Prepares the arguments of the operation and encodes an unsharded
+    * dispatch, without submitting it. The encoded dispatch references the
+    * operation and is valid until the operation is dispatched again.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int encode(VMCLDispatchOp &vmcl_dispatch_2_arg) {
+      unsigned int numArguments = bindings.size();
+      unsigned int contextId = clctx->get_contextId();
+      unsigned int queueId = get_queue_id();
+      unsigned int i;
+
+      /*
+       * The bindings are fixed once prepared, the argument array is reused
+       * when the operation is dispatched again.
+       */
+      if (kernelArgs == NULL) {
+         kernelArgs = (VMCLKernelArgDesc *)malloc(sizeof(VMCLKernelArgDesc) *
+                                                  numArguments);
+      }
+
+      if (kernelArgs == NULL) {
+         VMACCEL_WARNING(
+            "%s: Unable to create a kernel arguments and surface ids\n",
+            __FUNCTION__);
+         return VMACCEL_FAIL;
+      }
+
+      /*
+       * Zero out the arguments to ensure variable sized members are not
+       * encoded by the RPC stack.
+       */
+      memset(&kernelArgs[0], 0, sizeof(VMCLKernelArgDesc) * numArguments);
+
+      /*
+       * Keep the bound surfaces resident until the operation is quiesced.
+       */
+      pin_surfaces(true);
+
+      for (i = 0; i < numArguments; i++) {
+         if (bindings[i]->get_arg_type() != VMCL_ARG_SURFACE) {
+            if (!prepareComputeValueArgs(clctx, kernelArgs, i,
+                                         bindings[i].get().get())) {
+               VMACCEL_WARNING("%s: Unable to prepare compute argument %d\n",
+                               __FUNCTION__, i);
+            }
+            continue;
+         }
+
+         // Enqueue surface update on compute kernel queue.
+         if (!prepareComputeSurfaceArgs<ref_object<surface>>(
+                clctx, queueId, kernelArgs, i, bindings[i]->get_surf())) {
             VMACCEL_WARNING("%s: Unable to prepare compute argument %d\n",
                             __FUNCTION__, i);
          }
@@ -1728,7 +2671,8 @@ public:
       memset(&vmcl_dispatch_2_arg, 0, sizeof(vmcl_dispatch_2_arg));
       vmcl_dispatch_2_arg.queue.cid = contextId;
       vmcl_dispatch_2_arg.queue.id = queueId;
-      vmcl_dispatch_2_arg.kernel.id = kid;
+      vmcl_dispatch_2_arg.kernel.id =
+         kernel->get_id(kernelType, kernelFunc, subDevice);
       vmcl_dispatch_2_arg.dimension = 1;
       vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_len =
          computeTopology.get_num_dimensions();
@@ -1744,59 +2688,93 @@ public:
          (u_int *)computeTopology.get_local_sizes();
       vmcl_dispatch_2_arg.args.args_len = numArguments;
       vmcl_dispatch_2_arg.args.args_val = &kernelArgs[0];
+      vmcl_dispatch_2_arg.repeatCount = repeatCount;
+      vmcl_dispatch_2_arg.swaps.swaps_len = swaps.size();
+      vmcl_dispatch_2_arg.swaps.swaps_val = swaps.empty() ? NULL : &swaps[0];
 
-      res = VMACCEL_RESOURCE_UNAVAILABLE;
-      while (retryCount < RETRY_MAX_COUNT &&
-             res == VMACCEL_RESOURCE_UNAVAILABLE) {
-#if DEBUG_COMPUTE_OPERATION || DEBUG_SURFACE_CONSISTENCY
-         VMACCEL_LOG("%s: Dispatching with kernelArgs\n", __FUNCTION__);
-         for (i = 0; i < numArguments; i++) {
-            VMACCEL_LOG("%s:  arg[%d]: type=%d sid=%d gen=%d\n", __FUNCTION__,
-                        i, kernelArgs[i].type, kernelArgs[i].surf.id,
-                        kernelArgs[i].surf.generation);
-         }
-#endif
+      return VMACCEL_SUCCESS;
+   }
 
-         result_1 = vmcl_dispatch_2(&vmcl_dispatch_2_arg, client);
+   /**
+    * Accessors for compute::dispatch_list.
+    */
+   bool is_prepared() { return prepared; }
 
-         if (result_1 != NULL) {
-            res = result_1->VMAccelReturnStatus_u.ret->status;
+   bool is_dispatched() { return dispatched; }
 
-            if (client != NULL) {
-               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
-                                (caddr_t)result_1);
-            }
+   bool is_sharded() { return sharded; }
 
-            result_1 = NULL;
+   ref_object<clcontext> &get_context() { return clctx; }
 
-            clctx->flush_queue(queueId);
+   unsigned int get_sub_device() { return subDevice; }
 
-            if (res == VMACCEL_RESOURCE_UNAVAILABLE) {
-               if ((retryCount > 0) &&
-                   (retryCount % (RETRY_MAX_COUNT / 4) == 0)) {
-                  VMACCEL_LOG("Dispatch requested resource that is unavailble, "
-                              "retryCount=%d...\n",
-                              retryCount);
-               }
-               pthread_yield();
-               usleep(retryCount * 1000);
-            }
+   /**
+    * set_queue
+    *
+    * Selects the queue of the sub-device used by unsharded dispatches, the
+    * index wraps at the number of queues of the context.
+    */
+   void set_queue(unsigned int index) { queueIndex = index; }
+
+   /**
+    * get_queue_id
+    *
+    * @return Identifier of the queue used by unsharded dispatches.
+    */
+   VMAccelId get_queue_id() {
+      unsigned int numQueues = clctx->get_num_queues();
+
+      return subDevice * numQueues + (queueIndex % numQueues);
+   }
+
+   /**
+    * get_surface_access
+    *
+    * Retrieves the surfaces bound to the operation, by whether the kernel
+    * may write to them.
+    */
+   void get_surface_access(std::vector<ref_object<surface>> &reads,
+                           std::vector<ref_object<surface>> &writes) {
+      for (unsigned int i = 0; i < bindings.size(); i++) {
+         if (bindings[i]->get_arg_type() != VMCL_ARG_SURFACE) {
+            continue;
          }
 
-         retryCount++;
+         if (bindings[i]->get_usage() == VMACCEL_SURFACE_USAGE_READONLY) {
+            reads.push_back(bindings[i]->get_surf());
+         } else {
+            writes.push_back(bindings[i]->get_surf());
+         }
       }
+   }
 
-      if (res == VMACCEL_SUCCESS) {
-         dispatched = true;
-      }
+   /**
+    * set_dispatched
+    *
+    * Marks an operation encoded with encode() as submitted, stamping the
+    * start of the host time with the submission of the list.
+    */
+   void set_dispatched(const struct timespec &startTime) {
+      hostStartTime = startTime;
+      dispatched = true;
+      quiesced = false;
+   }
 
-      if (retryCount > 1) {
-         INC_COUNTER_STAT(resource_unavailable_per_dispatch, retryCount - 1);
+   /**
+    * set_quiesced
+    *
+    * Marks a dispatched operation whose results were read back by the
+    * caller as quiesced, stamping the end of the host time.
+    */
+   void set_quiesced() {
+      if (!dispatched || quiesced) {
+         return;
       }
 
-      END_TIME_STAT(dispatch);
-
-      return res;
+      record_profile(get_queue_id());
+      clock_gettime(CLOCK_MONOTONIC, &hostEndTime);
+      quiesced = true;
+      pin_surfaces(false);
    }
 
    /**
@@ -1826,11 +2804,18 @@ public:
          }
       }
 
+      if (!shards.empty()) {
+         i = quiesce_shards();
+         clock_gettime(CLOCK_MONOTONIC, &hostEndTime);
+         END_TIME_STAT(quiesce);
+         return i;
+      }
+
       for (i = 0; i < bindings.size(); i++) {
          // Download surfaces after workload completion, enqueue download
          // on the compute kernel dispatch queue.
          if (!quiesceComputeSurfaceArgs<ref_object<surface>>(
-                clctx, subDevice * clctx->get_num_queues(), kernelArgs, i,
+                clctx, get_queue_id(), kernelArgs, i,
                 bindings[i]->get_surf())) {
             VMACCEL_WARNING("%s: Unable to prepare compute argument %d\n",
                             __FUNCTION__, i);
@@ -1839,8 +2824,14 @@ public:
          }
       }
 
+      record_profile(get_queue_id());
+
+      clock_gettime(CLOCK_MONOTONIC, &hostEndTime);
+
       quiesced = true;
 
+      pin_surfaces(false);
+
       END_TIME_STAT(quiesce);
 
       return VMACCEL_SUCCESS;
@@ -1869,111 +2860,1204 @@ public:
    }
 
 private:
-   bool prepared;
-   bool dispatched;
-   bool quiesced;
-
-   ref_object<clcontext> clctx;
-   unsigned int subDevice;
-   ref_object<clkernel> kernel;
-   VMCLKernelLanguageType kernelType;
-   std::string kernelFunc;
-   vmaccel::work_topology computeTopology;
-   VMCLKernelArgDesc *kernelArgs;
-
-   DECLARE_TIME_STAT(dispatch);
-   DECLARE_TIME_STAT(finish);
-   DECLARE_TIME_STAT(quiesce);
-   DECLARE_COUNTER_STAT(resource_unavailable_per_dispatch);
-};
-
-/**
- * Compute context encapsulating class.
- *
- * This class is used to encapsulate the clcontext, to unify the management
- * of adding a context object to the vmaccel::accelerator. A reference object
- * must be added to vmaccel::accelerator for dereference active contexts
- * during surface destruction.
- */
-
-class context {
-
-public:
-   /**
-    * Default constructor.
+   /*
+    * Slice of a sharded dispatch executing on a single sub-device.
     */
-   context() {}
+   struct shard {
+      unsigned int subDevice;
+      unsigned int offset;
+      unsigned int size;
+      std::vector<VMCLKernelArgDesc> kernelArgs;
+      std::vector<ref_object<surface>> surfs;
+      std::vector<std::shared_ptr<accelerator_surface>> partitions;
+      struct timespec startTime;
+   };
 
    /**
-    * Constructor.
+    * pin_surfaces
     *
-    * @param a Accelerator class used to instantiate the compute operation.
-    * @param megaFlops The estimated mega-flops needed for the workload.
-    * @param selectionMask The selection mask for the accelerators requested.
-    * @param numSubDevices The number of sub-devices to explicitly submit work
-    *to.
-    * @param requiredCaps The required capabilites for this compute context.
+    * Pins or unpins the surfaces bound to the operation, see
+    * clcontext::pin_surface.
     */
-   context(std::shared_ptr<vmaccel::accelerator> &a, unsigned int megaFlops,
-           unsigned int selectionMask, unsigned int numSubDevices,
-           unsigned int numQueues, unsigned int requiredCaps) {
-      std::shared_ptr<vmaccel::clcontext> clctxPtr;
-      clctxPtr = std::shared_ptr<clcontext>(new clcontext(
-         a, megaFlops, selectionMask, numSubDevices, numQueues, requiredCaps));
-      /*
-       * Downcast the clcontext for tracking in the accelerator. Tracking in the
-       * accelerator class is required for a surface to destroy its remote
-       * object upon class destruction.
-       */
-      std::shared_ptr<vmaccel::context> ctxPtr =
-         std::static_pointer_cast<vmaccel::context, clcontext>(clctxPtr);
-      ref_object<vmaccel::context> cb(ctxPtr, sizeof(vmaccel::clcontext), 0, 0);
-      /*
-       * Track the context so vmaccel::surface::destroy can dereference and
-       * instantiate destruction of the server side surface.
-       */
-      a->add_context(clctxPtr->get_contextId(), cb);
-      clctx = ref_object<vmaccel::clcontext>(clctxPtr,
-                                             sizeof(vmaccel::clcontext), 0, 0);
+   void pin_surfaces(bool pin) {
+      if (pinned == pin) {
+         return;
+      }
+
+      for (unsigned int i = 0; i < bindings.size(); i++) {
+         if (bindings[i]->get_arg_type() == VMCL_ARG_SURFACE) {
+            clctx->pin_surface(bindings[i]->get_surf()->get_id(), pin);
+         }
+      }
+
+      pinned = pin;
    }
 
    /**
-    * Destructor.
+    * record_profile
+    *
+    * Records the device timestamps of the operation's commands on a queue,
+    * widening the recorded span when the operation spans several queues.
     */
-   ~context() {
-      /*
-       * Remove the tracked context.
-       */
-      clctx->get_accel()->remove_context(clctx->get_contextId());
+   void record_profile(VMAccelId qid) {
+      const VMCLProfileOpType types[] = {
+         VMCL_PROFILE_DISPATCH, VMCL_PROFILE_UPLOAD, VMCL_PROFILE_DOWNLOAD};
+
+      if (!clctx->is_profiling()) {
+         return;
+      }
+
+      for (auto type : types) {
+         VMCLProfileStatus profile;
+         VMCLProfileStatus &rec = profiles[type];
+
+         if (!clctx->query_profile(qid, type, profile)) {
+            continue;
+         }
+
+         if (rec.status != VMACCEL_SUCCESS) {
+            rec = profile;
+         } else {
+            rec.queued = (profile.queued < rec.queued) ? profile.queued
+                                                       : rec.queued;
+            rec.submit = (profile.submit < rec.submit) ? profile.submit
+                                                       : rec.submit;
+            rec.start = (profile.start < rec.start) ? profile.start
+                                                    : rec.start;
+            rec.end = (profile.end > rec.end) ? profile.end : rec.end;
+         }
+      }
    }
 
    /**
-    * Accessors.
+    * submit
+    *
+    * Submits a dispatch to the Accelerator, retrying while the Accelerator
+    * reports the requested resources as unavailable.
     */
-   vmaccel::clcontext *operator->() { return clctx.get().get(); }
+   unsigned int submit(VMCLDispatchOp &vmcl_dispatch_2_arg) {
+      VMAccelReturnStatus *result_1;
+      unsigned int queueId = vmcl_dispatch_2_arg.queue.id;
+      unsigned int res = VMACCEL_RESOURCE_UNAVAILABLE;
+      unsigned int retryCount = 0;
+      CLIENT *client = clctx->get_client();
 
-   operator ref_object<vmaccel::clcontext> &() { return clctx; }
+      while (retryCount < RETRY_MAX_COUNT &&
+             res == VMACCEL_RESOURCE_UNAVAILABLE) {
+#if DEBUG_COMPUTE_OPERATION || DEBUG_SURFACE_CONSISTENCY
+         VMCLKernelArgDesc *args = vmcl_dispatch_2_arg.args.args_val;
+         VMACCEL_LOG("%s: Dispatching with kernelArgs\n", __FUNCTION__);
+         for (int i = 0; i < vmcl_dispatch_2_arg.args.args_len; i++) {
+            VMACCEL_LOG("%s:  arg[%d]: type=%d sid=%d gen=%d\n", __FUNCTION__,
+                        i, args[i].type, args[i].surf.id,
+                        args[i].surf.generation);
+         }
+#endif
 
-private:
-   ref_object<vmaccel::clcontext> clctx;
-};
+         result_1 = vmcl_dispatch_2(&vmcl_dispatch_2_arg, client);
 
-/**
- * Compute operation for compute kernels.
- *
- * Operation will allocate and instantiate a compute kernel on an available
- * Compute Accelerator. The specified kernel function is instantiated
- * per-thread, allowing for multi-dimensional partitioning of the working
- * set. The number of concurrent threads is defined as follows:
- *
- *   n = numDimensions
- *   # of threads = n * SUM(globalWorkSizes[0] ... globalWorkSizes[n]) *
- *                  SUM(localWorkSizes[0] ... localWorkSizes[n])
- *
- * The working set comprises of Input and Output to the function, and
- * is specified in the args parameter.
- *
- * @param accel Accelerator class used to instantiate the compute operation.
+         if (result_1 != NULL) {
+            res = result_1->VMAccelReturnStatus_u.ret->status;
+
+            if (client != NULL) {
+               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                                (caddr_t)result_1);
+            }
+
+            result_1 = NULL;
+
+            clctx->flush_queue(queueId);
+
+            if (res == VMACCEL_RESOURCE_UNAVAILABLE) {
+               if ((retryCount > 0) &&
+                   (retryCount % (RETRY_MAX_COUNT / 4) == 0)) {
+                  VMACCEL_LOG("Dispatch requested resource that is unavailble, "
+                              "retryCount=%d...\n",
+                              retryCount);
+               }
+               pthread_yield();
+               usleep(retryCount * 1000);
+            }
+         }
+
+         retryCount++;
+      }
+
+      if (retryCount > 1) {
+         INC_COUNTER_STAT(resource_unavailable_per_dispatch, retryCount - 1);
+      }
+
+      return res;
+   }
+
+   /**
+    * can_shard
+    *
+    * Determines if the operation can be split across sub-devices, given the
+    * access ranges declared by the bindings.
+    */
+   bool can_shard() {
+      unsigned int globalSize;
+      unsigned int i;
+
+      if (!sharded || repeatCount > 1 || clctx->get_num_sub_devices() < 2 ||
+          computeTopology.get_num_dimensions() == 0) {
+         return false;
+      }
+
+      globalSize = computeTopology.get_global_sizes()[0];
+
+      for (i = 0; i < bindings.size(); i++) {
+         size_t stride = bindings[i]->get_shard_stride();
+
+         /*
+          * Samplers, immediate values and local memory are per work-group.
+          */
+         if (bindings[i]->get_arg_type() != VMCL_ARG_SURFACE) {
+            continue;
+         }
+
+         if (stride == 0) {
+            if (bindings[i]->get_usage() != VMACCEL_SURFACE_USAGE_READONLY) {
+               VMACCEL_WARNING("%s: Writable argument %d has no shard stride, "
+                               "dispatching unsharded\n",
+                               __FUNCTION__, i);
+               return false;
+            }
+         } else if (globalSize * stride >
+                    bindings[i]->get_surf()->get_desc().width) {
+            VMACCEL_WARNING("%s: Argument %d is smaller than its declared "
+                            "access range, dispatching unsharded\n",
+                            __FUNCTION__, i);
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   /**
+    * partition_work
+    *
+    * Divides dimension 0 of the global work range between the sub-devices
+    * in proportion to their measured throughput. Sub-devices without a
+    * measurement are assumed to match the average of those measured, and
+    * slices are aligned to the local work size so each slice remains a
+    * valid work range. The remainder is given to the fastest sub-device.
+    */
+   void partition_work(std::vector<unsigned int> &sizes) {
+      unsigned int numSubDevices = sizes.size();
+      unsigned int globalSize = computeTopology.get_global_sizes()[0];
+      unsigned int localSize = computeTopology.get_local_sizes()[0];
+      unsigned int granularity = (localSize != 0) ? localSize : 1;
+      std::vector<double> weights(numSubDevices);
+      double measured = 0.0;
+      double estimate = 1.0;
+      double total = 0.0;
+      unsigned int numMeasured = 0;
+      unsigned int assigned = 0;
+      unsigned int fastest = 0;
+      unsigned int s;
+
+      for (s = 0; s < numSubDevices; s++) {
+         weights[s] = clctx->get_sub_device_throughput(s);
+
+         if (weights[s] > 0.0) {
+            measured += weights[s];
+            numMeasured++;
+         }
+      }
+
+      if (numMeasured > 0) {
+         estimate = measured / numMeasured;
+      }
+
+      for (s = 0; s < numSubDevices; s++) {
+         if (weights[s] == 0.0) {
+            weights[s] = estimate;
+         }
+
+         total += weights[s];
+
+         if (weights[s] > weights[fastest]) {
+            fastest = s;
+         }
+      }
+
+      for (s = 0; s < numSubDevices; s++) {
+         sizes[s] = (unsigned int)(globalSize * (weights[s] / total));
+         sizes[s] -= sizes[s] % granularity;
+         assigned += sizes[s];
+      }
+
+      sizes[fastest] += globalSize - assigned;
+   }
+
+   /**
+    * dispatch_shards
+    *
+    * Partitions the arguments and dispatches a slice of the work range to
+    * each sub-device. Slices are submitted back to back so the sub-devices
+    * execute concurrently.
+    */
+   unsigned int dispatch_shards() {
+      std::vector<unsigned int> sizes(clctx->get_num_sub_devices());
+      std::vector<unsigned int> globalSizes(
+         computeTopology.get_global_sizes(),
+         computeTopology.get_global_sizes() +
+            computeTopology.get_num_dimensions());
+      unsigned int numArguments = bindings.size();
+      unsigned int numQueues = clctx->get_num_queues();
+      unsigned int offset = 0;
+      unsigned int res = VMACCEL_SUCCESS;
+      unsigned int i, s;
+
+      shards.clear();
+
+      partition_work(sizes);
+
+      for (s = 0; s < sizes.size(); s++) {
+         shard sh;
+
+         if (sizes[s] == 0) {
+            continue;
+         }
+
+         sh.subDevice = s;
+         sh.offset = offset;
+         sh.size = sizes[s];
+         offset += sizes[s];
+
+         /*
+          * Zero out the arguments to ensure variable sized members are not
+          * encoded by the RPC stack.
+          */
+         sh.kernelArgs.assign(numArguments, VMCLKernelArgDesc());
+         memset(&sh.kernelArgs[0], 0,
+                sizeof(VMCLKernelArgDesc) * numArguments);
+
+         for (i = 0; i < numArguments; i++) {
+            ref_object<surface> surf = bindings[i]->get_surf();
+            size_t stride = bindings[i]->get_shard_stride();
+
+            if (stride != 0) {
+               VMAccelSurfaceDesc desc = surf->get_desc();
+               std::shared_ptr<accelerator_surface> part;
+
+               desc.width = sh.size * stride;
+               part = std::shared_ptr<accelerator_surface>(
+                  new accelerator_surface(surf->get_accel(),
+                                          surf->get_queue_id(), desc));
+               memcpy((*part)->get_backing().get(),
+                      surf->get_backing().get() + sh.offset * stride,
+                      desc.width);
+               sh.partitions.push_back(part);
+               surf = *part;
+            }
+
+            sh.surfs.push_back(surf);
+
+            if (bindings[i]->get_arg_type() != VMCL_ARG_SURFACE) {
+               if (!prepareComputeValueArgs(clctx, &sh.kernelArgs[0], i,
+                                            bindings[i].get().get())) {
+                  VMACCEL_WARNING(
+                     "%s: Unable to prepare compute argument %d for shard %d\n",
+                     __FUNCTION__, i, s);
+               }
+               continue;
+            }
+
+            // Enqueue surface update on the sub-device's first queue.
+            if (!prepareComputeSurfaceArgs<ref_object<surface>>(
+                   clctx, s * numQueues, &sh.kernelArgs[0], i, surf)) {
+               VMACCEL_WARNING(
+                  "%s: Unable to prepare compute argument %d for shard %d\n",
+                  __FUNCTION__, i, s);
+            }
+         }
+
+         shards.push_back(sh);
+      }
+
+      for (s = 0; s < shards.size() && res == VMACCEL_SUCCESS; s++) {
+         VMCLDispatchOp vmcl_dispatch_2_arg;
+         shard &sh = shards[s];
+
+         globalSizes[0] = sh.size;
+
+         memset(&vmcl_dispatch_2_arg, 0, sizeof(vmcl_dispatch_2_arg));
+         vmcl_dispatch_2_arg.queue.cid = clctx->get_contextId();
+         vmcl_dispatch_2_arg.queue.id = sh.subDevice * numQueues;
+         vmcl_dispatch_2_arg.kernel.id =
+            kernel->get_id(kernelType, kernelFunc, sh.subDevice);
+         vmcl_dispatch_2_arg.dimension = 1;
+         vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_len =
+            computeTopology.get_num_dimensions();
+         vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_val =
+            (u_int *)computeTopology.get_global_offsets();
+         vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_len =
+            computeTopology.get_num_dimensions();
+         vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_val =
+            (u_int *)&globalSizes[0];
+         vmcl_dispatch_2_arg.localWorkSize.localWorkSize_len =
+            computeTopology.get_num_dimensions();
+         vmcl_dispatch_2_arg.localWorkSize.localWorkSize_val =
+            (u_int *)computeTopology.get_local_sizes();
+         vmcl_dispatch_2_arg.args.args_len = numArguments;
+         vmcl_dispatch_2_arg.args.args_val = &sh.kernelArgs[0];
+
+         clock_gettime(CLOCK_MONOTONIC, &sh.startTime);
+
+         res = submit(vmcl_dispatch_2_arg);
+      }
+
+      if (res == VMACCEL_SUCCESS) {
+         dispatched = true;
+      } else {
+         VMACCEL_WARNING("%s: Unable to dispatch shard %d\n", __FUNCTION__,
+                         s - 1);
+         shards.clear();
+      }
+
+      return res;
+   }
+
+   /**
+    * quiesce_shards
+    *
+    * Retrieves each slice, merges the partitioned arguments back into the
+    * bound surfaces and records the throughput of each sub-device.
+    */
+   unsigned int quiesce_shards() {
+      unsigned int numQueues = clctx->get_num_queues();
+      unsigned int i, s;
+
+      for (s = 0; s < shards.size(); s++) {
+         shard &sh = shards[s];
+         struct timespec endTime;
+         double elapsed;
+
+         for (i = 0; i < bindings.size(); i++) {
+            if (!quiesceComputeSurfaceArgs<ref_object<surface>>(
+                   clctx, sh.subDevice * numQueues, &sh.kernelArgs[0], i,
+                   sh.surfs[i])) {
+               VMACCEL_WARNING(
+                  "%s: Unable to quiesce compute argument %d for shard %d\n",
+                  __FUNCTION__, i, s);
+               shards.clear();
+               return VMACCEL_FAIL;
+            }
+         }
+
+         record_profile(sh.subDevice * numQueues);
+
+         clock_gettime(CLOCK_MONOTONIC, &endTime);
+         elapsed = (endTime.tv_sec - sh.startTime.tv_sec) +
+                   (endTime.tv_nsec - sh.startTime.tv_nsec) / 1000000000.0;
+         clctx->update_sub_device_throughput(sh.subDevice, sh.size, elapsed);
+
+         for (i = 0; i < bindings.size(); i++) {
+            ref_object<surface> &surf = bindings[i]->get_surf();
+            size_t stride = bindings[i]->get_shard_stride();
+
+            if (stride == 0 ||
+                bindings[i]->get_usage() == VMACCEL_SURFACE_USAGE_READONLY) {
+               continue;
+            }
+
+            memcpy(surf->get_backing().get() + sh.offset * stride,
+                   sh.surfs[i]->get_backing().get(), sh.size * stride);
+         }
+      }
+
+      /*
+       * The merged contents only exist in the client, force an upload on the
+       * next use of each written surface.
+       */
+      for (i = 0; i < bindings.size(); i++) {
+         ref_object<surface> &surf = bindings[i]->get_surf();
+
+         if (bindings[i]->get_shard_stride() != 0 &&
+             bindings[i]->get_usage() != VMACCEL_SURFACE_USAGE_READONLY) {
+            surf->set_consistency_range(
+               0, surf->get_accel()->get_max_ref_objects() - 1, false);
+            surf->get_generation()++;
+         }
+      }
+
+      shards.clear();
+      quiesced = true;
+
+      return VMACCEL_SUCCESS;
+   }
+
+   bool prepared;
+   bool dispatched;
+   bool quiesced;
+   bool sharded;
+   bool pinned;
+   unsigned int queueIndex;
+   unsigned int repeatCount;
+   std::vector<VMCLKernelArgSwap> swaps;
+
+   ref_object<clcontext> clctx;
+   unsigned int subDevice;
+   ref_object<clkernel> kernel;
+   VMCLKernelLanguageType kernelType;
+   std::string kernelFunc;
+   vmaccel::work_topology computeTopology;
+   VMCLKernelArgDesc *kernelArgs;
+   std::vector<shard> shards;
+   VMCLProfileStatus profiles[VMCL_PROFILE_MAX];
+   struct timespec hostStartTime;
+   struct timespec hostEndTime;
+
+   DECLARE_TIME_STAT(dispatch);
+   DECLARE_TIME_STAT(finish);
+   DECLARE_TIME_STAT(quiesce);
+   DECLARE_COUNTER_STAT(resource_unavailable_per_dispatch);
+};
+
+/**
+ * Compute context encapsulating class.
+ *
+ * This class is used to encapsulate the clcontext, to unify the management
+ * of adding a context object to the vmaccel::accelerator. A reference object
+ * must be added to vmaccel::accelerator for dereference active contexts
+ * during surface destruction.
+ */
+
+class context {
+
+public:
+   /**
+    * Default constructor.
+    */
+   context() {}
+
+   /**
+    * Constructor.
+    *
+    * @param a Accelerator class used to instantiate the compute operation.
+    * @param megaFlops The estimated mega-flops needed for the workload.
+    * @param selectionMask The selection mask for the accelerators requested.
+    * @param numSubDevices The number of sub-devices to explicitly submit work
+    *to.
+    * @param requiredCaps The required capabilites for this compute context.
+    */
+   context(std::shared_ptr<vmaccel::accelerator> &a, unsigned int megaFlops,
+           unsigned int selectionMask, unsigned int numSubDevices,
+           unsigned int numQueues, unsigned int requiredCaps) {
+      std::shared_ptr<vmaccel::clcontext> clctxPtr;
+      clctxPtr = std::shared_ptr<clcontext>(new clcontext(
+         a, megaFlops, selectionMask, numSubDevices, numQueues, requiredCaps));
+      /*
+       * Downcast the clcontext for tracking in the accelerator. Tracking in the
+       * accelerator class is required for a surface to destroy its remote
+       * object upon class destruction.
+       */
+      std::shared_ptr<vmaccel::context> ctxPtr =
+         std::static_pointer_cast<vmaccel::context, clcontext>(clctxPtr);
+      ref_object<vmaccel::context> cb(ctxPtr, sizeof(vmaccel::clcontext), 0, 0);
+      /*
+       * Track the context so vmaccel::surface::destroy can dereference and
+       * instantiate destruction of the server side surface.
+       */
+      a->add_context(clctxPtr->get_contextId(), cb);
+      clctx = ref_object<vmaccel::clcontext>(clctxPtr,
+                                             sizeof(vmaccel::clcontext), 0, 0);
+   }
+
+   /**
+    * Destructor.
+    */
+   ~context() {
+      /*
+       * Remove the tracked context.
+       */
+      clctx->get_accel()->remove_context(clctx->get_contextId());
+   }
+
+   /**
+    * Accessors.
+    */
+   vmaccel::clcontext *operator->() { return clctx.get().get(); }
+
+   operator ref_object<vmaccel::clcontext> &() { return clctx; }
+
+private:
+   ref_object<vmaccel::clcontext> clctx;
+};
+
+/**
+ * Compute session for repeated one-shot executions.
+ *
+ * A session keeps the context of an accelerator, the kernels built by the
+ * executions and the surfaces of their arguments across calls of
+ * compute::execute. Kernels are reused by source and function, and an
+ * argument surface is reused while the size and usage of the argument at
+ * its index are unchanged, only the contents of the argument are
+ * transferred. A session is used by one thread at a time.
+ */
+class session {
+
+public:
+   /**
+    * Constructor.
+    *
+    * @param a Accelerator of the executions.
+    * @param numSubDevices The number of sub-devices available to the
+    *                      executions.
+    */
+   session(std::shared_ptr<vmaccel::accelerator> &a,
+           unsigned int numSubDevices = 1) {
+      accel = a;
+      subDevices = MAX(numSubDevices, 1);
+   }
+
+   /**
+    * Destructor.
+    */
+   ~session() { clear(); }
+
+   /**
+    * open
+    *
+    * Instantiates the context of the session on first use.
+    *
+    * @return True if the session has a context.
+    */
+   bool open() {
+      if (ctx) {
+         return true;
+      }
+
+      try {
+         ctx = std::make_shared<compute::context>(
+            accel, 1, VMACCEL_CPU_MASK | VMACCEL_GPU_MASK, subDevices, 1, 0);
+      } catch (const exception &) {
+         VMACCEL_WARNING("%s: Unable to instantiate VMCL\n", __FUNCTION__);
+         ctx.reset();
+         return false;
+      }
+
+      return true;
+   }
+
+   /**
+    * clear
+    *
+    * Releases the argument surfaces, kernels and context of the session.
+    */
+   void clear() {
+      if (!ctx) {
+         return;
+      }
+
+      for (unsigned int i = 0; i < surfaces.size(); i++) {
+         destroy_surface(surfaces[i]);
+      }
+
+      surfaces.clear();
+      kernels.clear();
+      ctx.reset();
+   }
+
+   unsigned int get_num_sub_devices() { return subDevices; }
+
+   ref_object<clcontext> &get_context() { return *ctx; }
+
+   /**
+    * get_kernel
+    *
+    * @return Identifier of the kernel function for the sub-device, built
+    *         on first use.
+    */
+   VMAccelId get_kernel(compute::kernel &kernel,
+                        const VMCLKernelLanguageType kernelType,
+                        const std::string &kernelFunction,
+                        unsigned int subDevice) {
+      std::map<unsigned int, ref_object<char>> &sources = kernel;
+      auto src = sources.find(kernelType);
+      std::pair<unsigned int, uint64_t> key;
+
+      if (src == sources.end()) {
+         return VMACCEL_INVALID_ID;
+      }
+
+      key = std::make_pair((unsigned int)kernelType,
+                           VMAccel_Hash64(src->second.get_ptr(),
+                                          src->second.get_size(), 0));
+
+      auto it = kernels.find(key);
+
+      if (it == kernels.end()) {
+         it = kernels
+                 .insert(std::make_pair(
+                    key, std::make_shared<clkernel>(get_context(), sources)))
+                 .first;
+      }
+
+      return it->second->get_id(kernelType, kernelFunction, subDevice);
+   }
+
+   /**
+    * Recursively prepares the arguments of an execution in the surfaces of
+    * the session, see prepareComputeArgs.
+    */
+   template <typename T>
+   bool prepare_args(VMCLKernelArgDesc *kernelArgs, VMAccelId qid,
+                     unsigned int argIndex, T arg) {
+      return prepare_arg(kernelArgs[argIndex], qid, argIndex, arg.get_ptr(),
+                         arg.get_size(), arg.get_usage());
+   }
+
+   template <typename T, typename... R>
+   bool prepare_args(VMCLKernelArgDesc *kernelArgs, VMAccelId qid,
+                     unsigned int argIndex, T arg, R... args) {
+      if (!prepare_args(kernelArgs, qid, argIndex, arg)) {
+         return false;
+      }
+      return prepare_args(kernelArgs, qid, ++argIndex, args...);
+   }
+
+   /**
+    * Recursively reads back the arguments of an execution, the surfaces
+    * are kept by the session, see quiesceComputeArgs.
+    */
+   template <typename T>
+   bool quiesce_args(VMCLKernelArgDesc *kernelArgs, VMAccelId qid,
+                     unsigned int argIndex, T arg) {
+      return quiesce_arg(kernelArgs[argIndex], qid, arg.get_ptr(),
+                         arg.get_size(), arg.get_usage());
+   }
+
+   template <typename T, typename... R>
+   bool quiesce_args(VMCLKernelArgDesc *kernelArgs, VMAccelId qid,
+                     unsigned int argIndex, T arg, R... args) {
+      if (!quiesce_args(kernelArgs, qid, argIndex, arg)) {
+         return false;
+      }
+      return quiesce_args(kernelArgs, qid, ++argIndex, args...);
+   }
+
+private:
+   struct arg_surface {
+      VMAccelId id;
+      size_t size;
+      unsigned int usage;
+   };
+
+   bool prepare_arg(VMCLKernelArgDesc &desc, VMAccelId qid,
+                    unsigned int argIndex, void *ptr, size_t size,
+                    unsigned int usage) {
+      ref_object<clcontext> &clctx = get_context();
+      CLIENT *client = clctx->get_client();
+      VMAccelStatusCode status = VMACCEL_FAIL;
+
+      if (surfaces.size() <= argIndex) {
+         arg_surface unused;
+
+         unused.id = VMACCEL_INVALID_ID;
+         unused.size = 0;
+         unused.usage = 0;
+         surfaces.resize(argIndex + 1, unused);
+      }
+
+      arg_surface &surf = surfaces[argIndex];
+
+      if ((surf.id != VMACCEL_INVALID_ID) && (surf.size == size) &&
+          (surf.usage == usage)) {
+         VMCLImageUploadOp vmcl_imgupload_2_arg;
+         VMAccelReturnStatus *result_1;
+
+         /*
+          * The previous execution has completed, the contents of the
+          * surface are replaced in place.
+          */
+         memset(&vmcl_imgupload_2_arg, 0, sizeof(vmcl_imgupload_2_arg));
+         vmcl_imgupload_2_arg.queue.cid = clctx->get_contextId();
+         vmcl_imgupload_2_arg.queue.id = qid;
+         vmcl_imgupload_2_arg.img.cid = clctx->get_contextId();
+         vmcl_imgupload_2_arg.img.accel.id = surf.id;
+         vmcl_imgupload_2_arg.op.imgRegion.size.x = size;
+         vmcl_imgupload_2_arg.op.ptr.ptr_len = size;
+         vmcl_imgupload_2_arg.op.ptr.ptr_val = (char *)ptr;
+         vmcl_imgupload_2_arg.mode = VMACCEL_SURFACE_WRITE_ASYNCHRONOUS;
+
+         result_1 = vmcl_imageupload_2(&vmcl_imgupload_2_arg, client);
+
+         if (result_1 != NULL) {
+            status = result_1->VMAccelReturnStatus_u.ret->status;
+
+            if (client != NULL) {
+               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                                (caddr_t)result_1);
+            }
+         }
+      } else {
+         VMCLSurfaceAllocateInitOp vmcl_surfaceallocinit_2_arg;
+         VMAccelSurfaceAllocateReturnStatus *result_1;
+
+         destroy_surface(surf);
+
+         surf.id = clctx->get_accel()->alloc_id();
+         surf.size = size;
+         surf.usage = usage;
+
+         memset(&vmcl_surfaceallocinit_2_arg, 0,
+                sizeof(vmcl_surfaceallocinit_2_arg));
+         vmcl_surfaceallocinit_2_arg.queue.cid = clctx->get_contextId();
+         vmcl_surfaceallocinit_2_arg.queue.id = qid;
+         vmcl_surfaceallocinit_2_arg.alloc.client.cid = clctx->get_contextId();
+         vmcl_surfaceallocinit_2_arg.alloc.client.accel.id = surf.id;
+         vmcl_surfaceallocinit_2_arg.alloc.desc.type = VMACCEL_SURFACE_BUFFER;
+         vmcl_surfaceallocinit_2_arg.alloc.desc.width = size;
+         vmcl_surfaceallocinit_2_arg.alloc.desc.format =
+            VMACCEL_FORMAT_R8_TYPELESS;
+         vmcl_surfaceallocinit_2_arg.alloc.desc.usage =
+            (VMAccelSurfaceUsage)usage;
+         vmcl_surfaceallocinit_2_arg.alloc.desc.bindFlags =
+            VMACCEL_BIND_UNORDERED_ACCESS_FLAG;
+         vmcl_surfaceallocinit_2_arg.data.data_len = size;
+         vmcl_surfaceallocinit_2_arg.data.data_val = (char *)ptr;
+
+         result_1 =
+            vmcl_surfaceallocinit_2(&vmcl_surfaceallocinit_2_arg, client);
+
+         if (result_1 != NULL) {
+            if (result_1->VMAccelSurfaceAllocateReturnStatus_u.ret != NULL) {
+               status =
+                  result_1->VMAccelSurfaceAllocateReturnStatus_u.ret->status;
+            }
+
+            if (client != NULL) {
+               vmaccel_xdr_free(
+                  (xdrproc_t)xdr_VMAccelSurfaceAllocateReturnStatus,
+                  (caddr_t)result_1);
+            }
+         }
+
+         if (status != VMACCEL_SUCCESS) {
+            destroy_surface(surf);
+         }
+      }
+
+      if (status != VMACCEL_SUCCESS) {
+         VMACCEL_WARNING("%s: Unable to prepare argument %d for context %d\n",
+                         __FUNCTION__, argIndex, clctx->get_contextId());
+         return false;
+      }
+
+      desc.index = argIndex;
+      desc.type = VMCL_ARG_SURFACE;
+      desc.surf.id = surf.id;
+      desc.surf.generation = 0;
+
+      return true;
+   }
+
+   bool quiesce_arg(VMCLKernelArgDesc &desc, VMAccelId qid, void *ptr,
+                    size_t size, unsigned int usage) {
+      ref_object<clcontext> &clctx = get_context();
+      CLIENT *client = clctx->get_client();
+      VMCLImageDownloadOp vmcl_imgdownload_2_arg;
+      VMAccelDownloadReturnStatus *result_1;
+      bool ret = false;
+
+      if (usage == VMACCEL_SURFACE_USAGE_READONLY) {
+         return true;
+      }
+
+      /*
+       * Remote contents are returned in the reply, the request carries no
+       * payload.
+       */
+      memset(&vmcl_imgdownload_2_arg, 0, sizeof(vmcl_imgdownload_2_arg));
+      vmcl_imgdownload_2_arg.queue.cid = clctx->get_contextId();
+      vmcl_imgdownload_2_arg.queue.id = qid;
+      vmcl_imgdownload_2_arg.img.cid = clctx->get_contextId();
+      vmcl_imgdownload_2_arg.img.accel.id = desc.surf.id;
+      vmcl_imgdownload_2_arg.img.accel.generation = desc.surf.generation;
+      vmcl_imgdownload_2_arg.op.imgRegion.size.x = size;
+      if (client == NULL) {
+         vmcl_imgdownload_2_arg.op.ptr.ptr_len = size;
+         vmcl_imgdownload_2_arg.op.ptr.ptr_val = (char *)ptr;
+      }
+      vmcl_imgdownload_2_arg.mode = VMACCEL_SURFACE_READ_SYNCHRONOUS;
+
+      result_1 = vmcl_imagedownload_2(&vmcl_imgdownload_2_arg, client);
+
+      if (result_1 != NULL) {
+         VMAccelDownloadStatus *status =
+            result_1->VMAccelDownloadReturnStatus_u.ret;
+
+         if ((status->status == VMACCEL_SUCCESS) &&
+             (status->ptr.ptr_len >= size)) {
+            if (status->ptr.ptr_val != ptr) {
+               memcpy(ptr, status->ptr.ptr_val, size);
+            }
+            ret = true;
+         }
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelDownloadReturnStatus,
+                             (caddr_t)result_1);
+         }
+      }
+
+      return ret;
+   }
+
+   void destroy_surface(arg_surface &surf) {
+      ref_object<clcontext> &clctx = get_context();
+      VMCLSurfaceId vmcl_surfacedestroy_2_arg;
+      VMAccelReturnStatus *result_1;
+      CLIENT *client = clctx->get_client();
+
+      if (surf.id == VMACCEL_INVALID_ID) {
+         return;
+      }
+
+      memset(&vmcl_surfacedestroy_2_arg, 0, sizeof(vmcl_surfacedestroy_2_arg));
+      vmcl_surfacedestroy_2_arg.cid = clctx->get_contextId();
+      vmcl_surfacedestroy_2_arg.accel.id = surf.id;
+
+      result_1 = vmcl_surfacedestroy_2(&vmcl_surfacedestroy_2_arg, client);
+
+      if ((result_1 != NULL) && (client != NULL)) {
+         vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                          (caddr_t)result_1);
+      }
+
+      clctx->get_accel()->release_id(surf.id);
+      surf.id = VMACCEL_INVALID_ID;
+   }
+
+   std::shared_ptr<vmaccel::accelerator> accel;
+   unsigned int subDevices;
+   std::shared_ptr<compute::context> ctx;
+   std::map<std::pair<unsigned int, uint64_t>, std::shared_ptr<clkernel>>
+      kernels;
+   std::vector<arg_surface> surfaces;
+};
+
+/**
+ * Compute operation for compute kernels.
+ *
+ * Operation will allocate and instantiate a compute kernel on an available
+ * Compute Accelerator. The specified kernel function is instantiated
+ * per-thread, allowing for multi-dimensional partitioning of the working
+ * set. The number of concurrent threads is defined as follows:
+ *
+ *   n = numDimensions
+ *   # of threads = n * SUM(globalWorkSizes[0] ... globalWorkSizes[n]) *
+ *                  SUM(localWorkSizes[0] ... localWorkSizes[n])
+ *
+ * The working set comprises of Input and Output to the function, and
+ * is specified in the args parameter.
+ *
+ * @param accel Accelerator class used to instantiate the compute operation.
+ * @param kernelType Kernel type as defined in vmcl_defs.h, e.g.
+ *                   VMCL_SPIRV_1_0.
+ * @param kernel A vector of per-architecture kernels.
+ * @param kernelFunction Name of the function in the kernel to instantiate.
+ * @param computeTopology Topology for the Accelerator's threading model.
+ * @param args Packed list of arguments to pass to the kernel function, will be
+ *             evaluated in declared order for both input and output.
+ * @return VMAccelStatusCodeEnum value.
+ */
+
+template <class... ARGTYPES>
+int execute(std::shared_ptr<vmaccel::accelerator> &accel,
+            const unsigned int subDevice, compute::kernel &kernel,
+            const VMCLKernelLanguageType kernelType,
+            const std::string &kernelFunction,
+            const vmaccel::work_topology &computeTopology, ARGTYPES... args) {
+   compute::context ctx;
+   VMCLKernelAllocateReturnStatus *result_1;
+   VMCLKernelAllocateDesc vmcl_kernelalloc_2_arg;
+   VMAccelReturnStatus *result_2;
+   VMCLDispatchOp vmcl_dispatch_2_arg;
+   VMAccelReturnStatus *result_3;
+   VMCLQueueId vmcl_queueflush_2_arg;
+   VMAccelReturnStatus *result_4;
+   VMCLKernelId vmcl_kerneldestroy_2_arg;
+   VMCLKernelArgDesc *kernelArgs = NULL;
+   unsigned int numArguments = sizeof...(args);
+   unsigned int kernelId = 0;
+   unsigned int i;
+
+   /*
+    * Query an accelerator manager for the Compute Resource.
+    */
+   try {
+      ctx = compute::context(accel, 1, VMACCEL_CPU_MASK | VMACCEL_GPU_MASK,
+                             subDevice + 1, 1, 0);
+   } catch (const exception &) {
+      VMACCEL_WARNING("%s: Unable to instantiate VMCL\n", __FUNCTION__);
+      return VMACCEL_FAIL;
+   }
+
+   kernelArgs =
+      (VMCLKernelArgDesc *)malloc(sizeof(VMCLKernelArgDesc) * numArguments);
+
+   if (kernelArgs == NULL) {
+      VMACCEL_WARNING(
+         "%s: Unable to create a kernel arguments and surface ids\n",
+         __FUNCTION__);
+      return VMACCEL_FAIL;
+   }
+
+   /*
+    * Zero out the arguments to ensure variable sized members are not
+    * encoded by the RPC stack.
+    */
+   memset(&kernelArgs[0], 0, sizeof(VMCLKernelArgDesc) * numArguments);
+
+   if (prepareComputeArgs(ctx, kernelArgs, 0, args...)) {
+      clkernel clk(ctx, kernel);
+      clk.prepare(kernelType, kernelFunction);
+      CLIENT *client = ctx->get_client();
+
+      /*
+       * Execute the compute kernel
+       */
+      memset(&vmcl_dispatch_2_arg, 0, sizeof(vmcl_dispatch_2_arg));
+      vmcl_dispatch_2_arg.queue.cid = ctx->get_contextId();
+      vmcl_dispatch_2_arg.queue.id = subDevice;
+      vmcl_dispatch_2_arg.kernel.id = clk.get_id(kernelType, kernelFunction);
+      vmcl_dispatch_2_arg.dimension = 1;
+      vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_len =
+         computeTopology.get_num_dimensions();
+      vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_val =
+         (u_int *)computeTopology.get_global_offsets();
+      vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_len =
+         computeTopology.get_num_dimensions();
+      vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_val =
+         (u_int *)computeTopology.get_global_sizes();
+      vmcl_dispatch_2_arg.localWorkSize.localWorkSize_len =
+         computeTopology.get_num_dimensions();
+      vmcl_dispatch_2_arg.localWorkSize.localWorkSize_val =
+         (u_int *)computeTopology.get_local_sizes();
+      vmcl_dispatch_2_arg.args.args_len = numArguments;
+      vmcl_dispatch_2_arg.args.args_val = &kernelArgs[0];
+
+      result_2 = vmcl_dispatch_2(&vmcl_dispatch_2_arg, client);
+
+      if (result_2 != NULL) {
+         vmcl_queueflush_2_arg.cid = ctx->get_contextId();
+         vmcl_queueflush_2_arg.id = subDevice;
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                             (caddr_t)result_2);
+         }
+
+         result_3 = vmcl_queueflush_2(&vmcl_queueflush_2_arg, client);
+
+         if (result_3 != NULL) {
+            /*
+             * Quiesce the Compute Kernel arguments and retrieve the data.
+             */
+            quiesceComputeArgs(ctx, kernelArgs, 0, args...);
+            if (client != NULL) {
+               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                                (caddr_t)result_3);
+            }
+         }
+      }
+   }
+
+   free(kernelArgs);
+
+   return VMACCEL_SUCCESS;
+}
+
+/**
+ * Compute operation for compute kernels, executed in a session.
+ *
+ * Executes as compute::execute, reusing the context, the kernel and the
+ * argument surfaces of the session's previous executions.
+ *
+ * @param s Session of the execution.
+ * @param subDevice Sub-device of the session executing the kernel.
+ * @return VMAccelStatusCodeEnum value.
+ */
+
+template <class... ARGTYPES>
+int execute(compute::session &s, const unsigned int subDevice,
+            compute::kernel &kernel, const VMCLKernelLanguageType kernelType,
+            const std::string &kernelFunction,
+            const vmaccel::work_topology &computeTopology, ARGTYPES... args) {
+   std::vector<VMCLKernelArgDesc> kernelArgs(sizeof...(args));
+   VMCLDispatchOp vmcl_dispatch_2_arg;
+   VMAccelReturnStatus *result_1;
+   VMCLQueueId vmcl_queueflush_2_arg;
+   VMAccelReturnStatus *result_2;
+   VMAccelId kernelId;
+   int res = VMACCEL_FAIL;
+
+   if (subDevice >= s.get_num_sub_devices()) {
+      return VMACCEL_SEMANTIC_ERROR;
+   }
+
+   if (!s.open()) {
+      return VMACCEL_FAIL;
+   }
+
+   ref_object<clcontext> &ctx = s.get_context();
+   CLIENT *client = ctx->get_client();
+   VMAccelId qid = subDevice * ctx->get_num_queues();
+
+   kernelId = s.get_kernel(kernel, kernelType, kernelFunction, subDevice);
+
+   if (kernelId == VMACCEL_INVALID_ID) {
+      VMACCEL_WARNING("%s: Unable to prepare kernel %s\n", __FUNCTION__,
+                      kernelFunction.c_str());
+      return VMACCEL_FAIL;
+   }
+
+   /*
+    * Zero out the arguments to ensure variable sized members are not
+    * encoded by the RPC stack.
+    */
+   memset(&kernelArgs[0], 0, sizeof(VMCLKernelArgDesc) * kernelArgs.size());
+
+   if (!s.prepare_args(&kernelArgs[0], qid, 0, args...)) {
+      return VMACCEL_FAIL;
+   }
+
+   memset(&vmcl_dispatch_2_arg, 0, sizeof(vmcl_dispatch_2_arg));
+   vmcl_dispatch_2_arg.queue.cid = ctx->get_contextId();
+   vmcl_dispatch_2_arg.queue.id = qid;
+   vmcl_dispatch_2_arg.kernel.id = kernelId;
+   vmcl_dispatch_2_arg.dimension = 1;
+   vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_len =
+      computeTopology.get_num_dimensions();
+   vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_val =
+      (u_int *)computeTopology.get_global_offsets();
+   vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_len =
+      computeTopology.get_num_dimensions();
+   vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_val =
+      (u_int *)computeTopology.get_global_sizes();
+   vmcl_dispatch_2_arg.localWorkSize.localWorkSize_len =
+      computeTopology.get_num_dimensions();
+   vmcl_dispatch_2_arg.localWorkSize.localWorkSize_val =
+      (u_int *)computeTopology.get_local_sizes();
+   vmcl_dispatch_2_arg.args.args_len = kernelArgs.size();
+   vmcl_dispatch_2_arg.args.args_val = &kernelArgs[0];
+
+   result_1 = vmcl_dispatch_2(&vmcl_dispatch_2_arg, client);
+
+   if (result_1 == NULL) {
+      return VMACCEL_FAIL;
+   }
+
+   res = result_1->VMAccelReturnStatus_u.ret->status;
+
+   if (client != NULL) {
+      vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus, (caddr_t)result_1);
+   }
+
+   if (res != VMACCEL_SUCCESS) {
+      return res;
+   }
+
+   vmcl_queueflush_2_arg.cid = ctx->get_contextId();
+   vmcl_queueflush_2_arg.id = qid;
+
+   result_2 = vmcl_queueflush_2(&vmcl_queueflush_2_arg, client);
+
+   if ((result_2 != NULL) && (client != NULL)) {
+      vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus, (caddr_t)result_2);
+   }
+
+   /*
+    * Retrieve the data of the arguments, the surfaces stay resident.
+    */
+   if (!s.quiesce_args(&kernelArgs[0], qid, 0, args...)) {
+      return VMACCEL_FAIL;
+   }
+
+   return VMACCEL_SUCCESS;
+}
+
+/**
+ * Asynchronous compute operation for compute kernels.
+ *
+ * Create an Operation Object that will prepare a compute kernel for an
+ * available Compute Accelerator. The specified kernel function will be
+ * instantiated per-thread, allowing for multi-dimensional partitioning
+ * of the working set. The number of concurrent threads is defined as
+ * follows:
+ *
+ *   n = numDimensions
+ *   # of threads = n * SUM(globalWorkSizes[0] ... globalWorkSizes[n]) *
+ *                  SUM(localWorkSizes[0] ... localWorkSizes[n])
+ *
+ * The working set comprises of Input and Output to the function, and
+ * is specified in the args parameter.
+ *
+ * @param ctx Context class used to instantiate the compute operation.
+ * @param opobj Operation Object class used to store the operation
+ *              metadata.
+ * @param kernelType Kernel type as defined in vmcl_defs.h, e.g.
+ *                   VMCL_SPIRV_1_0.
+ * @param kernel A vector of per-architecture kernels.
+ * @param kernelFunction Name of the function in the kernel to instantiate.
+ * @param computeTopology Topology for the Accelerator's threading model.
+ * @param args Packed list of arguments to pass to the kernel function, will be
+ *             evaluated in declared order for both input and output.
+ * @return Initialized ref_object for the Operation Object.
+ */
+
+template <class... ARGTYPES>
+int dispatch(compute::context &ctx, const unsigned int subDevice,
+             ref_object<compute::operation> &opobj, compute::kernel &kernel,
+             const VMCLKernelLanguageType kernelType,
+             const std::string &kernelFunction,
+             const vmaccel::work_topology &computeTopology, ARGTYPES... args) {
+   std::shared_ptr<compute::operation> op(new compute::operation());
+   ref_object<clkernel> clk = kernel.alloc_clkernel(ctx);
+
+   op->prepare<ref_object<vmaccel::binding>>(ctx, subDevice, clk, kernelType,
+                                             kernelFunction, computeTopology,
+                                             args...);
+
+   if (opobj.get().get() != NULL) {
+#if DEBUG_COMPUTE_OPERATION
+      VMACCEL_LOG("%s: dispatching existing\n", __FUNCTION__);
+#endif
+      opobj->dispatch();
+#if DEBUG_COMPUTE_OPERATION
+      VMACCEL_LOG("%s: quiescing\n", __FUNCTION__);
+#endif
+      opobj->quiesce();
+   } else {
+#if DEBUG_COMPUTE_OPERATION
+      VMACCEL_LOG("%s: creating new operation\n", __FUNCTION__);
+#endif
+   }
+
+   opobj = ref_object<compute::operation>(op, sizeof(compute::operation), 0,
+                                          subDevice);
+
+   return VMACCEL_SUCCESS;
+}
+
+/**
+ * Sharded asynchronous compute operation for compute kernels.
+ *
+ * Create an Operation Object that splits dimension 0 of the compute topology
+ * across every sub-device of the context, weighted by the throughput each
+ * sub-device has demonstrated on previous sharded operations. Arguments
+ * bound with a shard stride are partitioned with the work range and merged
+ * back when the operation is quiesced, see compute::operation::set_sharding.
+ *
+ * @param ctx Context class used to instantiate the compute operation.
+ * @param opobj Operation Object class used to store the operation
+ *              metadata.
  * @param kernelType Kernel type as defined in vmcl_defs.h, e.g.
  *                   VMCL_SPIRV_1_0.
  * @param kernel A vector of per-architecture kernels.
@@ -1981,177 +4065,1009 @@ private:
  * @param computeTopology Topology for the Accelerator's threading model.
  * @param args Packed list of arguments to pass to the kernel function, will be
  *             evaluated in declared order for both input and output.
+ * @return Initialized ref_object for the Operation Object.
+ */
+
+template <class... ARGTYPES>
+int dispatch_sharded(compute::context &ctx,
+                     ref_object<compute::operation> &opobj,
+                     compute::kernel &kernel,
+                     const VMCLKernelLanguageType kernelType,
+                     const std::string &kernelFunction,
+                     const vmaccel::work_topology &computeTopology,
+                     ARGTYPES... args) {
+   std::shared_ptr<compute::operation> op(new compute::operation());
+   ref_object<clkernel> clk = kernel.alloc_clkernel(ctx);
+
+   op->prepare<ref_object<vmaccel::binding>>(ctx, 0, clk, kernelType,
+                                             kernelFunction, computeTopology,
+                                             args...);
+   op->set_sharding(true);
+
+   if (opobj.get().get() != NULL) {
+      opobj->dispatch();
+      opobj->quiesce();
+   }
+
+   opobj = ref_object<compute::operation>(op, sizeof(compute::operation), 0, 0);
+
+   return VMACCEL_SUCCESS;
+}
+
+/**
+ * Batched dispatch of compute operations.
+ *
+ * Submits the prepared operations of a context's sub-device as a single
+ * dispatch list, enqueued back to back by the accelerator in one request.
+ * The operations may use different kernels, topologies and bindings, and
+ * are quiesced individually. Sharded operations are dispatched on their
+ * own.
+ *
+ * Lists are not atomic. VMACCEL_RESOURCE_UNAVAILABLE means that nothing was
+ * enqueued, and the list is then retried. VMACCEL_FAIL means that the list
+ * stopped at a failing dispatch. The dispatches before it remain enqueued,
+ * but none of the operations is marked dispatched.
+ *
+ * @param ops Prepared operations, dispatched in order.
  * @return VMAccelStatusCodeEnum value.
  */
+template <class... R>
+int dispatch_list(std::vector<ref_object<compute::operation>> &ops) {
+   VMAccelReturnStatus *result_1;
+   VMCLDispatchListOp vmcl_dispatchlist_2_arg;
+   std::vector<ref_object<compute::operation>> batch;
+   std::vector<VMCLDispatchOp> dispatches;
+   struct timespec startTime;
+   unsigned int res = VMACCEL_SUCCESS;
+   unsigned int retryCount = 0;
+   unsigned int i;
+
+   for (i = 0; i < ops.size(); i++) {
+      if (!ops[i]->is_prepared() || ops[i]->is_dispatched()) {
+         return VMACCEL_FAIL;
+      }
+
+      if (ops[i]->is_sharded()) {
+         res = ops[i]->dispatch();
+      } else if (!batch.empty() &&
+                 ((ops[i]->get_context()->get_contextId() !=
+                   batch[0]->get_context()->get_contextId()) ||
+                  (ops[i]->get_sub_device() != batch[0]->get_sub_device()))) {
+         VMACCEL_WARNING("%s: Operation %d is not on the queue of the list\n",
+                         __FUNCTION__, i);
+         res = VMACCEL_SEMANTIC_ERROR;
+      } else {
+         batch.push_back(ops[i]);
+      }
+
+      if (res != VMACCEL_SUCCESS) {
+         return res;
+      }
+   }
+
+   if (batch.empty()) {
+      return VMACCEL_SUCCESS;
+   }
+
+   ref_object<clcontext> &clctx = batch[0]->get_context();
+   CLIENT *client = clctx->get_client();
+
+   clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+   dispatches.assign(batch.size(), VMCLDispatchOp());
+
+   for (i = 0; i < batch.size(); i++) {
+      res = batch[i]->encode(dispatches[i]);
+
+      if (res != VMACCEL_SUCCESS) {
+         return res;
+      }
+   }
+
+   memset(&vmcl_dispatchlist_2_arg, 0, sizeof(vmcl_dispatchlist_2_arg));
+   vmcl_dispatchlist_2_arg.queue = dispatches[0].queue;
+   vmcl_dispatchlist_2_arg.dispatches.dispatches_len = dispatches.size();
+   vmcl_dispatchlist_2_arg.dispatches.dispatches_val = &dispatches[0];
+
+   /*
+    * A list waiting on a surface update is rejected before any dispatch is
+    * enqueued, and retried as a whole.
+    */
+   res = VMACCEL_RESOURCE_UNAVAILABLE;
+
+   while (retryCount < RETRY_MAX_COUNT && res == VMACCEL_RESOURCE_UNAVAILABLE) {
+      result_1 = vmcl_dispatchlist_2(&vmcl_dispatchlist_2_arg, client);
+
+      if (result_1 != NULL) {
+         res = result_1->VMAccelReturnStatus_u.ret->status;
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                             (caddr_t)result_1);
+         }
+
+         clctx->flush_queue(vmcl_dispatchlist_2_arg.queue.id);
+
+         if (res == VMACCEL_RESOURCE_UNAVAILABLE) {
+            std::this_thread::yield();
+            usleep(retryCount * 1000);
+         }
+      } else {
+         res = VMACCEL_FAIL;
+      }
+
+      retryCount++;
+   }
+
+   if (res == VMACCEL_SUCCESS) {
+      for (i = 0; i < batch.size(); i++) {
+         batch[i]->set_dispatched(startTime);
+      }
+   }
+
+   return res;
+}
+
+/**
+ * Command list of compute operations.
+ *
+ * Records the dispatches of prepared operations into a list held by the
+ * accelerator, which is then replayed with a single request. A replay
+ * uploads the surfaces modified by the client since their last use, and
+ * sends only the arguments changed since the list was recorded, e.g. a
+ * surface at a new generation or a new immediate value. The operations are
+ * quiesced individually after each replay, and must remain prepared with
+ * the same kernels, topologies and bindings while recorded.
+ */
+class command_list {
+
+public:
+   /**
+    * Default constructor.
+    */
+   command_list() { id = VMACCEL_INVALID_ID; }
+
+   /**
+    * Destructor.
+    */
+   ~command_list() { destroy(); }
+
+   /**
+    * record
+    *
+    * Records the dispatches of the prepared operations of a context's
+    * sub-device, replacing the contents of the list. The operations are
+    * not executed until the list is replayed.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int record(std::vector<ref_object<compute::operation>> &operations) {
+      VMAccelReturnStatus *result_1;
+      VMCLCmdListRecordOp vmcl_cmdlistrecord_2_arg;
+      std::vector<VMCLDispatchOp> dispatches;
+      CLIENT *client;
+      unsigned int res = VMACCEL_SUCCESS;
+      unsigned int i;
+
+      if (operations.empty()) {
+         return VMACCEL_FAIL;
+      }
+
+      for (i = 0; i < operations.size(); i++) {
+         if (!operations[i]->is_prepared() || operations[i]->is_sharded() ||
+             (operations[i]->get_context()->get_contextId() !=
+              operations[0]->get_context()->get_contextId()) ||
+             (operations[i]->get_sub_device() !=
+              operations[0]->get_sub_device())) {
+            VMACCEL_WARNING("%s: Operation %d can't be recorded in the list\n",
+                            __FUNCTION__, i);
+            return VMACCEL_SEMANTIC_ERROR;
+         }
+      }
+
+      destroy();
+
+      clctx = operations[0]->get_context();
+      client = clctx->get_client();
+      dispatches.assign(operations.size(), VMCLDispatchOp());
+
+      for (i = 0; i < operations.size(); i++) {
+         res = operations[i]->encode(dispatches[i]);
+
+         if (res != VMACCEL_SUCCESS) {
+            return res;
+         }
+      }
+
+      id = clctx->get_accel()->alloc_id();
+
+      memset(&vmcl_cmdlistrecord_2_arg, 0, sizeof(vmcl_cmdlistrecord_2_arg));
+      vmcl_cmdlistrecord_2_arg.list.cid = clctx->get_contextId();
+      vmcl_cmdlistrecord_2_arg.list.id = id;
+      vmcl_cmdlistrecord_2_arg.dispatches.queue = dispatches[0].queue;
+      vmcl_cmdlistrecord_2_arg.dispatches.dispatches.dispatches_len =
+         dispatches.size();
+      vmcl_cmdlistrecord_2_arg.dispatches.dispatches.dispatches_val =
+         &dispatches[0];
+
+      result_1 = vmcl_cmdlistrecord_2(&vmcl_cmdlistrecord_2_arg, client);
+
+      if (result_1 != NULL) {
+         res = result_1->VMAccelReturnStatus_u.ret->status;
+
+         if (client != NULL) {
+            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                             (caddr_t)result_1);
+         }
+      } else {
+         res = VMACCEL_FAIL;
+      }
+
+      if (res != VMACCEL_SUCCESS) {
+         VMACCEL_WARNING("%s: Unable to record command list %d\n",
+                         __FUNCTION__, id);
+         clctx->get_accel()->release_id(id);
+         id = VMACCEL_INVALID_ID;
+         return res;
+      }
+
+      ops = operations;
+      recordedArgs.assign(dispatches.size(), std::vector<recorded_arg>());
+
+      for (i = 0; i < dispatches.size(); i++) {
+         for (unsigned int j = 0; j < dispatches[i].args.args_len; j++) {
+            recordedArgs[i].push_back(
+               recorded_arg(dispatches[i].args.args_val[j]));
+         }
+      }
+
+      return VMACCEL_SUCCESS;
+   }
+
+   /**
+    * replay
+    *
+    * Replays the recorded list, quiescing the operations of the previous
+    * replay first. Arguments are diffed against the recorded list, the
+    * server applies the updates to the replay only and keeps the recorded
+    * list as is.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int replay() {
+      VMAccelReturnStatus *result_1;
+      VMCLCmdListReplayOp vmcl_cmdlistreplay_2_arg;
+      std::vector<VMCLDispatchOp> dispatches;
+      std::vector<VMCLKernelArgUpdate> updates;
+      struct timespec startTime;
+      CLIENT *client;
+      unsigned int res = VMACCEL_SUCCESS;
+      unsigned int retryCount = 0;
+      unsigned int i, j;
+
+      if (id == VMACCEL_INVALID_ID) {
+         return VMACCEL_FAIL;
+      }
+
+      client = clctx->get_client();
+      dispatches.assign(ops.size(), VMCLDispatchOp());
+
+      clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+      for (i = 0; i < ops.size(); i++) {
+         if (ops[i]->is_dispatched()) {
+            ops[i]->quiesce();
+         }
+
+         res = ops[i]->encode(dispatches[i]);
+
+         if (res != VMACCEL_SUCCESS) {
+            return res;
+         }
+
+         if (dispatches[i].args.args_len != recordedArgs[i].size()) {
+            return VMACCEL_SEMANTIC_ERROR;
+         }
+
+         for (j = 0; j < dispatches[i].args.args_len; j++) {
+            VMCLKernelArgDesc &arg = dispatches[i].args.args_val[j];
+
+            if (!recordedArgs[i][j].matches(arg)) {
+               VMCLKernelArgUpdate update;
+
+               update.dispatch = i;
+               update.arg = arg;
+               updates.push_back(update);
+            }
+         }
+      }
+
+      memset(&vmcl_cmdlistreplay_2_arg, 0, sizeof(vmcl_cmdlistreplay_2_arg));
+      vmcl_cmdlistreplay_2_arg.list.cid = clctx->get_contextId();
+      vmcl_cmdlistreplay_2_arg.list.id = id;
+      vmcl_cmdlistreplay_2_arg.updates.updates_len = updates.size();
+      vmcl_cmdlistreplay_2_arg.updates.updates_val =
+         updates.empty() ? NULL : &updates[0];
+
+      /*
+       * The updates are applied by each attempt, a replay waiting on a
+       * surface update is retried as a whole.
+       */
+      res = VMACCEL_RESOURCE_UNAVAILABLE;
+
+      while (retryCount < RETRY_MAX_COUNT &&
+             res == VMACCEL_RESOURCE_UNAVAILABLE) {
+         result_1 = vmcl_cmdlistreplay_2(&vmcl_cmdlistreplay_2_arg, client);
+
+         if (result_1 != NULL) {
+            res = result_1->VMAccelReturnStatus_u.ret->status;
+
+            if (client != NULL) {
+               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                                (caddr_t)result_1);
+            }
+
+            clctx->flush_queue(dispatches[0].queue.id);
+
+            if (res == VMACCEL_RESOURCE_UNAVAILABLE) {
+               std::this_thread::yield();
+               usleep(retryCount * 1000);
+            }
+         } else {
+            res = VMACCEL_FAIL;
+         }
+
+         retryCount++;
+      }
+
+      if (res == VMACCEL_SUCCESS) {
+         for (i = 0; i < ops.size(); i++) {
+            ops[i]->set_dispatched(startTime);
+         }
+      }
+
+      return res;
+   }
+
+   /**
+    * destroy
+    *
+    * Releases the list held by the accelerator.
+    */
+   void destroy() {
+      VMAccelReturnStatus *result_1;
+      VMCLCmdListId vmcl_cmdlistdestroy_2_arg;
+
+      if (id == VMACCEL_INVALID_ID) {
+         return;
+      }
+
+      memset(&vmcl_cmdlistdestroy_2_arg, 0, sizeof(vmcl_cmdlistdestroy_2_arg));
+      vmcl_cmdlistdestroy_2_arg.cid = clctx->get_contextId();
+      vmcl_cmdlistdestroy_2_arg.id = id;
+
+      result_1 =
+         vmcl_cmdlistdestroy_2(&vmcl_cmdlistdestroy_2_arg, clctx->get_client());
+
+      if (result_1 == NULL) {
+         VMACCEL_WARNING("%s: Unable to destroy command list id = %u\n",
+                         __FUNCTION__, id);
+      } else if (clctx->get_client() != NULL) {
+         vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
+                          (caddr_t)result_1);
+      }
+
+      clctx->get_accel()->release_id(id);
+      id = VMACCEL_INVALID_ID;
+
+      ops.clear();
+      recordedArgs.clear();
+   }
+
+private:
+   /*
+    * Recorded state of a kernel argument, compared with the argument
+    * encoded for a replay.
+    */
+   struct recorded_arg {
+      recorded_arg(const VMCLKernelArgDesc &arg) {
+         desc = arg;
+         desc.data.data_len = 0;
+         desc.data.data_val = NULL;
+         data.assign(arg.data.data_val, arg.data.data_val + arg.data.data_len);
+      }
+
+      bool matches(const VMCLKernelArgDesc &arg) const {
+         return (desc.type == arg.type) && (desc.surf.id == arg.surf.id) &&
+                (desc.surf.generation == arg.surf.generation) &&
+                (desc.sampler.id == arg.sampler.id) &&
+                (desc.localSize == arg.localSize) &&
+                (data.size() == arg.data.data_len) &&
+                std::equal(data.begin(), data.end(), arg.data.data_val);
+      }
+
+      VMCLKernelArgDesc desc;
+      std::vector<char> data;
+   };
+
+   ref_object<clcontext> clctx;
+   VMAccelId id;
+   std::vector<ref_object<compute::operation>> ops;
+   std::vector<std::vector<recorded_arg>> recordedArgs;
+};
+
+/**
+ * Task graph of compute operations and surface transfers.
+ *
+ * Nodes declare the surfaces they read and write, dispatches use the
+ * bindings of their operation. Dependencies are inferred in the order the
+ * nodes are added: a node follows the last writer of each surface it
+ * accesses, and a writer also follows the readers since that writer.
+ *
+ * The nodes are submitted in waves of independent nodes. Dispatches of a
+ * wave are spread over the queues of their sub-device, and transfers are
+ * kept off the first queue when the context has more than one, so the
+ * transfers of a wave overlap with its compute. The Accelerator orders
+ * the commands referencing a surface across queues. The operations are
+ * quiesced once the graph has been submitted.
+ */
+class task_graph {
+
+public:
+   /**
+    * Constructor.
+    *
+    * @param c Context of the transfers and operations.
+    * @param subDev Sub-device of the queues used for transfers.
+    */
+   task_graph(ref_object<clcontext> &c, unsigned int subDev = 0) {
+      clctx = c;
+      subDevice = subDev;
+   }
+
+   /**
+    * add_upload
+    *
+    * Adds an update of a surface from its backing, see
+    * clcontext::upload_surface.
+    *
+    * @return Index of the node.
+    */
+   unsigned int add_upload(ref_object<surface> surf, bool force = false) {
+      node n(NODE_UPLOAD);
+
+      n.surfs.push_back(surf);
+      n.writes.push_back(surf->get_id());
+      n.force = force;
+
+      return add_node(n);
+   }
+
+   /**
+    * add_download
+    *
+    * Adds a read back of a surface into its backing.
+    *
+    * @return Index of the node.
+    */
+   unsigned int add_download(ref_object<surface> surf) {
+      node n(NODE_DOWNLOAD);
+
+      n.surfs.push_back(surf);
+      n.reads.push_back(surf->get_id());
+
+      return add_node(n);
+   }
+
+   /**
+    * add_copy
+    *
+    * Adds a copy between resident surfaces, see clcontext::copy_surface.
+    *
+    * @return Index of the node.
+    */
+   unsigned int add_copy(ref_object<surface> srcSurf,
+                         const VMAccelSurfaceRegion &srcRegion,
+                         ref_object<surface> dstSurf,
+                         const VMAccelSurfaceRegion &dstRegion) {
+      node n(NODE_COPY);
+
+      n.surfs.push_back(srcSurf);
+      n.surfs.push_back(dstSurf);
+      n.regions.push_back(srcRegion);
+      n.regions.push_back(dstRegion);
+      n.reads.push_back(srcSurf->get_id());
+      n.writes.push_back(dstSurf->get_id());
+
+      return add_node(n);
+   }
+
+   /**
+    * add_dispatch
+    *
+    * Adds the dispatch of a prepared operation of the graph's context.
+    * Surfaces accessed by the kernel other than through its bindings may
+    * be declared with reads and writes.
+    *
+    * @return Index of the node.
+    */
+   unsigned int add_dispatch(ref_object<compute::operation> op,
+                             const std::vector<ref_object<surface>> &reads =
+                                std::vector<ref_object<surface>>(),
+                             const std::vector<ref_object<surface>> &writes =
+                                std::vector<ref_object<surface>>()) {
+      std::vector<ref_object<surface>> opReads(reads);
+      std::vector<ref_object<surface>> opWrites(writes);
+      node n(NODE_DISPATCH);
+      unsigned int i;
+
+      op->get_surface_access(opReads, opWrites);
+
+      for (i = 0; i < opReads.size(); i++) {
+         n.reads.push_back(opReads[i]->get_id());
+      }
+
+      for (i = 0; i < opWrites.size(); i++) {
+         n.writes.push_back(opWrites[i]->get_id());
+      }
+
+      n.op = op;
+
+      return add_node(n);
+   }
+
+   /**
+    * add_dependency
+    *
+    * Orders a node after a node added before it, in addition to the
+    * dependencies inferred from the surfaces.
+    */
+   bool add_dependency(unsigned int before, unsigned int after) {
+      if ((before >= after) || (after >= nodes.size())) {
+         return false;
+      }
+
+      add_edge(before, after);
+
+      return true;
+   }
+
+   /**
+    * execute
+    *
+    * Submits the nodes of the graph, and quiesces the operations.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int execute() {
+      unsigned int numQueues = clctx->get_num_queues();
+      unsigned int baseQueue = subDevice * numQueues;
+      std::vector<unsigned int> order(nodes.size());
+      std::vector<unsigned int> waveDispatches;
+      unsigned int nextTransfer = 0;
+      int res = VMACCEL_SUCCESS;
+      unsigned int i;
+
+      for (i = 0; i < nodes.size(); i++) {
+         if ((nodes[i].type == NODE_DISPATCH) &&
+             (!nodes[i].op->is_prepared() ||
+              (nodes[i].op->get_context()->get_contextId() !=
+               clctx->get_contextId()))) {
+            VMACCEL_WARNING("%s: Operation of node %d not prepared for the "
+                            "graph's context\n",
+                            __FUNCTION__, i);
+            return VMACCEL_SEMANTIC_ERROR;
+         }
+
+         order[i] = i;
+      }
+
+      /*
+       * Submit wave by wave, the synchronous read backs of a wave are
+       * submitted after the remainder of the wave.
+       */
+      std::stable_sort(order.begin(), order.end(),
+                       [this](unsigned int a, unsigned int b) {
+                          if (nodes[a].wave != nodes[b].wave) {
+                             return nodes[a].wave < nodes[b].wave;
+                          }
+                          return (nodes[a].type != NODE_DOWNLOAD) &&
+                                 (nodes[b].type == NODE_DOWNLOAD);
+                       });
+
+      for (i = 0; (i < order.size()) && (res == VMACCEL_SUCCESS); i++) {
+         node &n = nodes[order[i]];
+         VMAccelId qid = baseQueue;
+
+         if (waveDispatches.size() <= n.wave) {
+            waveDispatches.resize(n.wave + 1, 0);
+         }
+
+         if ((n.type != NODE_DISPATCH) && (numQueues > 1)) {
+            qid = baseQueue + 1 + (nextTransfer++ % (numQueues - 1));
+         }
+
+         switch (n.type) {
+            case NODE_UPLOAD:
+               if (!clctx->alloc_surface(n.surfs[0]) ||
+                   !clctx->upload_surface(n.surfs[0], n.force, false, true,
+                                          qid)) {
+                  res = VMACCEL_FAIL;
+               }
+               queues.insert(qid);
+               break;
+            case NODE_DOWNLOAD:
+               /*
+                * The read back waits for commands of every queue.
+                */
+               flush_queues();
+               if (!clctx->download_surface(n.surfs[0], true,
+                                            ENABLE_IMAGE_DOWNLOAD, qid)) {
+                  res = VMACCEL_FAIL;
+               }
+               break;
+            case NODE_COPY:
+               if (!clctx->alloc_surface(n.surfs[0]) ||
+                   !clctx->alloc_surface(n.surfs[1])) {
+                  res = VMACCEL_FAIL;
+                  break;
+               }
+               clctx->copy_surface(qid, n.surfs[0], n.regions[0], n.surfs[1],
+                                   n.regions[1]);
+               break;
+            case NODE_DISPATCH:
+               n.op->set_queue(waveDispatches[n.wave]++);
+               res = n.op->dispatch(true);
+               queues.insert(n.op->get_queue_id());
+               break;
+         }
 
-template <class... ARGTYPES>
-int execute(std::shared_ptr<vmaccel::accelerator> &accel,
-            const unsigned int subDevice, compute::kernel &kernel,
-            const VMCLKernelLanguageType kernelType,
-            const std::string &kernelFunction,
-            const vmaccel::work_topology &computeTopology, ARGTYPES... args) {
-   compute::context ctx;
-   VMCLKernelAllocateReturnStatus *result_1;
-   VMCLKernelAllocateDesc vmcl_kernelalloc_2_arg;
-   VMAccelReturnStatus *result_2;
-   VMCLDispatchOp vmcl_dispatch_2_arg;
-   VMAccelReturnStatus *result_3;
-   VMCLQueueId vmcl_queueflush_2_arg;
-   VMAccelReturnStatus *result_4;
-   VMCLKernelId vmcl_kerneldestroy_2_arg;
-   VMCLKernelArgDesc *kernelArgs = NULL;
-   unsigned int numArguments = sizeof...(args);
-   unsigned int kernelId = 0;
-   unsigned int i;
+         if (res != VMACCEL_SUCCESS) {
+            VMACCEL_WARNING("%s: Unable to submit node %d\n", __FUNCTION__,
+                            order[i]);
+         }
+      }
 
-   /*
-    * Query an accelerator manager for the Compute Resource.
+      flush_queues();
+
+      for (i = 0; i < order.size(); i++) {
+         node &n = nodes[order[i]];
+
+         if ((n.type == NODE_DISPATCH) && n.op->is_dispatched() &&
+             (n.op->quiesce() != VMACCEL_SUCCESS)) {
+            res = VMACCEL_FAIL;
+         }
+      }
+
+      return res;
+   }
+
+   /**
+    * clear
+    *
+    * Removes every node of the graph.
     */
-   try {
-      ctx = compute::context(accel, 1, VMACCEL_CPU_MASK | VMACCEL_GPU_MASK,
-                             subDevice + 1, 1, 0);
-   } catch (const exception &) {
-      VMACCEL_WARNING("%s: Unable to instantiate VMCL\n", __FUNCTION__);
-      return VMACCEL_FAIL;
+   void clear() {
+      nodes.clear();
+      lastWriter.clear();
+      readers.clear();
    }
 
-   kernelArgs =
-      (VMCLKernelArgDesc *)malloc(sizeof(VMCLKernelArgDesc) * numArguments);
+private:
+   enum node_type {
+      NODE_UPLOAD,
+      NODE_DOWNLOAD,
+      NODE_COPY,
+      NODE_DISPATCH,
+   };
+
+   struct node {
+      node(node_type t) {
+         type = t;
+         wave = 0;
+         force = false;
+      }
 
-   if (kernelArgs == NULL) {
-      VMACCEL_WARNING(
-         "%s: Unable to create a kernel arguments and surface ids\n",
-         __FUNCTION__);
-      return VMACCEL_FAIL;
-   }
+      node_type type;
+      unsigned int wave;
+      bool force;
+      std::vector<VMAccelId> reads;
+      std::vector<VMAccelId> writes;
+      std::vector<ref_object<surface>> surfs;
+      std::vector<VMAccelSurfaceRegion> regions;
+      ref_object<compute::operation> op;
+   };
 
    /*
-    * Zero out the arguments to ensure variable sized members are not
-    * encoded by the RPC stack.
+    * Nodes are only ordered after nodes added before them, the wave of a
+    * node is the length of the longest path of dependencies to it.
     */
-   memset(&kernelArgs[0], 0, sizeof(VMCLKernelArgDesc) * numArguments);
-
-   if (prepareComputeArgs(ctx, kernelArgs, 0, args...)) {
-      clkernel clk(ctx, kernel);
-      clk.prepare(kernelType, kernelFunction);
-      CLIENT *client = ctx->get_client();
+   void add_edge(unsigned int before, unsigned int after) {
+      nodes[after].wave = MAX(nodes[after].wave, nodes[before].wave + 1);
+   }
 
-      /*
-       * Execute the compute kernel
-       */
-      memset(&vmcl_dispatch_2_arg, 0, sizeof(vmcl_dispatch_2_arg));
-      vmcl_dispatch_2_arg.queue.cid = ctx->get_contextId();
-      vmcl_dispatch_2_arg.queue.id = subDevice;
-      vmcl_dispatch_2_arg.kernel.id = clk.get_id(kernelType, kernelFunction);
-      vmcl_dispatch_2_arg.dimension = 1;
-      vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_len =
-         computeTopology.get_num_dimensions();
-      vmcl_dispatch_2_arg.globalWorkOffset.globalWorkOffset_val =
-         (u_int *)computeTopology.get_global_offsets();
-      vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_len =
-         computeTopology.get_num_dimensions();
-      vmcl_dispatch_2_arg.globalWorkSize.globalWorkSize_val =
-         (u_int *)computeTopology.get_global_sizes();
-      vmcl_dispatch_2_arg.localWorkSize.localWorkSize_len =
-         computeTopology.get_num_dimensions();
-      vmcl_dispatch_2_arg.localWorkSize.localWorkSize_val =
-         (u_int *)computeTopology.get_local_sizes();
-      vmcl_dispatch_2_arg.args.args_len = numArguments;
-      vmcl_dispatch_2_arg.args.args_val = &kernelArgs[0];
+   unsigned int add_node(const node &n) {
+      unsigned int index = nodes.size();
+      unsigned int i;
 
-      result_2 = vmcl_dispatch_2(&vmcl_dispatch_2_arg, client);
+      nodes.push_back(n);
 
-      if (result_2 != NULL) {
-         vmcl_queueflush_2_arg.cid = ctx->get_contextId();
-         vmcl_queueflush_2_arg.id = subDevice;
+      for (i = 0; i < n.reads.size(); i++) {
+         auto w = lastWriter.find(n.reads[i]);
 
-         if (client != NULL) {
-            vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
-                             (caddr_t)result_2);
+         if (w != lastWriter.end()) {
+            add_edge(w->second, index);
          }
+      }
 
-         result_3 = vmcl_queueflush_2(&vmcl_queueflush_2_arg, client);
+      for (i = 0; i < n.writes.size(); i++) {
+         auto w = lastWriter.find(n.writes[i]);
+         std::vector<unsigned int> &r = readers[n.writes[i]];
 
-         if (result_3 != NULL) {
-            /*
-             * Quiesce the Compute Kernel arguments and retrieve the data.
-             */
-            quiesceComputeArgs(ctx, kernelArgs, 0, args...);
-            if (client != NULL) {
-               vmaccel_xdr_free((xdrproc_t)xdr_VMAccelReturnStatus,
-                                (caddr_t)result_3);
+         if (w != lastWriter.end()) {
+            add_edge(w->second, index);
+         }
+
+         for (unsigned int j = 0; j < r.size(); j++) {
+            if (r[j] != index) {
+               add_edge(r[j], index);
             }
          }
+
+         r.clear();
+         lastWriter[n.writes[i]] = index;
+      }
+
+      for (i = 0; i < n.reads.size(); i++) {
+         if (std::find(n.writes.begin(), n.writes.end(), n.reads[i]) ==
+             n.writes.end()) {
+            readers[n.reads[i]].push_back(index);
+         }
       }
+
+      return index;
    }
 
-   free(kernelArgs);
+   void flush_queues() {
+      for (auto it = queues.begin(); it != queues.end(); it++) {
+         clctx->flush_queue(*it);
+      }
 
-   return VMACCEL_SUCCESS;
-}
+      queues.clear();
+   }
+
+   ref_object<clcontext> clctx;
+   unsigned int subDevice;
+   std::vector<node> nodes;
+   std::map<VMAccelId, unsigned int> lastWriter;
+   std::map<VMAccelId, std::vector<unsigned int>> readers;
+   std::set<VMAccelId> queues;
+};
 
 /**
- * Asynchronous compute operation for compute kernels.
- *
- * Create an Operation Object that will prepare a compute kernel for an
- * available Compute Accelerator. The specified kernel function will be
- * instantiated per-thread, allowing for multi-dimensional partitioning
- * of the working set. The number of concurrent threads is defined as
- * follows:
- *
- *   n = numDimensions
- *   # of threads = n * SUM(globalWorkSizes[0] ... globalWorkSizes[n]) *
- *                  SUM(localWorkSizes[0] ... localWorkSizes[n])
+ * Pipeline of an iterative workload over rotating slots.
  *
- * The working set comprises of Input and Output to the function, and
- * is specified in the args parameter.
+ * A slot holds a prepared operation with the surfaces uploaded before and
+ * read back after its dispatch. Iteration i uses slot i modulo the number
+ * of slots, so that the upload of iteration N+1, the dispatch of iteration
+ * N and the read back of iteration N-1 are in flight together. Uploads,
+ * dispatches and read backs are issued on separate queues of the
+ * sub-device when the context has them, and the Accelerator orders the
+ * commands referencing a surface across queues. In steady state an
+ * iteration costs the longest of its transfers and its compute, instead of
+ * their sum.
  *
- * @param ctx Context class used to instantiate the compute operation.
- * @param opobj Operation Object class used to store the operation
- *              metadata.
- * @param kernelType Kernel type as defined in vmcl_defs.h, e.g.
- *                   VMCL_SPIRV_1_0.
- * @param kernel A vector of per-architecture kernels.
- * @param kernelFunction Name of the function in the kernel to instantiate.
- * @param computeTopology Topology for the Accelerator's threading model.
- * @param args Packed list of arguments to pass to the kernel function, will be
- *             evaluated in declared order for both input and output.
- * @return Initialized ref_object for the Operation Object.
+ * The operations and surfaces of the slots must be distinct. The inputs
+ * are replaced entirely by each iteration, and are uploaded discarding
+ * their previous contents.
  */
+class pipeline {
 
-template <class... ARGTYPES>
-int dispatch(compute::context &ctx, const unsigned int subDevice,
-             ref_object<compute::operation> &opobj, compute::kernel &kernel,
-             const VMCLKernelLanguageType kernelType,
-             const std::string &kernelFunction,
-             const vmaccel::work_topology &computeTopology, ARGTYPES... args) {
-   std::shared_ptr<compute::operation> op(new compute::operation());
-   ref_object<clkernel> clk = kernel.alloc_clkernel(ctx);
+public:
+   /**
+    * Callback of an iteration, with the index of the iteration and the
+    * index of its slot.
+    */
+   typedef std::function<void(unsigned int, unsigned int)> callback;
 
-   op->prepare<ref_object<vmaccel::binding>>(ctx, subDevice, clk, kernelType,
-                                             kernelFunction, computeTopology,
-                                             args...);
+   /**
+    * Constructor.
+    *
+    * @param c Context of the transfers and operations.
+    * @param subDev Sub-device of the queues used for transfers.
+    */
+   pipeline(ref_object<clcontext> &c, unsigned int subDev = 0) {
+      clctx = c;
+      subDevice = subDev;
+   }
 
-   if (opobj.get().get() != NULL) {
-#if DEBUG_COMPUTE_OPERATION
-      VMACCEL_LOG("%s: dispatching existing\n", __FUNCTION__);
-#endif
-      opobj->dispatch();
-#if DEBUG_COMPUTE_OPERATION
-      VMACCEL_LOG("%s: quiescing\n", __FUNCTION__);
-#endif
-      opobj->quiesce();
-   } else {
-#if DEBUG_COMPUTE_OPERATION
-      VMACCEL_LOG("%s: creating new operation\n", __FUNCTION__);
-#endif
+   /**
+    * add_slot
+    *
+    * Adds a slot of the pipeline.
+    *
+    * @param op Operation prepared for the pipeline's context.
+    * @param inputs Surfaces filled by the application before the dispatch.
+    * @param outputs Surfaces read back after the dispatch.
+    * @return Index of the slot.
+    */
+   unsigned int add_slot(ref_object<compute::operation> op,
+                         const std::vector<ref_object<surface>> &inputs,
+                         const std::vector<ref_object<surface>> &outputs) {
+      slot s;
+
+      s.op = op;
+      s.inputs = inputs;
+      s.outputs = outputs;
+      slots.push_back(s);
+
+      return slots.size() - 1;
    }
 
-   opobj = ref_object<compute::operation>(op, sizeof(compute::operation), 0,
-                                          subDevice);
+   /**
+    * run
+    *
+    * Runs iterations of the workload through the slots, requiring at least
+    * two slots. The fill callback writes the backing of the inputs of an
+    * iteration before their upload, the drain callback consumes the
+    * backing of the outputs once read back. Callbacks are invoked in the
+    * order of the iterations, on the calling thread.
+    *
+    * @return VMAccelStatusCodeEnum value.
+    */
+   int run(unsigned int numIterations, const callback &fill,
+           const callback &drain) {
+      unsigned int numQueues = clctx->get_num_queues();
+      unsigned int baseQueue = subDevice * numQueues;
+      int res = VMACCEL_SUCCESS;
+      unsigned int i;
 
-   return VMACCEL_SUCCESS;
-}
+      if (slots.size() < 2) {
+         VMACCEL_WARNING("%s: Pipeline requires at least two slots\n",
+                         __FUNCTION__);
+         return VMACCEL_SEMANTIC_ERROR;
+      }
+
+      for (i = 0; i < slots.size(); i++) {
+         if (!slots[i].op->is_prepared() ||
+             (slots[i].op->get_context()->get_contextId() !=
+              clctx->get_contextId())) {
+            VMACCEL_WARNING("%s: Operation of slot %d not prepared for the "
+                            "pipeline's context\n",
+                            __FUNCTION__, i);
+            return VMACCEL_SEMANTIC_ERROR;
+         }
+
+         slots[i].op->set_queue(QUEUE_DISPATCH);
+      }
+
+      uploadQueue = baseQueue + (QUEUE_UPLOAD % numQueues);
+      downloadQueue = baseQueue + (QUEUE_DOWNLOAD % numQueues);
+
+      /*
+       * Step i dispatches iteration i-1, then reads back iteration i-2 and
+       * uploads iteration i. With two slots, the inputs of iteration i
+       * share the slot of iteration i-2 and are filled once it is drained.
+       */
+      for (i = 0; (i < numIterations + 2) && (res == VMACCEL_SUCCESS); i++) {
+         if ((i >= 1) && (i <= numIterations)) {
+            res = dispatch(i - 1);
+         }
+
+         if ((res == VMACCEL_SUCCESS) && (slots.size() > 2) &&
+             (i < numIterations)) {
+            res = upload(i, fill);
+         }
+
+         if ((res == VMACCEL_SUCCESS) && (i >= 2)) {
+            res = download(i - 2, drain);
+         }
+
+         if ((res == VMACCEL_SUCCESS) && (slots.size() == 2) &&
+             (i < numIterations)) {
+            res = upload(i, fill);
+         }
+      }
+
+      if (res != VMACCEL_SUCCESS) {
+         VMACCEL_WARNING("%s: Pipeline stopped at step %d\n", __FUNCTION__,
+                         i - 1);
+      }
+
+      flush_queues();
+
+      /*
+       * Operations left in flight by a failure are quiesced by their owner.
+       */
+      return res;
+   }
+
+private:
+   /*
+    * Queue indices of the sub-device, wrapped at the number of queues of
+    * the context.
+    */
+   enum queue_index {
+      QUEUE_DISPATCH = 0,
+      QUEUE_UPLOAD = 1,
+      QUEUE_DOWNLOAD = 2,
+   };
+
+   struct slot {
+      ref_object<compute::operation> op;
+      std::vector<ref_object<surface>> inputs;
+      std::vector<ref_object<surface>> outputs;
+   };
+
+   int upload(unsigned int iteration, const callback &fill) {
+      slot &s = slots[iteration % slots.size()];
+
+      if (fill) {
+         fill(iteration, iteration % slots.size());
+      }
+
+      for (unsigned int i = 0; i < s.inputs.size(); i++) {
+         if (!clctx->alloc_surface(s.inputs[i]) ||
+             !clctx->upload_surface(s.inputs[i], true, false, true,
+                                    uploadQueue, true)) {
+            return VMACCEL_FAIL;
+         }
+      }
+
+      queues.insert(uploadQueue);
+
+      return VMACCEL_SUCCESS;
+   }
+
+   int dispatch(unsigned int iteration) {
+      slot &s = slots[iteration % slots.size()];
+      int res = s.op->dispatch(true);
+
+      queues.insert(s.op->get_queue_id());
+
+      return res;
+   }
+
+   int download(unsigned int iteration, const callback &drain) {
+      slot &s = slots[iteration % slots.size()];
+
+      /*
+       * The read back waits for the dispatch, submit the pending commands
+       * of every queue before blocking on it.
+       */
+      flush_queues();
+
+      for (unsigned int i = 0; i < s.outputs.size(); i++) {
+         if (!clctx->download_surface(s.outputs[i], true,
+                                      ENABLE_IMAGE_DOWNLOAD, downloadQueue)) {
+            return VMACCEL_FAIL;
+         }
+      }
+
+      s.op->set_quiesced();
+
+      if (drain) {
+         drain(iteration, iteration % slots.size());
+      }
+
+      return VMACCEL_SUCCESS;
+   }
+
+   void flush_queues() {
+      for (auto it = queues.begin(); it != queues.end(); it++) {
+         clctx->flush_queue(*it);
+      }
+
+      queues.clear();
+   }
+
+   ref_object<clcontext> clctx;
+   unsigned int subDevice;
+   VMAccelId uploadQueue;
+   VMAccelId downloadQueue;
+   std::vector<slot> slots;
+   std::set<VMAccelId> queues;
+};
 }; // namespace compute
 }; // namespace vmaccel
 
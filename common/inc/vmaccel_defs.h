@@ -48,7 +48,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define VMACCEL_MAX_STREAMS 4
 #endif
 
-#define VMACCEL_MAX_SURFACE_INSTANCE 1
+/*
+ * Number of instances backing a surface, write-discard updates are renamed
+ * across instances to overlap with commands using the previous generation.
+ */
+#ifndef VMACCEL_MAX_SURFACE_INSTANCE
+#define VMACCEL_MAX_SURFACE_INSTANCE 3
+#endif
+
 #define VMACCEL_STREAM_PRIORITY_DELTA 1
 
 #ifndef ENABLE_IMAGE_DOWNLOAD
@@ -208,6 +215,10 @@ typedef enum VMAccelSurfacePoolEnum {
    VMACCEL_SURFACE_POOL_AUTO,
    VMACCEL_SURFACE_POOL_ACCELERATOR,
    VMACCEL_SURFACE_POOL_SYSTEM_MEMORY,
+   /*
+    * Memory owned by the application, used in place by local Accelerators.
+    */
+   VMACCEL_SURFACE_POOL_USER_MEMORY,
 } VMAccelSurfacePoolEnum;
 
 typedef enum VMAccelSurfaceTypeEnum {
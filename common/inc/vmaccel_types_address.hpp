@@ -34,6 +34,7 @@ static void Constructor(VMAccelAddress &obj) {
    obj.addr.addr_val = NULL;
    obj.port = 0;
    obj.resourceType = 0;
+   obj.subDevice = 0;
 }
 
 static void Destructor(VMAccelAddress &obj) {
@@ -58,6 +59,7 @@ static void DeepCopy(VMAccelAddress &lhs, const VMAccelAddress &rhs) {
       }
       lhs.port = rhs.port;
       lhs.resourceType = rhs.resourceType;
+      lhs.subDevice = rhs.subDevice;
    }
 }
 
@@ -76,6 +78,7 @@ static void Move(VMAccelAddress &lhs, VMAccelAddress &rhs) {
       lhs.addr.addr_val = rhs.addr.addr_val;
       lhs.port = rhs.port;
       lhs.resourceType = rhs.resourceType;
+      lhs.subDevice = rhs.subDevice;
       memset(&rhs, 0, sizeof(rhs));
    }
 }
@@ -137,54 +137,41 @@ static bool Reserve(const AllocRange &a, const AllocRange &req, AllocRange &d,
 static bool
 FreeObj(std::multiset<VMAccelObject<AllocRange>, AllocRangeCmp> &pool,
         const VMAccelObject<AllocRange> obj) {
+   AllocRange r = obj.GetObj();
+   bool merged = false;
+   bool found;
+
    /*
-    * Update and replace the value.
+    * Coalesce with the adjacent ranges on either side. The pool is ordered
+    * by size for best fit, so the neighbors are found by a scan.
     */
-   AllocRange r = obj.GetObj();
-   r.cmpRange = true;
-   auto it =
-      //   typename std::multiset<VMAccelObject<AllocRange>,
-      //   AllocRangeCmp>::iterator it =
-      pool.lower_bound(VMAccelObject<AllocRange>(obj.GetParentId(), &r));
-   if (it != pool.end()) {
-      AllocRange range = it->GetObj();
-      if (range.begin == r.end + 1) {
-         pool.erase(it);
-         range.begin = r.begin;
-         range.size += r.end - r.begin + 1;
-         auto res =
-            pool.insert(VMAccelObject<AllocRange>(obj.GetParentId(), &range));
-         return res != pool.end();
-      }
-      if (range.end + 1 == r.begin) {
-         pool.erase(it);
-         range.end = r.begin;
-         range.size += r.end - r.begin + 1;
-         auto res =
-            pool.insert(VMAccelObject<AllocRange>(obj.GetParentId(), &range));
-         return res != pool.end();
-      }
-   }
-   it = pool.upper_bound(VMAccelObject<AllocRange>(obj.GetParentId(), &r));
-   if (it != pool.end()) {
-      AllocRange range = it->GetObj();
-      if (range.begin == r.end + 1) {
-         pool.erase(it);
-         range.begin = r.begin;
-         range.size += r.end - r.begin + 1;
-         auto res =
-            pool.insert(VMAccelObject<AllocRange>(obj.GetParentId(), &range));
-         return res != pool.end();
-      }
-      if (range.end + 1 == r.begin) {
+   do {
+      found = false;
+      for (auto it = pool.begin(); it != pool.end(); ++it) {
+         if (it->GetParentId() != obj.GetParentId()) {
+            continue;
+         }
+         AllocRange range = it->GetObj();
+         if (range.begin == r.end + 1) {
+            r.end = range.end;
+         } else if (range.end + 1 == r.begin) {
+            r.begin = range.begin;
+         } else {
+            continue;
+         }
+         r.size += range.size;
          pool.erase(it);
-         range.end = r.begin;
-         range.size += r.end - r.begin + 1;
-         auto res =
-            pool.insert(VMAccelObject<AllocRange>(obj.GetParentId(), &range));
-         return res != pool.end();
+         merged = found = true;
+         break;
       }
+   } while (found);
+
+   if (merged) {
+      r.cmpRange = false;
+      auto res = pool.insert(VMAccelObject<AllocRange>(obj.GetParentId(), &r));
+      return res != pool.end();
    }
+
    auto res = pool.insert(obj);
    return res != pool.end();
 }
@@ -30,7 +30,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define _VMACCEL_UTILS_H_ 1
 
 #include "vmaccel_rpc.h"
+#include "vmcl_rpc.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #define DEBUG_OBJECT_LIFETIME 0
@@ -146,6 +148,23 @@ struct timespec DiffTime(struct timespec *start, struct timespec *end);
 int BitMask_FindFirstZero(unsigned int bitMask);
 int BitMask_FindFirstOne(unsigned int bitMask);
 
+uint64_t VMAccel_Hash64(const void *data, size_t len, uint64_t seed);
+size_t VMAccel_ProgramKeyDesc(char *buf, size_t size, uint64_t sourceHash,
+                              unsigned int language, const char *options,
+                              const char *const *strs, unsigned int numStrs);
+
+unsigned int VMAccel_SurfaceFormatSize(VMAccelSurfaceFormat format);
+bool VMAccel_SurfaceIsImage(const VMAccelSurfaceDesc *desc);
+size_t VMAccel_SurfaceSize(const VMAccelSurfaceDesc *desc);
+bool VMAccel_SurfaceRegionLayout(const VMAccelSurfaceDesc *desc,
+                                 const VMAccelSurfaceRegion *rgn,
+                                 size_t origin[3], size_t region[3],
+                                 size_t *rowPitch, size_t *slicePitch);
+
+VMAccelStatusCode VMAccel_CmdListApplyUpdates(
+   const VMCLDispatchListOp *list, const VMCLKernelArgUpdate *updates,
+   unsigned int numUpdates, VMCLDispatchListOp *out, unsigned int *badUpdate);
+
 typedef struct IdentifierDB {
    unsigned int size;
    unsigned int numWords;
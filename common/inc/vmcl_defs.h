@@ -31,6 +31,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "vmaccel_defs.h"
 
+#define VMCL_MAX_DEVICES 8
 #define VMCL_MAX_SUBDEVICES 32
 #define VMCL_MAX_CONTEXTS 32
 #define VMCL_MAX_SURFACES 32
@@ -39,6 +40,65 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define VMCL_MAX_EVENTS 32
 #define VMCL_MAX_SAMPLERS 32
 #define VMCL_MAX_KERNELS 32
+#define VMCL_MAX_CMDLISTS 32
+#define VMCL_MAX_DIMENSIONS 3
+
+/*
+ * Persistent program binary cache, programs are keyed by the source hash,
+ * language, build options and device. The cache is kept in the directory
+ * VMCL_PROGRAM_CACHE_NAME of $XDG_CACHE_HOME, or of $HOME/.cache. The
+ * directory may be overridden by defining VMCL_PROGRAM_CACHE_DIR, or by the
+ * VMCL_PROGRAM_CACHE_DIR environment variable. The directory must be owned
+ * by the user of the server and not writable by others.
+ */
+#ifndef ENABLE_VMCL_PROGRAM_CACHE
+#define ENABLE_VMCL_PROGRAM_CACHE 1
+#endif
+
+#define VMCL_PROGRAM_CACHE_NAME "vmcl_program_cache"
+#define VMCL_PROGRAM_KEY_DESC_MAX 2048
+
+/*
+ * Small buffer surfaces are sub-allocated from a per-context arena instead
+ * of a driver allocation per surface.
+ */
+#ifndef ENABLE_VMCL_SURFACE_ARENA
+#define ENABLE_VMCL_SURFACE_ARENA 1
+#endif
+
+#ifndef VMCL_SURFACE_ARENA_SIZE
+#define VMCL_SURFACE_ARENA_SIZE (64 * 1024 * 1024)
+#endif
+
+#ifndef VMCL_SURFACE_ARENA_MAX_ALLOC_SIZE
+#define VMCL_SURFACE_ARENA_MAX_ALLOC_SIZE (256 * 1024)
+#endif
+
+/*
+ * Image uploads and synchronous downloads are staged through a pool of
+ * pinned host buffers per context, recycled when their transfer completes.
+ * Larger transfers are made from pageable memory.
+ */
+#ifndef ENABLE_VMCL_STAGING_POOL
+#define ENABLE_VMCL_STAGING_POOL 1
+#endif
+
+#ifndef VMCL_STAGING_POOL_SIZE
+#define VMCL_STAGING_POOL_SIZE 8
+#endif
+
+#ifndef VMCL_STAGING_MAX_ALLOC_SIZE
+#define VMCL_STAGING_MAX_ALLOC_SIZE (16 * 1024 * 1024)
+#endif
+
+/*
+ * Backend objects are checkpointed when the server powers off, and restored
+ * when it powers on, if the VMCL_SNAPSHOT_PATH environment variable names
+ * the snapshot file.
+ */
+#ifndef ENABLE_VMCL_SNAPSHOT
+#define ENABLE_VMCL_SNAPSHOT 1
+#endif
 
 enum VMCLCapsShift {
    VMCL_SPIRV_32_BIT_SHIFT = 0,
@@ -48,7 +108,8 @@ enum VMCLCapsShift {
    VMCL_SPIRV_1_2_CAP_SHIFT = 4,
    VMCL_UPLOAD_FROM_VADDR_CAP_SHIFT = 5,
    VMCL_DOWNLOAD_TO_VADDR_CAP_SHIFT = 6,
-   VMCL_CAP_MAX = 7,
+   VMCL_PROFILING_CAP_SHIFT = 7,
+   VMCL_CAP_MAX = 8,
 };
 typedef enum VMCLCapsShift VMCLCapsShift;
 
@@ -61,6 +122,7 @@ typedef enum VMCLCapsShift VMCLCapsShift;
 #define VMCL_SPIRV_1_2_CAP (1 << VMCL_SPIRV_1_2_CAP_SHIFT)
 #define VMCL_UPLOAD_FROM_VADDR_CAP (1 << VMCL_UPLOAD_FROM_VADDR_CAP_SHIFT)
 #define VMCL_DOWNLOAD_TO_VADDR_CAP (1 << VMCL_DOWNLOAD_TO_VADDR_CAP_SHIFT)
+#define VMCL_PROFILING_CAP (1 << VMCL_PROFILING_CAP_SHIFT)
 #define VMCL_CAP_MASK ((1 << VMCL_CAP_MAX) - 1)
 typedef unsigned int VMCLCaps;
 
@@ -79,7 +141,8 @@ enum VMCLKernelLanguageType {
    VMCL_OPENCL_CPP_1_0 = 11,
    VMCL_SPIRV_1_1 = 12,
    VMCL_SPIRV_1_2 = 13,
-   VMCL_LANGUAGE_MAX = 14,
+   VMCL_NATIVE_CPP = 14,
+   VMCL_LANGUAGE_MAX = 15,
 };
 
 enum VMCLKernelArchitecture {
@@ -44,6 +44,10 @@ typedef struct VMCLOps {
                                      unsigned int useDataStreaming);
    VMAccelStatus *(*poweroff)(void);
    VMAccelStatus *(*checkpoint)(void);
+   /*
+    * Restored contexts keep their identifiers and are recreated on the
+    * backend device they were checkpointed on.
+    */
    VMAccelStatus *(*restore)(void);
 
    /*
@@ -75,10 +79,38 @@ typedef struct VMCLOps {
    VMAccelStatus *(*surfacecopy_1)(VMCLSurfaceCopyOp *);
    VMAccelStatus *(*imagefill_1)(VMCLImageFillOp *);
    VMAccelStatus *(*dispatch_1)(VMCLDispatchOp *);
+
+   /*
+    * Profiling, optional
+    */
+   VMCLProfileStatus *(*profilequery_1)(VMCLProfileQueryOp *);
+
+   /*
+    * Batched dispatch, optional. Enqueues every dispatch of the list or, if
+    * a surface is not at the requested generation, none of them.
+    */
+   VMAccelStatus *(*dispatchlist_1)(VMCLDispatchListOp *);
+
+   /*
+    * Allocation of a surface on the memory of a local client, optional. The
+    * memory in data holds the contents of the surface until it is
+    * destroyed. Surfaces the backend can't create on client memory return
+    * VMACCEL_SEMANTIC_ERROR.
+    */
+   VMAccelSurfaceAllocateStatus *(*surfaceallocuser_1)(
+      VMCLSurfaceAllocateInitOp *);
 } VMCLOps;
 
 VMAccelAllocateStatus *vmcl_poweron_svc(VMCLOps *ops,
                                         unsigned int useDataStreaming);
 VMAccelStatus *vmcl_poweroff_svc();
 
+/*
+ * Devices powered on by vmcl_poweron_svc. Each device is registered as a
+ * separate accelerator, and is selected by its index in the accelId of
+ * VMCLContextAllocateDesc.
+ */
+unsigned int vmcl_num_devices_svc();
+VMAccelAllocateStatus *vmcl_device_svc(unsigned int device);
+
 #endif /* !defined _VMCL_OPS_H_ */
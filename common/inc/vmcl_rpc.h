@@ -95,6 +95,16 @@ struct VMCLQueueFlushOp {
 };
 typedef struct VMCLQueueFlushOp VMCLQueueFlushOp;
 
+struct VMCLSurfaceAllocateInitOp {
+   VMCLQueueId queue;
+   VMCLSurfaceAllocateDesc alloc;
+   struct {
+      u_int data_len;
+      char *data_val;
+   } data;
+};
+typedef struct VMCLSurfaceAllocateInitOp VMCLSurfaceAllocateInitOp;
+
 struct VMCLSurfaceCopyOp {
    VMCLQueueId queue;
    VMCLSurfaceId dst;
@@ -187,6 +197,7 @@ struct VMCLKernelAllocateDesc {
    VMCLKernelId client;
    u_int subDevice;
    VMCLKernelLanguage language;
+   u_quad_t sourceHash;
    struct {
       u_int source_len;
       char *source_val;
@@ -221,6 +232,7 @@ enum VMCLKernelArgType {
    VMCL_ARG_IMMEDIATE = 0,
    VMCL_ARG_SURFACE = 1,
    VMCL_ARG_SAMPLER = 2,
+   VMCL_ARG_LOCAL = 3,
 };
 typedef enum VMCLKernelArgType VMCLKernelArgType;
 
@@ -231,9 +243,20 @@ struct VMCLKernelArgDesc {
    VMAccelSurfaceUsage usage;
    VMAccelSurfaceId surf;
    VMCLSamplerId sampler;
+   struct {
+      u_int data_len;
+      char *data_val;
+   } data;
+   u_int localSize;
 };
 typedef struct VMCLKernelArgDesc VMCLKernelArgDesc;
 
+struct VMCLKernelArgSwap {
+   u_int first;
+   u_int second;
+};
+typedef struct VMCLKernelArgSwap VMCLKernelArgSwap;
+
 struct VMCLDispatchOp {
    VMCLQueueId queue;
    VMCLKernelId kernel;
@@ -258,9 +281,74 @@ struct VMCLDispatchOp {
       u_int refs_len;
       VMAccelSurfaceId *refs_val;
    } refs;
+   u_int repeatCount;
+   struct {
+      u_int swaps_len;
+      VMCLKernelArgSwap *swaps_val;
+   } swaps;
 };
 typedef struct VMCLDispatchOp VMCLDispatchOp;
 
+struct VMCLDispatchListOp {
+   VMCLQueueId queue;
+   struct {
+      u_int dispatches_len;
+      VMCLDispatchOp *dispatches_val;
+   } dispatches;
+};
+typedef struct VMCLDispatchListOp VMCLDispatchListOp;
+
+struct VMCLCmdListId {
+   VMCLContextId cid;
+   VMAccelId id;
+};
+typedef struct VMCLCmdListId VMCLCmdListId;
+
+struct VMCLCmdListRecordOp {
+   VMCLCmdListId list;
+   VMCLDispatchListOp dispatches;
+};
+typedef struct VMCLCmdListRecordOp VMCLCmdListRecordOp;
+
+struct VMCLKernelArgUpdate {
+   u_int dispatch;
+   VMCLKernelArgDesc arg;
+};
+typedef struct VMCLKernelArgUpdate VMCLKernelArgUpdate;
+
+struct VMCLCmdListReplayOp {
+   VMCLCmdListId list;
+   struct {
+      u_int updates_len;
+      VMCLKernelArgUpdate *updates_val;
+   } updates;
+};
+typedef struct VMCLCmdListReplayOp VMCLCmdListReplayOp;
+
+enum VMCLProfileOpType {
+   VMCL_PROFILE_DISPATCH = 0,
+   VMCL_PROFILE_UPLOAD = 1,
+   VMCL_PROFILE_DOWNLOAD = 2,
+   VMCL_PROFILE_COPY = 3,
+   VMCL_PROFILE_MAX = 4,
+};
+typedef enum VMCLProfileOpType VMCLProfileOpType;
+
+struct VMCLProfileQueryOp {
+   VMCLQueueId queue;
+   VMCLProfileOpType type;
+};
+typedef struct VMCLProfileQueryOp VMCLProfileQueryOp;
+
+struct VMCLProfileStatus {
+   VMAccelStatusCode status;
+   u_quad_t queued;
+   u_quad_t submit;
+   u_quad_t start;
+   u_quad_t end;
+};
+typedef struct VMCLProfileStatus VMCLProfileStatus;
+
 struct VMCLContextAllocateReturnStatus {
    int errno;
    union {
@@ -285,6 +373,14 @@ struct VMCLKernelAllocateReturnStatus {
 };
 typedef struct VMCLKernelAllocateReturnStatus VMCLKernelAllocateReturnStatus;
 
+struct VMCLProfileReturnStatus {
+   int errno;
+   union {
+      VMCLProfileStatus *ret;
+   } VMCLProfileReturnStatus_u;
+};
+typedef struct VMCLProfileReturnStatus VMCLProfileReturnStatus;
+
 #define VMCL 0x20000081
 #define VMCL_VERSION 2
 
@@ -368,6 +464,35 @@ extern VMAccelReturnStatus *vmcl_kerneldestroy_2_svc(VMCLKernelId *,
 extern VMAccelReturnStatus *vmcl_dispatch_2(VMCLDispatchOp *, CLIENT *);
 extern VMAccelReturnStatus *vmcl_dispatch_2_svc(VMCLDispatchOp *,
                                                 struct svc_req *);
+#define VMCL_PROFILEQUERY 19
+extern VMCLProfileReturnStatus *vmcl_profilequery_2(VMCLProfileQueryOp *,
+                                                    CLIENT *);
+extern VMCLProfileReturnStatus *vmcl_profilequery_2_svc(VMCLProfileQueryOp *,
+                                                        struct svc_req *);
+#define VMCL_DISPATCHLIST 20
+extern VMAccelReturnStatus *vmcl_dispatchlist_2(VMCLDispatchListOp *,
+                                                CLIENT *);
+extern VMAccelReturnStatus *vmcl_dispatchlist_2_svc(VMCLDispatchListOp *,
+                                                    struct svc_req *);
+#define VMCL_CMDLISTRECORD 21
+extern VMAccelReturnStatus *vmcl_cmdlistrecord_2(VMCLCmdListRecordOp *,
+                                                 CLIENT *);
+extern VMAccelReturnStatus *vmcl_cmdlistrecord_2_svc(VMCLCmdListRecordOp *,
+                                                     struct svc_req *);
+#define VMCL_CMDLISTREPLAY 22
+extern VMAccelReturnStatus *vmcl_cmdlistreplay_2(VMCLCmdListReplayOp *,
+                                                 CLIENT *);
+extern VMAccelReturnStatus *vmcl_cmdlistreplay_2_svc(VMCLCmdListReplayOp *,
+                                                     struct svc_req *);
+#define VMCL_CMDLISTDESTROY 23
+extern VMAccelReturnStatus *vmcl_cmdlistdestroy_2(VMCLCmdListId *, CLIENT *);
+extern VMAccelReturnStatus *vmcl_cmdlistdestroy_2_svc(VMCLCmdListId *,
+                                                      struct svc_req *);
+#define VMCL_SURFACEALLOCINIT 24
+extern VMAccelSurfaceAllocateReturnStatus *
+vmcl_surfaceallocinit_2(VMCLSurfaceAllocateInitOp *, CLIENT *);
+extern VMAccelSurfaceAllocateReturnStatus *
+vmcl_surfaceallocinit_2_svc(VMCLSurfaceAllocateInitOp *, struct svc_req *);
 extern int vmcl_2_freeresult(SVCXPRT *, xdrproc_t, caddr_t);
 
 #else /* K&R C */
@@ -425,6 +550,24 @@ extern VMAccelReturnStatus *vmcl_kerneldestroy_2_svc();
 #define VMCL_DISPATCH 18
 extern VMAccelReturnStatus *vmcl_dispatch_2();
 extern VMAccelReturnStatus *vmcl_dispatch_2_svc();
+#define VMCL_PROFILEQUERY 19
+extern VMCLProfileReturnStatus *vmcl_profilequery_2();
+extern VMCLProfileReturnStatus *vmcl_profilequery_2_svc();
+#define VMCL_DISPATCHLIST 20
+extern VMAccelReturnStatus *vmcl_dispatchlist_2();
+extern VMAccelReturnStatus *vmcl_dispatchlist_2_svc();
+#define VMCL_CMDLISTRECORD 21
+extern VMAccelReturnStatus *vmcl_cmdlistrecord_2();
+extern VMAccelReturnStatus *vmcl_cmdlistrecord_2_svc();
+#define VMCL_CMDLISTREPLAY 22
+extern VMAccelReturnStatus *vmcl_cmdlistreplay_2();
+extern VMAccelReturnStatus *vmcl_cmdlistreplay_2_svc();
+#define VMCL_CMDLISTDESTROY 23
+extern VMAccelReturnStatus *vmcl_cmdlistdestroy_2();
+extern VMAccelReturnStatus *vmcl_cmdlistdestroy_2_svc();
+#define VMCL_SURFACEALLOCINIT 24
+extern VMAccelSurfaceAllocateReturnStatus *vmcl_surfaceallocinit_2();
+extern VMAccelSurfaceAllocateReturnStatus *vmcl_surfaceallocinit_2_svc();
 extern int vmcl_2_freeresult();
 #endif /* K&R C */
 
@@ -441,6 +584,8 @@ extern bool_t xdr_VMCLSurfaceAllocateDesc(XDR *, VMCLSurfaceAllocateDesc *);
 extern bool_t xdr_VMCLQueueId(XDR *, VMCLQueueId *);
 extern bool_t xdr_VMCLQueueAllocateDesc(XDR *, VMCLQueueAllocateDesc *);
 extern bool_t xdr_VMCLQueueFlushOp(XDR *, VMCLQueueFlushOp *);
+extern bool_t xdr_VMCLSurfaceAllocateInitOp(XDR *,
+                                           VMCLSurfaceAllocateInitOp *);
 extern bool_t xdr_VMCLSurfaceCopyOp(XDR *, VMCLSurfaceCopyOp *);
 extern bool_t xdr_VMCLImageFillOp(XDR *, VMCLImageFillOp *);
 extern bool_t xdr_VMCLImageUploadOp(XDR *, VMCLImageUploadOp *);
@@ -459,13 +604,23 @@ extern bool_t xdr_VMCLKernelAllocateStatus(XDR *, VMCLKernelAllocateStatus *);
 extern bool_t xdr_VMCLKernelSemanticType(XDR *, VMCLKernelSemanticType *);
 extern bool_t xdr_VMCLKernelArgType(XDR *, VMCLKernelArgType *);
 extern bool_t xdr_VMCLKernelArgDesc(XDR *, VMCLKernelArgDesc *);
+extern bool_t xdr_VMCLKernelArgSwap(XDR *, VMCLKernelArgSwap *);
 extern bool_t xdr_VMCLDispatchOp(XDR *, VMCLDispatchOp *);
+extern bool_t xdr_VMCLDispatchListOp(XDR *, VMCLDispatchListOp *);
+extern bool_t xdr_VMCLCmdListId(XDR *, VMCLCmdListId *);
+extern bool_t xdr_VMCLCmdListRecordOp(XDR *, VMCLCmdListRecordOp *);
+extern bool_t xdr_VMCLKernelArgUpdate(XDR *, VMCLKernelArgUpdate *);
+extern bool_t xdr_VMCLCmdListReplayOp(XDR *, VMCLCmdListReplayOp *);
+extern bool_t xdr_VMCLProfileOpType(XDR *, VMCLProfileOpType *);
+extern bool_t xdr_VMCLProfileQueryOp(XDR *, VMCLProfileQueryOp *);
+extern bool_t xdr_VMCLProfileStatus(XDR *, VMCLProfileStatus *);
 extern bool_t
 xdr_VMCLContextAllocateReturnStatus(XDR *, VMCLContextAllocateReturnStatus *);
 extern bool_t
 xdr_VMCLSamplerAllocateReturnStatus(XDR *, VMCLSamplerAllocateReturnStatus *);
 extern bool_t
 xdr_VMCLKernelAllocateReturnStatus(XDR *, VMCLKernelAllocateReturnStatus *);
+extern bool_t xdr_VMCLProfileReturnStatus(XDR *, VMCLProfileReturnStatus *);
 
 #else /* K&R C */
 extern bool_t xdr_VMCLCaps();
@@ -478,6 +633,7 @@ extern bool_t xdr_VMCLSurfaceAllocateDesc();
 extern bool_t xdr_VMCLQueueId();
 extern bool_t xdr_VMCLQueueAllocateDesc();
 extern bool_t xdr_VMCLQueueFlushOp();
+extern bool_t xdr_VMCLSurfaceAllocateInitOp();
 extern bool_t xdr_VMCLSurfaceCopyOp();
 extern bool_t xdr_VMCLImageFillOp();
 extern bool_t xdr_VMCLImageUploadOp();
@@ -496,10 +652,20 @@ extern bool_t xdr_VMCLKernelAllocateStatus();
 extern bool_t xdr_VMCLKernelSemanticType();
 extern bool_t xdr_VMCLKernelArgType();
 extern bool_t xdr_VMCLKernelArgDesc();
+extern bool_t xdr_VMCLKernelArgSwap();
 extern bool_t xdr_VMCLDispatchOp();
+extern bool_t xdr_VMCLDispatchListOp();
+extern bool_t xdr_VMCLCmdListId();
+extern bool_t xdr_VMCLCmdListRecordOp();
+extern bool_t xdr_VMCLKernelArgUpdate();
+extern bool_t xdr_VMCLCmdListReplayOp();
+extern bool_t xdr_VMCLProfileOpType();
+extern bool_t xdr_VMCLProfileQueryOp();
+extern bool_t xdr_VMCLProfileStatus();
 extern bool_t xdr_VMCLContextAllocateReturnStatus();
 extern bool_t xdr_VMCLSamplerAllocateReturnStatus();
 extern bool_t xdr_VMCLKernelAllocateReturnStatus();
+extern bool_t xdr_VMCLProfileReturnStatus();
 
 #endif /* K&R C */
 
@@ -0,0 +1,98 @@
+/******************************************************************************
+
+Copyright (c) 2022 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#ifndef _VMCPU_H_
+#define _VMCPU_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vmcl_ops.h"
+#include "vmcl_rpc.h"
+
+/*
+ * Pure-CPU VMCL backend, surfaces are kept in host memory and kernels are
+ * native functions registered with the backend by name. Kernels are
+ * allocated with the VMCL_NATIVE_CPP language and the registered name.
+ * The backend registers its built-in kernels, vmcpu_double_int and
+ * vmcpu_add_int, when powered on.
+ */
+extern VMCLOps vmcpuOps;
+
+/*
+ * Loopback VMCL backend, identical to vmcpuOps except that kernels of any
+ * language are accepted and never executed. A dispatch is a no-op, or a
+ * copy of the first surface argument to the other surface arguments when
+ * VMCL_NULL_DISPATCH=memcpy. Used to measure protocol and client overhead.
+ */
+extern VMCLOps vmnullOps;
+
+#define VMCPU_MAX_DIMENSIONS 3
+#define VMCPU_MAX_NATIVE_KERNELS 64
+#define VMCPU_MAX_KERNEL_NAME 256
+#define VMCPU_MAX_KERNEL_ARGS 64
+
+/*
+ * Work-group executed by a single invocation of a native kernel.
+ */
+typedef struct VMCPUWorkGroup {
+   unsigned int dimension;
+   size_t groupId[VMCPU_MAX_DIMENSIONS];
+   size_t numGroups[VMCPU_MAX_DIMENSIONS];
+   size_t globalOffset[VMCPU_MAX_DIMENSIONS];
+   size_t globalSize[VMCPU_MAX_DIMENSIONS];
+   size_t localSize[VMCPU_MAX_DIMENSIONS];
+} VMCPUWorkGroup;
+
+typedef struct VMCPUKernelArg {
+   void *ptr;
+   size_t size;
+} VMCPUKernelArg;
+
+/*
+ * Native kernels are invoked once per work-group, in parallel across the
+ * backend's worker threads. Arguments are indexed by kernel argument index.
+ * Immediate arguments point at their value, local arguments point at
+ * scratch memory private to the invoking worker thread.
+ */
+typedef void (*VMCPUKernelFunc)(const VMCPUWorkGroup *group,
+                                const VMCPUKernelArg *args,
+                                unsigned int numArgs);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool VMCPU_RegisterKernel(const char *name, VMCPUKernelFunc func);
+void VMCPU_UnregisterKernel(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_VMCPU_H_ */
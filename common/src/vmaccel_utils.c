@@ -32,7 +32,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "vmaccel_types_address.h"
 #include <assert.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * @brief Takes a difference of two timespec structures per the example
@@ -122,6 +124,278 @@ int BitMask_FindFirstOne(unsigned int bitMask) {
    return -1;
 }
 
+/**
+ * @brief 64-bit FNV-1a hash, used to identify content shared between the
+ * client and server, e.g. kernel source.
+ */
+uint64_t VMAccel_Hash64(const void *data, size_t len, uint64_t seed) {
+   const unsigned char *bytes = (const unsigned char *)data;
+   uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+   }
+
+   return hash;
+}
+
+/**
+ * @brief Formats the description of a compiled program, the source hash,
+ * language, build options and the strings identifying the device and driver.
+ * Strings are prefixed by their length so distinct keys never format alike.
+ * @return Length of the description, zero if it does not fit in size bytes.
+ */
+size_t VMAccel_ProgramKeyDesc(char *buf, size_t size, uint64_t sourceHash,
+                              unsigned int language, const char *options,
+                              const char *const *strs, unsigned int numStrs) {
+   size_t len;
+   unsigned int i;
+   int ret;
+
+   if (options == NULL) {
+      options = "";
+   }
+
+   ret = snprintf(buf, size, "source=%016llx\nlanguage=%u\noptions[%zu]=%s\n",
+                  (unsigned long long)sourceHash, language, strlen(options),
+                  options);
+
+   if ((ret < 0) || ((size_t)ret >= size)) {
+      return 0;
+   }
+
+   len = ret;
+
+   for (i = 0; i < numStrs; i++) {
+      const char *str = (strs[i] != NULL) ? strs[i] : "";
+
+      ret = snprintf(buf + len, size - len, "device[%zu]=%s\n", strlen(str),
+                     str);
+
+      if ((ret < 0) || ((size_t)ret >= size - len)) {
+         return 0;
+      }
+
+      len += ret;
+   }
+
+   return len;
+}
+
+/**
+ * @brief Returns the size in bytes of an element of a format, zero if the
+ * format is unknown. Formats are enumerated in groups of 8, 16 and 32-bit
+ * components, ordered by component count and then by component type.
+ */
+unsigned int VMAccel_SurfaceFormatSize(VMAccelSurfaceFormat format) {
+   if (format < VMACCEL_FORMAT_R16_UNORM) {
+      return (format - VMACCEL_FORMAT_R8_UNORM) /
+                (VMACCEL_FORMAT_R8G8_UNORM - VMACCEL_FORMAT_R8_UNORM) +
+             1;
+   } else if (format < VMACCEL_FORMAT_R32_UNORM) {
+      return ((format - VMACCEL_FORMAT_R16_UNORM) /
+                 (VMACCEL_FORMAT_R16G16_UNORM - VMACCEL_FORMAT_R16_UNORM) +
+              1) *
+             2;
+   } else if (format < VMACCEL_FORMAT_MAX) {
+      return ((format - VMACCEL_FORMAT_R32_UNORM) /
+                 (VMACCEL_FORMAT_R32G32_UNORM - VMACCEL_FORMAT_R32_UNORM) +
+              1) *
+             4;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Returns true if the surface is a 1D, 2D or 3D image.
+ */
+bool VMAccel_SurfaceIsImage(const VMAccelSurfaceDesc *desc) {
+   return (desc->type == VMACCEL_SURFACE_1D_IMAGE) ||
+          (desc->type == VMACCEL_SURFACE_2D_IMAGE) ||
+          (desc->type == VMACCEL_SURFACE_3D_IMAGE);
+}
+
+/**
+ * @brief Returns the size in bytes of the contents of a surface. Buffer
+ * widths are in bytes, image dimensions are in elements of the format.
+ */
+size_t VMAccel_SurfaceSize(const VMAccelSurfaceDesc *desc) {
+   size_t height = MAX(desc->height, 1);
+   size_t depth = MAX(desc->depth, 1);
+   size_t rowPitch, slicePitch;
+
+   if (!VMAccel_SurfaceIsImage(desc)) {
+      return desc->width;
+   }
+
+   rowPitch = desc->rowPitch;
+
+   if (rowPitch == 0) {
+      rowPitch = desc->width * VMAccel_SurfaceFormatSize(desc->format);
+   }
+
+   slicePitch =
+      (desc->slicePitch != 0) ? desc->slicePitch : rowPitch * height;
+
+   return slicePitch * depth;
+}
+
+/**
+ * @brief Validates a transfer region of a surface. The region is returned
+ * in bytes, rows and slices, along with the pitches of the surface. Image
+ * regions are given in elements and are returned in bytes along x. Unset
+ * pitches describe rows and slices packed within the surface, host memory
+ * for the region is tightly packed.
+ */
+bool VMAccel_SurfaceRegionLayout(const VMAccelSurfaceDesc *desc,
+                                 const VMAccelSurfaceRegion *rgn,
+                                 size_t origin[3], size_t region[3],
+                                 size_t *rowPitch, size_t *slicePitch) {
+   size_t height = MAX(desc->height, 1);
+   size_t depth = MAX(desc->depth, 1);
+   size_t elementSize;
+   size_t end;
+
+   origin[0] = rgn->coord.x;
+   origin[1] = rgn->coord.y;
+   origin[2] = rgn->coord.z;
+   region[0] = rgn->size.x;
+   region[1] = MAX(rgn->size.y, 1);
+   region[2] = MAX(rgn->size.z, 1);
+
+   if (region[0] == 0) {
+      return false;
+   }
+
+   if (VMAccel_SurfaceIsImage(desc)) {
+      elementSize = VMAccel_SurfaceFormatSize(desc->format);
+
+      if ((elementSize == 0) || (origin[0] + region[0] > desc->width) ||
+          (origin[1] + region[1] > height) || (origin[2] + region[2] > depth)) {
+         return false;
+      }
+
+      origin[0] *= elementSize;
+      region[0] *= elementSize;
+
+      *rowPitch = (desc->rowPitch != 0) ? desc->rowPitch
+                                        : (size_t)desc->width * elementSize;
+      *slicePitch =
+         (desc->slicePitch != 0) ? desc->slicePitch : *rowPitch * height;
+
+      return true;
+   }
+
+   *rowPitch = (desc->rowPitch != 0) ? desc->rowPitch : desc->width / height;
+   *slicePitch =
+      (desc->slicePitch != 0) ? desc->slicePitch : *rowPitch * height;
+
+   if (((region[1] > 1) || (region[2] > 1)) &&
+       (origin[0] + region[0] > *rowPitch)) {
+      return false;
+   }
+
+   end = (origin[2] + region[2] - 1) * *slicePitch +
+         (origin[1] + region[1] - 1) * *rowPitch + origin[0] + region[0];
+
+   return (end <= desc->width);
+}
+
+/**
+ * @brief Copies a recorded dispatch list with kernel argument updates
+ * applied, each update replaces the argument of its dispatch with the same
+ * index. Every update is validated before the copy is made, the recorded
+ * list is never modified. The copy shares the storage of the list and the
+ * updates, and is released by freeing its dispatches.
+ * @return VMACCEL_SEMANTIC_ERROR with the index of the first invalid update
+ * in badUpdate, VMACCEL_OUT_OF_MEMORY or VMACCEL_SUCCESS.
+ */
+VMAccelStatusCode VMAccel_CmdListApplyUpdates(
+   const VMCLDispatchListOp *list, const VMCLKernelArgUpdate *updates,
+   unsigned int numUpdates, VMCLDispatchListOp *out, unsigned int *badUpdate) {
+   unsigned int numDispatches = list->dispatches.dispatches_len;
+   VMCLKernelArgDesc *args;
+   size_t numArgs = 0;
+   unsigned int i, j;
+
+   memset(out, 0, sizeof(*out));
+
+   for (i = 0; i < numUpdates; i++) {
+      const VMCLDispatchOp *op;
+
+      if (updates[i].dispatch >= numDispatches) {
+         *badUpdate = i;
+         return VMACCEL_SEMANTIC_ERROR;
+      }
+
+      op = &list->dispatches.dispatches_val[updates[i].dispatch];
+
+      for (j = 0; j < op->args.args_len; j++) {
+         if (op->args.args_val[j].index == updates[i].arg.index) {
+            break;
+         }
+      }
+
+      if (j == op->args.args_len) {
+         *badUpdate = i;
+         return VMACCEL_SEMANTIC_ERROR;
+      }
+   }
+
+   out->queue = list->queue;
+
+   if (numDispatches == 0) {
+      return VMACCEL_SUCCESS;
+   }
+
+   for (i = 0; i < numDispatches; i++) {
+      numArgs += list->dispatches.dispatches_val[i].args.args_len;
+   }
+
+   /*
+    * The dispatches are followed by their arguments in a single allocation.
+    */
+   out->dispatches.dispatches_val =
+      malloc(numDispatches * sizeof(VMCLDispatchOp) +
+             numArgs * sizeof(VMCLKernelArgDesc));
+
+   if (out->dispatches.dispatches_val == NULL) {
+      return VMACCEL_OUT_OF_MEMORY;
+   }
+
+   out->dispatches.dispatches_len = numDispatches;
+   args = (VMCLKernelArgDesc *)&out->dispatches.dispatches_val[numDispatches];
+
+   for (i = 0; i < numDispatches; i++) {
+      VMCLDispatchOp *op = &out->dispatches.dispatches_val[i];
+
+      *op = list->dispatches.dispatches_val[i];
+
+      if (op->args.args_len > 0) {
+         memcpy(args, op->args.args_val, op->args.args_len * sizeof(*args));
+      }
+
+      op->args.args_val = args;
+      args += op->args.args_len;
+   }
+
+   for (i = 0; i < numUpdates; i++) {
+      VMCLDispatchOp *op = &out->dispatches.dispatches_val[updates[i].dispatch];
+
+      for (j = 0; j < op->args.args_len; j++) {
+         if (op->args.args_val[j].index == updates[i].arg.index) {
+            op->args.args_val[j] = updates[i].arg;
+            break;
+         }
+      }
+   }
+
+   return VMACCEL_SUCCESS;
+}
+
 IdentifierDB *IdentifierDB_Alloc(unsigned int size) {
    IdentifierDB *db = calloc(1, sizeof(IdentifierDB));
    if (db != NULL) {
@@ -36,15 +36,15 @@ using namespace vmaccel;
 const char *matrixAdd2DKernel =
    "__kernel void MatrixAdd2D(__global int *a, __global int *b,\n"
    "                          __global int *semaphores,\n"
-   "                          __global int *dims)\n"
+   "                          int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
    "         b[n * chunkSize * i + chunkSize * j + k] +=\n"
@@ -56,15 +56,15 @@ const char *matrixAdd2DKernel =
 const char *matrixCopy2DKernel =
    "__kernel void MatrixCopy2D(__global int *a, __global int *b,\n"
    "                           __global int *semaphores,\n"
-   "                           __global int *dims)\n"
+   "                           int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
    "         b[n * chunkSize * i + chunkSize * j + k] =\n"
@@ -76,15 +76,15 @@ const char *matrixCopy2DKernel =
 const char *matrixAddTranspose2DKernel =
    "__kernel void MatrixAddTranspose2D(__global int *a, __global int *b,\n"
    "                                   __global int *semaphores,\n"
-   "                                   __global int *dims)\n"
+   "                                   int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
    "         b[n * chunkSize * j + chunkSize * i + k] +=\n"
@@ -96,15 +96,15 @@ const char *matrixAddTranspose2DKernel =
 const char *matrixCopyTranspose2DKernel =
    "__kernel void MatrixCopyTranspose2D(__global int *a, __global int *b,\n"
    "                                    __global int *semaphores,\n"
-   "                                    __global int *dims)\n"
+   "                                    int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
    "         b[n * chunkSize * j + chunkSize * i + k] =\n"
@@ -116,15 +116,15 @@ const char *matrixCopyTranspose2DKernel =
 const char *matrixAdd2DSemaphore1UKernel =
    "__kernel void MatrixAdd2DSemaphore1U(__global int *a, __global int *b,\n"
    "                                     __global int *semaphores,\n"
-   "                                     __global int *dims)\n"
+   "                                     int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   while (semaphores[0] == 0);\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
@@ -137,15 +137,15 @@ const char *matrixAdd2DSemaphore1UKernel =
 const char *matrixAdd2DSemaphoreNUKernel =
    "__kernel void MatrixAdd2DSemaphoreNU(__global int *a, __global int *b,\n"
    "                                     __global int *semaphores,\n"
-   "                                     __global int *dims)\n"
+   "                                     int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   while (semaphores[n * i + j] == 0);\n"
    "   for (l = 0; l < numPasses; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
@@ -158,15 +158,15 @@ const char *matrixAdd2DSemaphoreNUKernel =
 const char *matrixAdd2DExecChainNUKernel =
    "__kernel void MatrixAdd2DExecChainNU(__global int *a, __global int *b,\n"
    "                                     __global int *semaphores,\n"
-   "                                     __global int *dims)\n"
+   "                                     int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k = 0, l = 0;\n"
-   "   int chunkSize = dims[2];\n"
-   "   int numPasses = dims[3];\n"
+   "   int chunkSize = dims.z;\n"
+   "   int numPasses = dims.w;\n"
    "   while (semaphores[n * i + j] == 0) {\n"
    "      k = k + 1;\n"
    "   }\n"
@@ -182,14 +182,14 @@ const char *matrixAdd2DExecChainNUKernel =
 const char *matrixAdd2DEpsilonJumpNUKernel =
    "__kernel void MatrixAdd2DEpsilonJumpNU(__global int *a, __global int *b,\n"
    "                                       __global int *semaphores,\n"
-   "                                       __global int *dims)\n"
+   "                                       int4 dims)\n"
    "{\n"
    "   int i = get_global_id(0);\n"
    "   int j = get_global_id(1);\n"
-   "   int m = dims[0];\n"
-   "   int n = dims[1];\n"
+   "   int m = dims.x;\n"
+   "   int n = dims.y;\n"
    "   int k, l;\n"
-   "   int chunkSize = dims[2];\n"
+   "   int chunkSize = dims.z;\n"
    "   for (l = 0; ; l++) {\n"
    "      for (k = 0; k < chunkSize; k++) {\n"
    "         if (semaphores[n * i + j] == 1) {\n"
@@ -537,9 +537,6 @@ int main(int argc, char **argv) {
       VMAccelSurfaceDesc descB = {
          0,
       };
-      VMAccelSurfaceDesc descDims = {
-         0,
-      };
       VMAccelSurfaceDesc semDesc;
 
       descA.type = VMACCEL_SURFACE_BUFFER;
@@ -550,9 +547,6 @@ int main(int argc, char **argv) {
       descA.bindFlags = VMACCEL_BIND_UNORDERED_ACCESS_FLAG;
       descB = descA;
       descB.pool = MEMPOOL(memoryPoolB);
-      descDims = descA;
-      descDims.width = sizeof(int) * 4;
-      descDims.pool = VMACCEL_SURFACE_POOL_AUTO;
       semDesc = descA;
       semDesc.width = sizeof(int) * numRows * numColumns;
       semDesc.pool = MEMPOOL(memoryPoolS);
@@ -565,7 +559,6 @@ int main(int argc, char **argv) {
       accelerator_surface accelS(
          accel.get(),
          MEMDEVICE(memoryPoolS) * numQueues + MEMQUEUE(memoryPoolS), semDesc);
-      accelerator_surface accelDims(accel.get(), kernelDevice, descDims);
 
       VMAccelSurfaceRegion rgn = {
          0, {0, 0, 0}, {numRows * numColumns * chunkSize, 0, 0}};
@@ -588,12 +581,6 @@ int main(int argc, char **argv) {
          return 1;
       }
 
-      VMAccelSurfaceRegion rgnDims = {0, {0, 0, 0}, {4, 0, 0}};
-      if (accelDims->upload<int>(rgnDims, memDims) != VMACCEL_SUCCESS) {
-         VMACCEL_LOG("ERROR: Unable to upload dims\n");
-         return 1;
-      }
-
       uploadBytes += 2 * numRows * numColumns * sizeof(int);
 
       compute::binding bindA(VMACCEL_BIND_UNORDERED_ACCESS_FLAG,
@@ -602,13 +589,12 @@ int main(int argc, char **argv) {
                              VMACCEL_SURFACE_USAGE_READWRITE, accelB);
       compute::binding bindS(VMACCEL_BIND_UNORDERED_ACCESS_FLAG,
                              VMACCEL_SURFACE_USAGE_READWRITE, accelS);
-      compute::binding bindDims(VMACCEL_BIND_UNORDERED_ACCESS_FLAG,
-                                VMACCEL_SURFACE_USAGE_READWRITE, accelDims);
+      // Dimensions are passed by value, without a surface.
+      compute::binding bindDims(&memDims[0], dimBytes);
 
       if (!c->alloc_surface(bindA->get_surf()) ||
           !c->alloc_surface(bindB->get_surf()) ||
-          !c->alloc_surface(bindS->get_surf()) ||
-          !c->alloc_surface(bindDims->get_surf())) {
+          !c->alloc_surface(bindS->get_surf())) {
          VMACCEL_LOG("ERROR: Unable to allocate surfaces\n");
          return 1;
       }
@@ -616,7 +602,6 @@ int main(int argc, char **argv) {
       c->upload_surface(bindA->get_surf());
       c->upload_surface(bindB->get_surf());
       c->upload_surface(bindS->get_surf());
-      c->upload_surface(bindDims->get_surf());
 
       clock_gettime(CLOCK_REALTIME, &e2eStartTime);
 
@@ -687,7 +672,12 @@ int main(int argc, char **argv) {
                   VMACCEL_LOG("ERROR: Unable to upload A\n");
                   return 1;
                }
-               c->upload_surface(bindA->get_surf(), false);
+               /*
+                * Discard the previous contents, allowing the upload to
+                * overlap with the previous iteration's dispatch.
+                */
+               c->upload_surface(bindA->get_surf(), false, false, false,
+                                 VMACCEL_INVALID_ID, true);
                uploadBytes += surfBytes;
             }
 
@@ -118,6 +118,41 @@ int main(int argc, char **argv) {
    }
 
    // Unregister the resource.
+   assert(rangeMgr->Unregister(parent.id)->status == VMACCEL_SUCCESS);
+
+   // Register a resource for coalescing, split into four adjacent ranges.
+   range.size = 4096;
+   range.begin = 0;
+   range.end = range.size - 1;
+   parent = *rangeMgr->Register(&range);
+   assert(parent.status == VMACCEL_SUCCESS);
+
+   const int freeOrder[3][4] = {{0, 1, 2, 3}, {3, 2, 1, 0}, {0, 2, 3, 1}};
+
+   for (int order = 0; order < 3; order++) {
+      range.size = 1024;
+      for (int i = 0; i < 4; i++) {
+         alloc[i] = *rangeMgr->Alloc(parent.id, &range, val);
+         assert(alloc[i].status == VMACCEL_SUCCESS);
+         assert(val.begin == i * 1024u && val.end == i * 1024u + 1023);
+      }
+
+      // Free the ranges in ascending, descending and mixed order. A range
+      // coalesces with the free ranges before and after it.
+      for (int i = 0; i < 4; i++) {
+         assert(rangeMgr->Free(alloc[freeOrder[order][i]].id));
+      }
+
+      // The coalesced range spans the resource.
+      range.size = 4096;
+      alloc[0] = *rangeMgr->Alloc(parent.id, &range, val);
+      assert(alloc[0].status == VMACCEL_SUCCESS);
+      VMACCEL_LOG("%s: rangeMgr.Alloc(%zu, ...) -> [%zu ... %zu]\n",
+                  __FUNCTION__, range.size, val.begin, val.end);
+      assert(val.begin == 0 && val.end == 4095 && val.size == 4096);
+      assert(rangeMgr->Free(alloc[0].id));
+   }
+
    assert(rangeMgr->Unregister(parent.id)->status == VMACCEL_SUCCESS);
    delete rangeMgr;
 
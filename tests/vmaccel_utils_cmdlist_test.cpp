@@ -0,0 +1,194 @@
+/******************************************************************************
+
+Copyright (c) 2016-2020 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+extern "C" {
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmaccel_rpc.h"
+#include "vmaccel_utils.h"
+#include "vmcl_rpc.h"
+}
+
+#include <iostream>
+
+#include "log_level.h"
+
+
+using namespace std;
+
+static void SetArg(VMCLKernelArgDesc *arg, unsigned int index,
+                   VMAccelId surfId) {
+   memset(arg, 0, sizeof(*arg));
+   arg->index = index;
+   arg->type = VMCL_ARG_SURFACE;
+   arg->surf.id = surfId;
+}
+
+static void SetImmediate(VMCLKernelArgDesc *arg, unsigned int index,
+                         unsigned int *value) {
+   memset(arg, 0, sizeof(*arg));
+   arg->index = index;
+   arg->type = VMCL_ARG_IMMEDIATE;
+   arg->data.data_len = sizeof(*value);
+   arg->data.data_val = (char *)value;
+}
+
+static unsigned int GetImmediate(const VMCLKernelArgDesc *arg) {
+   unsigned int value;
+   assert(arg->type == VMCL_ARG_IMMEDIATE);
+   assert(arg->data.data_len == sizeof(value));
+   memcpy(&value, arg->data.data_val, sizeof(value));
+   return value;
+}
+
+int main(int argc, char **argv) {
+   VMCLKernelArgDesc args0[2];
+   VMCLKernelArgDesc args1[1];
+   VMCLKernelArgDesc immArgs[1];
+   VMCLDispatchOp immDispatch;
+   VMCLDispatchListOp immList;
+   unsigned int recordedValue = 1;
+   unsigned int changedValue = 5;
+   VMCLDispatchOp dispatches[2];
+   VMCLDispatchListOp list;
+   VMCLDispatchListOp copy;
+   VMCLKernelArgUpdate updates[3];
+   unsigned int badUpdate;
+
+   VMACCEL_LOG("%s: Running self-test of command list updates...\n",
+               __FUNCTION__);
+
+   // Dispatch 0 binds arguments 0 and 1, dispatch 1 binds argument 2.
+   SetArg(&args0[0], 0, 10);
+   SetArg(&args0[1], 1, 11);
+   SetArg(&args1[0], 2, 12);
+
+   memset(dispatches, 0, sizeof(dispatches));
+   dispatches[0].args.args_len = 2;
+   dispatches[0].args.args_val = args0;
+   dispatches[1].args.args_len = 1;
+   dispatches[1].args.args_val = args1;
+
+   memset(&list, 0, sizeof(list));
+   list.queue.id = 3;
+   list.dispatches.dispatches_len = 2;
+   list.dispatches.dispatches_val = dispatches;
+
+   memset(updates, 0, sizeof(updates));
+
+   // A replay without updates copies the recorded list.
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 0, &copy, &badUpdate) ==
+          VMACCEL_SUCCESS);
+   assert(copy.queue.id == 3);
+   assert(copy.dispatches.dispatches_len == 2);
+   assert(copy.dispatches.dispatches_val != dispatches);
+   assert(copy.dispatches.dispatches_val[0].args.args_len == 2);
+   assert(copy.dispatches.dispatches_val[0].args.args_val != args0);
+   assert(copy.dispatches.dispatches_val[0].args.args_val[1].surf.id == 11);
+   assert(copy.dispatches.dispatches_val[1].args.args_val[0].surf.id == 12);
+   free(copy.dispatches.dispatches_val);
+
+   // Updates replace the argument with the same index in the copy only.
+   updates[0].dispatch = 0;
+   SetArg(&updates[0].arg, 1, 21);
+   updates[1].dispatch = 1;
+   SetArg(&updates[1].arg, 2, 22);
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 2, &copy, &badUpdate) ==
+          VMACCEL_SUCCESS);
+   assert(copy.dispatches.dispatches_val[0].args.args_val[0].surf.id == 10);
+   assert(copy.dispatches.dispatches_val[0].args.args_val[1].surf.id == 21);
+   assert(copy.dispatches.dispatches_val[1].args.args_val[0].surf.id == 22);
+   assert(args0[1].surf.id == 11 && args1[0].surf.id == 12);
+   free(copy.dispatches.dispatches_val);
+
+   // An update of a dispatch beyond the list is rejected.
+   updates[2].dispatch = 2;
+   SetArg(&updates[2].arg, 0, 23);
+   badUpdate = 0;
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 3, &copy, &badUpdate) ==
+          VMACCEL_SEMANTIC_ERROR);
+   assert(badUpdate == 2);
+   assert(copy.dispatches.dispatches_val == NULL);
+
+   // An update of an argument the dispatch doesn't bind is rejected.
+   updates[2].dispatch = 1;
+   SetArg(&updates[2].arg, 0, 23);
+   badUpdate = 0;
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 3, &copy, &badUpdate) ==
+          VMACCEL_SEMANTIC_ERROR);
+   assert(badUpdate == 2);
+
+   // Validation precedes the copy, the recorded list is left intact.
+   assert(args0[0].surf.id == 10 && args0[1].surf.id == 11);
+   assert(args1[0].surf.id == 12);
+
+   // Replays diff against the recorded list, the same changed immediate is
+   // sent again by each replay and the recorded value is kept.
+   SetImmediate(&immArgs[0], 0, &recordedValue);
+   memset(&immDispatch, 0, sizeof(immDispatch));
+   immDispatch.args.args_len = 1;
+   immDispatch.args.args_val = immArgs;
+   memset(&immList, 0, sizeof(immList));
+   immList.dispatches.dispatches_len = 1;
+   immList.dispatches.dispatches_val = &immDispatch;
+
+   updates[0].dispatch = 0;
+   SetImmediate(&updates[0].arg, 0, &changedValue);
+
+   for (int replay = 0; replay < 2; replay++) {
+      assert(VMAccel_CmdListApplyUpdates(&immList, updates, 1, &copy,
+                                         &badUpdate) == VMACCEL_SUCCESS);
+      assert(GetImmediate(copy.dispatches.dispatches_val[0].args.args_val) ==
+             changedValue);
+      assert(GetImmediate(&immArgs[0]) == recordedValue);
+      free(copy.dispatches.dispatches_val);
+   }
+
+   // Returning to the recorded value needs no update.
+   assert(VMAccel_CmdListApplyUpdates(&immList, updates, 0, &copy,
+                                      &badUpdate) == VMACCEL_SUCCESS);
+   assert(GetImmediate(copy.dispatches.dispatches_val[0].args.args_val) ==
+          recordedValue);
+   free(copy.dispatches.dispatches_val);
+
+   // An empty list accepts no updates.
+   list.dispatches.dispatches_len = 0;
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 0, &copy, &badUpdate) ==
+          VMACCEL_SUCCESS);
+   assert(copy.dispatches.dispatches_len == 0);
+   assert(VMAccel_CmdListApplyUpdates(&list, updates, 1, &copy, &badUpdate) ==
+          VMACCEL_SEMANTIC_ERROR);
+   assert(badUpdate == 0);
+
+   VMACCEL_LOG("%s: Self-test complete...\n", __FUNCTION__);
+
+   return 0;
+}
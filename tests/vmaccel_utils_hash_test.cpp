@@ -0,0 +1,107 @@
+/******************************************************************************
+
+Copyright (c) 2016-2020 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+extern "C" {
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmaccel_rpc.h"
+#include "vmaccel_utils.h"
+}
+
+#include <iostream>
+#include <string>
+
+#include "log_level.h"
+
+
+using namespace std;
+
+static size_t KeyDesc(char *buf, size_t size, uint64_t sourceHash,
+                      unsigned int language, const char *options,
+                      const char *device) {
+   const char *strs[2] = {device, "driver 1.0"};
+
+   return VMAccel_ProgramKeyDesc(buf, size, sourceHash, language, options,
+                                 strs, 2);
+}
+
+int main(int argc, char **argv) {
+   const char src[] = "__kernel void f() {}";
+   char desc[2][2048];
+   size_t len[2];
+   uint64_t hash;
+
+   VMACCEL_LOG("%s: Running self-test of hash and program keys...\n",
+               __FUNCTION__);
+
+   // FNV-1a reference values.
+   assert(VMAccel_Hash64("", 0, 0) == 0xcbf29ce484222325ULL);
+   assert(VMAccel_Hash64("a", 1, 0) == 0xaf63dc4c8601ec8cULL);
+   assert(VMAccel_Hash64("foobar", 6, 0) == 0x85944171f73967e8ULL);
+
+   // Hashes are deterministic, and depend on the contents and the seed.
+   hash = VMAccel_Hash64(src, sizeof(src), 0);
+   assert(hash == VMAccel_Hash64(src, sizeof(src), 0));
+   assert(hash != VMAccel_Hash64(src, sizeof(src) - 1, 0));
+   assert(hash != VMAccel_Hash64(src, sizeof(src), 1));
+
+   // Descriptions of the same key are identical.
+   len[0] = KeyDesc(desc[0], sizeof(desc[0]), hash, 1, NULL, "dev");
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash, 1, "", "dev");
+   assert(len[0] > 0);
+   assert(len[0] == len[1] && memcmp(desc[0], desc[1], len[0]) == 0);
+   assert(strstr(desc[0], "device[3]=dev\n") != NULL);
+   assert(strstr(desc[0], "device[10]=driver 1.0\n") != NULL);
+
+   // Each component of the key changes the description.
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash + 1, 1, NULL, "dev");
+   assert(len[1] == len[0] && memcmp(desc[0], desc[1], len[0]) != 0);
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash, 2, NULL, "dev");
+   assert(len[1] == len[0] && memcmp(desc[0], desc[1], len[0]) != 0);
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash, 1, "-O2", "dev");
+   assert(len[1] != len[0]);
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash, 1, NULL, "deV");
+   assert(len[1] == len[0] && memcmp(desc[0], desc[1], len[0]) != 0);
+
+   // Length prefixes keep strings with separators unambiguous.
+   len[0] = KeyDesc(desc[0], sizeof(desc[0]), hash, 1, "a\ndevice[1]=b", "c");
+   len[1] = KeyDesc(desc[1], sizeof(desc[1]), hash, 1, "a", "b\ndevice[1]=c");
+   assert(len[0] != len[1] || memcmp(desc[0], desc[1], len[0]) != 0);
+
+   // Descriptions that do not fit are rejected.
+   len[0] = KeyDesc(desc[0], sizeof(desc[0]), hash, 1, NULL, "dev");
+   assert(KeyDesc(desc[1], len[0], hash, 1, NULL, "dev") == 0);
+   assert(KeyDesc(desc[1], len[0] + 1, hash, 1, NULL, "dev") == len[0]);
+   assert(KeyDesc(desc[1], 8, hash, 1, NULL, "dev") == 0);
+
+   VMACCEL_LOG("%s: Self-test complete...\n", __FUNCTION__);
+
+   return 0;
+}
@@ -0,0 +1,160 @@
+/******************************************************************************
+
+Copyright (c) 2016-2020 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+
+extern "C" {
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmaccel_rpc.h"
+#include "vmaccel_utils.h"
+}
+
+#include <iostream>
+
+#include "log_level.h"
+
+
+using namespace std;
+
+static bool Layout(const VMAccelSurfaceDesc *desc, unsigned int x,
+                   unsigned int y, unsigned int z, unsigned int w,
+                   unsigned int h, unsigned int d, size_t origin[3],
+                   size_t region[3], size_t *rowPitch, size_t *slicePitch) {
+   VMAccelSurfaceRegion rgn;
+
+   memset(&rgn, 0, sizeof(rgn));
+   rgn.coord.x = x;
+   rgn.coord.y = y;
+   rgn.coord.z = z;
+   rgn.size.x = w;
+   rgn.size.y = h;
+   rgn.size.z = d;
+
+   return VMAccel_SurfaceRegionLayout(desc, &rgn, origin, region, rowPitch,
+                                      slicePitch);
+}
+
+int main(int argc, char **argv) {
+   VMAccelSurfaceDesc desc;
+   size_t origin[3];
+   size_t region[3];
+   size_t rowPitch;
+   size_t slicePitch;
+
+   VMACCEL_LOG("%s: Running self-test of surface region layouts...\n",
+               __FUNCTION__);
+
+   // 16x8 image of 4 byte elements, regions are converted to bytes along x.
+   memset(&desc, 0, sizeof(desc));
+   desc.type = VMACCEL_SURFACE_2D_IMAGE;
+   desc.width = 16;
+   desc.height = 8;
+   desc.format = VMACCEL_FORMAT_R8G8B8A8_UNORM;
+   assert(VMAccel_SurfaceFormatSize(desc.format) == 4);
+
+   assert(Layout(&desc, 2, 3, 0, 4, 2, 0, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(origin[0] == 8 && origin[1] == 3 && origin[2] == 0);
+   assert(region[0] == 16 && region[1] == 2 && region[2] == 1);
+   assert(rowPitch == 64 && slicePitch == 512);
+
+   // Explicit pitches are returned as given.
+   desc.rowPitch = 128;
+   assert(Layout(&desc, 0, 0, 0, 16, 8, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(rowPitch == 128 && slicePitch == 1024);
+   desc.slicePitch = 2048;
+   assert(Layout(&desc, 0, 0, 0, 16, 8, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(rowPitch == 128 && slicePitch == 2048);
+   desc.rowPitch = 0;
+   desc.slicePitch = 0;
+
+   // Regions must lie within the image.
+   assert(Layout(&desc, 12, 0, 0, 4, 1, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(!Layout(&desc, 14, 0, 0, 4, 1, 1, origin, region, &rowPitch,
+                  &slicePitch));
+   assert(!Layout(&desc, 0, 7, 0, 1, 2, 1, origin, region, &rowPitch,
+                  &slicePitch));
+   assert(!Layout(&desc, 0, 0, 1, 1, 1, 1, origin, region, &rowPitch,
+                  &slicePitch));
+   assert(!Layout(&desc, 0, 0, 0, 0, 1, 1, origin, region, &rowPitch,
+                  &slicePitch));
+
+   // Images of an unknown format have no layout.
+   desc.format = VMACCEL_FORMAT_MAX;
+   assert(!Layout(&desc, 0, 0, 0, 1, 1, 1, origin, region, &rowPitch,
+                  &slicePitch));
+
+   // A 1024 byte buffer is a single row by default.
+   memset(&desc, 0, sizeof(desc));
+   desc.type = VMACCEL_SURFACE_BUFFER;
+   desc.width = 1024;
+   desc.format = VMACCEL_FORMAT_R8_TYPELESS;
+
+   assert(Layout(&desc, 1000, 0, 0, 24, 0, 0, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(origin[0] == 1000 && region[0] == 24);
+   assert(region[1] == 1 && region[2] == 1);
+   assert(rowPitch == 1024 && slicePitch == 1024);
+   assert(!Layout(&desc, 1000, 0, 0, 25, 0, 0, origin, region, &rowPitch,
+                  &slicePitch));
+
+   // Rows of a buffer with a height divide the width.
+   desc.height = 4;
+   assert(Layout(&desc, 16, 1, 0, 32, 3, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(rowPitch == 256 && slicePitch == 1024);
+   assert(origin[0] == 16 && origin[1] == 1);
+   assert(region[0] == 32 && region[1] == 3);
+
+   // Rows of a region must not cross rows of the buffer.
+   assert(Layout(&desc, 224, 0, 0, 32, 2, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(!Layout(&desc, 240, 0, 0, 32, 2, 1, origin, region, &rowPitch,
+                  &slicePitch));
+
+   // The last row of a region must end within the buffer.
+   assert(!Layout(&desc, 0, 2, 0, 32, 3, 1, origin, region, &rowPitch,
+                  &slicePitch));
+
+   // A row pitch wider than the buffer leaves room for one row only.
+   desc.height = 0;
+   desc.rowPitch = 2048;
+   assert(Layout(&desc, 0, 0, 0, 1024, 1, 1, origin, region, &rowPitch,
+                 &slicePitch));
+   assert(!Layout(&desc, 0, 0, 0, 16, 2, 1, origin, region, &rowPitch,
+                  &slicePitch));
+
+   VMACCEL_LOG("%s: Self-test complete...\n", __FUNCTION__);
+
+   return 0;
+}
@@ -0,0 +1,241 @@
+/******************************************************************************
+
+Copyright (c) 2016-2020 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+
+extern "C" {
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmaccel_rpc.h"
+#include "vmcl_rpc.h"
+#include "vmcpu.h"
+}
+
+#include <iostream>
+
+#include "log_level.h"
+
+
+using namespace std;
+
+#define NUM_ELEMENTS 64
+#define SURFACE_A 1
+#define SURFACE_B 2
+#define INACTIVE_SURFACE 3
+
+static void AllocSurface(unsigned int sid) {
+   VMCLSurfaceAllocateDesc desc;
+
+   memset(&desc, 0, sizeof(desc));
+   desc.client.accel.id = sid;
+   desc.desc.type = VMACCEL_SURFACE_BUFFER;
+   desc.desc.width = NUM_ELEMENTS * sizeof(int);
+
+   assert(vmcpuOps.surfacealloc_1(&desc)->status == VMACCEL_SUCCESS);
+}
+
+static VMAccelStatusCode Upload(unsigned int sid, int *data) {
+   VMCLImageUploadOp op;
+
+   memset(&op, 0, sizeof(op));
+   op.img.accel.id = sid;
+   op.img.accel.generation = 1;
+   op.op.imgRegion.size.x = NUM_ELEMENTS * sizeof(int);
+   op.op.ptr.ptr_len = NUM_ELEMENTS * sizeof(int);
+   op.op.ptr.ptr_val = (char *)data;
+
+   return vmcpuOps.imageupload_1(&op)->status;
+}
+
+static VMAccelStatusCode Download(unsigned int sid, int *data) {
+   VMCLImageDownloadOp op;
+
+   memset(&op, 0, sizeof(op));
+   op.img.accel.id = sid;
+   op.img.accel.generation = 1;
+   op.op.imgRegion.size.x = NUM_ELEMENTS * sizeof(int);
+   op.op.ptr.ptr_len = NUM_ELEMENTS * sizeof(int);
+   op.op.ptr.ptr_val = (char *)data;
+
+   return vmcpuOps.imagedownload_1(&op)->status;
+}
+
+static VMAccelStatusCode AllocKernel(unsigned int kid, const char *name) {
+   VMCLKernelAllocateDesc desc;
+
+   memset(&desc, 0, sizeof(desc));
+   desc.client.id = kid;
+   desc.language = VMCL_NATIVE_CPP;
+   desc.kernelName.kernelName_len = strlen(name) + 1;
+   desc.kernelName.kernelName_val = (char *)name;
+
+   return vmcpuOps.kernelalloc_1(&desc)->status;
+}
+
+static VMAccelStatusCode Dispatch(unsigned int kid, VMCLKernelArgDesc *args,
+                                  unsigned int numArgs) {
+   VMCLDispatchOp op;
+   u_int offset = 0;
+   u_int globalSize = NUM_ELEMENTS;
+   u_int localSize = 8;
+
+   memset(&op, 0, sizeof(op));
+   op.kernel.id = kid;
+   op.dimension = 1;
+   op.globalWorkOffset.globalWorkOffset_len = 1;
+   op.globalWorkOffset.globalWorkOffset_val = &offset;
+   op.globalWorkSize.globalWorkSize_len = 1;
+   op.globalWorkSize.globalWorkSize_val = &globalSize;
+   op.localWorkSize.localWorkSize_len = 1;
+   op.localWorkSize.localWorkSize_val = &localSize;
+   op.args.args_len = numArgs;
+   op.args.args_val = args;
+
+   return vmcpuOps.dispatch_1(&op)->status;
+}
+
+static void SetSurfaceArg(VMCLKernelArgDesc *arg, unsigned int index,
+                          unsigned int sid) {
+   memset(arg, 0, sizeof(*arg));
+   arg->index = index;
+   arg->type = VMCL_ARG_SURFACE;
+   arg->surf.id = sid;
+   arg->surf.generation = 1;
+}
+
+/*
+ * Fills the first argument with the immediate value of the second.
+ */
+static void FillKernel(const VMCPUWorkGroup *group, const VMCPUKernelArg *args,
+                       unsigned int numArgs) {
+   size_t begin = group->groupId[0] * group->localSize[0];
+   size_t gid;
+
+   assert(numArgs == 2);
+   assert(args[1].size == sizeof(int));
+
+   for (gid = begin; gid < begin + group->localSize[0]; gid++) {
+      ((int *)args[0].ptr)[gid] = *(const int *)args[1].ptr;
+   }
+}
+
+int main(int argc, char **argv) {
+   VMCLContextAllocateDesc contextDesc;
+   VMCLKernelArgDesc args[2];
+   int a[NUM_ELEMENTS];
+   int b[NUM_ELEMENTS];
+   int value = 7;
+   int i;
+
+   VMACCEL_LOG("%s: Running self-test of the CPU backend dispatch...\n",
+               __FUNCTION__);
+
+   assert(vmcpuOps.poweron(&vmcpuOps, VMACCEL_CPU, 0, false)->status ==
+          VMACCEL_SUCCESS);
+
+   memset(&contextDesc, 0, sizeof(contextDesc));
+   assert(vmcpuOps.contextalloc_1(&contextDesc)->status == VMACCEL_SUCCESS);
+
+   AllocSurface(SURFACE_A);
+   AllocSurface(SURFACE_B);
+
+   for (i = 0; i < NUM_ELEMENTS; i++) {
+      a[i] = i;
+      b[i] = 100 * i;
+   }
+
+   assert(Upload(SURFACE_A, a) == VMACCEL_SUCCESS);
+   assert(Upload(SURFACE_B, b) == VMACCEL_SUCCESS);
+
+   // Built-in kernels are registered on power on.
+   assert(AllocKernel(0, "vmcpu_double_int") == VMACCEL_SUCCESS);
+   assert(AllocKernel(1, "vmcpu_add_int") == VMACCEL_SUCCESS);
+   assert(AllocKernel(2, "unknown_kernel") == VMACCEL_FAIL);
+
+   SetSurfaceArg(&args[0], 0, SURFACE_A);
+   assert(Dispatch(0, args, 1) == VMACCEL_SUCCESS);
+
+   SetSurfaceArg(&args[1], 1, SURFACE_B);
+   assert(Dispatch(1, args, 2) == VMACCEL_SUCCESS);
+
+   assert(Download(SURFACE_A, a) == VMACCEL_SUCCESS);
+   assert(Download(SURFACE_B, b) == VMACCEL_SUCCESS);
+
+   for (i = 0; i < NUM_ELEMENTS; i++) {
+      assert(a[i] == 2 * i);
+      assert(b[i] == 102 * i);
+   }
+
+   // Kernels registered by the embedding server, immediates point at the
+   // value in the request.
+   assert(VMCPU_RegisterKernel("test_fill", FillKernel));
+   assert(AllocKernel(2, "test_fill") == VMACCEL_SUCCESS);
+
+   SetSurfaceArg(&args[0], 0, SURFACE_A);
+   memset(&args[1], 0, sizeof(args[1]));
+   args[1].index = 1;
+   args[1].type = VMCL_ARG_IMMEDIATE;
+   args[1].data.data_len = sizeof(value);
+   args[1].data.data_val = (char *)&value;
+   assert(Dispatch(2, args, 2) == VMACCEL_SUCCESS);
+
+   assert(Download(SURFACE_A, a) == VMACCEL_SUCCESS);
+
+   for (i = 0; i < NUM_ELEMENTS; i++) {
+      assert(a[i] == value);
+   }
+
+   VMCPU_UnregisterKernel("test_fill");
+   assert(AllocKernel(3, "test_fill") == VMACCEL_FAIL);
+
+   // Unallocated and out of range surfaces are rejected.
+   SetSurfaceArg(&args[0], 0, INACTIVE_SURFACE);
+   assert(Dispatch(0, args, 1) == VMACCEL_SEMANTIC_ERROR);
+   SetSurfaceArg(&args[0], 0, VMCL_MAX_SURFACES + 1);
+   assert(Dispatch(0, args, 1) == VMACCEL_SEMANTIC_ERROR);
+   assert(Upload(INACTIVE_SURFACE, a) == VMACCEL_SEMANTIC_ERROR);
+   assert(Download(VMCL_MAX_SURFACES, a) == VMACCEL_SEMANTIC_ERROR);
+
+   // Unsupported arguments are rejected.
+   memset(&args[0], 0, sizeof(args[0]));
+   args[0].type = VMCL_ARG_SAMPLER;
+   assert(Dispatch(0, args, 1) == VMACCEL_SEMANTIC_ERROR);
+
+   // A failed dispatch leaves the surfaces usable.
+   SetSurfaceArg(&args[0], 0, SURFACE_A);
+   assert(Dispatch(0, args, 1) == VMACCEL_SUCCESS);
+   assert(Download(SURFACE_A, a) == VMACCEL_SUCCESS);
+   assert(a[0] == 2 * value);
+
+   vmcpuOps.poweroff();
+
+   VMACCEL_LOG("%s: Self-test complete...\n", __FUNCTION__);
+
+   return 0;
+}
@@ -0,0 +1,135 @@
+/******************************************************************************
+
+Copyright (c) 2016-2020 VMware, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+
+extern "C" {
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmcpu_pool.h"
+}
+
+#include <iostream>
+#include <vector>
+
+#include "log_level.h"
+
+
+using namespace std;
+
+#define NUM_WORKERS 4
+
+/*
+ * Records the number of executions and the executing thread of each task.
+ */
+typedef struct TaskLog {
+   vector<unsigned int> hits;
+   vector<pthread_t> threads;
+   unsigned int sleepIndex;
+} TaskLog;
+
+static void LogTasks(void *data, unsigned int begin, unsigned int end) {
+   TaskLog *log = (TaskLog *)data;
+   unsigned int i;
+
+   for (i = begin; i < end; i++) {
+      if (i == log->sleepIndex) {
+         usleep(200 * 1000);
+      }
+
+      log->hits[i]++;
+      log->threads[i] = pthread_self();
+   }
+}
+
+static void Run(VMCPUPool *pool, TaskLog *log, unsigned int count,
+                unsigned int grain) {
+   log->hits.assign(count, 0);
+   log->threads.assign(count, pthread_t());
+
+   VMCPUPool_Run(pool, LogTasks, log, count, grain);
+}
+
+int main(int argc, char **argv) {
+   VMCPUPool *pool;
+   TaskLog log;
+   unsigned int numStolen = 0;
+   unsigned int count;
+   unsigned int i;
+
+   VMACCEL_LOG("%s: Running self-test of the CPU work-stealing pool...\n",
+               __FUNCTION__);
+
+   pool = VMCPUPool_Create(NUM_WORKERS);
+   assert(pool != NULL);
+   assert(VMCPUPool_NumWorkers(pool) == NUM_WORKERS);
+
+   // Each task of a job is executed exactly once.
+   log.sleepIndex = ~0U;
+   Run(pool, &log, 1000, 1);
+
+   for (i = 0; i < 1000; i++) {
+      assert(log.hits[i] == 1);
+   }
+
+   // Stalling the first task of worker 0 leaves the upper halves of its
+   // share on its deque, which the other workers steal.
+   log.sleepIndex = 0;
+   Run(pool, &log, NUM_WORKERS * 64, 1);
+
+   for (i = 0; i < NUM_WORKERS * 64; i++) {
+      assert(log.hits[i] == 1);
+
+      if ((i < 64) && !pthread_equal(log.threads[i], log.threads[0])) {
+         numStolen++;
+      }
+   }
+
+   assert(numStolen > 0);
+
+   // Jobs are serialized, the workers pick up each job of the pool in turn
+   // including jobs smaller than the number of workers.
+   log.sleepIndex = ~0U;
+
+   for (count = 0; count < 100; count++) {
+      Run(pool, &log, count, (count % 7) + 1);
+
+      for (i = 0; i < count; i++) {
+         assert(log.hits[i] == 1);
+      }
+   }
+
+   VMCPUPool_Destroy(pool);
+
+   VMACCEL_LOG("%s: Self-test complete...\n", __FUNCTION__);
+
+   return 0;
+}